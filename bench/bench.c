@@ -0,0 +1,300 @@
+#include "../src/class.h"
+#include "../src/arena.c"
+#include "../src/buffer.c"
+#include "../src/class.c"
+#include "../src/code.c"
+#include "../src/descriptor.c"
+#include "../src/filter.c"
+#include "../src/intern.c"
+#include "../src/json.c"
+#include "../src/mutf8.c"
+#include "../src/print.c"
+#include "../src/stats.c"
+#include "../src/symtab.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Microbenchmarks for the parse and print paths, run over a synthetic class with a large constant pool, many methods and big Code
+ * attributes. Each benchmark reports ns/op, image bytes/s and mallocs/op; the SConstruct links with --wrap so every malloc, calloc
+ * and realloc made by cfr's code passes through the counters below. */
+
+static size_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	allocations++;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	allocations++;
+	return __real_realloc(p, size);
+}
+
+/* What to generate */
+typedef struct {
+	unsigned methods;
+	unsigned constants;  /* besides the ones the methods need */
+	unsigned code_bytes; /* per method */
+} Shape;
+
+/* The class image under test, and a file and stream holding the same bytes */
+typedef struct {
+	Buffer image;
+	char path[32];
+	FILE *file;
+	FILE *null;
+} Fixture;
+
+static void put_u1(Buffer *out, uint8_t value) {
+	append_char(out, (char) value);
+}
+
+static void put_u2(Buffer *out, uint16_t value) {
+	put_u1(out, value >> 8);
+	put_u1(out, value);
+}
+
+static void put_u4(Buffer *out, uint32_t value) {
+	put_u2(out, value >> 16);
+	put_u2(out, value);
+}
+
+static void put_utf8(Buffer *out, const char *value) {
+	put_u1(out, STRING_UTF8);
+	put_u2(out, strlen(value));
+	append_string(out, value);
+}
+
+static void put_ref(Buffer *out, uint8_t tag, uint16_t first, uint16_t second) {
+	put_u1(out, tag);
+	put_u2(out, first);
+	put_u2(out, second);
+}
+
+/* Return the pool count of a class shaped like shape, or 0 if it wouldn't fit in a u2 */
+static uint32_t pool_count(const Shape *shape) {
+	// Six fixed constants, three per method and the extras; every fourth extra is an Integer and a Long, three slots in all
+	uint32_t count = 7 + 3 * shape->methods + shape->constants + 2 * ((shape->constants + 3) / 4);
+	return count <= UINT16_MAX ? count : 0;
+}
+
+/* Write a class shaped like shape to out. Pool layout: #1 and #2 this class, #3 and #4 its super class, #5 "Code", #6 "()V",
+ * then a name, NameAndType and Methodref per method, then Integers, Longs, Strings and their UTF-8 bodies. */
+static void generate_class(Buffer *out, const Shape *shape) {
+	char text[64];
+	uint32_t i;
+	put_u4(out, 0xcafebabe);
+	put_u2(out, 0);
+	put_u2(out, 52);
+	put_u2(out, pool_count(shape));
+
+	put_utf8(out, "bench/Synthetic");
+	put_ref(out, CLASS, 1, 0);
+	out->length -= 2; // Class has one index
+	put_utf8(out, "java/lang/Object");
+	put_ref(out, CLASS, 3, 0);
+	out->length -= 2;
+	put_utf8(out, "Code");
+	put_utf8(out, "()V");
+	const uint16_t first_method = 7;
+	for (i = 0; i < shape->methods; i++) {
+		snprintf(text, sizeof(text), "method%u", i);
+		put_utf8(out, text);
+		put_ref(out, NAME, first_method + 3 * i, 6);
+		put_ref(out, METHOD, 2, first_method + 3 * i + 1);
+	}
+	uint16_t cp_idx = first_method + 3 * shape->methods;
+	for (i = 0; i < shape->constants; i++) {
+		switch (i % 4) {
+			case 0:
+				put_u1(out, INTEGER);
+				put_u4(out, i);
+				put_u1(out, LONG);
+				put_u4(out, i);
+				put_u4(out, ~i);
+				cp_idx += 3;
+				break;
+			case 1:
+				put_ref(out, STRING, cp_idx + 1, 0);
+				out->length -= 2;
+				cp_idx++;
+				break;
+			default:
+				snprintf(text, sizeof(text), "constant number %u of the synthetic class", i);
+				put_utf8(out, text);
+				cp_idx++;
+		}
+	}
+
+	put_u2(out, 0x0021);
+	put_u2(out, 2);
+	put_u2(out, 4);
+	put_u2(out, 0); // interfaces
+	put_u2(out, 0); // fields
+	put_u2(out, shape->methods);
+	for (i = 0; i < shape->methods; i++) {
+		put_u2(out, 0x0001);
+		put_u2(out, first_method + 3 * i);
+		put_u2(out, 6);
+		put_u2(out, 1);
+
+		// Code: call the next methods in turn, pad with nops and return
+		put_u2(out, 5);
+		put_u4(out, 12 + shape->code_bytes);
+		put_u2(out, 1);
+		put_u2(out, 1);
+		put_u4(out, shape->code_bytes);
+		uint32_t written = 0;
+		uint32_t callee = i;
+		while (written + 5 <= shape->code_bytes) {
+			callee = (callee + 1) % shape->methods;
+			put_u1(out, OP_ALOAD_0);
+			put_u1(out, OP_INVOKEVIRTUAL);
+			put_u2(out, first_method + 3 * callee + 2);
+			written += 4;
+		}
+		for (; written + 1 < shape->code_bytes; written++) put_u1(out, OP_NOP);
+		put_u1(out, OP_RETURN);
+		put_u2(out, 0); // exception table
+		put_u2(out, 0); // attributes
+	}
+	put_u2(out, 0);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_is_class(Fixture *fixture) {
+	rewind(fixture->file);
+	if (!is_class(fixture->file)) abort();
+}
+
+static void bench_parse_const_pool(Fixture *fixture) {
+	Arena *arena = create_arena(fixture->image.length);
+	Class *class = arena_calloc(arena, 1, sizeof(Class));
+	class->arena = arena;
+	Cursor cursor = {(const uint8_t *) fixture->image.data, fixture->image.length, 8, false};
+	class->const_pool_count = read_u2(&cursor);
+	parse_const_pool(class, class->const_pool_count, &cursor);
+	if (class->pool_size_bytes == 0) abort();
+	free_arena(arena);
+}
+
+static void bench_read_class(Fixture *fixture) {
+	rewind(fixture->file);
+	if (!is_class(fixture->file)) abort();
+	ClassFile class_file = {fixture->path, fixture->file};
+	Class *class = read_class(class_file, NULL);
+	if (class == NULL) abort();
+	free_class(class);
+}
+
+static void bench_read_class_from_buffer(Fixture *fixture) {
+	Class *class = read_class_from_buffer(fixture->path, (const uint8_t *) fixture->image.data, fixture->image.length, NULL);
+	if (class == NULL) abort();
+	free_class(class);
+}
+
+/* Parsed once; only the printing is timed */
+static Class *printed;
+
+static void bench_print_class(Fixture *fixture) {
+	print_class(fixture->null, printed);
+}
+
+/* Run op in doubling batches until a batch takes at least seconds, then report that batch. Each op handles bytes bytes. */
+static void run(const char *name, void (*op)(Fixture *), Fixture *fixture, size_t bytes, double seconds) {
+	op(fixture); // warm up caches and the arena's chunk cache
+	size_t ops = 1;
+	for (;;) {
+		size_t allocations_before = allocations;
+		double start = now();
+		size_t i;
+		for (i = 0; i < ops; i++) op(fixture);
+		double elapsed = now() - start;
+		if (elapsed >= seconds || ops >= (size_t) 1 << 40) {
+			printf("%-24s %10zu ops %12.1f ns/op %10.1f MB/s %8.2f allocs/op\n", name, ops, elapsed * 1e9 / ops,
+					bytes * (double) ops / elapsed / 1e6, (double) (allocations - allocations_before) / ops);
+			return;
+		}
+		ops *= 2;
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: cfr-bench [-m METHODS] [-p CONSTANTS] [-c CODE_BYTES] [-t SECONDS]\n"
+			"  -m  methods in the synthetic class (default 2000)\n"
+			"  -p  constants besides the methods' own (default 8000)\n"
+			"  -c  bytes of code per method (default 256)\n"
+			"  -t  minimum time per benchmark in seconds (default 0.5)\n");
+}
+
+int main(int argc, char **argv) {
+	Shape shape = {2000, 8000, 256};
+	double seconds = 0.5;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:p:c:t:h")) != -1) {
+		switch (opt) {
+			case 'm': shape.methods = strtoul(optarg, NULL, 10); break;
+			case 'p': shape.constants = strtoul(optarg, NULL, 10); break;
+			case 'c': shape.code_bytes = strtoul(optarg, NULL, 10); break;
+			case 't': seconds = strtod(optarg, NULL); break;
+			default:
+				usage();
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (shape.methods == 0 || shape.code_bytes == 0 || pool_count(&shape) == 0) {
+		fprintf(stderr, "cfr-bench: the class needs a method and at least a byte of code, and at most 65535 constants\n");
+		return 1;
+	}
+
+	Fixture fixture;
+	init_buffer(&fixture.image, NULL, 1 << 20);
+	generate_class(&fixture.image, &shape);
+	strcpy(fixture.path, "/tmp/cfr-bench-XXXXXX");
+	int fd = mkstemp(fixture.path);
+	if (fd < 0 || write(fd, fixture.image.data, fixture.image.length) != (ssize_t) fixture.image.length) {
+		perror("cfr-bench: writing the synthetic class");
+		return 1;
+	}
+	fixture.file = fdopen(fd, "r");
+	fixture.null = fopen("/dev/null", "w");
+	printed = read_class_from_buffer(fixture.path, (const uint8_t *) fixture.image.data, fixture.image.length, NULL);
+	if (fixture.file == NULL || fixture.null == NULL || printed == NULL) {
+		fprintf(stderr, "cfr-bench: couldn't set up the synthetic class\n");
+		unlink(fixture.path);
+		return 1;
+	}
+
+	printf("Synthetic class: %zu bytes, %u constants, %u methods, %u code bytes each\n", fixture.image.length,
+			printed->const_pool_count, shape.methods, shape.code_bytes);
+	const size_t length = fixture.image.length;
+	run("is_class", bench_is_class, &fixture, 4, seconds);
+	run("parse_const_pool", bench_parse_const_pool, &fixture, printed->pool_size_bytes, seconds);
+	run("read_class", bench_read_class, &fixture, length, seconds);
+	run("read_class_from_buffer", bench_read_class_from_buffer, &fixture, length, seconds);
+	run("print_class", bench_print_class, &fixture, length, seconds);
+
+	free_class(printed);
+	fclose(fixture.null);
+	fclose(fixture.file);
+	unlink(fixture.path);
+	free_buffer(&fixture.image);
+	return 0;
+}
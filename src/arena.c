@@ -0,0 +1,146 @@
+#include "arena.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum ARENA_SIZES {
+	MIN_CHUNK_SIZE = 4096,
+	ALIGNMENT = 16, /* what malloc guarantees on 64-bit platforms */
+
+	/* Chunks larger than this go straight back to malloc instead of the per-thread cache */
+	MAX_CACHED_CHUNK_SIZE = 1 << 20,
+	MAX_CACHED_CHUNKS = 4
+};
+
+/* Chunks from freed arenas, reused by the next arena on this thread */
+static __thread ArenaChunk *spare_chunks;
+static __thread int spare_chunks_count;
+
+/* Chunks this thread has had to malloc, for arena_chunks_allocated */
+static __thread uint64_t chunks_allocated;
+
+/* Only used for its destructor, which empties a thread's cache when the thread exits */
+static pthread_key_t spare_chunks_key;
+static pthread_once_t spare_chunks_once = PTHREAD_ONCE_INIT;
+
+static void free_spare_chunks(void *unused) {
+	(void) unused;
+	while (spare_chunks != NULL) {
+		ArenaChunk *next = spare_chunks->next;
+		free(spare_chunks);
+		spare_chunks = next;
+	}
+	spare_chunks_count = 0;
+}
+
+static void create_spare_chunks_key(void) {
+	pthread_key_create(&spare_chunks_key, free_spare_chunks);
+}
+
+static ArenaChunk *new_chunk(size_t size) {
+	ArenaChunk **prev = &spare_chunks;
+	ArenaChunk *chunk;
+	for (chunk = spare_chunks; chunk != NULL; prev = &chunk->next, chunk = chunk->next) {
+		if (chunk->size >= size) {
+			*prev = chunk->next;
+			spare_chunks_count--;
+			chunk->used = 0;
+			return chunk;
+		}
+	}
+
+	chunk = malloc(sizeof(ArenaChunk) + size);
+	if (chunk == NULL) {
+		fprintf(stderr, "Out of memory allocating a %zu byte arena chunk\n", size);
+		abort();
+	}
+	chunks_allocated++;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+static void release_chunk(ArenaChunk *chunk) {
+	if (chunk->size <= MAX_CACHED_CHUNK_SIZE && spare_chunks_count < MAX_CACHED_CHUNKS) {
+		if (spare_chunks == NULL) {
+			pthread_once(&spare_chunks_once, create_spare_chunks_key);
+			pthread_setspecific(spare_chunks_key, &spare_chunks);
+		}
+		chunk->next = spare_chunks;
+		spare_chunks = chunk;
+		spare_chunks_count++;
+	} else {
+		free(chunk);
+	}
+}
+
+Arena *create_arena(size_t size_hint) {
+	size_t size = size_hint + sizeof(Arena) + ALIGNMENT;
+	if (size < MIN_CHUNK_SIZE) size = MIN_CHUNK_SIZE;
+
+	// The Arena itself lives at the start of its first chunk
+	ArenaChunk *chunk = new_chunk(size);
+	chunk->next = NULL;
+	Arena *arena = (Arena *) chunk->data;
+	chunk->used = (sizeof(Arena) + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+	arena->head = chunk;
+	arena->chunk_size = chunk->size * 2;
+	arena->allocated = 0;
+	return arena;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+	size = (size + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+	ArenaChunk *chunk = arena->head;
+	if (chunk->size - chunk->used < size) {
+		size_t chunk_size = arena->chunk_size;
+		if (chunk_size < size) chunk_size = size;
+		chunk = new_chunk(chunk_size);
+		chunk->next = arena->head;
+		arena->head = chunk;
+		arena->chunk_size = chunk_size * 2;
+	}
+	void *p = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->allocated += size;
+	return p;
+}
+
+void *arena_calloc(Arena *arena, size_t count, size_t size) {
+	if (size != 0 && count > SIZE_MAX / size) {
+		fprintf(stderr, "Arena allocation of %zu * %zu bytes overflows\n", count, size);
+		abort();
+	}
+	void *p = arena_alloc(arena, count * size);
+	memset(p, 0, count * size);
+	return p;
+}
+
+void reset_arena(Arena *arena) {
+	// The first chunk, which holds the Arena itself, is at the tail of the list
+	ArenaChunk *chunk = arena->head;
+	while (chunk->next != NULL) {
+		ArenaChunk *next = chunk->next;
+		release_chunk(chunk);
+		chunk = next;
+	}
+	arena->head = chunk;
+	chunk->used = (sizeof(Arena) + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+	arena->allocated = 0;
+}
+
+void free_arena(Arena *arena) {
+	if (arena == NULL) return;
+	ArenaChunk *chunk = arena->head;
+	while (chunk != NULL) {
+		ArenaChunk *next = chunk->next;
+		release_chunk(chunk);
+		chunk = next;
+	}
+}
+
+uint64_t arena_chunks_allocated(void) {
+	return chunks_allocated;
+}
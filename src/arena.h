@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* A block of arena memory; chunks form a singly linked list, newest first */
+typedef struct ArenaChunk {
+	struct ArenaChunk *next;
+	size_t size;
+	size_t used;
+	unsigned char data[] __attribute__((aligned(16)));
+} ArenaChunk;
+
+/* A bump allocator. Allocations are never freed individually; free_arena or reset_arena drop them all at once. */
+typedef struct {
+	ArenaChunk *head;
+	size_t chunk_size; // size of the next chunk to allocate; doubles as the arena grows
+	size_t allocated;  // bytes handed out, for statistics
+} Arena;
+
+/* Return a new arena whose first chunk holds at least size_hint bytes */
+Arena *create_arena(size_t size_hint);
+
+/* Return size bytes aligned for any type. Never returns NULL; aborts if memory is exhausted. */
+void *arena_alloc(Arena *arena, size_t size);
+
+/* Return count * size zeroed bytes, like calloc */
+void *arena_calloc(Arena *arena, size_t count, size_t size);
+
+/* Drop every allocation but keep the arena's first chunk for reuse */
+void reset_arena(Arena *arena);
+
+/* Release arena and everything allocated from it. Chunks are kept in a small per-thread cache so the next arena created on the
+ * same thread doesn't go back to malloc. */
+void free_arena(Arena *arena);
+
+/* Return how many chunks the calling thread has taken from malloc rather than its cache, for statistics */
+uint64_t arena_chunks_allocated(void);
+
+#endif //ARENA_H
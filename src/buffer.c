@@ -0,0 +1,50 @@
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+void init_buffer(Buffer *buffer, FILE *stream, size_t capacity) {
+	buffer->data = malloc(capacity > 0 ? capacity : 1);
+	buffer->length = 0;
+	buffer->capacity = capacity > 0 ? capacity : 1;
+	buffer->stream = stream;
+}
+
+void flush_buffer(Buffer *buffer) {
+	if (buffer->stream == NULL || buffer->length == 0) return;
+	fwrite(buffer->data, 1, buffer->length, buffer->stream);
+	buffer->length = 0;
+}
+
+void free_buffer(Buffer *buffer) {
+	flush_buffer(buffer);
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->length = buffer->capacity = 0;
+}
+
+char *reserve(Buffer *buffer, size_t length) {
+	if (buffer->capacity - buffer->length >= length) {
+		return buffer->data + buffer->length;
+	}
+	if (buffer->stream != NULL) {
+		flush_buffer(buffer);
+	}
+	if (buffer->capacity - buffer->length < length) {
+		size_t capacity = buffer->capacity * 2;
+		while (capacity - buffer->length < length) capacity *= 2;
+		char *data = realloc(buffer->data, capacity);
+		if (data == NULL) {
+			fprintf(stderr, "Out of memory growing an output buffer to %zu bytes\n", capacity);
+			abort();
+		}
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+	return buffer->data + buffer->length;
+}
+
+void append_double(Buffer *buffer, double value) {
+	// %f of DBL_MAX is 316 characters
+	char *p = reserve(buffer, 320);
+	buffer->length += snprintf(p, 320, "%f", value);
+}
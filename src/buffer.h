@@ -0,0 +1,87 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* An output buffer. Bound to a stream, it writes itself out in large chunks whenever it fills up; unbound (stream == NULL), it
+ * grows in memory until the owner takes the data. */
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+	FILE *stream;
+} Buffer;
+
+/* Set up buffer with room for capacity bytes, flushing to stream when full, or growing if stream is NULL */
+void init_buffer(Buffer *buffer, FILE *stream, size_t capacity);
+
+/* Write out and forget everything appended so far. Unbound buffers are left as they are. */
+void flush_buffer(Buffer *buffer);
+
+/* Flush buffer and release its memory */
+void free_buffer(Buffer *buffer);
+
+/* Make room for at least length more bytes, flushing or growing as needed. Returns where they go. */
+char *reserve(Buffer *buffer, size_t length);
+
+static inline void append_chars(Buffer *buffer, const char *chars, size_t length) {
+	if (buffer->capacity - buffer->length < length) {
+		if (buffer->stream != NULL && length >= buffer->capacity) {
+			// Too big to be worth copying
+			flush_buffer(buffer);
+			fwrite(chars, 1, length, buffer->stream);
+			return;
+		}
+		reserve(buffer, length);
+	}
+	memcpy(buffer->data + buffer->length, chars, length);
+	buffer->length += length;
+}
+
+static inline void append_string(Buffer *buffer, const char *string) {
+	append_chars(buffer, string, strlen(string));
+}
+
+static inline void append_char(Buffer *buffer, char c) {
+	if (buffer->length == buffer->capacity) reserve(buffer, 1);
+	buffer->data[buffer->length++] = c;
+}
+
+static inline void append_uint(Buffer *buffer, uint64_t value) {
+	char digits[20];
+	int i = sizeof(digits);
+	do {
+		digits[--i] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	append_chars(buffer, digits + i, sizeof(digits) - i);
+}
+
+static inline void append_int(Buffer *buffer, int64_t value) {
+	if (value < 0) {
+		append_char(buffer, '-');
+		append_uint(buffer, -(uint64_t) value);
+	} else {
+		append_uint(buffer, value);
+	}
+}
+
+/* Lower case hex without a prefix, like %x */
+static inline void append_hex(Buffer *buffer, uint64_t value) {
+	static const char hex[] = "0123456789abcdef";
+	char digits[16];
+	int i = sizeof(digits);
+	do {
+		digits[--i] = hex[value & 0xf];
+		value >>= 4;
+	} while (value != 0);
+	append_chars(buffer, digits + i, sizeof(digits) - i);
+}
+
+/* Format value like printf's %f. Floating point constants are rare enough to leave to snprintf. */
+void append_double(Buffer *buffer, double value);
+
+#endif //BUFFER_H
@@ -0,0 +1,280 @@
+#include "cache.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "print.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char ENTRY_MAGIC[4] = {'C', 'F', 'R', 'C'};
+
+enum {
+	// Bump when the entry layout changes
+	CACHE_VERSION = 1,
+
+	// "<directory>/xx/" + 30 more hex digits + ".tmpXXXXXX" + NUL
+	ENTRY_NAME_SLACK = 1 + 2 + 1 + 30 + 10 + 1
+};
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	CacheKey key;
+	uint64_t length;
+} EntryHeader;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+CacheKey hash_bytes(const void *data, size_t length, CacheKey seed) {
+	static const uint64_t c1 = 0x87c37b91114253d5ULL;
+	static const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const uint8_t *bytes = data;
+	const size_t blocks = length / 16;
+	uint64_t h1 = seed.high, h2 = seed.low;
+	uint64_t k1, k2;
+
+	size_t i;
+	for (i = 0; i < blocks; i++) {
+		memcpy(&k1, bytes + i * 16, 8);
+		memcpy(&k2, bytes + i * 16 + 8, 8);
+		k1 = le64toh(k1);
+		k2 = le64toh(k2);
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const uint8_t *tail = bytes + blocks * 16;
+	const size_t rest = length & 15;
+	k1 = k2 = 0;
+	for (i = rest; i > 8; i--) {
+		k2 ^= (uint64_t) tail[i - 1] << ((i - 9) * 8);
+	}
+	if (rest > 8) {
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+	}
+	for (i = rest < 8 ? rest : 8; i > 0; i--) {
+		k1 ^= (uint64_t) tail[i - 1] << ((i - 1) * 8);
+	}
+	if (rest > 0) {
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= length;
+	h2 ^= length;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+	CacheKey key = {h1, h2};
+	return key;
+}
+
+bool open_cache(Cache *cache, char *directory, uint64_t flavour) {
+	if (mkdir(directory, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Could not create cache directory '%s': %s\n", directory, strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (stat(directory, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "Cache '%s' is not a directory\n", directory);
+		return false;
+	}
+
+	// Rebuilding the same source keeps the cache; changing how classes print retires it
+	const CacheKey seed = {CACHE_VERSION, OUTPUT_VERSION};
+	cache->flavour = hash_bytes(&flavour, sizeof(flavour), seed);
+	cache->directory = directory;
+	cache->hits = cache->misses = 0;
+	return true;
+}
+
+/* Domain separation, so stat and content keys can never collide */
+static CacheKey domain_seed(const Cache *cache, char domain) {
+	return hash_bytes(&domain, 1, cache->flavour);
+}
+
+/* Derive the stat entry key for file_name without reading it. Returns false if it isn't a regular file. */
+static bool stat_cache_key(const Cache *cache, const char *file_name, CacheKey *key) {
+	struct stat st;
+	if (stat(file_name, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+	uint64_t identity[5] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_ino, st.st_dev};
+	*key = hash_bytes(identity, sizeof(identity), domain_seed(cache, 'S'));
+	*key = hash_bytes(file_name, strlen(file_name), *key);
+	return true;
+}
+
+/* Derive the content key for the output of length bytes of data named name */
+static CacheKey content_cache_key(const Cache *cache, const void *data, size_t length, const char *name) {
+	// The name is part of the output, so it's part of the key
+	CacheKey key = hash_bytes(data, length, domain_seed(cache, 'C'));
+	return hash_bytes(name, strlen(name), key);
+}
+
+/* Derive the content key for file_name by hashing its bytes. Returns false if it can't be mapped. */
+static bool file_cache_key(const Cache *cache, const char *file_name, const char *name, CacheKey *key) {
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) return false;
+	*key = content_cache_key(cache, image, st.st_size, name);
+	munmap(image, st.st_size);
+	return true;
+}
+
+/* Write the path of the entry for key, plus suffix, to path, which must hold strlen(directory) + ENTRY_NAME_SLACK bytes */
+static void entry_path(const Cache *cache, const CacheKey key, char *path, const char *suffix) {
+	sprintf(path, "%s/%02x/%014llx%016llx%s", cache->directory, (unsigned) (key.high >> 56),
+			(unsigned long long) (key.high & 0xffffffffffffffULL), (unsigned long long) key.low, suffix);
+}
+
+/* read(2) until length bytes arrive; false on error or early end of file */
+static bool read_fully(int fd, void *data, size_t length) {
+	char *p = data;
+	while (length > 0) {
+		ssize_t n = read(fd, p, length);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		length -= n;
+	}
+	return true;
+}
+
+/* write(2) all length bytes */
+static bool write_fully(int fd, const void *data, size_t length) {
+	const char *p = data;
+	while (length > 0) {
+		ssize_t n = write(fd, p, length);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		length -= n;
+	}
+	return true;
+}
+
+/* Append the entry stored under key to out. Returns false, leaving out as it was, if there is no such intact entry. */
+static bool lookup_cache(const Cache *cache, const CacheKey key, Buffer *out) {
+	char path[strlen(cache->directory) + ENTRY_NAME_SLACK];
+	entry_path(cache, key, path, "");
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	EntryHeader header;
+	struct stat st;
+	bool found = fstat(fd, &st) == 0
+		&& read_fully(fd, &header, sizeof(header))
+		&& memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) == 0
+		&& header.version == CACHE_VERSION
+		&& header.key.high == key.high && header.key.low == key.low
+		&& header.length == (uint64_t) st.st_size - sizeof(header);
+	if (found) {
+		char *p = reserve(out, header.length);
+		found = read_fully(fd, p, header.length);
+		if (found) out->length += header.length;
+	}
+	close(fd);
+	return found;
+}
+
+static void store_cache(const Cache *cache, const CacheKey key, const void *data, size_t length) {
+	char path[strlen(cache->directory) + ENTRY_NAME_SLACK];
+	char temp[sizeof(path)];
+	entry_path(cache, key, path, "");
+	entry_path(cache, key, temp, ".tmpXXXXXX");
+
+	int fd = mkstemp(temp);
+	if (fd < 0 && errno == ENOENT) {
+		// First entry in this fan-out directory
+		char *slash = strrchr(temp, '/');
+		*slash = '\0';
+		mkdir(temp, 0777);
+		entry_path(cache, key, temp, ".tmpXXXXXX"); // mkstemp leaves the template undefined when it fails
+		fd = mkstemp(temp);
+	}
+	if (fd < 0) return;
+
+	EntryHeader header;
+	memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+	header.version = CACHE_VERSION;
+	header.key = key;
+	header.length = length;
+	bool written = write_fully(fd, &header, sizeof(header)) && write_fully(fd, data, length);
+	if (close(fd) != 0) written = false;
+	if (!written || rename(temp, path) != 0) unlink(temp);
+}
+
+static void count_cache_result(Cache *cache, bool hit) {
+	__atomic_fetch_add(hit ? &cache->hits : &cache->misses, 1, __ATOMIC_RELAXED);
+}
+
+bool probe_file(Cache *cache, const char *file_name, const char *name, CacheProbe *probe, Buffer *out) {
+	memset(probe, 0, sizeof(*probe));
+	probe->has_stat_key = stat_cache_key(cache, file_name, &probe->stat_key);
+	if (probe->has_stat_key) {
+		Buffer value;
+		init_buffer(&value, NULL, sizeof(CacheKey));
+		if (lookup_cache(cache, probe->stat_key, &value) && value.length == sizeof(CacheKey)) {
+			memcpy(&probe->content_key, value.data, sizeof(CacheKey));
+			probe->has_content_key = true;
+		}
+		free_buffer(&value);
+		if (probe->has_content_key && lookup_cache(cache, probe->content_key, out)) {
+			count_cache_result(cache, true);
+			return true;
+		}
+	}
+
+	// The file changed, moved or was touched, or the content entry has gone: fall back to its bytes
+	probe->has_content_key = file_cache_key(cache, file_name, name, &probe->content_key);
+	bool hit = probe->has_content_key && lookup_cache(cache, probe->content_key, out);
+	if (hit && probe->has_stat_key) {
+		store_cache(cache, probe->stat_key, &probe->content_key, sizeof(CacheKey));
+	}
+	count_cache_result(cache, hit);
+	return hit;
+}
+
+bool probe_data(Cache *cache, const void *data, size_t length, const char *name, CacheProbe *probe, Buffer *out) {
+	memset(probe, 0, sizeof(*probe));
+	probe->content_key = content_cache_key(cache, data, length, name);
+	probe->has_content_key = true;
+	bool hit = lookup_cache(cache, probe->content_key, out);
+	count_cache_result(cache, hit);
+	return hit;
+}
+
+void store_probe(const Cache *cache, const CacheProbe *probe, const char *output, size_t length) {
+	if (!probe->has_content_key) return;
+	store_cache(cache, probe->content_key, output, length);
+	if (probe->has_stat_key) {
+		store_cache(cache, probe->stat_key, &probe->content_key, sizeof(CacheKey));
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include "buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* An on-disk cache of rendered output. Entries are files named after a 128-bit key, fanned out over 256 subdirectories the way
+ * git stores objects, and are written to a temporary name then renamed into place so concurrent runs never see half an entry.
+ *
+ * Two kinds of entry share the directory. Content entries map a hash of an input's bytes to the output rendered from it. Stat
+ * entries map an input's (path, size, mtime, inode) to its content key, so an unchanged file is a hit without reading it at all. */
+
+typedef struct {
+	uint64_t high;
+	uint64_t low;
+} CacheKey;
+
+typedef struct {
+	char *directory;
+	CacheKey flavour;  // everything other than the input that changes the output: options, format and OUTPUT_VERSION
+	size_t hits;
+	size_t misses;
+} Cache;
+
+/* Create directory if need be and set cache up to use it. flavour is folded into every key. Returns false, after reporting why on
+ * stderr, if the directory can't be used. */
+bool open_cache(Cache *cache, char *directory, uint64_t flavour);
+
+/* Hash length bytes of data, continuing from seed. MurmurHash3's x64 128-bit variant, seeded with both halves. */
+CacheKey hash_bytes(const void *data, size_t length, CacheKey seed);
+
+/* What a probe learnt about an input, for store_probe to file its output under after a miss */
+typedef struct {
+	CacheKey content_key;
+	CacheKey stat_key;
+	bool has_content_key;
+	bool has_stat_key;
+} CacheProbe;
+
+/* Look for the output of the class file file_name, shown as name: first by stat entry, then by hashing its bytes. On a hit the
+ * output is appended to out and true returned; on a miss probe is filled in for store_probe. Either way the result is counted. */
+bool probe_file(Cache *cache, const char *file_name, const char *name, CacheProbe *probe, Buffer *out);
+
+/* Like probe_file for length bytes already in memory, e.g. a jar entry's stored or deflated data; there is no stat entry */
+bool probe_data(Cache *cache, const void *data, size_t length, const char *name, CacheProbe *probe, Buffer *out);
+
+/* Store length bytes of output under the keys a missed probe found. Failures only cost a future miss, so they are ignored. */
+void store_probe(const Cache *cache, const CacheProbe *probe, const char *output, size_t length);
+
+#endif //CACHE_H
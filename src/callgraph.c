@@ -0,0 +1,254 @@
+#include "callgraph.h"
+#include "code.h"
+#include <stdlib.h>
+#include <string.h>
+
+void free_call_sites(CallSites *sites) {
+	free(sites->keys);
+	memset(sites, 0, sizeof(*sites));
+}
+
+/* Append (owner, name, descriptor) to sites as a method with no calls yet, returning its index */
+static size_t push_key(CallSites *sites, SymbolId owner, SymbolId name, SymbolId descriptor) {
+	if (sites->keys_count == sites->keys_capacity) {
+		sites->keys_capacity = sites->keys_capacity ? sites->keys_capacity * 2 : 256;
+		sites->keys = realloc(sites->keys, sites->keys_capacity * sizeof(MethodKey));
+	}
+	MethodKey *key = sites->keys + sites->keys_count;
+	key->owner = owner;
+	key->name = name;
+	key->descriptor = descriptor;
+	key->callees = 0;
+	return sites->keys_count++;
+}
+
+/* Return the global id of the name of the Class constant at cp_idx, or NO_SYMBOL if there isn't one */
+static SymbolId class_symbol(const Class *class, uint16_t cp_idx) {
+	return get_tag(class, cp_idx) == CLASS ? constant_symbol(class, get_ref(class, cp_idx).class_idx) : NO_SYMBOL;
+}
+
+/* What visit_call needs to know about the method being scanned */
+typedef struct {
+	CallSites *sites;
+	const Class *class;
+	size_t caller; // index of its key in sites
+} Scan;
+
+/* Record the method ref of an invoke instruction as a callee of scan->caller; an InstructionVisitor */
+static bool visit_call(const Instruction *instruction, void *context) {
+	if (instruction->opcode < OP_INVOKEVIRTUAL || instruction->opcode > OP_INVOKEINTERFACE) return true;
+
+	Scan *scan = context;
+	const Class *class = scan->class;
+	uint16_t cp_idx = instruction_index(instruction);
+	if (cp_idx == 0 || cp_idx >= class->const_pool_count) return true;
+	uint8_t tag = get_tag(class, cp_idx);
+	if (tag != METHOD && tag != INTERFACE_METHOD) return true;
+	const Ref ref = get_ref(class, cp_idx);
+	if (get_tag(class, ref.name_idx) != NAME) return true;
+	const Ref nat = get_ref(class, ref.name_idx);
+	const SymbolId owner = class_symbol(class, ref.class_idx);
+	const SymbolId name = constant_symbol(class, nat.class_idx);
+	const SymbolId descriptor = constant_symbol(class, nat.name_idx);
+	if (owner == NO_SYMBOL || name == NO_SYMBOL || descriptor == NO_SYMBOL) return true;
+
+	push_key(scan->sites, owner, name, descriptor);
+	scan->sites->keys[scan->caller].callees++;
+	return true;
+}
+
+void add_call_sites(CallSites *sites, const Class *class) {
+	const SymbolId owner = class_symbol(class, class->this_class);
+	if (owner == NO_SYMBOL) return;
+
+	Scan scan = {sites, class, 0};
+	uint16_t i, a;
+	for (i = 0; i < class->methods_count; i++) {
+		const Method *method = class->methods + i;
+		const SymbolId name = constant_symbol(class, method->name_idx);
+		const SymbolId descriptor = constant_symbol(class, method->desc_idx);
+		if (name == NO_SYMBOL || descriptor == NO_SYMBOL) continue;
+
+		// Every method is a node, even one that calls nothing
+		scan.caller = push_key(sites, owner, name, descriptor);
+		for (a = 0; a < method->attrs_count; a++) {
+			Code code;
+			if (method->attrs[a].kind == ATTR_CODE && read_code(class, method->attrs + a, &code)) {
+				visit_instructions(&code, visit_call, &scan);
+			}
+		}
+	}
+}
+
+void init_call_graph(CallGraph *graph) {
+	memset(graph, 0, sizeof(*graph));
+	graph->slots_mask = 255;
+	graph->slots = calloc(graph->slots_mask + 1, sizeof(uint32_t));
+}
+
+void free_call_graph(CallGraph *graph) {
+	free(graph->methods);
+	free(graph->slots);
+	free(graph->pairs);
+	free(graph->offsets);
+	free(graph->callees);
+}
+
+static inline uint32_t hash_method(const MethodKey *key) {
+	uint32_t hash = key->owner * 0x9e3779b1u ^ key->name * 0x85ebca6bu ^ key->descriptor * 0xc2b2ae35u;
+	return hash ^ hash >> 15;
+}
+
+/* Return the slot holding key's node, or the empty slot where it would go */
+static uint32_t *find_method_slot(const CallGraph *graph, const MethodKey *key) {
+	uint32_t slot = hash_method(key) & graph->slots_mask;
+	for (;; slot = (slot + 1) & graph->slots_mask) {
+		if (graph->slots[slot] == 0) return graph->slots + slot;
+		const MethodKey *method = graph->methods + graph->slots[slot] - 1;
+		if (method->owner == key->owner && method->name == key->name && method->descriptor == key->descriptor) {
+			return graph->slots + slot;
+		}
+	}
+}
+
+/* Return key's node, numbering it next if it is new */
+static MethodId add_method(CallGraph *graph, const MethodKey *key) {
+	uint32_t *slot = find_method_slot(graph, key);
+	if (*slot != 0) return *slot - 1;
+
+	if (graph->methods_count == graph->methods_capacity) {
+		graph->methods_capacity = graph->methods_capacity ? graph->methods_capacity * 2 : 256;
+		graph->methods = realloc(graph->methods, graph->methods_capacity * sizeof(MethodKey));
+	}
+	const MethodId method = graph->methods_count++;
+	graph->methods[method] = *key;
+	graph->methods[method].callees = 0;
+	*slot = method + 1;
+
+	// Keep the index at most half full
+	if (graph->methods_count * 2 > graph->slots_mask + 1) {
+		free(graph->slots);
+		graph->slots_mask = graph->slots_mask * 2 + 1;
+		graph->slots = calloc(graph->slots_mask + 1, sizeof(uint32_t));
+		uint32_t m;
+		for (m = 0; m < graph->methods_count; m++) {
+			*find_method_slot(graph, graph->methods + m) = m + 1;
+		}
+	}
+	return method;
+}
+
+/* Queue a call from caller to callee */
+static void push_pair(CallGraph *graph, MethodId caller, MethodId callee) {
+	if (graph->pairs_count == graph->pairs_capacity) {
+		graph->pairs_capacity = graph->pairs_capacity ? graph->pairs_capacity * 2 : 256;
+		graph->pairs = realloc(graph->pairs, graph->pairs_capacity * 2 * sizeof(MethodId));
+	}
+	graph->pairs[graph->pairs_count * 2] = caller;
+	graph->pairs[graph->pairs_count * 2 + 1] = callee;
+	graph->pairs_count++;
+}
+
+void merge_call_sites(CallGraph *graph, const CallSites *sites, size_t first, size_t count) {
+	if (count == 0) return;
+	const MethodKey *keys = sites->keys + first;
+	size_t k = 0;
+	while (k < count) {
+		const MethodId caller = add_method(graph, keys + k);
+		const size_t end = k + 1 + keys[k].callees;
+		for (k++; k < end && k < count; k++) {
+			push_pair(graph, caller, add_method(graph, keys + k));
+		}
+	}
+}
+
+MethodId find_method(const CallGraph *graph, const char *method, size_t length) {
+	// Owners are internal names and names can't hold '.' or '(', so the first of each splits the three apart
+	const char *dot = memchr(method, '.', length);
+	const char *paren = dot != NULL ? memchr(dot, '(', method + length - dot) : NULL;
+	if (paren == NULL) return NO_METHOD;
+	MethodKey key = {find_interned(method, dot - method), find_interned(dot + 1, paren - dot - 1),
+			find_interned(paren, method + length - paren), 0};
+	if (key.owner == NO_SYMBOL || key.name == NO_SYMBOL || key.descriptor == NO_SYMBOL) return NO_METHOD;
+	const uint32_t *slot = find_method_slot(graph, &key);
+	return *slot != 0 ? *slot - 1 : NO_METHOD;
+}
+
+void append_method(Buffer *out, const CallGraph *graph, MethodId method) {
+	const MethodKey *key = graph->methods + method;
+	String part = interned_string(key->owner);
+	append_chars(out, part.value, part.length);
+	append_char(out, '.');
+	part = interned_string(key->name);
+	append_chars(out, part.value, part.length);
+	part = interned_string(key->descriptor);
+	append_chars(out, part.value, part.length);
+}
+
+static int compare_ids(const void *a, const void *b) {
+	MethodId x = *(const MethodId *) a, y = *(const MethodId *) b;
+	return x < y ? -1 : x > y;
+}
+
+void build_call_graph(CallGraph *graph) {
+	const uint32_t nodes = graph->methods_count;
+	free(graph->offsets);
+	free(graph->callees);
+	graph->offsets = calloc(nodes + 1, sizeof(uint32_t));
+	graph->callees = malloc((graph->pairs_count > 0 ? graph->pairs_count : 1) * sizeof(MethodId));
+
+	// Counting sort by caller
+	size_t p;
+	for (p = 0; p < graph->pairs_count; p++) {
+		graph->offsets[graph->pairs[p * 2] + 1]++;
+	}
+	uint32_t n;
+	for (n = 0; n < nodes; n++) {
+		graph->offsets[n + 1] += graph->offsets[n];
+	}
+	uint32_t *next = malloc((nodes > 0 ? nodes : 1) * sizeof(uint32_t));
+	memcpy(next, graph->offsets, nodes * sizeof(uint32_t));
+	for (p = 0; p < graph->pairs_count; p++) {
+		graph->callees[next[graph->pairs[p * 2]]++] = graph->pairs[p * 2 + 1];
+	}
+	free(next);
+	free(graph->pairs);
+	graph->pairs = NULL;
+	graph->pairs_count = graph->pairs_capacity = 0;
+
+	// Sort each row and squeeze out repeated calls, compacting the rows as we go
+	uint32_t write = 0, start = 0;
+	for (n = 0; n < nodes; n++) {
+		uint32_t end = graph->offsets[n + 1];
+		qsort(graph->callees + start, end - start, sizeof(MethodId), compare_ids);
+		graph->offsets[n] = write;
+		uint32_t i;
+		for (i = start; i < end; i++) {
+			if (i == start || graph->callees[i] != graph->callees[i - 1]) graph->callees[write++] = graph->callees[i];
+		}
+		start = end;
+	}
+	graph->offsets[nodes] = write;
+	graph->edges_count = write;
+}
+
+uint32_t find_reachable(const CallGraph *graph, MethodId start, MethodId *reached) {
+	const uint32_t nodes = graph->methods_count;
+	uint64_t *seen = calloc((nodes + 63) / 64 + 1, sizeof(uint64_t));
+	uint32_t head = 0, tail = 0;
+	reached[tail++] = start;
+	seen[start / 64] |= 1ULL << (start % 64);
+	// reached doubles as the queue
+	while (head < tail) {
+		MethodId method = reached[head++];
+		uint32_t i;
+		for (i = graph->offsets[method]; i < graph->offsets[method + 1]; i++) {
+			MethodId callee = graph->callees[i];
+			if (seen[callee / 64] & 1ULL << (callee % 64)) continue;
+			seen[callee / 64] |= 1ULL << (callee % 64);
+			reached[tail++] = callee;
+		}
+	}
+	free(seen);
+	return tail;
+}
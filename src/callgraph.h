@@ -0,0 +1,88 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+#include "buffer.h"
+#include "class.h"
+#include "intern.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A static call graph. Methods are named by owner, name and descriptor, each a global id from the process-wide interner
+ * (intern.h), so workers share one table and merging compares integers, never bytes. Edges come from invokevirtual,
+ * invokespecial, invokestatic and invokeinterface; invokedynamic call sites are left out because their targets are only known
+ * once the bootstrap method has run. */
+
+typedef uint32_t MethodId;
+
+/* Never a node of a CallGraph */
+#define NO_METHOD UINT32_MAX
+
+/* A method as the global ids of its owner's internal name, its name and its descriptor */
+typedef struct {
+	SymbolId owner;
+	SymbolId name;
+	SymbolId descriptor;
+	uint32_t callees; // for a method scanned, how many of the keys straight after it are its calls; 0 for those
+} MethodKey;
+
+/* The calls found by one worker: each method scanned, followed by the methods it calls. Zeroed, it is empty and has allocated
+ * nothing; the keys array is only allocated by the first add_call_sites. */
+typedef struct {
+	MethodKey *keys;
+	size_t keys_count;
+	size_t keys_capacity;
+} CallSites;
+
+/* The merged graph in compressed sparse row form: the callees of node n are callees[offsets[n]] to callees[offsets[n + 1]],
+ * sorted and without duplicates */
+typedef struct {
+	MethodKey *methods;  // by node
+	uint32_t methods_count;
+	uint32_t methods_capacity;
+	uint32_t *slots;     // open addressing index of methods: node + 1, or 0 if empty
+	uint32_t slots_mask;
+	MethodId *pairs;     // merged (caller, callee) pairs, until build_call_graph
+	size_t pairs_count;
+	size_t pairs_capacity;
+	uint32_t *offsets;
+	MethodId *callees;
+	size_t edges_count;
+} CallGraph;
+
+void free_call_sites(CallSites *sites);
+
+/* Append every method of class and the invokes in it to sites. UTF-8 constants are looked up in class->symbols, so classes
+ * read with ParseOptions.intern cost no hashing here; others are interned on the way. */
+void add_call_sites(CallSites *sites, const Class *class);
+
+void init_call_graph(CallGraph *graph);
+void free_call_graph(CallGraph *graph);
+
+/* Number the methods of count keys from first in sites, in order of first appearance, and queue their calls */
+void merge_call_sites(CallGraph *graph, const CallSites *sites, size_t first, size_t count);
+
+/* Sort the queued calls into compressed rows; call once every class has been merged */
+void build_call_graph(CallGraph *graph);
+
+static inline uint32_t methods_count(const CallGraph *graph) {
+	return graph->methods_count;
+}
+
+/* Return the node of the method named by owner, name and descriptor run together, e.g. "java/lang/Object.<init>()V", or
+ * NO_METHOD if the graph has no such method */
+MethodId find_method(const CallGraph *graph, const char *method, size_t length);
+
+/* Append the name of method, as owner, name and descriptor run together */
+void append_method(Buffer *out, const CallGraph *graph, MethodId method);
+
+/* Return the callees of method and store how many there are in count */
+static inline const MethodId *get_callees(const CallGraph *graph, MethodId method, uint32_t *count) {
+	*count = graph->offsets[method + 1] - graph->offsets[method];
+	return graph->callees + graph->offsets[method];
+}
+
+/* Store every method reachable from start, start included, in breadth first order in reached, which must have room for
+ * methods_count(graph) ids. Returns how many were stored. */
+uint32_t find_reachable(const CallGraph *graph, MethodId start, MethodId *reached);
+
+#endif //CALLGRAPH_H
@@ -1,240 +1,522 @@
 #include "class.h"
 #include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
+#include "filter.h"
+#include "intern.h"
+#include "stats.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-Class *read_class_from_file_name(char *file_name) {
-	FILE *file = fopen(file_name, "r");
-	if (!file) {
+/* Decode the whole of a file's contents, reporting on stderr if they aren't a class */
+static Class *read_whole_file_image(char *file_name, const uint8_t *image, size_t length, const ParseOptions *options) {
+	// Check the file header for .class nature
+	uint64_t started = stats_clock();
+	bool valid = is_class_image(image, length);
+	record_phase(PHASE_IS_CLASS, started);
+	if (!valid) {
+		fprintf(stderr, "Skipping '%s': not a valid class file\n", file_name);
+		return NULL;
+	}
+
+	Class *class = read_class_from_buffer(file_name, image, length, options);
+	if (class == NULL) {
+		fprintf(stderr, "Parsing aborted; invalid class file contents: %s\n", file_name);
+	}
+	return class;
+}
+
+Class *read_class_from_file_name(char *file_name, const ParseOptions *options) {
+	uint64_t started = stats_clock();
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
 		fprintf(stderr, "Could not open '%s': %s\n", file_name, strerror(errno));
 		return NULL;
 	}
-	// Check the file header for .class nature
-	if (!is_class(file)) {
-		fprintf(stderr, "Skipping '%s': not a valid class file\n", file_name);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		// Not something we can map, e.g. a pipe; stream it instead
+		FILE *file = fdopen(fd, "r");
+		if (!file) {
+			fprintf(stderr, "Could not open '%s': %s\n", file_name, strerror(errno));
+			close(fd);
+			return NULL;
+		}
+		Class *class = NULL;
+		uint64_t checked = stats_clock();
+		bool valid = is_class(file);
+		record_phase(PHASE_IS_CLASS, checked);
+		if (!valid) {
+			fprintf(stderr, "Skipping '%s': not a valid class file\n", file_name);
+		} else if ((class = read_class((ClassFile) {file_name, file}, options)) == NULL) {
+			fprintf(stderr, "Parsing aborted; invalid class file contents: %s\n", file_name);
+		}
+		fclose(file);
+		return class;
+	}
+
+	const size_t length = st.st_size;
+	uint8_t *image = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "Could not map '%s': %s\n", file_name, strerror(errno));
 		return NULL;
 	}
-	const ClassFile cf = {file_name, file};
-	return read_class(cf);
+	madvise(image, length, MADV_SEQUENTIAL);
+	record_phase(PHASE_OPEN, started);
+
+	Class *class = read_whole_file_image(file_name, image, length, options);
+	if (class == NULL) {
+		munmap(image, length);
+		return NULL;
+	}
+	class->image_source = IMAGE_MAPPED;
+	return class;
 }
 
-Class *read_class(const ClassFile class_file) {
-	Class *class = (Class *) malloc(sizeof(Class));
-	
-	parse_header(class_file, class);
+Class *read_class_from_heap(char *file_name, uint8_t *image, size_t length, const ParseOptions *options) {
+	Class *class = read_whole_file_image(file_name, image, length, options);
+	if (class == NULL) {
+		free(image);
+		return NULL;
+	}
+	class->image_source = IMAGE_HEAP;
+	return class;
+}
 
-	parse_const_pool(class, class->const_pool_count, class_file);
-	
-	if (class->pool_size_bytes == 0) {
+Class *read_class(const ClassFile class_file, const ParseOptions *options) {
+	// A regular file can be mapped, so attribute bodies are only paged in if someone asks for them
+	struct stat st;
+	if (fstat(fileno(class_file.file), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		const size_t length = st.st_size;
+		uint8_t *image = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(class_file.file), 0);
+		if (image != MAP_FAILED) {
+			Class *class = read_class_from_buffer(class_file.file_name, image, length, options);
+			if (class == NULL) {
+				munmap(image, length);
+				return NULL;
+			}
+			class->image_source = IMAGE_MAPPED;
+			fseek(class_file.file, 0, SEEK_END);
+			return class;
+		}
+	}
+
+	// Slurp the remainder of the stream behind a re-instated magic number so offsets match the file's
+	size_t capacity = 8192;
+	size_t length = 4;
+	uint8_t *image = malloc(capacity);
+	const uint8_t magic[4] = {0xca, 0xfe, 0xba, 0xbe};
+	memcpy(image, magic, sizeof(magic));
+
+	size_t num_read;
+	while ((num_read = fread(image + length, 1, capacity - length, class_file.file)) > 0) {
+		length += num_read;
+		if (length == capacity) {
+			capacity *= 2;
+			image = realloc(image, capacity);
+		}
+	}
+
+	Class *class = read_class_from_buffer(class_file.file_name, image, length, options);
+	if (class == NULL) {
+		free(image);
 		return NULL;
 	}
+	class->image_source = IMAGE_HEAP;
+	return class;
+}
+
+Class *read_class_from_buffer(char *file_name, const uint8_t *data, size_t length, const ParseOptions *options) {
+	uint64_t started = stats_clock();
+	if (!is_class_image(data, length)) {
+		return NULL;
+	}
+
+	// Members and constants take up at most a couple of times their encoded size
+	Arena *arena = create_arena(2 * length);
+	Class *class = (Class *) arena_calloc(arena, 1, sizeof(Class));
+	class->arena = arena;
+	class->file_name = file_name;
+	class->image = data;
+	class->image_length = length;
+	class->image_source = IMAGE_BORROWED;
 
-	fread(&class->flags, sizeof(class->flags), 1, class_file.file);
-	class->flags = be16toh(class->flags);
+	Cursor cursor = {data, length, 4, false};
+	parse_header(&cursor, class);
 
-	fread(&class->this_class, sizeof(class->this_class), 1, class_file.file);
-	class->this_class = be16toh(class->this_class);
+	const struct Filter *filter = options != NULL ? options->filter : NULL;
+	if (filter != NULL && !cursor.overflow && filter_class(filter, class, FILTER_HEADER) == FILTER_FALSE) {
+		// Rejected on its version alone, so the constant pool is never decoded
+		class->const_pool_count = 0;
+		class->filtered = true;
+		count_class(class);
+		return class;
+	}
 
-	fread(&class->super_class, sizeof(class->super_class), 1, class_file.file);
-	class->super_class = be16toh(class->super_class);
+	parse_const_pool(class, class->const_pool_count, &cursor);
+	
+	if (class->pool_size_bytes == 0 || cursor.overflow) {
+		free_class(class);
+		return NULL;
+	}
+	if (options != NULL && options->intern) intern_constants(class);
+	started = record_phase(PHASE_CONST_POOL, started);
 
-	fread(&class->interfaces_count, sizeof(class->interfaces_count), 1, class_file.file);
-	class->interfaces_count = be16toh(class->interfaces_count);
+	class->flags = read_u2(&cursor);
+	class->this_class = read_u2(&cursor);
+	class->super_class = read_u2(&cursor);
+	class->interfaces_count = read_u2(&cursor);
 
-	class->interfaces = calloc(class->interfaces_count, sizeof(Ref));
+	class->interfaces = arena_calloc(arena, class->interfaces_count, sizeof(Ref));
 	int idx = 0;
 	while (idx < class->interfaces_count) {
-		fread(&class->interfaces[idx].class_idx, sizeof(class->interfaces[idx].class_idx), 1, class_file.file);
-		class->interfaces[idx].class_idx = be16toh(class->interfaces[idx].class_idx);
+		class->interfaces[idx].class_idx = read_u2(&cursor);
 		idx++;
 	}
 
-	fread(&class->fields_count, sizeof(class->fields_count), 1, class_file.file);
-	class->fields_count = be16toh(class->fields_count);
+	FilterTruth verdict = filter != NULL ? filter_class(filter, class, FILTER_DECLARATION) : FILTER_TRUE;
+	if (verdict == FILTER_FALSE && !cursor.overflow) {
+		class->filtered = true;
+		record_phase(PHASE_MEMBERS, started);
+		count_class(class);
+		return class;
+	}
+
+	if (options != NULL && options->skim) {
+		// Everything a hierarchy index needs is in hand; leave the rest of the image untouched
+		class->skimmed = true;
+		class->filtered = verdict != FILTER_TRUE;
+		if (cursor.overflow) {
+			free_class(class);
+			return NULL;
+		}
+		record_phase(PHASE_MEMBERS, started);
+		count_class(class);
+		return class;
+	}
 
-	class->fields = calloc(class->fields_count, sizeof(Field));
+	class->fields_count = read_u2(&cursor);
+	class->fields = arena_calloc(arena, class->fields_count, sizeof(Field));
 	Field *f;
 	idx = 0;
-	while (idx < class->fields_count) {
+	while (idx < class->fields_count && !cursor.overflow) {
 		f = class->fields + idx;
-		fread(&f->flags, sizeof(u2), 1, class_file.file);
-		fread(&f->name_idx, sizeof(u2), 1, class_file.file);
-		fread(&f->desc_idx, sizeof(u2), 1, class_file.file);
-		fread(&f->attrs_count, sizeof(u2), 1, class_file.file);
-		f->name_idx = be16toh(f->name_idx);
-		f->desc_idx = be16toh(f->desc_idx);
-		f->attrs_count = be16toh(f->attrs_count);
-		f->attrs = calloc(f->attrs_count, sizeof(Attribute));
+		f->flags = read_u2(&cursor);
+		f->name_idx = read_u2(&cursor);
+		f->desc_idx = read_u2(&cursor);
+		f->attrs_count = read_u2(&cursor);
+		f->attrs = arena_calloc(arena, f->attrs_count, sizeof(Attribute));
 
 		int aidx = 0;
 		while (aidx < f->attrs_count) {
-			parse_attribute(class_file, f->attrs + aidx);
+			parse_attribute(&cursor, f->attrs + aidx);
+			classify_attribute(class, f->attrs + aidx);
 			aidx++;
 		}
 		idx++;
 	}
 
-	fread(&class->methods_count, sizeof(class->methods_count), 1, class_file.file);
-	class->methods_count = be16toh(class->methods_count);
-
-	class->methods = calloc(class->methods_count, sizeof(Method));
+	class->methods_count = read_u2(&cursor);
+	class->methods = arena_calloc(arena, class->methods_count, sizeof(Method));
 	Method *m;
 	idx = 0;
-	while (idx < class->methods_count) {
+	while (idx < class->methods_count && !cursor.overflow) {
 		m = class->methods + idx;
-		fread(&m->flags, sizeof(u2), 1, class_file.file);
-		fread(&m->name_idx, sizeof(u2), 1, class_file.file);
-		fread(&m->desc_idx, sizeof(u2), 1, class_file.file);
-		fread(&m->attrs_count, sizeof(u2), 1, class_file.file);
-		m->name_idx = be16toh(m->name_idx);
-		m->desc_idx = be16toh(m->desc_idx);
-		m->attrs_count = be16toh(m->attrs_count);
-		m->attrs = calloc(m->attrs_count, sizeof(Attribute));
+		m->flags = read_u2(&cursor);
+		m->name_idx = read_u2(&cursor);
+		m->desc_idx = read_u2(&cursor);
+		m->attrs_count = read_u2(&cursor);
+		m->attrs = arena_calloc(arena, m->attrs_count, sizeof(Attribute));
 
 		int aidx = 0;
 		while (aidx < m->attrs_count) {
-			parse_attribute(class_file, m->attrs + aidx);
+			parse_attribute(&cursor, m->attrs + aidx);
+			classify_attribute(class, m->attrs + aidx);
 			aidx++;
 		}
 		idx++;
 	}
 
-	fread(&class->attributes_count, sizeof(class->attributes_count), 1, class_file.file);
-	class->attributes_count = be16toh(class->attributes_count);
-
-	class->attributes = calloc(class->attributes_count, sizeof(Attribute));
+	class->attributes_count = read_u2(&cursor);
+	class->attributes = arena_calloc(arena, class->attributes_count, sizeof(Attribute));
 	idx = 0;
 	while (idx < class->attributes_count) {
-		parse_attribute(class_file, class->attributes + idx);
+		parse_attribute(&cursor, class->attributes + idx);
+		classify_attribute(class, class->attributes + idx);
 		idx++;
 	}
+
+	if (cursor.overflow) {
+		// Truncated; the member tables may be partially filled
+		free_class(class);
+		return NULL;
+	}
+	if (verdict == FILTER_UNKNOWN) {
+		// Only member tests are left to judge
+		class->filtered = !filter_members(filter, class);
+	}
+	record_phase(PHASE_MEMBERS, started);
+	count_class(class);
 	return class;
 }
 
-void parse_header(ClassFile class_file, Class *class) {
-	class->file_name = class_file.file_name;
-	fread(&class->minor_version, sizeof(uint16_t), 1, class_file.file);
-	fread(&class->major_version, sizeof(uint16_t), 1, class_file.file);
-	fread(&class->const_pool_count, sizeof(uint16_t), 1, class_file.file);
-	
-	// convert the big endian ints to host equivalents
-	class->minor_version = be16toh(class->minor_version);
-	class->major_version = be16toh(class->major_version);
-	class->const_pool_count = be16toh(class->const_pool_count);
+void free_class(Class *class) {
+	if (class == NULL) return;
+
+	if (class->image_source == IMAGE_MAPPED) {
+		munmap((void *) class->image, class->image_length);
+	} else if (class->image_source == IMAGE_HEAP) {
+		free((void *) class->image);
+	}
+	free_arena(class->arena);
+}
+
+void parse_header(Cursor *cursor, Class *class) {
+	class->minor_version = read_u2(cursor);
+	class->major_version = read_u2(cursor);
+	class->const_pool_count = read_u2(cursor);
+}
+
+static const char *ATTRIBUTE_NAMES[ATTRIBUTE_KINDS] = {
+	[ATTR_CONSTANT_VALUE] = "ConstantValue",
+	[ATTR_CODE] = "Code",
+	[ATTR_STACK_MAP_TABLE] = "StackMapTable",
+	[ATTR_EXCEPTIONS] = "Exceptions",
+	[ATTR_INNER_CLASSES] = "InnerClasses",
+	[ATTR_ENCLOSING_METHOD] = "EnclosingMethod",
+	[ATTR_SYNTHETIC] = "Synthetic",
+	[ATTR_SIGNATURE] = "Signature",
+	[ATTR_SOURCE_FILE] = "SourceFile",
+	[ATTR_SOURCE_DEBUG_EXTENSION] = "SourceDebugExtension",
+	[ATTR_LINE_NUMBER_TABLE] = "LineNumberTable",
+	[ATTR_LOCAL_VARIABLE_TABLE] = "LocalVariableTable",
+	[ATTR_LOCAL_VARIABLE_TYPE_TABLE] = "LocalVariableTypeTable",
+	[ATTR_DEPRECATED] = "Deprecated",
+	[ATTR_RUNTIME_VISIBLE_ANNOTATIONS] = "RuntimeVisibleAnnotations",
+	[ATTR_RUNTIME_INVISIBLE_ANNOTATIONS] = "RuntimeInvisibleAnnotations",
+	[ATTR_RUNTIME_VISIBLE_PARAMETER_ANNOTATIONS] = "RuntimeVisibleParameterAnnotations",
+	[ATTR_RUNTIME_INVISIBLE_PARAMETER_ANNOTATIONS] = "RuntimeInvisibleParameterAnnotations",
+	[ATTR_RUNTIME_VISIBLE_TYPE_ANNOTATIONS] = "RuntimeVisibleTypeAnnotations",
+	[ATTR_RUNTIME_INVISIBLE_TYPE_ANNOTATIONS] = "RuntimeInvisibleTypeAnnotations",
+	[ATTR_ANNOTATION_DEFAULT] = "AnnotationDefault",
+	[ATTR_BOOTSTRAP_METHODS] = "BootstrapMethods",
+	[ATTR_METHOD_PARAMETERS] = "MethodParameters",
+	[ATTR_MODULE] = "Module",
+	[ATTR_MODULE_PACKAGES] = "ModulePackages",
+	[ATTR_MODULE_MAIN_CLASS] = "ModuleMainClass",
+	[ATTR_NEST_HOST] = "NestHost",
+	[ATTR_NEST_MEMBERS] = "NestMembers",
+	[ATTR_RECORD] = "Record",
+	[ATTR_PERMITTED_SUBCLASSES] = "PermittedSubclasses",
+};
+
+/* attribute_slot's value for each spec name; no two collide, so one probe and one memcmp settle any name */
+static const uint8_t ATTRIBUTE_SLOTS[64] = {
+	[2] = ATTR_LOCAL_VARIABLE_TYPE_TABLE,
+	[4] = ATTR_METHOD_PARAMETERS,
+	[6] = ATTR_RECORD,
+	[7] = ATTR_PERMITTED_SUBCLASSES,
+	[8] = ATTR_NEST_HOST,
+	[9] = ATTR_STACK_MAP_TABLE,
+	[10] = ATTR_DEPRECATED,
+	[13] = ATTR_RUNTIME_VISIBLE_ANNOTATIONS,
+	[15] = ATTR_RUNTIME_INVISIBLE_ANNOTATIONS,
+	[16] = ATTR_INNER_CLASSES,
+	[17] = ATTR_RUNTIME_VISIBLE_TYPE_ANNOTATIONS,
+	[19] = ATTR_RUNTIME_INVISIBLE_TYPE_ANNOTATIONS,
+	[21] = ATTR_SIGNATURE,
+	[22] = ATTR_RUNTIME_VISIBLE_PARAMETER_ANNOTATIONS,
+	[24] = ATTR_RUNTIME_INVISIBLE_PARAMETER_ANNOTATIONS,
+	[27] = ATTR_LINE_NUMBER_TABLE,
+	[31] = ATTR_ENCLOSING_METHOD,
+	[33] = ATTR_ANNOTATION_DEFAULT,
+	[34] = ATTR_MODULE_PACKAGES,
+	[35] = ATTR_MODULE_MAIN_CLASS,
+	[36] = ATTR_BOOTSTRAP_METHODS,
+	[44] = ATTR_SOURCE_DEBUG_EXTENSION,
+	[46] = ATTR_EXCEPTIONS,
+	[48] = ATTR_CODE,
+	[50] = ATTR_MODULE,
+	[54] = ATTR_SOURCE_FILE,
+	[57] = ATTR_CONSTANT_VALUE,
+	[61] = ATTR_SYNTHETIC,
+	[62] = ATTR_LOCAL_VARIABLE_TABLE,
+	[63] = ATTR_NEST_MEMBERS,
+};
+
+/* Every spec name is at least 4 bytes, and its length and second and last bytes tell it apart from the others */
+static inline unsigned attribute_slot(const String *name) {
+	return (name->length + 16 * (uint8_t) name->value[1] + 12 * (uint8_t) name->value[name->length - 1]) & 63;
+}
+
+AttributeKind attribute_kind(const String *name) {
+	if (name->length < 4) return ATTR_UNKNOWN;
+	AttributeKind kind = ATTRIBUTE_SLOTS[attribute_slot(name)];
+	const char *expected = ATTRIBUTE_NAMES[kind];
+	if (kind == ATTR_UNKNOWN || strlen(expected) != name->length || memcmp(expected, name->value, name->length) != 0) {
+		return ATTR_UNKNOWN;
+	}
+	return kind;
+}
+
+const char *attribute_kind_name(AttributeKind kind) {
+	return kind < ATTRIBUTE_KINDS ? ATTRIBUTE_NAMES[kind] : NULL;
 }
 
-void parse_attribute(ClassFile class_file, Attribute *attr) {
-	fread(&attr->name_idx, sizeof(u2), 1, class_file.file);
-	fread(&attr->length, sizeof(u4), 1, class_file.file);
-	attr->name_idx = be16toh(attr->name_idx);
-	attr->length = be32toh(attr->length);
-	attr->info = calloc(attr->length + 1, sizeof(char));
-	fread(attr->info, sizeof(char), attr->length, class_file.file);
-	attr->info[attr->length] = '\0';
+void classify_attribute(const Class *class, Attribute *attr) {
+	if (class->symbols != NULL && attr->name_idx < class->const_pool_count) {
+		// The commonest names were interned first, so an interned class settles them with an integer compare
+		switch (class->symbols[attr->name_idx]) {
+			case SYMBOL_CODE:
+				attr->kind = ATTR_CODE;
+				return;
+			case SYMBOL_CONSTANT_VALUE:
+				attr->kind = ATTR_CONSTANT_VALUE;
+				return;
+			case SYMBOL_EXCEPTIONS:
+				attr->kind = ATTR_EXCEPTIONS;
+				return;
+			case SYMBOL_INNER_CLASSES:
+				attr->kind = ATTR_INNER_CLASSES;
+				return;
+			case SYMBOL_SIGNATURE:
+				attr->kind = ATTR_SIGNATURE;
+				return;
+			case SYMBOL_SOURCE_FILE:
+				attr->kind = ATTR_SOURCE_FILE;
+				return;
+			default:
+				break;
+		}
+	}
+	const String *name = get_utf8(class, attr->name_idx);
+	attr->kind = name != NULL ? attribute_kind(name) : ATTR_UNKNOWN;
+}
+
+const Attribute *find_attribute(const Attribute *attrs, uint16_t count, AttributeKind kind) {
+	uint16_t i;
+	for (i = 0; i < count; i++) {
+		if (attrs[i].kind == kind) return attrs + i;
+	}
+	return NULL;
+}
+
+void parse_attribute(Cursor *cursor, Attribute *attr) {
+	attr->name_idx = read_u2(cursor);
+	attr->kind = ATTR_UNKNOWN;
+	attr->length = read_u4(cursor);
+	attr->offset = cursor->offset;
+	read_bytes(cursor, attr->length);
+}
+
+/* Where an entry's fields sit after its tag byte: width bytes, the first first of them one field and the rest another. A width
+ * of 0 marks a tag the spec doesn't define. */
+typedef struct {
+	uint8_t width;
+	uint8_t first;
+	uint8_t slots; /* Pool indexes taken: 2 for Long and Double */
+} ConstantLayout;
+
+static const ConstantLayout CONSTANT_LAYOUTS[MAX_CPOOL_TAG + 1] = {
+	[STRING_UTF8]      = {2, 2, 1}, // just the length; the bytes follow
+	[INTEGER]          = {4, 4, 1},
+	[FLOAT]            = {4, 4, 1},
+	[LONG]             = {8, 4, 2},
+	[DOUBLE]           = {8, 4, 2},
+	[CLASS]            = {2, 2, 1},
+	[STRING]           = {2, 2, 1},
+	[FIELD]            = {4, 2, 1},
+	[METHOD]           = {4, 2, 1},
+	[INTERFACE_METHOD] = {4, 2, 1},
+	[NAME]             = {4, 2, 1},
+	[METHOD_HANDLE]    = {3, 1, 1},
+	[METHOD_TYPE]      = {2, 2, 1},
+	[DYNAMIC]          = {4, 2, 1},
+	[INVOKE_DYNAMIC]   = {4, 2, 1},
+	[MODULE]           = {2, 2, 1},
+	[PACKAGE]          = {2, 2, 1}
+};
+
+/* Return the length big-endian bytes at p as a number */
+static inline uint32_t read_be(const uint8_t *p, unsigned length) {
+	uint32_t value = 0;
+	while (length-- > 0) value = value << 8 | *p++;
+	return value;
 }
 
-void parse_const_pool(Class *class, const uint16_t const_pool_count, const ClassFile class_file) {
-	const int MAX_ITEMS = const_pool_count - 1;
+void parse_const_pool(Class *class, const uint16_t const_pool_count, Cursor *cursor) {
+	class->pool_size_bytes = 0;
+	if (const_pool_count == 0) return;
+
+	class->tags = arena_calloc(class->arena, const_pool_count, sizeof(uint8_t));
+	class->payloads = arena_calloc(class->arena, const_pool_count, sizeof(uint32_t));
+	uint32_t *offsets = arena_alloc(class->arena, const_pool_count * sizeof(uint32_t));
+	const uint8_t *data = cursor->data;
+	size_t position = cursor->offset;
 	uint32_t table_size_bytes = 0;
-	int i;
-	char tag_byte;
-	Ref r;
+	uint32_t strings_count = 0;
+	uint16_t i;
 
-	class->items = calloc(MAX_ITEMS, sizeof(Class));
-	for (i = 1; i <= MAX_ITEMS; i++) {
-		fread(&tag_byte, sizeof(char), 1, class_file.file);
+	// First pass: check each tag and note where its entry starts, decoding nothing but UTF-8 lengths
+	for (i = 1; i < const_pool_count; i += CONSTANT_LAYOUTS[class->tags[i]].slots) {
+		if (position >= cursor->length) return;
+		uint8_t tag_byte = data[position];
 		if (tag_byte < MIN_CPOOL_TAG || tag_byte > MAX_CPOOL_TAG) {
 			fprintf(stderr, "Tag byte '%d' is outside permitted range %u to %u\n", tag_byte, MIN_CPOOL_TAG, MAX_CPOOL_TAG);
-			table_size_bytes = 0;
-			break; // fail fast
+			return; // fail fast
+		}
+		const ConstantLayout layout = CONSTANT_LAYOUTS[tag_byte];
+		if (layout.width == 0) {
+			fprintf(stderr, "Found tag byte '%d' but don't know what to do with it\n", tag_byte);
+			return;
 		}
+		// 8-byte consts take 2 pool entries, so can't start in the last one
+		if (i + layout.slots > const_pool_count) return;
 
-		String s;
-		uint16_t ptr_idx = i - 1;
-		Item *item = class->items + ptr_idx;
-		item->tag = tag_byte;
-
-		// Populate item based on tag_byte
-		switch (tag_byte) {
-			case STRING_UTF8: // String prefixed by a uint16 indicating the number of bytes in the encoded string which immediately follows
-				fread(&s.length, sizeof(s.length), 1, class_file.file);
-				s.length = be16toh(s.length);
-				s.value = malloc(sizeof(char) * s.length);
-				fread(s.value, sizeof(char), s.length, class_file.file);
-				item->value.string = s;
-				table_size_bytes += 2 + s.length;
-				break;
-			case INTEGER: // Integer: a signed 32-bit two's complement number in big-endian format
-				fread(&item->value.integer, sizeof(item->value.integer), 1, class_file.file);
-				item->value.integer = be32toh(item->value.integer);
-				table_size_bytes += 4;
-				break;
-			case FLOAT: // Float: a 32-bit single-precision IEEE 754 floating-point number
-				fread(&item->value.flt, sizeof(item->value.flt), 1, class_file.file);
-				item->value.flt = be32toh(item->value.flt);
-				table_size_bytes += 4;
-				break;
-			case LONG: // Long: a signed 64-bit two's complement number in big-endian format (takes two slots in the constant pool table)
-				fread(&item->value.lng.high, sizeof(item->value.lng.high), 1, class_file.file); // 4 bytes
-				fread(&item->value.lng.low, sizeof(item->value.lng.low), 1, class_file.file); // 4 bytes
-				item->value.lng.high = be32toh(item->value.lng.high);
-				item->value.lng.low = be32toh(item->value.lng.low);
-				// 8-byte consts take 2 pool entries
-				++i;
-				table_size_bytes += 8;
-				break;
-			case DOUBLE: // Double: a 64-bit double-precision IEEE 754 floating-point number (takes two slots in the constant pool table)
-				fread(&item->value.dbl.high, sizeof(item->value.dbl.high), 1, class_file.file); // 4 bytes
-				fread(&item->value.dbl.low, sizeof(item->value.dbl.low), 1, class_file.file); // 4 bytes
-				item->value.dbl.high = be32toh(item->value.dbl.high);
-				item->value.dbl.low = be32toh(item->value.dbl.low);
-				// 8-byte consts take 2 pool entries
-				++i;
-				table_size_bytes += 8;
-				break;
-			case CLASS: // Class reference: an uint16 within the constant pool to a UTF-8 string containing the fully qualified class name
-				fread(&r.class_idx, sizeof(r.class_idx), 1, class_file.file);
-				r.class_idx = be16toh(r.class_idx);
-				item->value.ref = r;
-				table_size_bytes += 2;
-				break;
-			case STRING: // String reference: an uint16 within the constant pool to a UTF-8 string
-				fread(&r.class_idx, sizeof(r.class_idx), 1, class_file.file);
-				r.class_idx = be16toh(r.class_idx);
-				item->value.ref = r;
-				table_size_bytes += 2;
-				break;
-			case FIELD: // Field reference: two uint16 within the pool, 1st pointing to a Class reference, 2nd to a Name and Type descriptor
-				/* FALL THROUGH TO METHOD */
-			case METHOD: // Method reference: two uint16s within the pool, 1st pointing to a Class reference, 2nd to a Name and Type descriptor
-				/* FALL THROUGH TO INTERFACE_METHOD */
-			case INTERFACE_METHOD: // Interface method reference: 2 uint16 within the pool, 1st pointing to a Class reference, 2nd to a Name and Type descriptor
-				fread(&r.class_idx, sizeof(r.class_idx), 1, class_file.file);
-				fread(&r.name_idx, sizeof(r.name_idx), 1, class_file.file);
-				r.class_idx = be16toh(r.class_idx);
-				r.name_idx = be16toh(r.name_idx);
-				item->value.ref = r;
-				table_size_bytes += 4;
-				break;
-			case NAME: // Name and type descriptor: 2 uint16 to UTF-8 strings, 1st representing a name (identifier), 2nd a specially encoded type descriptor
-				fread(&r.class_idx, sizeof(r.class_idx), 1, class_file.file);
-				fread(&r.name_idx, sizeof(r.name_idx), 1, class_file.file);
-				r.class_idx = be16toh(r.class_idx);
-				r.name_idx = be16toh(r.name_idx);
-				item->value.ref = r;
-				table_size_bytes += 4;
-				break;
-			default:
-				fprintf(stderr, "Found tag byte '%d' but don't know what to do with it\n", tag_byte);
-				item = NULL;
-				break;
+		size_t width = layout.width;
+		if (tag_byte == STRING_UTF8) {
+			if (cursor->length - position < 3) return;
+			width += data[position + 1] << 8 | data[position + 2];
+			strings_count++;
 		}
-		if (item != NULL) class->items[i-1] = *item;
+		if (cursor->length - position - 1 < width) return;
+		class->tags[i] = tag_byte;
+		offsets[i] = position + 1;
+		position += 1 + width;
+		table_size_bytes += width;
 	}
+
+	// Second pass: decode every entry into the arrays
+	class->strings = arena_alloc(class->arena, (strings_count > 0 ? strings_count : 1) * sizeof(String));
+	class->strings_count = 0;
+	for (i = 1; i < const_pool_count; i += CONSTANT_LAYOUTS[class->tags[i]].slots) {
+		const ConstantLayout layout = CONSTANT_LAYOUTS[class->tags[i]];
+		const uint8_t *fields = data + offsets[i];
+		uint32_t a = read_be(fields, layout.first);
+		uint32_t b = read_be(fields + layout.first, layout.width - layout.first);
+		if (layout.first == 4) {
+			// The low word of a Long or Double goes in its second slot
+			class->payloads[i] = a;
+			if (layout.slots == 2) class->payloads[i + 1] = b;
+		} else {
+			class->payloads[i] = a << 16 | b;
+		}
+		if (class->tags[i] == STRING_UTF8) {
+			String *string = class->strings + class->strings_count;
+			string->length = a;
+			string->value = (const char *) fields + 2;
+			class->payloads[i] = class->strings_count++;
+		}
+	}
+	cursor->offset = position;
 	class->pool_size_bytes = table_size_bytes;
 }
 
@@ -244,38 +526,63 @@ bool is_class(FILE *class_file) {
 	return num_read == 1 && be32toh(magicNum) == 0xcafebabe;
 }
 
-Item *get_item(const Class *class, const uint16_t cp_idx) {
-	if (cp_idx < class->const_pool_count) return &class->items[cp_idx-1];
-	else return NULL;
+bool is_class_image(const uint8_t *data, size_t length) {
+	Cursor cursor = {data, length, 0, false};
+	return read_u4(&cursor) == 0xcafebabe && !cursor.overflow;
+}
+
+Item get_item(const Class *class, const uint16_t cp_idx) {
+	Item item;
+	memset(&item, 0, sizeof(item));
+	item.tag = get_tag(class, cp_idx);
+	if (item.tag == 0) return item;
+
+	uint32_t payload = class->payloads[cp_idx];
+	switch (item.tag) {
+		case STRING_UTF8:
+			item.value.string = class->strings[payload];
+			break;
+		case INTEGER:
+		case FLOAT:
+			// Same bits either way
+			item.value.integer = (int32_t) payload;
+			break;
+		case LONG:
+		case DOUBLE:
+			item.value.lng.high = payload;
+			item.value.lng.low = class->payloads[cp_idx + 1];
+			break;
+		default:
+			item.value.ref = get_ref(class, cp_idx);
+	}
+	return item;
+}
+
+Item get_class_string(const Class *class, const uint16_t index) {
+	Item item;
+	memset(&item, 0, sizeof(item));
+	if (get_tag(class, index) != CLASS) return item;
+	return get_item(class, get_ref(class, index).class_idx);
+}
+
+const String *get_utf8(const Class *class, const uint16_t cp_idx) {
+	return get_tag(class, cp_idx) == STRING_UTF8 ? class->strings + class->payloads[cp_idx] : NULL;
 }
 
-Item *get_class_string(const Class *class, const uint16_t index) {
-	Item *i1 = get_item(class, index);
-	return get_item(class, i1->value.ref.class_idx);
+const String *get_class_name(const Class *class, const uint16_t cp_idx) {
+	return get_tag(class, cp_idx) == CLASS ? get_utf8(class, get_ref(class, cp_idx).class_idx) : NULL;
 }
 
 double to_double(const Double dbl) {
-	return -dbl.high; //FIXME check the following implementation
-	//unsigned long bits = ((long) be32toh(item->dbl.high) << 32) + be32toh(item->dbl.low);
-	//if (bits == 0x7ff0000000000000L) {
-		//return POSITIVE_INFINITY;
-	//} else if (bits == 0xfff0000000000000L) {
-		//return POSITIVE_INFINITY;
-	//} else if ((bits > 0x7ff0000000000000L && bits < 0x7fffffffffffffffL) 
-			//|| (bits > 0xfff0000000000001L && bits < 0xffffffffffffffffL)) {
-		//return NaN;
-	//} else {
-		//int s = ((bits >> 63) == 0) ? 1 : -1; 
-		//int e = (int)((bits >> 52) & 0x7ffL);
-		//long m = (e == 0) 
-			//? (bits & 0xfffffffffffffL) << 1 
-			//: (bits & 0xfffffffffffffL) | 0x10000000000000L;
-		//return s * m * (2 << (e - 1075)); //FIXME this is wrong
-	//} 
+	// high and low are already in host order; reassemble the IEEE 754 bits
+	uint64_t bits = (uint64_t) dbl.high << 32 | dbl.low;
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
 }
 
 long to_long(const Long lng) {
-	return ((long) be32toh(lng.high) << 32) + be32toh(lng.low);
+	return (long) ((uint64_t) lng.high << 32 | lng.low);
 }
 
 char *field2str(const char fld_type) {
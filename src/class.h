@@ -1,10 +1,13 @@
 #ifndef CLASS_H
 #define CLASS_H
+#include "arena.h"
 #include <endian.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define u2 uint16_t
 #define u4 uint32_t
@@ -20,10 +23,48 @@ typedef enum {
 	ACC_ENUM 		= 0x4000
 } AccessFlags;
 
+/* The attributes defined by the JVM spec (section 4.7), so consumers can switch on a kind instead of comparing names */
+typedef enum {
+	ATTR_UNKNOWN, /* Not a name the spec defines, e.g. one a compiler or tool made up */
+	ATTR_CONSTANT_VALUE,
+	ATTR_CODE,
+	ATTR_STACK_MAP_TABLE,
+	ATTR_EXCEPTIONS,
+	ATTR_INNER_CLASSES,
+	ATTR_ENCLOSING_METHOD,
+	ATTR_SYNTHETIC,
+	ATTR_SIGNATURE,
+	ATTR_SOURCE_FILE,
+	ATTR_SOURCE_DEBUG_EXTENSION,
+	ATTR_LINE_NUMBER_TABLE,
+	ATTR_LOCAL_VARIABLE_TABLE,
+	ATTR_LOCAL_VARIABLE_TYPE_TABLE,
+	ATTR_DEPRECATED,
+	ATTR_RUNTIME_VISIBLE_ANNOTATIONS,
+	ATTR_RUNTIME_INVISIBLE_ANNOTATIONS,
+	ATTR_RUNTIME_VISIBLE_PARAMETER_ANNOTATIONS,
+	ATTR_RUNTIME_INVISIBLE_PARAMETER_ANNOTATIONS,
+	ATTR_RUNTIME_VISIBLE_TYPE_ANNOTATIONS,
+	ATTR_RUNTIME_INVISIBLE_TYPE_ANNOTATIONS,
+	ATTR_ANNOTATION_DEFAULT,
+	ATTR_BOOTSTRAP_METHODS,
+	ATTR_METHOD_PARAMETERS,
+	ATTR_MODULE,
+	ATTR_MODULE_PACKAGES,
+	ATTR_MODULE_MAIN_CLASS,
+	ATTR_NEST_HOST,
+	ATTR_NEST_MEMBERS,
+	ATTR_RECORD,
+	ATTR_PERMITTED_SUBCLASSES,
+	ATTRIBUTE_KINDS
+} AttributeKind;
+
+/* An attribute's header. The body isn't touched while parsing; get_attribute_info materialises it from offset on demand. */
 typedef struct {
 	uint16_t name_idx;
+	uint16_t kind; /* An AttributeKind, set by classify_attribute */
 	uint32_t length;
-	char *info;
+	uint32_t offset; /* Where the body starts in the class image */
 } Attribute;
 
 /* A wrapper for FILE structs that also holds the file name.  */
@@ -32,6 +73,21 @@ typedef struct {
 	FILE *file;
 } ClassFile;
 
+/* A bounds-checked read position over an in-memory class image. Reads past the end yield zeroes and set overflow. */
+typedef struct {
+	const uint8_t *data;
+	size_t length;
+	size_t offset;
+	bool overflow;
+} Cursor;
+
+/* Who owns the bytes a Class was decoded from, and so how free_class releases them */
+typedef enum {
+	IMAGE_BORROWED, /* Supplied by the caller, who must keep it alive for as long as the Class */
+	IMAGE_HEAP,     /* Read from a stream into a malloc'd buffer */
+	IMAGE_MAPPED    /* mmap'd from a regular file */
+} ImageSource;
+
 typedef struct {
 	uint32_t high;
 	uint32_t low;
@@ -64,11 +120,14 @@ typedef struct {
 	uint16_t name_idx;
 } Ref;
 
+/* A modified UTF-8 constant. value points into the class image, or into the interner for classes read with
+ * ParseOptions.intern, and is NOT NUL-terminated; always honour length. */
 typedef struct {
 	uint16_t length;
-	char *value;
+	const char *value;
 } String;
 
+/* One constant, decoded out of the pool's arrays by get_item */
 typedef struct {
 	uint8_t tag; // the tag byte
 	union {
@@ -77,7 +136,8 @@ typedef struct {
 		Double dbl;
 		Long lng;
 		int32_t integer;
-		Ref ref; /* A method, field or interface reference */
+		Ref ref; /* Every index-only constant: class_idx is the first index, name_idx the second. For MethodHandle that is
+		          * reference_kind and reference_index; for Dynamic and InvokeDynamic, the bootstrap method and the NameAndType. */
 	} value;
 } Item;
 
@@ -88,7 +148,12 @@ typedef struct {
 	uint16_t major_version;
 	uint16_t const_pool_count;
 	uint32_t pool_size_bytes;
-	Item *items;
+	/* The constant pool as parallel arrays by pool index, so a lookup touches a byte and a word rather than a whole Item */
+	uint8_t *tags;      /* 0 at index 0 and in the second slot of a Long or Double */
+	uint32_t *payloads; /* A reference's two indexes, first in the high half; the bits of an Integer or Float; the high word of a Long
+	                     * or Double, its low word in the second slot; for a UTF-8 constant, its index in strings */
+	String *strings;    /* The UTF-8 constants in pool order */
+	uint16_t strings_count;
 	uint16_t flags;
 	uint16_t this_class;
 	uint16_t super_class;
@@ -100,6 +165,14 @@ typedef struct {
 	Method *methods;
 	uint16_t attributes_count;
 	Attribute *attributes;
+	const uint8_t *image; /* The raw class file bytes that strings and attributes point into */
+	size_t image_length;
+	ImageSource image_source;
+	bool skimmed; /* Parsed with ParseOptions.skim, so the member tables were never read */
+	bool filtered; /* Rejected by ParseOptions.filter; only as much as it took to tell was parsed */
+	uint32_t *symbols; /* With ParseOptions.intern, the global id of each UTF-8 constant by pool index, NO_SYMBOL for the rest */
+	const struct TypeNode **types; /* Without it, trees parsed from UTF-8 constants by pool index, filled in on demand; see descriptor.h */
+	Arena *arena; /* Everything above is allocated from here, including the Class itself */
 } Class;
 
 typedef enum {
@@ -114,9 +187,12 @@ typedef enum {
 	METHOD           = 10, /* Method reference: two indexes within the constant pool, the first pointing to a Class reference, the second to a Name and Type descriptor. */
 	INTERFACE_METHOD = 11, /* Interface method reference: two indexes within the constant pool, the first pointing to a Class reference, the second to a Name and Type descriptor. */
 	NAME             = 12, /* Name and type descriptor: 2 indexes to UTF-8 strings, the first representing a name and the second a specially encoded type descriptor. */
-	METHOD_HANDLE 	 = 15,
-	METHOD_TYPE 	 = 16,
-	INVOKE_DYNAMIC 	 = 18
+	METHOD_HANDLE    = 15, /* Method handle: a 1-byte reference kind and an index to the field or method it refers to */
+	METHOD_TYPE      = 16, /* Method type: an index to a UTF-8 method descriptor */
+	DYNAMIC          = 17, /* Dynamically computed constant: an index into BootstrapMethods and an index to a Name and Type descriptor */
+	INVOKE_DYNAMIC   = 18, /* Call site for invokedynamic: an index into BootstrapMethods and an index to a Name and Type descriptor */
+	MODULE           = 19, /* Module: an index to a UTF-8 module name */
+	PACKAGE          = 20  /* Package: an index to a UTF-8 package name in internal form */
 } CPool_t;
 
 static char *CPool_strings[] = {
@@ -137,7 +213,10 @@ static char *CPool_strings[] = {
 	"Undefined", // 14
 	"MethodHandle",
 	"MethodType",
-	"InvokeDynamic"
+	"Dynamic",
+	"InvokeDynamic",
+	"Module",
+	"Package"
 };
 
 enum RANGES {
@@ -145,36 +224,145 @@ enum RANGES {
 	MIN_CPOOL_TAG = 1,
 
 	/* The largest permitted value for a tag byte */
-	MAX_CPOOL_TAG = 18
+	MAX_CPOOL_TAG = 20
 };
 
-/* Delegate to read_class(ClassFile) */
-Class *read_class_from_file_name(char *f);
+static inline uint8_t read_u1(Cursor *cursor) {
+	if (cursor->length - cursor->offset < 1) {
+		cursor->overflow = true;
+		return 0;
+	}
+	return cursor->data[cursor->offset++];
+}
+
+static inline uint16_t read_u2(Cursor *cursor) {
+	if (cursor->length - cursor->offset < 2) {
+		cursor->overflow = true;
+		cursor->offset = cursor->length;
+		return 0;
+	}
+	const uint8_t *p = cursor->data + cursor->offset;
+	cursor->offset += 2;
+	return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t read_u4(Cursor *cursor) {
+	if (cursor->length - cursor->offset < 4) {
+		cursor->overflow = true;
+		cursor->offset = cursor->length;
+		return 0;
+	}
+	const uint8_t *p = cursor->data + cursor->offset;
+	cursor->offset += 4;
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+/* Return a pointer to the next length bytes and step over them, or NULL if fewer remain. */
+static inline const uint8_t *read_bytes(Cursor *cursor, size_t length) {
+	if (cursor->length - cursor->offset < length) {
+		cursor->overflow = true;
+		cursor->offset = cursor->length;
+		return NULL;
+	}
+	const uint8_t *p = cursor->data + cursor->offset;
+	cursor->offset += length;
+	return p;
+}
+
+struct Filter;
+
+/* Knobs for read_class and friends. Passing NULL means the defaults: everything is parsed. */
+typedef struct {
+	bool skim; /* Stop after the interfaces table, leaving fields, methods and attributes empty */
+	bool intern; /* Intern UTF-8 constants into the process-wide table, so their Strings outlive the image; see intern.h */
+	const struct Filter *filter; /* Mark classes it rejects as filtered and stop parsing them; drop members it rejects. See filter.h */
+} ParseOptions;
+
+/* Map the file and decode it with read_class_from_buffer. Files that can't be mapped (pipes, devices) are streamed through read_class. */
+Class *read_class_from_file_name(char *f, const ParseOptions *options);
+
+/* Parse the given class file into a Class struct. class_file.file must be positioned just after the magic number, i.e. is_class has
+ * been called. Regular files are mapped; anything else, e.g. a pipe, has the rest of the stream read into memory in one go. */
+Class *read_class(const ClassFile class_file, const ParseOptions *options);
 
-/* Parse the given class file into a Class struct. */
-Class *read_class(const ClassFile class_file);
+/* Decode the length bytes at data, starting with the magic number, into a Class. Strings and attribute bodies point into data, which
+ * must outlive the returned Class. Returns NULL if data isn't a valid class file. */
+Class *read_class_from_buffer(char *file_name, const uint8_t *data, size_t length, const ParseOptions *options);
 
-/* Parse the attribute properties from file into attr. Assumes class_file.file is at offset relative to reading an attribute struct.
- * See section 4.7 of the JVM spec. */
-void parse_attribute(ClassFile class_file, Attribute *attr);
+/* Decode length bytes of a file read into the malloc'd image, which the Class takes over. Reports failures on stderr the way
+ * read_class_from_file_name does, frees image and returns NULL. */
+Class *read_class_from_heap(char *file_name, uint8_t *image, size_t length, const ParseOptions *options);
 
-/* Parse the constant pool into class from class_file. ClassFile.file MUST be at the correct seek point i.e. byte offset 11.
- * The number of bytes read is returned. A return value of 0 signifies an invalid constant pool and class may have been changed.
+/* Release class along with everything read_class allocated for it, including its image if it owns it. Every allocation lives in
+ * class->arena, so this is a handful of free() calls however big the class is. */
+void free_class(Class *class);
+
+/* Parse the attribute header at cursor into attr and step over its body without reading it; attr->kind is left ATTR_UNKNOWN
+ * for classify_attribute. See section 4.7 of the JVM spec. */
+void parse_attribute(Cursor *cursor, Attribute *attr);
+
+/* Set attr->kind from its name. read_class does this for every attribute it parses. */
+void classify_attribute(const Class *class, Attribute *attr);
+
+/* Return the kind of the attribute called name, using a perfect hash over the spec's attribute names */
+AttributeKind attribute_kind(const String *name);
+
+/* Return the spec's name for kind, or NULL for ATTR_UNKNOWN */
+const char *attribute_kind_name(AttributeKind kind);
+
+/* Return the first of the count attributes at attrs of the given kind, or NULL if there is none */
+const Attribute *find_attribute(const Attribute *attrs, uint16_t count, AttributeKind kind);
+
+/* Parse the constant pool into class from cursor, which MUST be at byte offset 10. A first pass checks the tags and records where
+ * each entry starts; a second decodes the entries into class->tags, payloads and strings.
+ * class->pool_size_bytes is set to the number of bytes read; 0 signifies an invalid constant pool and class may have been changed.
  * See section 4.4 of the JVM spec.
  */
-void parse_const_pool(Class *class, const uint16_t const_pool_count, const ClassFile class_file);
+void parse_const_pool(Class *class, const uint16_t const_pool_count, Cursor *cursor);
 
-/* Parse the initial section of the given class_file up to and including the constant_pool_size section */
-void parse_header(ClassFile class_file, Class *class);
+/* Parse the initial section of the class image at cursor up to and including the constant_pool_size section */
+void parse_header(Cursor *cursor, Class *class);
 
 /* Return true if class_file's first four bytes match 0xcafebabe. */
 bool is_class(FILE *class_file);
 
-/* Return the item pointed to by cp_idx, the index of an item in the constant pool */
-Item *get_item(const Class *class, const uint16_t cp_idx);
+/* Return true if the length bytes at data start with 0xcafebabe. */
+bool is_class_image(const uint8_t *data, size_t length);
+
+/* Return the tag of the constant at cp_idx, or 0 if cp_idx is out of range or the second slot of a Long or Double */
+static inline uint8_t get_tag(const Class *class, const uint16_t cp_idx) {
+	return cp_idx < class->const_pool_count ? class->tags[cp_idx] : 0;
+}
 
-/* Resolve a Class's name by following class->items[index].ref.class_idx */
-Item *get_class_string(const Class *class, const uint16_t index);
+/* Return the two indexes of the reference constant at cp_idx, which must be in range */
+static inline Ref get_ref(const Class *class, const uint16_t cp_idx) {
+	uint32_t payload = class->payloads[cp_idx];
+	Ref ref = {(uint16_t) (payload >> 16), (uint16_t) payload};
+	return ref;
+}
+
+/* Return a copy of the constant at cp_idx, with tag 0 if there isn't one */
+Item get_item(const Class *class, const uint16_t cp_idx);
+
+/* Return the length bytes of attr's body, which point into class's image and are NOT NUL-terminated */
+static inline const uint8_t *get_attribute_info(const Class *class, const Attribute *attr) {
+	return class->image + attr->offset;
+}
+
+/* Resolve a Class's name by following the Class constant at index to its UTF-8 constant */
+Item get_class_string(const Class *class, const uint16_t index);
+
+/* Return the UTF-8 constant at cp_idx, or NULL if cp_idx is out of range or names some other kind of constant */
+const String *get_utf8(const Class *class, const uint16_t cp_idx);
+
+/* Return the name of the Class constant at cp_idx, or NULL if there isn't one, e.g. the super class of java/lang/Object */
+const String *get_class_name(const Class *class, const uint16_t cp_idx);
+
+/* Return true if string holds exactly the bytes of the NUL-terminated cstr */
+static inline bool string_equals(const String string, const char *cstr) {
+	size_t length = strlen(cstr);
+	return string.length == length && memcmp(string.value, cstr, length) == 0;
+}
 
 /* Convert the high and low bits of dbl to a double type */
 double to_double(const Double dbl);
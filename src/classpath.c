@@ -0,0 +1,126 @@
+#include "classpath.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static bool has_suffix(const char *name, const char *suffix) {
+	size_t length = strlen(name), suffix_length = strlen(suffix);
+	return length > suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static char *join_path(const char *directory, const char *name) {
+	size_t length = strlen(directory);
+	bool slash = length > 0 && directory[length - 1] != '/';
+	char *path = malloc(length + slash + strlen(name) + 1);
+	sprintf(path, slash ? "%s/%s" : "%s%s", directory, name);
+	return path;
+}
+
+/* Visit directory's matching files, and those of its subdirectories if recursive. With suffix NULL, visit the subdirectories
+ * themselves instead, each after everything under it. */
+static bool walk(const char *directory, const char *suffix, bool recursive, PathVisitor visit, void *context) {
+	DIR *dir = opendir(directory);
+	if (dir == NULL) {
+		fprintf(stderr, "Could not read directory '%s': %s\n", directory, strerror(errno));
+		return false;
+	}
+
+	// Read the whole listing first so it can be sorted
+	char **names = NULL;
+	size_t count = 0, capacity = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 32;
+			names = realloc(names, capacity * sizeof(char *));
+		}
+		// Each name is prefixed with its d_type so the two sort together
+		size_t length = strlen(entry->d_name);
+		char *name = malloc(length + 2);
+		name[0] = entry->d_type;
+		memcpy(name + 1, entry->d_name, length + 1);
+		names[count++] = name + 1;
+	}
+	closedir(dir);
+	qsort(names, count, sizeof(char *), compare_names);
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+		char *path = join_path(directory, names[i]);
+		unsigned char type = names[i][-1];
+		struct stat st;
+		if (type == DT_UNKNOWN) {
+			// Some file systems don't fill in d_type
+			if (lstat(path, &st) != 0) type = DT_UNKNOWN;
+			else if (S_ISDIR(st.st_mode)) type = DT_DIR;
+			else if (S_ISREG(st.st_mode)) type = DT_REG;
+			else if (S_ISLNK(st.st_mode)) type = DT_LNK;
+		}
+		if (type == DT_LNK) {
+			type = stat(path, &st) == 0 && S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if (type == DT_DIR && recursive) {
+			walk(path, suffix, true, visit, context);
+			if (suffix == NULL) {
+				visit(path, context);
+			} else {
+				free(path);
+			}
+		} else if (type == DT_REG && suffix != NULL && has_suffix(names[i], suffix)) {
+			visit(path, context);
+		} else {
+			free(path);
+		}
+		free(names[i] - 1);
+	}
+	free(names);
+	return true;
+}
+
+bool walk_directory(const char *directory, const char *suffix, PathVisitor visit, void *context) {
+	return walk(directory, suffix, true, visit, context);
+}
+
+bool walk_subdirectories(const char *directory, PathVisitor visit, void *context) {
+	return walk(directory, NULL, true, visit, context);
+}
+
+bool walk_classpath(const char *classpath, PathVisitor visit, void *context) {
+	bool walked = true;
+	const char *element = classpath;
+	for (;;) {
+		const char *end = strchr(element, ':');
+		size_t length = end != NULL ? (size_t) (end - element) : strlen(element);
+		if (length > 0) {
+			char *path = strndup(element, length);
+			if (strcmp(path, "*") == 0 || has_suffix(path, "/*")) {
+				// Like java, a wildcard means the jars in that directory and no deeper
+				path[length - 1] = '\0';
+				walked &= walk(length > 1 ? path : ".", ".jar", false, visit, context);
+				free(path);
+			} else if (is_directory(path)) {
+				walked &= walk(path, ".class", true, visit, context);
+				free(path);
+			} else {
+				visit(path, context);
+			}
+		}
+		if (end == NULL) break;
+		element = end + 1;
+	}
+	return walked;
+}
+
+bool is_directory(const char *path) {
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
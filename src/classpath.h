@@ -0,0 +1,27 @@
+#ifndef CLASSPATH_H
+#define CLASSPATH_H
+#include <stdbool.h>
+
+/* Finding inputs without the shell's help, so trees too big for the command line can still be read in one run. Directories are
+ * listed in name order, so the same tree always yields the same paths in the same order. */
+
+/* Called with each file found. path is malloc'd and belongs to the visitor from then on. */
+typedef void (*PathVisitor)(char *path, void *context);
+
+/* Visit every file under directory whose name ends in suffix, depth first. Symbolic links to files are visited; links to
+ * directories are not followed, so cycles can't arise. Returns false, after reporting why on stderr, if directory can't be read;
+ * unreadable subdirectories are reported and skipped. */
+bool walk_directory(const char *directory, const char *suffix, PathVisitor visit, void *context);
+
+/* Visit every directory under directory, not including directory itself, in the same order and without following links */
+bool walk_subdirectories(const char *directory, PathVisitor visit, void *context);
+
+/* Visit every input named by classpath, a list of paths separated by ':' like java's -cp. A directory contributes the .class files
+ * under it; a directory followed by "/" and "*" contributes the .jar files directly in it; anything else, e.g. a jar, is visited
+ * itself. Empty elements are ignored. Returns false if any directory couldn't be read. */
+bool walk_classpath(const char *classpath, PathVisitor visit, void *context);
+
+/* Return true if path names a directory, following symbolic links */
+bool is_directory(const char *path);
+
+#endif //CLASSPATH_H
@@ -0,0 +1,313 @@
+#include "code.h"
+#include <string.h>
+
+const OpcodeInfo OPCODES[256] = {
+	[0x00] = {"nop", 1, OPERAND_NONE},
+	[0x01] = {"aconst_null", 1, OPERAND_NONE},
+	[0x02] = {"iconst_m1", 1, OPERAND_NONE},
+	[0x03] = {"iconst_0", 1, OPERAND_NONE},
+	[0x04] = {"iconst_1", 1, OPERAND_NONE},
+	[0x05] = {"iconst_2", 1, OPERAND_NONE},
+	[0x06] = {"iconst_3", 1, OPERAND_NONE},
+	[0x07] = {"iconst_4", 1, OPERAND_NONE},
+	[0x08] = {"iconst_5", 1, OPERAND_NONE},
+	[0x09] = {"lconst_0", 1, OPERAND_NONE},
+	[0x0a] = {"lconst_1", 1, OPERAND_NONE},
+	[0x0b] = {"fconst_0", 1, OPERAND_NONE},
+	[0x0c] = {"fconst_1", 1, OPERAND_NONE},
+	[0x0d] = {"fconst_2", 1, OPERAND_NONE},
+	[0x0e] = {"dconst_0", 1, OPERAND_NONE},
+	[0x0f] = {"dconst_1", 1, OPERAND_NONE},
+	[0x10] = {"bipush", 2, OPERAND_BYTE},
+	[0x11] = {"sipush", 3, OPERAND_SHORT},
+	[0x12] = {"ldc", 2, OPERAND_CONSTANT},
+	[0x13] = {"ldc_w", 3, OPERAND_CONSTANT},
+	[0x14] = {"ldc2_w", 3, OPERAND_CONSTANT},
+	[0x15] = {"iload", 2, OPERAND_LOCAL},
+	[0x16] = {"lload", 2, OPERAND_LOCAL},
+	[0x17] = {"fload", 2, OPERAND_LOCAL},
+	[0x18] = {"dload", 2, OPERAND_LOCAL},
+	[0x19] = {"aload", 2, OPERAND_LOCAL},
+	[0x1a] = {"iload_0", 1, OPERAND_NONE},
+	[0x1b] = {"iload_1", 1, OPERAND_NONE},
+	[0x1c] = {"iload_2", 1, OPERAND_NONE},
+	[0x1d] = {"iload_3", 1, OPERAND_NONE},
+	[0x1e] = {"lload_0", 1, OPERAND_NONE},
+	[0x1f] = {"lload_1", 1, OPERAND_NONE},
+	[0x20] = {"lload_2", 1, OPERAND_NONE},
+	[0x21] = {"lload_3", 1, OPERAND_NONE},
+	[0x22] = {"fload_0", 1, OPERAND_NONE},
+	[0x23] = {"fload_1", 1, OPERAND_NONE},
+	[0x24] = {"fload_2", 1, OPERAND_NONE},
+	[0x25] = {"fload_3", 1, OPERAND_NONE},
+	[0x26] = {"dload_0", 1, OPERAND_NONE},
+	[0x27] = {"dload_1", 1, OPERAND_NONE},
+	[0x28] = {"dload_2", 1, OPERAND_NONE},
+	[0x29] = {"dload_3", 1, OPERAND_NONE},
+	[0x2a] = {"aload_0", 1, OPERAND_NONE},
+	[0x2b] = {"aload_1", 1, OPERAND_NONE},
+	[0x2c] = {"aload_2", 1, OPERAND_NONE},
+	[0x2d] = {"aload_3", 1, OPERAND_NONE},
+	[0x2e] = {"iaload", 1, OPERAND_NONE},
+	[0x2f] = {"laload", 1, OPERAND_NONE},
+	[0x30] = {"faload", 1, OPERAND_NONE},
+	[0x31] = {"daload", 1, OPERAND_NONE},
+	[0x32] = {"aaload", 1, OPERAND_NONE},
+	[0x33] = {"baload", 1, OPERAND_NONE},
+	[0x34] = {"caload", 1, OPERAND_NONE},
+	[0x35] = {"saload", 1, OPERAND_NONE},
+	[0x36] = {"istore", 2, OPERAND_LOCAL},
+	[0x37] = {"lstore", 2, OPERAND_LOCAL},
+	[0x38] = {"fstore", 2, OPERAND_LOCAL},
+	[0x39] = {"dstore", 2, OPERAND_LOCAL},
+	[0x3a] = {"astore", 2, OPERAND_LOCAL},
+	[0x3b] = {"istore_0", 1, OPERAND_NONE},
+	[0x3c] = {"istore_1", 1, OPERAND_NONE},
+	[0x3d] = {"istore_2", 1, OPERAND_NONE},
+	[0x3e] = {"istore_3", 1, OPERAND_NONE},
+	[0x3f] = {"lstore_0", 1, OPERAND_NONE},
+	[0x40] = {"lstore_1", 1, OPERAND_NONE},
+	[0x41] = {"lstore_2", 1, OPERAND_NONE},
+	[0x42] = {"lstore_3", 1, OPERAND_NONE},
+	[0x43] = {"fstore_0", 1, OPERAND_NONE},
+	[0x44] = {"fstore_1", 1, OPERAND_NONE},
+	[0x45] = {"fstore_2", 1, OPERAND_NONE},
+	[0x46] = {"fstore_3", 1, OPERAND_NONE},
+	[0x47] = {"dstore_0", 1, OPERAND_NONE},
+	[0x48] = {"dstore_1", 1, OPERAND_NONE},
+	[0x49] = {"dstore_2", 1, OPERAND_NONE},
+	[0x4a] = {"dstore_3", 1, OPERAND_NONE},
+	[0x4b] = {"astore_0", 1, OPERAND_NONE},
+	[0x4c] = {"astore_1", 1, OPERAND_NONE},
+	[0x4d] = {"astore_2", 1, OPERAND_NONE},
+	[0x4e] = {"astore_3", 1, OPERAND_NONE},
+	[0x4f] = {"iastore", 1, OPERAND_NONE},
+	[0x50] = {"lastore", 1, OPERAND_NONE},
+	[0x51] = {"fastore", 1, OPERAND_NONE},
+	[0x52] = {"dastore", 1, OPERAND_NONE},
+	[0x53] = {"aastore", 1, OPERAND_NONE},
+	[0x54] = {"bastore", 1, OPERAND_NONE},
+	[0x55] = {"castore", 1, OPERAND_NONE},
+	[0x56] = {"sastore", 1, OPERAND_NONE},
+	[0x57] = {"pop", 1, OPERAND_NONE},
+	[0x58] = {"pop2", 1, OPERAND_NONE},
+	[0x59] = {"dup", 1, OPERAND_NONE},
+	[0x5a] = {"dup_x1", 1, OPERAND_NONE},
+	[0x5b] = {"dup_x2", 1, OPERAND_NONE},
+	[0x5c] = {"dup2", 1, OPERAND_NONE},
+	[0x5d] = {"dup2_x1", 1, OPERAND_NONE},
+	[0x5e] = {"dup2_x2", 1, OPERAND_NONE},
+	[0x5f] = {"swap", 1, OPERAND_NONE},
+	[0x60] = {"iadd", 1, OPERAND_NONE},
+	[0x61] = {"ladd", 1, OPERAND_NONE},
+	[0x62] = {"fadd", 1, OPERAND_NONE},
+	[0x63] = {"dadd", 1, OPERAND_NONE},
+	[0x64] = {"isub", 1, OPERAND_NONE},
+	[0x65] = {"lsub", 1, OPERAND_NONE},
+	[0x66] = {"fsub", 1, OPERAND_NONE},
+	[0x67] = {"dsub", 1, OPERAND_NONE},
+	[0x68] = {"imul", 1, OPERAND_NONE},
+	[0x69] = {"lmul", 1, OPERAND_NONE},
+	[0x6a] = {"fmul", 1, OPERAND_NONE},
+	[0x6b] = {"dmul", 1, OPERAND_NONE},
+	[0x6c] = {"idiv", 1, OPERAND_NONE},
+	[0x6d] = {"ldiv", 1, OPERAND_NONE},
+	[0x6e] = {"fdiv", 1, OPERAND_NONE},
+	[0x6f] = {"ddiv", 1, OPERAND_NONE},
+	[0x70] = {"irem", 1, OPERAND_NONE},
+	[0x71] = {"lrem", 1, OPERAND_NONE},
+	[0x72] = {"frem", 1, OPERAND_NONE},
+	[0x73] = {"drem", 1, OPERAND_NONE},
+	[0x74] = {"ineg", 1, OPERAND_NONE},
+	[0x75] = {"lneg", 1, OPERAND_NONE},
+	[0x76] = {"fneg", 1, OPERAND_NONE},
+	[0x77] = {"dneg", 1, OPERAND_NONE},
+	[0x78] = {"ishl", 1, OPERAND_NONE},
+	[0x79] = {"lshl", 1, OPERAND_NONE},
+	[0x7a] = {"ishr", 1, OPERAND_NONE},
+	[0x7b] = {"lshr", 1, OPERAND_NONE},
+	[0x7c] = {"iushr", 1, OPERAND_NONE},
+	[0x7d] = {"lushr", 1, OPERAND_NONE},
+	[0x7e] = {"iand", 1, OPERAND_NONE},
+	[0x7f] = {"land", 1, OPERAND_NONE},
+	[0x80] = {"ior", 1, OPERAND_NONE},
+	[0x81] = {"lor", 1, OPERAND_NONE},
+	[0x82] = {"ixor", 1, OPERAND_NONE},
+	[0x83] = {"lxor", 1, OPERAND_NONE},
+	[0x84] = {"iinc", 3, OPERAND_IINC},
+	[0x85] = {"i2l", 1, OPERAND_NONE},
+	[0x86] = {"i2f", 1, OPERAND_NONE},
+	[0x87] = {"i2d", 1, OPERAND_NONE},
+	[0x88] = {"l2i", 1, OPERAND_NONE},
+	[0x89] = {"l2f", 1, OPERAND_NONE},
+	[0x8a] = {"l2d", 1, OPERAND_NONE},
+	[0x8b] = {"f2i", 1, OPERAND_NONE},
+	[0x8c] = {"f2l", 1, OPERAND_NONE},
+	[0x8d] = {"f2d", 1, OPERAND_NONE},
+	[0x8e] = {"d2i", 1, OPERAND_NONE},
+	[0x8f] = {"d2l", 1, OPERAND_NONE},
+	[0x90] = {"d2f", 1, OPERAND_NONE},
+	[0x91] = {"i2b", 1, OPERAND_NONE},
+	[0x92] = {"i2c", 1, OPERAND_NONE},
+	[0x93] = {"i2s", 1, OPERAND_NONE},
+	[0x94] = {"lcmp", 1, OPERAND_NONE},
+	[0x95] = {"fcmpl", 1, OPERAND_NONE},
+	[0x96] = {"fcmpg", 1, OPERAND_NONE},
+	[0x97] = {"dcmpl", 1, OPERAND_NONE},
+	[0x98] = {"dcmpg", 1, OPERAND_NONE},
+	[0x99] = {"ifeq", 3, OPERAND_BRANCH},
+	[0x9a] = {"ifne", 3, OPERAND_BRANCH},
+	[0x9b] = {"iflt", 3, OPERAND_BRANCH},
+	[0x9c] = {"ifge", 3, OPERAND_BRANCH},
+	[0x9d] = {"ifgt", 3, OPERAND_BRANCH},
+	[0x9e] = {"ifle", 3, OPERAND_BRANCH},
+	[0x9f] = {"if_icmpeq", 3, OPERAND_BRANCH},
+	[0xa0] = {"if_icmpne", 3, OPERAND_BRANCH},
+	[0xa1] = {"if_icmplt", 3, OPERAND_BRANCH},
+	[0xa2] = {"if_icmpge", 3, OPERAND_BRANCH},
+	[0xa3] = {"if_icmpgt", 3, OPERAND_BRANCH},
+	[0xa4] = {"if_icmple", 3, OPERAND_BRANCH},
+	[0xa5] = {"if_acmpeq", 3, OPERAND_BRANCH},
+	[0xa6] = {"if_acmpne", 3, OPERAND_BRANCH},
+	[0xa7] = {"goto", 3, OPERAND_BRANCH},
+	[0xa8] = {"jsr", 3, OPERAND_BRANCH},
+	[0xa9] = {"ret", 2, OPERAND_LOCAL},
+	[0xaa] = {"tableswitch", 0, OPERAND_TABLESWITCH},
+	[0xab] = {"lookupswitch", 0, OPERAND_LOOKUPSWITCH},
+	[0xac] = {"ireturn", 1, OPERAND_NONE},
+	[0xad] = {"lreturn", 1, OPERAND_NONE},
+	[0xae] = {"freturn", 1, OPERAND_NONE},
+	[0xaf] = {"dreturn", 1, OPERAND_NONE},
+	[0xb0] = {"areturn", 1, OPERAND_NONE},
+	[0xb1] = {"return", 1, OPERAND_NONE},
+	[0xb2] = {"getstatic", 3, OPERAND_CONSTANT},
+	[0xb3] = {"putstatic", 3, OPERAND_CONSTANT},
+	[0xb4] = {"getfield", 3, OPERAND_CONSTANT},
+	[0xb5] = {"putfield", 3, OPERAND_CONSTANT},
+	[0xb6] = {"invokevirtual", 3, OPERAND_CONSTANT},
+	[0xb7] = {"invokespecial", 3, OPERAND_CONSTANT},
+	[0xb8] = {"invokestatic", 3, OPERAND_CONSTANT},
+	[0xb9] = {"invokeinterface", 5, OPERAND_INVOKEINTERFACE},
+	[0xba] = {"invokedynamic", 5, OPERAND_CONSTANT},
+	[0xbb] = {"new", 3, OPERAND_CONSTANT},
+	[0xbc] = {"newarray", 2, OPERAND_NEWARRAY},
+	[0xbd] = {"anewarray", 3, OPERAND_CONSTANT},
+	[0xbe] = {"arraylength", 1, OPERAND_NONE},
+	[0xbf] = {"athrow", 1, OPERAND_NONE},
+	[0xc0] = {"checkcast", 3, OPERAND_CONSTANT},
+	[0xc1] = {"instanceof", 3, OPERAND_CONSTANT},
+	[0xc2] = {"monitorenter", 1, OPERAND_NONE},
+	[0xc3] = {"monitorexit", 1, OPERAND_NONE},
+	[0xc4] = {"wide", 0, OPERAND_WIDE},
+	[0xc5] = {"multianewarray", 4, OPERAND_MULTIANEWARRAY},
+	[0xc6] = {"ifnull", 3, OPERAND_BRANCH},
+	[0xc7] = {"ifnonnull", 3, OPERAND_BRANCH},
+	[0xc8] = {"goto_w", 5, OPERAND_BRANCH_WIDE},
+	[0xc9] = {"jsr_w", 5, OPERAND_BRANCH_WIDE},
+};
+
+bool decode_code(const uint8_t *image, uint32_t offset, uint32_t length, Code *code) {
+	Cursor cursor = {image, (size_t) offset + length, offset, false};
+	code->max_stack = read_u2(&cursor);
+	code->max_locals = read_u2(&cursor);
+	code->code_length = read_u4(&cursor);
+	code->code = read_bytes(&cursor, code->code_length);
+	code->exception_table_length = read_u2(&cursor);
+	code->exception_table = read_bytes(&cursor, (size_t) code->exception_table_length * 8);
+	code->attributes_count = read_u2(&cursor);
+	code->attributes = cursor;
+	return !cursor.overflow;
+}
+
+bool read_code(const Class *class, const Attribute *attr, Code *code) {
+	return decode_code(class->image, attr->offset, attr->length, code);
+}
+
+ExceptionHandler get_exception_handler(const Code *code, uint16_t index) {
+	const uint8_t *p = code->exception_table + (size_t) index * 8;
+	ExceptionHandler handler = {
+		(uint16_t) (p[0] << 8 | p[1]),
+		(uint16_t) (p[2] << 8 | p[3]),
+		(uint16_t) (p[4] << 8 | p[5]),
+		(uint16_t) (p[6] << 8 | p[7])
+	};
+	return handler;
+}
+
+InstructionIterator instruction_iterator(const Code *code) {
+	InstructionIterator it = {code->code, code->code_length, 0, false};
+	return it;
+}
+
+/* Work out the length of the switch at pc, whose padding and fixed header are known to fit in remaining bytes.
+ * Returns 0 if its table doesn't. */
+static uint64_t switch_length(const uint8_t *table, uint32_t header, uint8_t opcode, uint32_t remaining) {
+	uint64_t entries;
+	if (opcode == OP_TABLESWITCH) {
+		int32_t low = read_s4(table + 4), high = read_s4(table + 8);
+		if (high < low) return 0;
+		entries = ((uint64_t) ((int64_t) high - low) + 1) * 4;
+	} else {
+		int32_t npairs = read_s4(table + 4);
+		if (npairs < 0) return 0;
+		entries = (uint64_t) npairs * 8;
+	}
+	return entries <= remaining - header ? header + entries : 0;
+}
+
+bool next_instruction(InstructionIterator *it, Instruction *instruction) {
+	if (it->pc >= it->length || it->malformed) return false;
+	const uint32_t pc = it->pc;
+	const uint32_t remaining = it->length - pc;
+	const uint8_t *p = it->code + pc;
+	const OpcodeInfo *info = OPCODES + p[0];
+	uint64_t length = info->length;
+
+	instruction->pc = pc;
+	instruction->opcode = p[0];
+	instruction->wide = false;
+	instruction->operands = p + 1;
+
+	switch (info->operands) {
+		case OPERAND_WIDE:
+			if (remaining < 2) break;
+			instruction->opcode = p[1];
+			instruction->wide = true;
+			instruction->operands = p + 2;
+			// Only loads, stores, ret and iinc can be widened
+			if (OPCODES[p[1]].operands == OPERAND_LOCAL) {
+				length = 4;
+			} else if (OPCODES[p[1]].operands == OPERAND_IINC) {
+				length = 6;
+			}
+			break;
+		case OPERAND_TABLESWITCH:
+		case OPERAND_LOOKUPSWITCH: {
+			// The table starts on the next multiple of 4 from the start of the code
+			const uint32_t header = 1 + (3 - pc % 4) + (info->operands == OPERAND_TABLESWITCH ? 12 : 8);
+			if (header > remaining) break;
+			instruction->operands = p + 1 + (3 - pc % 4);
+			length = switch_length(instruction->operands, header, p[0], remaining);
+			break;
+		}
+		default:
+			break;
+	}
+
+	if (info->mnemonic == NULL || length == 0 || length > remaining) {
+		it->malformed = true;
+		return false;
+	}
+	instruction->length = length;
+	it->pc += length;
+	return true;
+}
+
+bool visit_instructions(const Code *code, InstructionVisitor visit, void *context) {
+	InstructionIterator it = instruction_iterator(code);
+	Instruction instruction;
+	while (next_instruction(&it, &instruction)) {
+		if (!visit(&instruction, context)) return true;
+	}
+	return !it.malformed;
+}
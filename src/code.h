@@ -0,0 +1,201 @@
+#ifndef CODE_H
+#define CODE_H
+#include "class.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Opcodes the decoder and its callers single out; see chapter 6 of the JVM spec for the rest */
+typedef enum {
+	OP_NOP             = 0x00,
+	OP_BIPUSH          = 0x10,
+	OP_SIPUSH          = 0x11,
+	OP_LDC             = 0x12,
+	OP_ALOAD_0         = 0x2a,
+	OP_IINC            = 0x84,
+	OP_TABLESWITCH     = 0xaa,
+	OP_LOOKUPSWITCH    = 0xab,
+	OP_RETURN          = 0xb1,
+	OP_GETSTATIC       = 0xb2,
+	OP_PUTSTATIC       = 0xb3,
+	OP_GETFIELD        = 0xb4,
+	OP_PUTFIELD        = 0xb5,
+	OP_INVOKEVIRTUAL   = 0xb6,
+	OP_INVOKESPECIAL   = 0xb7,
+	OP_INVOKESTATIC    = 0xb8,
+	OP_INVOKEINTERFACE = 0xb9,
+	OP_INVOKEDYNAMIC   = 0xba,
+	OP_NEW             = 0xbb,
+	OP_NEWARRAY        = 0xbc,
+	OP_WIDE            = 0xc4,
+	OP_MULTIANEWARRAY  = 0xc5
+} Opcode;
+
+/* How an instruction's operand bytes are laid out */
+typedef enum {
+	OPERAND_NONE,
+	OPERAND_BYTE,            /* bipush: s1 */
+	OPERAND_SHORT,           /* sipush: s2 */
+	OPERAND_CONSTANT,        /* u1 (ldc) or u2 constant pool index; invokedynamic adds two zero bytes */
+	OPERAND_LOCAL,           /* u1 local variable index, u2 after wide */
+	OPERAND_IINC,            /* u1 local, s1 increment; u2 and s2 after wide */
+	OPERAND_BRANCH,          /* s2 offset from the instruction */
+	OPERAND_BRANCH_WIDE,     /* s4 offset from the instruction */
+	OPERAND_INVOKEINTERFACE, /* u2 constant pool index, u1 count, u1 zero */
+	OPERAND_NEWARRAY,        /* u1 array type */
+	OPERAND_MULTIANEWARRAY,  /* u2 constant pool index, u1 dimensions */
+	OPERAND_TABLESWITCH,     /* padding to 4 bytes, then s4 default, low, high and high - low + 1 s4 offsets */
+	OPERAND_LOOKUPSWITCH,    /* padding to 4 bytes, then s4 default, npairs and npairs (s4 match, s4 offset) pairs */
+	OPERAND_WIDE             /* prefixes a LOCAL or IINC instruction, widening its operands */
+} OperandKind;
+
+/* One row of the opcode table. length counts the opcode byte; 0 means it depends on the operands. */
+typedef struct {
+	const char *mnemonic; /* NULL for opcodes that can't appear in a class file */
+	uint8_t length;
+	uint8_t operands;     /* an OperandKind */
+} OpcodeInfo;
+
+extern const OpcodeInfo OPCODES[256];
+
+/* A Code attribute split into its parts; see section 4.7.3 of the JVM spec. Nothing is copied: code and exception_table point
+ * into the class image. */
+typedef struct {
+	uint16_t max_stack;
+	uint16_t max_locals;
+	uint32_t code_length;
+	const uint8_t *code;
+	uint16_t exception_table_length;
+	const uint8_t *exception_table; /* 8 bytes per entry; see get_exception_handler */
+	uint16_t attributes_count;
+	Cursor attributes; /* Positioned on the nested attribute table; parse_attribute on a copy yields image offsets */
+} Code;
+
+typedef struct {
+	uint16_t start_pc;
+	uint16_t end_pc;
+	uint16_t handler_pc;
+	uint16_t catch_type; /* 0 catches everything, as for finally */
+} ExceptionHandler;
+
+/* One decoded instruction. For a wide instruction opcode is the widened one and length includes the prefix. */
+typedef struct {
+	uint32_t pc;
+	uint32_t length;
+	uint8_t opcode;
+	bool wide;
+	const uint8_t *operands; /* Just past the opcode, and past the padding of a switch */
+} Instruction;
+
+/* Walks a Code attribute's instructions without allocating */
+typedef struct {
+	const uint8_t *code;
+	uint32_t length;
+	uint32_t pc;
+	bool malformed; /* Set when an instruction is unknown or runs past the end of the code */
+} InstructionIterator;
+
+/* The jump table of a tableswitch or lookupswitch */
+typedef struct {
+	uint32_t pc;
+	int32_t default_offset;
+	int32_t low;            /* The match of the first tableswitch case */
+	uint32_t count;
+	bool lookup;
+	const uint8_t *entries;
+} Switch;
+
+/* Called once per instruction by visit_instructions. Return false to stop early. */
+typedef bool (*InstructionVisitor)(const Instruction *instruction, void *context);
+
+/* Split the Code attribute attr of class into code. Returns false if attr is too short for what it claims to hold. */
+bool read_code(const Class *class, const Attribute *attr, Code *code);
+
+/* Split the length byte Code attribute body at image + offset into code */
+bool decode_code(const uint8_t *image, uint32_t offset, uint32_t length, Code *code);
+
+
+/* Return entry index of code's exception table */
+ExceptionHandler get_exception_handler(const Code *code, uint16_t index);
+
+/* Return an iterator positioned before the first instruction of code */
+InstructionIterator instruction_iterator(const Code *code);
+
+/* Decode the next instruction into instruction. Returns false at the end of the code or, setting it->malformed, on bad bytecode. */
+bool next_instruction(InstructionIterator *it, Instruction *instruction);
+
+/* Call visit for each instruction in code. Returns false if the code is malformed; stopping early isn't an error. */
+bool visit_instructions(const Code *code, InstructionVisitor visit, void *context);
+
+/* Return opcode's mnemonic, or NULL if it isn't a valid opcode */
+static inline const char *opcode_name(uint8_t opcode) {
+	return OPCODES[opcode].mnemonic;
+}
+
+static inline int32_t read_s4(const uint8_t *p) {
+	return (int32_t) ((uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3]);
+}
+
+/* Return the constant pool or local variable index of an instruction with a CONSTANT, LOCAL, IINC, INVOKEINTERFACE or
+ * MULTIANEWARRAY operand */
+static inline uint16_t instruction_index(const Instruction *instruction) {
+	const uint8_t *p = instruction->operands;
+	const uint8_t kind = OPCODES[instruction->opcode].operands;
+	if (!instruction->wide && (kind == OPERAND_LOCAL || kind == OPERAND_IINC || instruction->opcode == OP_LDC)) {
+		return p[0];
+	}
+	return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+/* Return the immediate value of bipush, sipush, iinc (the increment), newarray (the type), invokeinterface (the count) and
+ * multianewarray (the dimensions) */
+static inline int32_t instruction_value(const Instruction *instruction) {
+	const uint8_t *p = instruction->operands;
+	switch (OPCODES[instruction->opcode].operands) {
+		case OPERAND_BYTE: return (int8_t) p[0];
+		case OPERAND_SHORT: return (int16_t) (p[0] << 8 | p[1]);
+		case OPERAND_IINC: return instruction->wide ? (int16_t) (p[2] << 8 | p[3]) : (int8_t) p[1];
+		case OPERAND_NEWARRAY: return p[0];
+		case OPERAND_INVOKEINTERFACE:
+		case OPERAND_MULTIANEWARRAY: return p[2];
+		default: return 0;
+	}
+}
+
+/* Return the pc a BRANCH or BRANCH_WIDE instruction jumps to */
+static inline uint32_t instruction_target(const Instruction *instruction) {
+	const uint8_t *p = instruction->operands;
+	int32_t offset = OPCODES[instruction->opcode].operands == OPERAND_BRANCH ? (int16_t) (p[0] << 8 | p[1]) : read_s4(p);
+	return instruction->pc + offset;
+}
+
+/* Return the jump table of a tableswitch or lookupswitch instruction, which next_instruction has already bounds-checked */
+static inline Switch instruction_switch(const Instruction *instruction) {
+	const uint8_t *p = instruction->operands;
+	Switch table;
+	table.pc = instruction->pc;
+	table.default_offset = read_s4(p);
+	table.lookup = instruction->opcode == OP_LOOKUPSWITCH;
+	if (table.lookup) {
+		table.low = 0;
+		table.count = read_s4(p + 4);
+		table.entries = p + 8;
+	} else {
+		table.low = read_s4(p + 4);
+		table.count = (uint32_t) read_s4(p + 8) - (uint32_t) table.low + 1;
+		table.entries = p + 12;
+	}
+	return table;
+}
+
+/* Store the match and jump target of case index of table */
+static inline void switch_case(const Switch *table, uint32_t index, int32_t *match, uint32_t *target) {
+	if (table->lookup) {
+		*match = read_s4(table->entries + index * 8);
+		*target = table->pc + read_s4(table->entries + index * 8 + 4);
+	} else {
+		*match = (int32_t) ((uint32_t) table->low + index);
+		*target = table->pc + read_s4(table->entries + index * 4);
+	}
+}
+
+#endif //CODE_H
@@ -0,0 +1,459 @@
+#include "code.h"
+#include "delta.h"
+#include "descriptor.h"
+#include "mutf8.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	/* Longest chain of references worth following from one constant, e.g. InvokeDynamic -> MethodHandle -> Methodref ->
+	 * NameAndType -> Utf8 */
+	MAX_CONSTANT_DEPTH = 6,
+
+	/* Deepest nesting of annotation values hashed by structure; anything deeper is hashed as raw bytes */
+	MAX_ANNOTATION_DEPTH = 32
+};
+
+static CacheKey hash_constant(const Class *class, uint16_t cp_idx, CacheKey key, int depth);
+
+/* Hash bootstrap method number of class by the method handle it calls and its static arguments */
+static CacheKey hash_bootstrap(const Class *class, uint16_t number, CacheKey key, int depth) {
+	const Attribute *attr = find_attribute(class->attributes, class->attributes_count, ATTR_BOOTSTRAP_METHODS);
+	Cursor cursor = {attr != NULL ? get_attribute_info(class, attr) : NULL, attr != NULL ? attr->length : 0, 0, false};
+	const uint16_t count = read_u2(&cursor);
+	if (number >= count) return hash_bytes(&number, sizeof(number), key);
+	uint16_t i;
+	for (i = 0; i < number && !cursor.overflow; i++) {
+		read_u2(&cursor);
+		read_bytes(&cursor, 2 * (size_t) read_u2(&cursor));
+	}
+	key = hash_constant(class, read_u2(&cursor), key, depth);
+	const uint16_t arguments = read_u2(&cursor);
+	for (i = 0; i < arguments && !cursor.overflow; i++) {
+		key = hash_constant(class, read_u2(&cursor), key, depth);
+	}
+	return key;
+}
+
+/* Hash what the constant at cp_idx means rather than where it sits in the pool */
+static CacheKey hash_constant(const Class *class, uint16_t cp_idx, CacheKey key, int depth) {
+	const Item item = get_item(class, cp_idx);
+	key = hash_bytes(&item.tag, sizeof(item.tag), key);
+	if (item.tag == 0 || depth == 0) return key;
+
+	switch (item.tag) {
+		case STRING_UTF8:
+			return hash_bytes(item.value.string.value, item.value.string.length, key);
+		case INTEGER:
+		case FLOAT:
+			return hash_bytes(&item.value.integer, sizeof(item.value.integer), key);
+		case LONG:
+		case DOUBLE:
+			return hash_bytes(&item.value.lng, sizeof(item.value.lng), key);
+		case CLASS:
+		case STRING:
+		case METHOD_TYPE:
+		case MODULE:
+		case PACKAGE:
+			return hash_constant(class, item.value.ref.class_idx, key, depth - 1);
+		case METHOD_HANDLE:
+			// The first half is a reference kind, not a pool index
+			key = hash_bytes(&item.value.ref.class_idx, sizeof(item.value.ref.class_idx), key);
+			return hash_constant(class, item.value.ref.name_idx, key, depth - 1);
+		case DYNAMIC:
+		case INVOKE_DYNAMIC:
+			// Bootstrap methods are followed only from the top, as their arguments may be dynamic constants in turn
+			if (depth == MAX_CONSTANT_DEPTH) {
+				key = hash_bootstrap(class, item.value.ref.class_idx, key, depth - 1);
+			} else {
+				key = hash_bytes(&item.value.ref.class_idx, sizeof(item.value.ref.class_idx), key);
+			}
+			return hash_constant(class, item.value.ref.name_idx, key, depth - 1);
+		default:
+			key = hash_constant(class, item.value.ref.class_idx, key, depth - 1);
+			return hash_constant(class, item.value.ref.name_idx, key, depth - 1);
+	}
+}
+
+/* Hash the u2 pool index at cursor, by what it refers to */
+static CacheKey hash_index(const Class *class, Cursor *cursor, CacheKey key) {
+	return hash_constant(class, read_u2(cursor), key, MAX_CONSTANT_DEPTH);
+}
+
+/* Hash a Code attribute's limits, instructions and exception handlers. Its nested attributes are all debugging tables or stack
+ * maps, which follow from the instructions, so they are left out. */
+static CacheKey hash_code(const Class *class, const Attribute *attr, CacheKey key) {
+	Code code;
+	if (!read_code(class, attr, &code)) return hash_bytes(get_attribute_info(class, attr), attr->length, key);
+	const uint16_t limits[2] = {code.max_stack, code.max_locals};
+	key = hash_bytes(limits, sizeof(limits), key);
+
+	InstructionIterator it = instruction_iterator(&code);
+	Instruction ins;
+	while (next_instruction(&it, &ins)) {
+		key = hash_bytes(&ins.opcode, sizeof(ins.opcode), key);
+		const uint8_t *rest = ins.operands;
+		const uint8_t *end = code.code + ins.pc + ins.length;
+		const uint8_t kind = OPCODES[ins.opcode].operands;
+		if (kind == OPERAND_CONSTANT || kind == OPERAND_INVOKEINTERFACE || kind == OPERAND_MULTIANEWARRAY) {
+			key = hash_constant(class, instruction_index(&ins), key, MAX_CONSTANT_DEPTH);
+			rest += ins.opcode == OP_LDC ? 1 : 2;
+		}
+		key = hash_bytes(rest, end - rest, key);
+	}
+	if (it.malformed) key = hash_bytes(code.code, code.code_length, key);
+
+	uint16_t i;
+	for (i = 0; i < code.exception_table_length; i++) {
+		const ExceptionHandler handler = get_exception_handler(&code, i);
+		const uint16_t pcs[3] = {handler.start_pc, handler.end_pc, handler.handler_pc};
+		key = hash_bytes(pcs, sizeof(pcs), key);
+		key = hash_constant(class, handler.catch_type, key, MAX_CONSTANT_DEPTH);
+	}
+	return key;
+}
+
+static CacheKey hash_annotation(const Class *class, Cursor *cursor, CacheKey key, int depth);
+
+/* Hash an annotation element_value; see section 4.7.16.1 of the JVM spec. Unknown tags and deep nesting set overflow. */
+static CacheKey hash_element_value(const Class *class, Cursor *cursor, CacheKey key, int depth) {
+	const uint8_t tag = read_u1(cursor);
+	key = hash_bytes(&tag, sizeof(tag), key);
+	uint16_t count, i;
+	switch (tag) {
+		case 'B': case 'C': case 'D': case 'F': case 'I': case 'J': case 'S': case 'Z': case 's': case 'c':
+			return hash_index(class, cursor, key);
+		case 'e':
+			key = hash_index(class, cursor, key);
+			return hash_index(class, cursor, key);
+		case '@':
+			if (depth == 0) break;
+			return hash_annotation(class, cursor, key, depth - 1);
+		case '[':
+			if (depth == 0) break;
+			count = read_u2(cursor);
+			for (i = 0; i < count && !cursor->overflow; i++) {
+				key = hash_element_value(class, cursor, key, depth - 1);
+			}
+			return key;
+	}
+	cursor->overflow = true;
+	return key;
+}
+
+static CacheKey hash_annotation(const Class *class, Cursor *cursor, CacheKey key, int depth) {
+	key = hash_index(class, cursor, key);
+	const uint16_t pairs = read_u2(cursor);
+	uint16_t i;
+	for (i = 0; i < pairs && !cursor->overflow; i++) {
+		key = hash_index(class, cursor, key);
+		key = hash_element_value(class, cursor, key, depth);
+	}
+	return key;
+}
+
+/* Hash the body of attr with every pool index in it resolved, for the kinds whose layout is known; the rest are hashed as raw
+ * bytes, as is a body that doesn't decode exactly */
+static CacheKey hash_attribute(const Class *class, const Attribute *attr, CacheKey key) {
+	const uint8_t *info = get_attribute_info(class, attr);
+	Cursor cursor = {info, attr->length, 0, false};
+	CacheKey hashed = key;
+	uint16_t tables = 1, count, i, j;
+	switch (attr->kind) {
+		case ATTR_CODE:
+			return hash_code(class, attr, key);
+		case ATTR_CONSTANT_VALUE:
+		case ATTR_SIGNATURE:
+		case ATTR_SOURCE_FILE:
+		case ATTR_NEST_HOST:
+		case ATTR_MODULE_MAIN_CLASS:
+		case ATTR_ENCLOSING_METHOD:
+			// One index, or two for EnclosingMethod
+			while (cursor.offset < cursor.length && !cursor.overflow) {
+				hashed = hash_index(class, &cursor, hashed);
+			}
+			break;
+		case ATTR_EXCEPTIONS:
+		case ATTR_NEST_MEMBERS:
+		case ATTR_PERMITTED_SUBCLASSES:
+		case ATTR_MODULE_PACKAGES:
+			count = read_u2(&cursor);
+			for (i = 0; i < count && !cursor.overflow; i++) {
+				hashed = hash_index(class, &cursor, hashed);
+			}
+			break;
+		case ATTR_INNER_CLASSES:
+			count = read_u2(&cursor);
+			for (i = 0; i < count && !cursor.overflow; i++) {
+				hashed = hash_index(class, &cursor, hashed);
+				hashed = hash_index(class, &cursor, hashed);
+				hashed = hash_index(class, &cursor, hashed);
+				const uint16_t flags = read_u2(&cursor);
+				hashed = hash_bytes(&flags, sizeof(flags), hashed);
+			}
+			break;
+		case ATTR_ANNOTATION_DEFAULT:
+			hashed = hash_element_value(class, &cursor, hashed, MAX_ANNOTATION_DEPTH);
+			break;
+		case ATTR_RUNTIME_VISIBLE_PARAMETER_ANNOTATIONS:
+		case ATTR_RUNTIME_INVISIBLE_PARAMETER_ANNOTATIONS:
+			tables = read_u1(&cursor);
+			// fall through
+		case ATTR_RUNTIME_VISIBLE_ANNOTATIONS:
+		case ATTR_RUNTIME_INVISIBLE_ANNOTATIONS:
+			for (i = 0; i < tables && !cursor.overflow; i++) {
+				count = read_u2(&cursor);
+				for (j = 0; j < count && !cursor.overflow; j++) {
+					hashed = hash_annotation(class, &cursor, hashed, MAX_ANNOTATION_DEPTH);
+				}
+			}
+			break;
+		default:
+			return hash_bytes(info, attr->length, key);
+	}
+	return cursor.overflow || cursor.offset != cursor.length ? hash_bytes(info, attr->length, key) : hashed;
+}
+
+/* Return true for attributes that only describe the code for debuggers and the verifier */
+static bool is_debugging(const Attribute *attr) {
+	return attr->kind == ATTR_LINE_NUMBER_TABLE || attr->kind == ATTR_LOCAL_VARIABLE_TABLE
+			|| attr->kind == ATTR_LOCAL_VARIABLE_TYPE_TABLE || attr->kind == ATTR_STACK_MAP_TABLE;
+}
+
+/* Hash a field's or method's attributes, each tagged with its kind, or its name if the spec doesn't define it */
+static CacheKey hash_attributes(const Class *class, const Attribute *attrs, uint16_t attrs_count, CacheKey key) {
+	uint16_t i;
+	for (i = 0; i < attrs_count; i++) {
+		const Attribute *attr = attrs + i;
+		if (is_debugging(attr)) continue;
+		if (attr->kind == ATTR_UNKNOWN) {
+			key = hash_constant(class, attr->name_idx, key, MAX_CONSTANT_DEPTH);
+		} else {
+			key = hash_bytes(&attr->kind, sizeof(attr->kind), key);
+		}
+		key = hash_attribute(class, attr, key);
+	}
+	return key;
+}
+
+static int compare_strings(const String a, const String b) {
+	int order = memcmp(a.value, b.value, a.length < b.length ? a.length : b.length);
+	return order != 0 ? order : (int) a.length - (int) b.length;
+}
+
+/* Order members as they are listed: fields, methods then attributes, each by name and descriptor */
+static int compare_members(const MemberPrint *a, const MemberPrint *b) {
+	if (a->kind != b->kind) return a->kind < b->kind ? -1 : 1;
+	int order = compare_strings(a->name, b->name);
+	return order != 0 ? order : compare_strings(a->descriptor, b->descriptor);
+}
+
+/* Order members by identity, falling back to the strings only when the hashes are equal */
+static int compare_identities(const void *a, const void *b) {
+	const MemberPrint *x = a, *y = b;
+	if (x->identity != y->identity) return x->identity < y->identity ? -1 : 1;
+	return compare_members(x, y);
+}
+
+static uint64_t member_identity(MemberKind kind, const String name, const String descriptor) {
+	// Seeding with the name's length keeps "ab" + "c" apart from "a" + "bc"
+	CacheKey key = {kind, name.length};
+	key = hash_bytes(name.value, name.length, key);
+	return hash_bytes(descriptor.value, descriptor.length, key).high;
+}
+
+static const String MISSING = {0, ""};
+
+/* Fields and Methods share a layout */
+static void fingerprint_member(MemberPrint *print, const Class *class, const Field *member, MemberKind kind) {
+	const String *name = get_utf8(class, member->name_idx);
+	const String *descriptor = get_utf8(class, member->desc_idx);
+	print->kind = kind;
+	print->flags = member->flags;
+	print->name = name != NULL ? *name : MISSING;
+	print->descriptor = descriptor != NULL ? *descriptor : MISSING;
+	print->identity = member_identity(kind, print->name, print->descriptor);
+	CacheKey key = {kind, member->flags};
+	print->fingerprint = hash_attributes(class, member->attrs, member->attrs_count, key);
+}
+
+void fingerprint_class(ClassPrint *print, const Class *class) {
+	const String *name = get_class_name(class, class->this_class);
+	print->name = name != NULL ? *name : MISSING;
+
+	CacheKey key = {class->flags, 0};
+	key = hash_constant(class, class->this_class, key, MAX_CONSTANT_DEPTH);
+	key = hash_constant(class, class->super_class, key, MAX_CONSTANT_DEPTH);
+	uint16_t i;
+	for (i = 0; i < class->interfaces_count; i++) {
+		key = hash_constant(class, class->interfaces[i].class_idx, key, MAX_CONSTANT_DEPTH);
+	}
+	const Attribute *signature = find_attribute(class->attributes, class->attributes_count, ATTR_SIGNATURE);
+	if (signature != NULL) key = hash_attribute(class, signature, key);
+	print->header = key;
+
+	print->members = malloc(((size_t) class->fields_count + class->methods_count + class->attributes_count + 1) * sizeof(MemberPrint));
+	MemberPrint *member = print->members;
+	for (i = 0; i < class->fields_count; i++) {
+		fingerprint_member(member++, class, class->fields + i, MEMBER_FIELD);
+	}
+	for (i = 0; i < class->methods_count; i++) {
+		fingerprint_member(member++, class, (const Field *) (class->methods + i), MEMBER_METHOD);
+	}
+	for (i = 0; i < class->attributes_count; i++) {
+		const Attribute *attr = class->attributes + i;
+		// The signature is part of the header, and bootstrap methods are hashed where the code uses them
+		if (attr->kind == ATTR_SIGNATURE || attr->kind == ATTR_BOOTSTRAP_METHODS || is_debugging(attr)) continue;
+		const String *attr_name = get_utf8(class, attr->name_idx);
+		member->kind = MEMBER_ATTRIBUTE;
+		member->flags = 0;
+		member->name = attr_name != NULL ? *attr_name : MISSING;
+		member->descriptor = MISSING;
+		member->identity = member_identity(MEMBER_ATTRIBUTE, member->name, member->descriptor);
+		CacheKey attr_key = {MEMBER_ATTRIBUTE, 0};
+		member->fingerprint = hash_attribute(class, attr, attr_key);
+		member++;
+	}
+	print->members_count = member - print->members;
+	qsort(print->members, print->members_count, sizeof(MemberPrint), compare_identities);
+}
+
+void free_class_print(ClassPrint *print) {
+	free(print->members);
+	print->members = NULL;
+	print->members_count = 0;
+}
+
+static void add_change(ClassDelta *delta, ChangeKind kind, const MemberPrint *member) {
+	delta->changes[delta->changes_count].kind = kind;
+	delta->changes[delta->changes_count++].member = member;
+}
+
+static int compare_changes(const void *a, const void *b) {
+	return compare_members(((const MemberChange *) a)->member, ((const MemberChange *) b)->member);
+}
+
+void diff_classes(ClassDelta *delta, const ClassPrint *before, const ClassPrint *after) {
+	const uint32_t before_count = before != NULL ? before->members_count : 0;
+	const uint32_t after_count = after != NULL ? after->members_count : 0;
+	delta->header_changed = before != NULL && after != NULL
+			&& (before->header.high != after->header.high || before->header.low != after->header.low);
+	delta->changes = malloc(((size_t) before_count + after_count + 1) * sizeof(MemberChange));
+	delta->changes_count = 0;
+
+	// Both sides are sorted by identity, so one merge pass pairs up the members they share
+	uint32_t b = 0, a = 0;
+	while (b < before_count || a < after_count) {
+		int order = b == before_count ? 1 : a == after_count ? -1 : compare_identities(before->members + b, after->members + a);
+		if (order < 0) {
+			add_change(delta, MEMBER_REMOVED, before->members + b++);
+		} else if (order > 0) {
+			add_change(delta, MEMBER_ADDED, after->members + a++);
+		} else {
+			const MemberPrint *old = before->members + b++, *new = after->members + a++;
+			if (old->flags != new->flags || old->fingerprint.high != new->fingerprint.high
+					|| old->fingerprint.low != new->fingerprint.low) {
+				add_change(delta, MEMBER_CHANGED, new);
+			}
+		}
+	}
+	// Hash order means nothing to a reader
+	qsort(delta->changes, delta->changes_count, sizeof(MemberChange), compare_changes);
+}
+
+void free_class_delta(ClassDelta *delta) {
+	free(delta->changes);
+	delta->changes = NULL;
+	delta->changes_count = 0;
+}
+
+/* Write member as Java would declare it, or as its name and descriptor if the descriptor is malformed. The descriptor's tree
+ * is parsed into arena, which the caller drops once the delta is written. */
+static void append_member(Buffer *out, const MemberPrint *member, Arena *arena) {
+	if (member->kind == MEMBER_ATTRIBUTE) {
+		append_string(out, "attribute ");
+		decode_mutf8(out, member->name.value, member->name.length);
+		return;
+	}
+	const TypeNode *type = parse_member_type(arena, member->descriptor.value, member->descriptor.length);
+	if (type != NULL) {
+		append_declaration(out, type, member->name);
+	} else {
+		decode_mutf8(out, member->name.value, member->name.length);
+		append_char(out, ' ');
+		decode_mutf8(out, member->descriptor.value, member->descriptor.length);
+	}
+}
+
+static const char CHANGE_MARKS[] = {'+', '-', '~'};
+
+void append_delta(Buffer *out, const ClassDelta *delta, const ClassPrint *print) {
+	if (delta->header_changed) {
+		append_string(out, "\t~ class ");
+		size_t start = out->length;
+		decode_mutf8(out, print->name.value, print->name.length);
+		size_t i;
+		for (i = start; i < out->length; i++) {
+			if (out->data[i] == '/') out->data[i] = '.';
+		}
+		append_char(out, '\n');
+	}
+	Arena *arena = create_arena(0);
+	size_t i;
+	for (i = 0; i < delta->changes_count; i++) {
+		append_char(out, '\t');
+		append_char(out, CHANGE_MARKS[delta->changes[i].kind]);
+		append_char(out, ' ');
+		append_member(out, delta->changes[i].member, arena);
+		append_char(out, '\n');
+	}
+	free_arena(arena);
+}
+
+void json_delta(JsonWriter *writer, const ClassDelta *delta) {
+	static const char *KEYS[] = {"added", "removed", "changed"};
+	Buffer declaration;
+	init_buffer(&declaration, NULL, 128);
+	Arena *arena = create_arena(0);
+	json_key(writer, "header_changed");
+	json_bool(writer, delta->header_changed);
+	int kind;
+	for (kind = MEMBER_ADDED; kind <= MEMBER_CHANGED; kind++) {
+		json_key(writer, KEYS[kind]);
+		json_begin_array(writer);
+		size_t i;
+		for (i = 0; i < delta->changes_count; i++) {
+			if ((int) delta->changes[i].kind != kind) continue;
+			declaration.length = 0;
+			append_member(&declaration, delta->changes[i].member, arena);
+			json_string(writer, declaration.data, declaration.length);
+		}
+		json_end_array(writer);
+	}
+	free_arena(arena);
+	free_buffer(&declaration);
+}
+
+void format_class_delta(Buffer *out, bool json, ChangeKind event, const char *file, const ClassPrint *print,
+		const ClassDelta *delta) {
+	static const char *EVENTS[] = {"added", "removed", "changed"};
+	static const char *TITLES[] = {"Added: ", "Removed: ", "Changed: "};
+	if (json) {
+		JsonWriter writer;
+		init_json_writer(&writer, out);
+		json_begin_object(&writer);
+		json_key(&writer, "event");
+		json_cstring(&writer, EVENTS[event]);
+		json_key(&writer, "file");
+		json_cstring(&writer, file);
+		json_key(&writer, "class");
+		json_mutf8(&writer, print->name.value, print->name.length);
+		json_delta(&writer, delta);
+		json_end_object(&writer);
+	} else {
+		append_string(out, TITLES[event]);
+		append_string(out, file);
+		append_char(out, '\n');
+		append_delta(out, delta, print);
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef DELTA_H
+#define DELTA_H
+#include "buffer.h"
+#include "cache.h"
+#include "class.h"
+#include "json.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Differences between two versions of a class, member by member. Each field, method and class attribute is reduced to a
+ * fixed-width identity, hashed from its kind, name and descriptor, and a fingerprint of its flags and attributes. In the
+ * fingerprint, constant pool indexes are replaced by what they refer to, so recompiling with the pool laid out differently
+ * changes nothing. Debugging tables (line numbers, local variables) and stack maps are left out, so moving code around in the
+ * source or editing comments isn't a change either. */
+
+typedef enum {
+	MEMBER_FIELD,
+	MEMBER_METHOD,
+	MEMBER_ATTRIBUTE /* Of the class; a member's own attributes are part of its fingerprint */
+} MemberKind;
+
+/* A field, method or class attribute reduced to what a change to it is judged by. name and descriptor point into its class's
+ * image; an attribute has only a name. */
+typedef struct {
+	MemberKind kind;
+	uint16_t flags;
+	uint64_t identity; /* Hash of kind, name and descriptor, which the two sides' members are matched by */
+	String name;
+	String descriptor;
+	CacheKey fingerprint;
+} MemberPrint;
+
+/* A class's members, sorted by identity, and a fingerprint of the rest of its declaration: flags, super class, interfaces and
+ * generic signature */
+typedef struct {
+	String name;
+	CacheKey header;
+	MemberPrint *members;
+	uint32_t members_count;
+} ClassPrint;
+
+typedef enum {
+	MEMBER_ADDED,
+	MEMBER_REMOVED,
+	MEMBER_CHANGED
+} ChangeKind;
+
+typedef struct {
+	ChangeKind kind;
+	const MemberPrint *member; /* The version after for MEMBER_ADDED and MEMBER_CHANGED, before for MEMBER_REMOVED */
+} MemberChange;
+
+/* How after differs from before. Changes are in declaration order: fields, then methods, then attributes, each by name. */
+typedef struct {
+	bool header_changed;
+	MemberChange *changes;
+	size_t changes_count;
+} ClassDelta;
+
+/* Fingerprint class, which must outlive print */
+void fingerprint_class(ClassPrint *print, const Class *class);
+void free_class_print(ClassPrint *print);
+
+/* Compare two versions of a class by matching their members' identities, in one pass over the two sorted lists. Either may be
+ * NULL: every member of a class that only exists after is added, and every member of one that only existed before is removed. */
+void diff_classes(ClassDelta *delta, const ClassPrint *before, const ClassPrint *after);
+void free_class_delta(ClassDelta *delta);
+
+/* Return true if delta has anything in it */
+static inline bool delta_changed(const ClassDelta *delta) {
+	return delta->header_changed || delta->changes_count > 0;
+}
+
+/* Append delta as one line per change, e.g. "\t+ void run()", "\t- int count", "\t~ java.lang.String toString()" or
+ * "\t~ attribute InnerClasses". A changed header is "\t~ class" and the class name. */
+void append_delta(Buffer *out, const ClassDelta *delta, const ClassPrint *print);
+
+/* Write delta's members into the JSON object being written: "header_changed" and the "added", "removed" and "changed" members
+ * as arrays of declarations */
+void json_delta(JsonWriter *writer, const ClassDelta *delta);
+
+/* Append how the class in file changed, event saying whether it was added, removed or changed as a whole. As text that is
+ * "Added: ", "Removed: " or "Changed: " and file, then append_delta's lines; with json, an object holding "event", "file",
+ * "class" and json_delta's members, with no newline after it. */
+void format_class_delta(Buffer *out, bool json, ChangeKind event, const char *file, const ClassPrint *print,
+		const ClassDelta *delta);
+
+#endif //DELTA_H
@@ -0,0 +1,430 @@
+#include "descriptor.h"
+#include "intern.h"
+#include "mutf8.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	/* Deeper nesting than this is malformed, or hostile */
+	MAX_DEPTH = 255,
+	TYPE_PAGE_BITS = 12,
+	TYPE_PAGE_SIZE = 1 << TYPE_PAGE_BITS,
+	MAX_TYPE_PAGES = 1 << 16,
+	TYPE_LOCKS = 64
+};
+
+#define PRIMITIVE(sort) {sort, 0, 0, 0, 0, {0, NULL}, NULL, NULL, NULL, NULL}
+
+static const TypeNode PRIMITIVES[] = {
+	PRIMITIVE(SORT_BYTE), PRIMITIVE(SORT_CHAR), PRIMITIVE(SORT_DOUBLE), PRIMITIVE(SORT_FLOAT), PRIMITIVE(SORT_INT),
+	PRIMITIVE(SORT_LONG), PRIMITIVE(SORT_SHORT), PRIMITIVE(SORT_BOOLEAN), PRIMITIVE(SORT_VOID)
+};
+
+static const TypeNode UNBOUNDED = PRIMITIVE(SORT_WILDCARD);
+
+static const char *PRIMITIVE_NAMES[] = {"byte", "char", "double", "float", "int", "long", "short", "boolean", "void"};
+
+typedef struct {
+	const char *p;
+	const char *end;
+	Arena *arena;
+	unsigned depth;
+	bool failed;
+} Parser;
+
+/* A list of nodes being parsed, grown in the parser's arena */
+typedef struct {
+	const TypeNode **items;
+	uint16_t count;
+	uint16_t capacity;
+} NodeList;
+
+static inline bool at(const Parser *parser, char c) {
+	return parser->p < parser->end && *parser->p == c;
+}
+
+static inline bool accept(Parser *parser, char c) {
+	if (!at(parser, c)) return false;
+	parser->p++;
+	return true;
+}
+
+static inline void expect(Parser *parser, char c) {
+	if (!accept(parser, c)) parser->failed = true;
+}
+
+static TypeNode *new_node(Parser *parser, TypeSort sort) {
+	TypeNode *node = arena_calloc(parser->arena, 1, sizeof(TypeNode));
+	node->sort = sort;
+	return node;
+}
+
+static void push_node(Parser *parser, NodeList *list, const TypeNode *node) {
+	if (list->count == list->capacity) {
+		if (list->capacity == UINT16_MAX) {
+			parser->failed = true;
+			return;
+		}
+		uint16_t capacity = list->capacity == 0 ? 4 : list->capacity > UINT16_MAX / 2 ? UINT16_MAX : list->capacity * 2;
+		const TypeNode **items = arena_alloc(parser->arena, capacity * sizeof(TypeNode *));
+		if (list->count > 0) memcpy(items, list->items, list->count * sizeof(TypeNode *));
+		list->items = items;
+		list->capacity = capacity;
+	}
+	list->items[list->count++] = node;
+}
+
+/* Return the run of characters up to, not including, the first of stops; an empty run is malformed */
+static String scan_identifier(Parser *parser, const char *stops) {
+	const char *start = parser->p;
+	while (parser->p < parser->end && strchr(stops, *parser->p) == NULL) parser->p++;
+	String name = {(uint16_t) (parser->p - start), start};
+	if (name.length == 0) parser->failed = true;
+	return name;
+}
+
+static TypeNode *parse_reference(Parser *parser);
+
+/* A field type: a primitive or a reference */
+static const TypeNode *parse_type(Parser *parser) {
+	if (parser->p == parser->end) {
+		parser->failed = true;
+		return NULL;
+	}
+	switch (*parser->p) {
+		case 'B': parser->p++; return PRIMITIVES + SORT_BYTE;
+		case 'C': parser->p++; return PRIMITIVES + SORT_CHAR;
+		case 'D': parser->p++; return PRIMITIVES + SORT_DOUBLE;
+		case 'F': parser->p++; return PRIMITIVES + SORT_FLOAT;
+		case 'I': parser->p++; return PRIMITIVES + SORT_INT;
+		case 'J': parser->p++; return PRIMITIVES + SORT_LONG;
+		case 'S': parser->p++; return PRIMITIVES + SORT_SHORT;
+		case 'Z': parser->p++; return PRIMITIVES + SORT_BOOLEAN;
+		default: return parse_reference(parser);
+	}
+}
+
+/* One of a class's type arguments: '*', or a reference with an optional + or - bound */
+static const TypeNode *parse_type_argument(Parser *parser) {
+	if (accept(parser, '*')) return &UNBOUNDED;
+	char wildcard = at(parser, '+') || at(parser, '-') ? *parser->p++ : 0;
+	TypeNode *argument = parse_reference(parser);
+	if (argument != NULL) argument->wildcard = wildcard;
+	return argument;
+}
+
+/* A class type after its L: each part, possibly generic, nested in the one before */
+static TypeNode *parse_class(Parser *parser) {
+	TypeNode *type = NULL;
+	do {
+		TypeNode *part = new_node(parser, SORT_CLASS);
+		part->inner = type;
+		part->name = scan_identifier(parser, ";<.");
+		if (accept(parser, '<')) {
+			NodeList arguments = {0};
+			while (!at(parser, '>') && !parser->failed) {
+				push_node(parser, &arguments, parse_type_argument(parser));
+			}
+			expect(parser, '>');
+			if (arguments.count == 0) parser->failed = true;
+			part->types = arguments.items;
+			part->types_count = arguments.count;
+		}
+		type = part;
+	} while (accept(parser, '.') && !parser->failed);
+	expect(parser, ';');
+	return type;
+}
+
+/* A class, array or type variable */
+static TypeNode *parse_reference(Parser *parser) {
+	if (++parser->depth > MAX_DEPTH || parser->p == parser->end) {
+		parser->failed = true;
+		return NULL;
+	}
+	TypeNode *type = NULL;
+	switch (*parser->p++) {
+		case 'L':
+			type = parse_class(parser);
+			break;
+		case 'T':
+			type = new_node(parser, SORT_TYPE_VARIABLE);
+			type->name = scan_identifier(parser, ";");
+			expect(parser, ';');
+			break;
+		case '[':
+			type = new_node(parser, SORT_ARRAY);
+			type->inner = parse_type(parser);
+			break;
+		default:
+			parser->failed = true;
+	}
+	parser->depth--;
+	return type;
+}
+
+/* An optional <T:bound:bound U::bound> list, stored in owner */
+static void parse_type_parameters(Parser *parser, TypeNode *owner) {
+	if (!accept(parser, '<')) return;
+	NodeList parameters = {0};
+	do {
+		TypeNode *parameter = new_node(parser, SORT_TYPE_PARAMETER);
+		parameter->name = scan_identifier(parser, ":>");
+		expect(parser, ':');
+		NodeList bounds = {0};
+		// The class bound may be left out, leaving just the colon
+		push_node(parser, &bounds, at(parser, ':') ? NULL : parse_reference(parser));
+		while (accept(parser, ':') && !parser->failed) {
+			push_node(parser, &bounds, parse_reference(parser));
+		}
+		parameter->types = bounds.items;
+		parameter->types_count = bounds.count;
+		push_node(parser, &parameters, parameter);
+	} while (!at(parser, '>') && !parser->failed);
+	expect(parser, '>');
+	owner->type_parameters = parameters.items;
+	owner->type_parameters_count = parameters.count;
+}
+
+const TypeNode *parse_member_type(Arena *arena, const char *value, size_t length) {
+	Parser parser = {value, value + length, arena, 0, false};
+	const TypeNode *type;
+	if (at(&parser, '<') || at(&parser, '(')) {
+		TypeNode *method = new_node(&parser, SORT_METHOD);
+		parse_type_parameters(&parser, method);
+		expect(&parser, '(');
+		NodeList parameters = {0};
+		while (!at(&parser, ')') && !parser.failed) {
+			push_node(&parser, &parameters, parse_type(&parser));
+		}
+		expect(&parser, ')');
+		method->types = parameters.items;
+		method->types_count = parameters.count;
+		method->inner = accept(&parser, 'V') ? PRIMITIVES + SORT_VOID : parse_type(&parser);
+		NodeList throws = {0};
+		while (accept(&parser, '^') && !parser.failed) {
+			push_node(&parser, &throws, parse_reference(&parser));
+		}
+		method->throws = throws.items;
+		method->throws_count = throws.count;
+		type = method;
+	} else {
+		type = parse_type(&parser);
+	}
+	return !parser.failed && parser.p == parser.end ? type : NULL;
+}
+
+const TypeNode *parse_class_signature(Arena *arena, const char *value, size_t length) {
+	Parser parser = {value, value + length, arena, 0, false};
+	TypeNode *signature = new_node(&parser, SORT_CLASS_SIGNATURE);
+	parse_type_parameters(&parser, signature);
+	signature->inner = parse_reference(&parser);
+	NodeList interfaces = {0};
+	while (parser.p < parser.end && !parser.failed) {
+		push_node(&parser, &interfaces, parse_reference(&parser));
+	}
+	signature->types = interfaces.items;
+	signature->types_count = interfaces.count;
+	return !parser.failed ? signature : NULL;
+}
+
+/* Trees by interned id, in fixed pages like the interner's strings. A lock per stripe of ids makes sure each is parsed once;
+ * once parsed, a tree is read without one. */
+typedef struct {
+	const TypeNode **pages[MAX_TYPE_PAGES];
+	pthread_mutex_t locks[TYPE_LOCKS];
+	Arena *arenas[TYPE_LOCKS];
+	const TypeNode *(*parse)(Arena *arena, const char *value, size_t length);
+} TypeCache;
+
+static TypeCache member_types = {.parse = parse_member_type};
+static TypeCache class_signatures = {.parse = parse_class_signature};
+static pthread_once_t caches_once = PTHREAD_ONCE_INIT;
+
+/* Cached in place of a NULL tree, so malformed strings aren't parsed again */
+static const TypeNode MALFORMED = PRIMITIVE(SORT_VOID);
+
+static void init_caches(void) {
+	int i;
+	for (i = 0; i < TYPE_LOCKS; i++) {
+		pthread_mutex_init(member_types.locks + i, NULL);
+		member_types.arenas[i] = create_arena(0);
+		pthread_mutex_init(class_signatures.locks + i, NULL);
+		class_signatures.arenas[i] = create_arena(0);
+	}
+}
+
+static const TypeNode *cached_type(TypeCache *cache, SymbolId id) {
+	if (id == NO_SYMBOL) return NULL;
+	pthread_once(&caches_once, init_caches);
+	const TypeNode ***page = cache->pages + (id >> TYPE_PAGE_BITS);
+	const TypeNode **types = __atomic_load_n(page, __ATOMIC_ACQUIRE);
+	if (types == NULL) {
+		const TypeNode **fresh = calloc(TYPE_PAGE_SIZE, sizeof(TypeNode *));
+		if (__atomic_compare_exchange_n(page, &types, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			types = fresh;
+		} else {
+			free(fresh);
+		}
+	}
+	const TypeNode **slot = types + (id & (TYPE_PAGE_SIZE - 1));
+	const TypeNode *type = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (type == NULL) {
+		unsigned stripe = id % TYPE_LOCKS;
+		pthread_mutex_lock(cache->locks + stripe);
+		type = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (type == NULL) {
+			String string = interned_string(id);
+			type = cache->parse(cache->arenas[stripe], string.value, string.length);
+			if (type == NULL) type = &MALFORMED;
+			__atomic_store_n(slot, type, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(cache->locks + stripe);
+	}
+	return type != &MALFORMED ? type : NULL;
+}
+
+const TypeNode *member_type(SymbolId id) {
+	return cached_type(&member_types, id);
+}
+
+const TypeNode *class_signature_type(SymbolId id) {
+	return cached_type(&class_signatures, id);
+}
+
+/* Cached in a class's types in place of a NULL class signature */
+static const TypeNode MALFORMED_SIGNATURE = PRIMITIVE(SORT_CLASS_SIGNATURE);
+
+/* Parse the UTF-8 constant at cp_idx into class's arena, remembering the tree in class->types. A constant read both ways, which
+ * only a malformed class does, is parsed again each time it's read the other way. */
+static const TypeNode *class_constant_type(const Class *class, uint16_t cp_idx, bool signature) {
+	const String *string = get_utf8(class, cp_idx);
+	if (string == NULL) return NULL;
+	// The memo doesn't change what the class holds, and a Class is only used by one thread at a time
+	Class *memo = (Class *) class;
+	if (memo->types == NULL) memo->types = arena_calloc(class->arena, class->const_pool_count, sizeof(TypeNode *));
+	const TypeNode *type = memo->types[cp_idx];
+	if (type == NULL || (type == &MALFORMED_SIGNATURE || type->sort == SORT_CLASS_SIGNATURE) != signature) {
+		const TypeNode *parsed = signature ? parse_class_signature(class->arena, string->value, string->length)
+				: parse_member_type(class->arena, string->value, string->length);
+		if (type != NULL) return parsed;
+		type = parsed != NULL ? parsed : signature ? &MALFORMED_SIGNATURE : &MALFORMED;
+		memo->types[cp_idx] = type;
+	}
+	return type != &MALFORMED && type != &MALFORMED_SIGNATURE ? type : NULL;
+}
+
+const TypeNode *constant_member_type(const Class *class, uint16_t cp_idx) {
+	if (class->symbols != NULL) return member_type(constant_symbol(class, cp_idx));
+	return class_constant_type(class, cp_idx, false);
+}
+
+const TypeNode *constant_class_signature(const Class *class, uint16_t cp_idx) {
+	if (class->symbols != NULL) return class_signature_type(constant_symbol(class, cp_idx));
+	return class_constant_type(class, cp_idx, true);
+}
+
+/* Write an internal name with dots for slashes */
+static void append_name(Buffer *out, const String name) {
+	const char *start = name.value, *end = name.value + name.length, *slash;
+	while ((slash = memchr(start, '/', end - start)) != NULL) {
+		decode_mutf8(out, start, slash - start);
+		append_char(out, '.');
+		start = slash + 1;
+	}
+	decode_mutf8(out, start, end - start);
+}
+
+static void append_types(Buffer *out, const TypeNode **types, uint16_t count, const char *separator) {
+	uint16_t i;
+	for (i = 0; i < count; i++) {
+		if (i > 0) append_string(out, separator);
+		append_type(out, types[i]);
+	}
+}
+
+static void append_type_parameters(Buffer *out, const TypeNode *owner) {
+	if (owner->type_parameters_count == 0) return;
+	append_char(out, '<');
+	append_types(out, owner->type_parameters, owner->type_parameters_count, ", ");
+	append_string(out, "> ");
+}
+
+/* The parenthesised parameters and throws clause of method */
+static void append_parameters(Buffer *out, const TypeNode *method) {
+	append_char(out, '(');
+	append_types(out, method->types, method->types_count, ", ");
+	append_char(out, ')');
+	if (method->throws_count > 0) {
+		append_string(out, " throws ");
+		append_types(out, method->throws, method->throws_count, ", ");
+	}
+}
+
+void append_type(Buffer *out, const TypeNode *type) {
+	if (type->wildcard != 0) append_string(out, type->wildcard == '+' ? "? extends " : "? super ");
+	uint16_t i;
+	switch (type->sort) {
+		case SORT_CLASS:
+			if (type->inner != NULL) {
+				append_type(out, type->inner);
+				append_char(out, '.');
+			}
+			append_name(out, type->name);
+			if (type->types_count > 0) {
+				append_char(out, '<');
+				append_types(out, type->types, type->types_count, ", ");
+				append_char(out, '>');
+			}
+			break;
+		case SORT_ARRAY:
+			append_type(out, type->inner);
+			append_string(out, "[]");
+			break;
+		case SORT_TYPE_VARIABLE:
+			decode_mutf8(out, type->name.value, type->name.length);
+			break;
+		case SORT_WILDCARD:
+			append_char(out, '?');
+			break;
+		case SORT_TYPE_PARAMETER:
+			decode_mutf8(out, type->name.value, type->name.length);
+			for (i = 0; i < type->types_count; i++) {
+				if (type->types[i] == NULL) continue;
+				append_string(out, i == 0 || (i == 1 && type->types[0] == NULL) ? " extends " : " & ");
+				append_type(out, type->types[i]);
+			}
+			break;
+		case SORT_METHOD:
+			append_type_parameters(out, type);
+			append_type(out, type->inner);
+			append_parameters(out, type);
+			break;
+		case SORT_CLASS_SIGNATURE:
+			append_type_parameters(out, type);
+			append_string(out, "extends ");
+			append_type(out, type->inner);
+			if (type->types_count > 0) {
+				append_string(out, " implements ");
+				append_types(out, type->types, type->types_count, ", ");
+			}
+			break;
+		default:
+			append_string(out, PRIMITIVE_NAMES[type->sort]);
+	}
+}
+
+void append_declaration(Buffer *out, const TypeNode *type, const String name) {
+	if (type->sort == SORT_METHOD) {
+		append_type_parameters(out, type);
+		append_type(out, type->inner);
+		append_char(out, ' ');
+		decode_mutf8(out, name.value, name.length);
+		append_parameters(out, type);
+	} else {
+		append_type(out, type);
+		append_char(out, ' ');
+		decode_mutf8(out, name.value, name.length);
+	}
+}
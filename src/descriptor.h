@@ -0,0 +1,75 @@
+#ifndef DESCRIPTOR_H
+#define DESCRIPTOR_H
+#include "arena.h"
+#include "buffer.h"
+#include "class.h"
+#include "symtab.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Type trees for descriptors and generic signatures (sections 4.3 and 4.7.9.1 of the JVM spec). A descriptor is just a
+ * signature without generics, so one grammar reads both. Trees are immutable once built: primitives are shared singletons and
+ * names point into the interned string they were parsed from. */
+
+typedef enum {
+	SORT_BYTE,
+	SORT_CHAR,
+	SORT_DOUBLE,
+	SORT_FLOAT,
+	SORT_INT,
+	SORT_LONG,
+	SORT_SHORT,
+	SORT_BOOLEAN,
+	SORT_VOID,
+	SORT_CLASS,           /* name is the internal name; for Outer<T>.Inner, the simple name, with inner the outer class */
+	SORT_ARRAY,           /* inner is the element type */
+	SORT_TYPE_VARIABLE,   /* name is the variable */
+	SORT_WILDCARD,        /* The unbounded type argument '?' */
+	SORT_TYPE_PARAMETER,  /* name is the parameter; types are its bounds, the first NULL if there is only an interface bound */
+	SORT_METHOD,          /* types are the parameters and inner the result, plus type parameters and throws */
+	SORT_CLASS_SIGNATURE  /* inner is the superclass and types the interfaces, plus type parameters */
+} TypeSort;
+
+typedef struct TypeNode {
+	uint8_t sort;                  /* A TypeSort */
+	char wildcard;                 /* On a bounded type argument: '+' for ? extends, '-' for ? super; 0 otherwise */
+	uint16_t types_count;
+	uint16_t type_parameters_count;
+	uint16_t throws_count;
+	String name;
+	const struct TypeNode *inner;
+	const struct TypeNode **types; /* Type arguments of a class, parameters of a method, bounds, or interfaces */
+	const struct TypeNode **type_parameters;
+	const struct TypeNode **throws;
+} TypeNode;
+
+/* Parse the field or method descriptor or signature at value into a tree allocated from arena. Returns NULL if it is
+ * malformed. */
+const TypeNode *parse_member_type(Arena *arena, const char *value, size_t length);
+
+/* Parse the class signature at value into a tree allocated from arena. Returns NULL if it is malformed. */
+const TypeNode *parse_class_signature(Arena *arena, const char *value, size_t length);
+
+/* Return the tree for the interned field or method descriptor or signature id, parsing it the first time any thread asks.
+ * Trees live as long as the process. Returns NULL if it is malformed. */
+const TypeNode *member_type(SymbolId id);
+
+/* Like member_type, for an interned class signature */
+const TypeNode *class_signature_type(SymbolId id);
+
+/* Return the tree for the field or method descriptor or signature in class's UTF-8 constant cp_idx, or NULL if there is no
+ * such constant or it is malformed. For a class read with ParseOptions.intern this is member_type; otherwise the tree is parsed
+ * into the class's arena the first time it's asked for, so nothing outlives the class. */
+const TypeNode *constant_member_type(const Class *class, uint16_t cp_idx);
+
+/* Like constant_member_type, for a class signature */
+const TypeNode *constant_class_signature(const Class *class, uint16_t cp_idx);
+
+/* Write type as Java source would, e.g. "java.util.Map<K, ? extends V>[]". Methods come out as "<T> R(A, B) throws E" and class
+ * signatures as "<T> extends S implements I". */
+void append_type(Buffer *out, const TypeNode *type);
+
+/* Write a declaration of name with the given type, e.g. "int[] counts" or "<T> void sort(java.util.List<T>)" */
+void append_declaration(Buffer *out, const TypeNode *type, const String name);
+
+#endif //DESCRIPTOR_H
@@ -0,0 +1,164 @@
+#include "cache.h"
+#include "diff.h"
+#include "jar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A jar's class entries, sorted by name so two jars pair up in one pass */
+typedef struct {
+	Jar *jar;
+	JarEntry *entries;
+	size_t count;
+} JarClasses;
+
+static int compare_entry_names(const JarEntry *a, const JarEntry *b) {
+	int order = memcmp(a->name, b->name, a->name_length < b->name_length ? a->name_length : b->name_length);
+	return order != 0 ? order : (int) a->name_length - (int) b->name_length;
+}
+
+static int compare_entries(const void *a, const void *b) {
+	return compare_entry_names(a, b);
+}
+
+static bool list_jar_classes(JarClasses *classes, char *file_name) {
+	classes->entries = NULL;
+	classes->count = 0;
+	classes->jar = open_jar(file_name);
+	if (classes->jar == NULL) return false;
+
+	size_t capacity = 0;
+	JarIterator it = jar_iterator(classes->jar);
+	JarEntry entry;
+	while (next_class_entry(&it, &entry)) {
+		if (classes->count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			classes->entries = realloc(classes->entries, capacity * sizeof(JarEntry));
+		}
+		classes->entries[classes->count++] = entry;
+	}
+	qsort(classes->entries, classes->count, sizeof(JarEntry), compare_entries);
+	return true;
+}
+
+static void free_jar_classes(JarClasses *classes) {
+	free(classes->entries);
+	if (classes->jar != NULL) close_jar(classes->jar);
+}
+
+/* Return true if the two entries hold the same bytes, judged by a hash of their data as stored so neither is inflated */
+static bool same_entry(const Jar *a_jar, const JarEntry *a, const Jar *b_jar, const JarEntry *b) {
+	if (a->method != b->method || a->size != b->size || a->compressed_size != b->compressed_size) return false;
+	const uint8_t *a_data = jar_entry_data(a_jar, a);
+	const uint8_t *b_data = jar_entry_data(b_jar, b);
+	if (a_data == NULL || b_data == NULL) return false;
+	const CacheKey seed = {a->method, a->size};
+	const CacheKey a_key = hash_bytes(a_data, a->compressed_size, seed);
+	const CacheKey b_key = hash_bytes(b_data, b->compressed_size, seed);
+	return a_key.high == b_key.high && a_key.low == b_key.low;
+}
+
+/* Report how after differs from before, either of which may be NULL for a class on one side only */
+static void compare_prints(const ClassPrint *before, const ClassPrint *after, const char *name, ChangeVisitor visit, void *context,
+		DiffCounts *counts) {
+	ClassDelta delta;
+	diff_classes(&delta, before, after);
+	ChangeKind event = before == NULL ? MEMBER_ADDED : after == NULL ? MEMBER_REMOVED : MEMBER_CHANGED;
+	if (event != MEMBER_CHANGED || delta_changed(&delta)) {
+		visit(event, name, after != NULL ? after : before, &delta, context);
+		counts->changed++;
+	}
+	free_class_delta(&delta);
+}
+
+/* Decode entry, named like "app.jar!/com/example/Foo.class" in file_name, and fingerprint it into print */
+static Class *read_entry(const Jar *jar, const JarEntry *entry, char **file_name, ClassPrint *print, const ParseOptions *options) {
+	*file_name = malloc(strlen(jar->file_name) + 2 + entry->name_length + 1);
+	sprintf(*file_name, "%s!/%.*s", jar->file_name, entry->name_length, entry->name);
+	Class *class = read_class_from_jar_entry(jar, entry, *file_name, options);
+	if (class != NULL) fingerprint_class(print, class);
+	return class;
+}
+
+static bool diff_jars(char *before_name, char *after_name, const ParseOptions *options, ChangeVisitor visit, void *context,
+		DiffCounts *counts) {
+	JarClasses before, after;
+	bool listed = list_jar_classes(&before, before_name);
+	listed &= list_jar_classes(&after, after_name);
+	if (!listed) {
+		free_jar_classes(&before);
+		free_jar_classes(&after);
+		return false;
+	}
+
+	bool read = true;
+	size_t b = 0, a = 0;
+	while (b < before.count || a < after.count) {
+		int order = b == before.count ? 1 : a == after.count ? -1 : compare_entry_names(before.entries + b, after.entries + a);
+		const JarEntry *old = order <= 0 ? before.entries + b++ : NULL;
+		const JarEntry *new = order >= 0 ? after.entries + a++ : NULL;
+		if (old != NULL && new != NULL && same_entry(before.jar, old, after.jar, new)) {
+			counts->identical++;
+			continue;
+		}
+
+		char *old_name = NULL, *new_name = NULL;
+		ClassPrint old_print, new_print;
+		Class *old_class = old != NULL ? read_entry(before.jar, old, &old_name, &old_print, options) : NULL;
+		Class *new_class = new != NULL ? read_entry(after.jar, new, &new_name, &new_print, options) : NULL;
+		if ((old != NULL && old_class == NULL) || (new != NULL && new_class == NULL)) {
+			read = false;
+		} else {
+			counts->compared += old != NULL && new != NULL;
+			// Report the entry's name within the jar
+			const char *name = new != NULL ? new_name + strlen(after_name) + 2 : old_name + strlen(before_name) + 2;
+			compare_prints(old != NULL ? &old_print : NULL, new != NULL ? &new_print : NULL, name, visit, context, counts);
+		}
+		if (old_class != NULL) {
+			free_class_print(&old_print);
+			free_class(old_class);
+		}
+		if (new_class != NULL) {
+			free_class_print(&new_print);
+			free_class(new_class);
+		}
+		free(old_name);
+		free(new_name);
+	}
+	free_jar_classes(&before);
+	free_jar_classes(&after);
+	return read;
+}
+
+static bool diff_class_files(char *before_name, char *after_name, const ParseOptions *options, ChangeVisitor visit, void *context,
+		DiffCounts *counts) {
+	Class *before = read_class_from_file_name(before_name, options);
+	Class *after = read_class_from_file_name(after_name, options);
+	bool read = before != NULL && after != NULL;
+	if (read && before->image_length == after->image_length && memcmp(before->image, after->image, before->image_length) == 0) {
+		counts->identical++;
+	} else if (read) {
+		ClassPrint before_print, after_print;
+		fingerprint_class(&before_print, before);
+		fingerprint_class(&after_print, after);
+		counts->compared++;
+		compare_prints(&before_print, &after_print, after_name, visit, context, counts);
+		free_class_print(&before_print);
+		free_class_print(&after_print);
+	}
+	if (before != NULL) free_class(before);
+	if (after != NULL) free_class(after);
+	return read;
+}
+
+bool diff_files(char *before, char *after, const ParseOptions *options, ChangeVisitor visit, void *context, DiffCounts *counts) {
+	counts->compared = counts->identical = counts->changed = 0;
+	if (is_jar_name(before) && is_jar_name(after)) {
+		return diff_jars(before, after, options, visit, context, counts);
+	}
+	if (is_jar_name(before) || is_jar_name(after)) {
+		fprintf(stderr, "Can't compare '%s' with '%s': give two class files or two jars\n", before, after);
+		return false;
+	}
+	return diff_class_files(before, after, options, visit, context, counts);
+}
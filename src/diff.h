@@ -0,0 +1,27 @@
+#ifndef DIFF_H
+#define DIFF_H
+#include "class.h"
+#include "delta.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Structural comparison of two class files or two jars, e.g. two releases of a library. Jar entries are paired by name, and a
+ * pair whose stored bytes hash the same is skipped without being inflated or parsed. The rest are fingerprinted and compared
+ * member by member with diff_classes. */
+
+/* Called with each class that was added, removed or changed. name is the jar entry's name, or the second file's when two
+ * class files are compared. print is the version after, or before for a removed class. */
+typedef void (*ChangeVisitor)(ChangeKind event, const char *name, const ClassPrint *print, const ClassDelta *delta, void *context);
+
+/* What diff_files did */
+typedef struct {
+	size_t compared;  /* pairs of classes parsed and compared member by member */
+	size_t identical; /* pairs skipped because their bytes are the same */
+	size_t changed;   /* classes passed to the visitor */
+} DiffCounts;
+
+/* Compare before with after, calling visit for each class that differs, in name order. Returns false, after reporting why on
+ * stderr, if either can't be read or a class in them can't be parsed; every other class is still compared. */
+bool diff_files(char *before, char *after, const ParseOptions *options, ChangeVisitor visit, void *context, DiffCounts *counts);
+
+#endif //DIFF_H
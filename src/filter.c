@@ -0,0 +1,456 @@
+#include "buffer.h"
+#include <ctype.h>
+#include "descriptor.h"
+#include "filter.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* What a test looks at */
+typedef enum {
+	TEST_MAJOR_VERSION,
+	TEST_MINOR_VERSION,
+	TEST_CLASS_FLAG,
+	TEST_CLASS_NAME,
+	TEST_SUPER,
+	TEST_IMPLEMENTS,
+	TEST_KIND,       /* method or field */
+	TEST_FLAG,
+	TEST_NAME,
+	TEST_DESCRIPTOR,
+	TEST_RETURNS
+} TestKind;
+
+typedef enum {
+	COMPARE_NONE,
+	COMPARE_EQ,
+	COMPARE_NE,
+	COMPARE_LT,
+	COMPARE_LE,
+	COMPARE_GT,
+	COMPARE_GE
+} Comparison;
+
+/* Where each kind of test can first be judged, by TestKind */
+static const FilterStage TEST_STAGES[] = {
+	FILTER_HEADER, FILTER_HEADER,
+	FILTER_DECLARATION, FILTER_DECLARATION, FILTER_DECLARATION, FILTER_DECLARATION,
+	FILTER_MEMBER, FILTER_MEMBER, FILTER_MEMBER, FILTER_MEMBER, FILTER_MEMBER
+};
+
+typedef struct {
+	TestKind kind;
+	Comparison comparison;
+	uint32_t number;
+	uint16_t flag;
+	int member_kind;  /* For TEST_KIND and flags that only one kind of member has: 1 for methods, 0 for fields, -1 for either */
+	char *pattern;    /* NUL-terminated; class names in internal form */
+} Test;
+
+/* One step of the compiled program, which runs as a stack machine over truth values in postfix order */
+typedef enum {
+	STEP_TEST,
+	STEP_NOT,
+	STEP_AND,
+	STEP_OR
+} StepKind;
+
+typedef struct {
+	StepKind kind;
+	uint32_t test;
+} Step;
+
+struct Filter {
+	Test *tests;
+	uint32_t tests_count;
+	Step *steps;
+	uint32_t steps_count;
+	uint32_t depth;      /* The most truth values on the stack at once */
+	bool uses_members;
+};
+
+/* A word the language knows, and the test it starts */
+typedef struct {
+	const char *word;
+	TestKind kind;
+	uint16_t flag;
+	int member_kind;
+} Keyword;
+
+static const Keyword KEYWORDS[] = {
+	{"major_version", TEST_MAJOR_VERSION, 0, -1},
+	{"minor_version", TEST_MINOR_VERSION, 0, -1},
+	{"class.public", TEST_CLASS_FLAG, 0x0001, -1},
+	{"class.final", TEST_CLASS_FLAG, 0x0010, -1},
+	{"class.super", TEST_CLASS_FLAG, 0x0020, -1},
+	{"class.interface", TEST_CLASS_FLAG, 0x0200, -1},
+	{"class.abstract", TEST_CLASS_FLAG, 0x0400, -1},
+	{"class.synthetic", TEST_CLASS_FLAG, 0x1000, -1},
+	{"class.annotation", TEST_CLASS_FLAG, 0x2000, -1},
+	{"class.enum", TEST_CLASS_FLAG, 0x4000, -1},
+	{"class.module", TEST_CLASS_FLAG, 0x8000, -1},
+	{"class.name", TEST_CLASS_NAME, 0, -1},
+	{"class.extends", TEST_SUPER, 0, -1},
+	{"class.implements", TEST_IMPLEMENTS, 0, -1},
+	{"method", TEST_KIND, 0, 1},
+	{"field", TEST_KIND, 0, 0},
+	{"public", TEST_FLAG, 0x0001, -1},
+	{"private", TEST_FLAG, 0x0002, -1},
+	{"protected", TEST_FLAG, 0x0004, -1},
+	{"static", TEST_FLAG, 0x0008, -1},
+	{"final", TEST_FLAG, 0x0010, -1},
+	{"synchronized", TEST_FLAG, 0x0020, 1},
+	{"volatile", TEST_FLAG, 0x0040, 0},
+	{"bridge", TEST_FLAG, 0x0040, 1},
+	{"transient", TEST_FLAG, 0x0080, 0},
+	{"varargs", TEST_FLAG, 0x0080, 1},
+	{"native", TEST_FLAG, 0x0100, 1},
+	{"abstract", TEST_FLAG, 0x0400, 1},
+	{"strict", TEST_FLAG, 0x0800, 1},
+	{"synthetic", TEST_FLAG, 0x1000, -1},
+	{"enum", TEST_FLAG, 0x4000, 0},
+	{"name", TEST_NAME, 0, -1},
+	{"descriptor", TEST_DESCRIPTOR, 0, -1},
+	{"returns", TEST_RETURNS, 0, -1}
+};
+
+/* Recursive descent over the expression, emitting steps as each operand is finished */
+typedef struct {
+	const char *text;
+	size_t position;
+	Filter *filter;
+	uint32_t depth;     /* Truth values the steps so far leave on the stack */
+	char *error;
+	size_t error_size;
+	bool failed;
+} ExpressionParser;
+
+static void fail(ExpressionParser *parser, const char *message) {
+	if (!parser->failed) snprintf(parser->error, parser->error_size, "%s at column %zu", message, parser->position + 1);
+	parser->failed = true;
+}
+
+static void skip_spaces(ExpressionParser *parser) {
+	while (isspace((unsigned char) parser->text[parser->position])) parser->position++;
+}
+
+/* Consume token if it comes next */
+static bool accept_token(ExpressionParser *parser, const char *token) {
+	skip_spaces(parser);
+	size_t length = strlen(token);
+	if (strncmp(parser->text + parser->position, token, length) != 0) return false;
+	parser->position += length;
+	return true;
+}
+
+static bool is_word_char(char c) {
+	return isalnum((unsigned char) c) || (c != '\0' && strchr("_.$/*[]-", c) != NULL);
+}
+
+/* Read a bare word or a quoted string into a malloc'd string, or return NULL if neither is next */
+static char *read_value(ExpressionParser *parser) {
+	skip_spaces(parser);
+	const char *start = parser->text + parser->position;
+	size_t length = 0;
+	if (*start == '"') {
+		const char *end = strchr(start + 1, '"');
+		if (end == NULL) {
+			fail(parser, "Unterminated string");
+			return NULL;
+		}
+		parser->position += end - start + 1;
+		return strndup(start + 1, end - start - 1);
+	}
+	while (is_word_char(start[length])) length++;
+	if (length == 0) return NULL;
+	parser->position += length;
+	return strndup(start, length);
+}
+
+static void emit_step(ExpressionParser *parser, StepKind kind, uint32_t test) {
+	Filter *filter = parser->filter;
+	filter->steps = realloc(filter->steps, (filter->steps_count + 1) * sizeof(Step));
+	filter->steps[filter->steps_count].kind = kind;
+	filter->steps[filter->steps_count++].test = test;
+	if (kind == STEP_TEST) {
+		if (++parser->depth > filter->depth) filter->depth = parser->depth;
+	} else if (kind != STEP_NOT) {
+		parser->depth--;
+	}
+}
+
+static Comparison read_comparison(ExpressionParser *parser) {
+	// Two-character operators first, so <= isn't read as <
+	static const char *OPERATORS[] = {"==", "!=", "<=", ">=", "<", ">"};
+	static const Comparison COMPARISONS[] = {COMPARE_EQ, COMPARE_NE, COMPARE_LE, COMPARE_GE, COMPARE_LT, COMPARE_GT};
+	size_t i;
+	for (i = 0; i < sizeof(OPERATORS) / sizeof(OPERATORS[0]); i++) {
+		if (accept_token(parser, OPERATORS[i])) return COMPARISONS[i];
+	}
+	return COMPARE_NONE;
+}
+
+static void parse_test(ExpressionParser *parser) {
+	size_t start = parser->position;
+	char *word = read_value(parser);
+	if (word == NULL) {
+		if (!parser->failed) fail(parser, "Expected a test");
+		return;
+	}
+	const Keyword *keyword = NULL;
+	size_t i;
+	for (i = 0; i < sizeof(KEYWORDS) / sizeof(KEYWORDS[0]); i++) {
+		if (strcmp(word, KEYWORDS[i].word) == 0) keyword = KEYWORDS + i;
+	}
+	free(word);
+	if (keyword == NULL) {
+		parser->position = start;
+		skip_spaces(parser);
+		fail(parser, "Unknown test");
+		return;
+	}
+
+	Test test = {keyword->kind, COMPARE_NONE, 0, keyword->flag, keyword->member_kind, NULL};
+	if (keyword->kind == TEST_MAJOR_VERSION || keyword->kind == TEST_MINOR_VERSION) {
+		test.comparison = read_comparison(parser);
+		char *value = read_value(parser);
+		char *end = NULL;
+		unsigned long number = value != NULL ? strtoul(value, &end, 10) : 0;
+		if (test.comparison == COMPARE_NONE || value == NULL || *end != '\0' || number > UINT16_MAX) {
+			free(value);
+			fail(parser, "Expected a comparison with a version number");
+			return;
+		}
+		free(value);
+		test.number = number;
+	} else if (keyword->kind != TEST_CLASS_FLAG && keyword->kind != TEST_KIND && keyword->kind != TEST_FLAG) {
+		test.comparison = read_comparison(parser);
+		if (test.comparison != COMPARE_EQ && test.comparison != COMPARE_NE) {
+			fail(parser, "Expected == or !=");
+			return;
+		}
+		test.pattern = read_value(parser);
+		if (test.pattern == NULL) {
+			fail(parser, "Expected a value");
+			return;
+		}
+		if (keyword->kind == TEST_CLASS_NAME || keyword->kind == TEST_SUPER || keyword->kind == TEST_IMPLEMENTS) {
+			// Class names are stored as java/lang/Object
+			char *c;
+			for (c = test.pattern; *c != '\0'; c++) {
+				if (*c == '.') *c = '/';
+			}
+		}
+	}
+
+	Filter *filter = parser->filter;
+	filter->tests = realloc(filter->tests, (filter->tests_count + 1) * sizeof(Test));
+	filter->tests[filter->tests_count] = test;
+	filter->uses_members |= TEST_STAGES[test.kind] == FILTER_MEMBER;
+	emit_step(parser, STEP_TEST, filter->tests_count++);
+}
+
+static void parse_or(ExpressionParser *parser);
+
+static void parse_unary(ExpressionParser *parser) {
+	if (parser->failed) return;
+	if (accept_token(parser, "!")) {
+		parse_unary(parser);
+		emit_step(parser, STEP_NOT, 0);
+	} else if (accept_token(parser, "(")) {
+		parse_or(parser);
+		if (!accept_token(parser, ")")) fail(parser, "Expected )");
+	} else {
+		parse_test(parser);
+	}
+}
+
+static void parse_and(ExpressionParser *parser) {
+	parse_unary(parser);
+	while (!parser->failed && accept_token(parser, "&&")) {
+		parse_unary(parser);
+		emit_step(parser, STEP_AND, 0);
+	}
+}
+
+static void parse_or(ExpressionParser *parser) {
+	parse_and(parser);
+	while (!parser->failed && accept_token(parser, "||")) {
+		parse_and(parser);
+		emit_step(parser, STEP_OR, 0);
+	}
+}
+
+Filter *compile_filter(const char *expression, char *error, size_t error_size) {
+	Filter *filter = calloc(1, sizeof(Filter));
+	ExpressionParser parser = {expression, 0, filter, 0, error, error_size, false};
+	parse_or(&parser);
+	skip_spaces(&parser);
+	if (!parser.failed && expression[parser.position] != '\0') fail(&parser, "Unexpected text");
+	if (parser.failed) {
+		free_filter(filter);
+		return NULL;
+	}
+	return filter;
+}
+
+void free_filter(Filter *filter) {
+	uint32_t i;
+	for (i = 0; i < filter->tests_count; i++) {
+		free(filter->tests[i].pattern);
+	}
+	free(filter->tests);
+	free(filter->steps);
+	free(filter);
+}
+
+bool filter_uses_members(const Filter *filter) {
+	return filter->uses_members;
+}
+
+/* Return true if text matches pattern, where * stands for any run of characters */
+static bool match_pattern(const char *pattern, const char *text, size_t length) {
+	const char *star = NULL;
+	size_t t = 0, mark = 0;
+	while (t < length) {
+		if (*pattern == '*') {
+			star = pattern++;
+			mark = t;
+		} else if (*pattern != '\0' && *pattern == text[t]) {
+			pattern++;
+			t++;
+		} else if (star != NULL) {
+			// Let the last star swallow one more character and retry
+			pattern = star + 1;
+			t = ++mark;
+		} else {
+			return false;
+		}
+	}
+	while (*pattern == '*') pattern++;
+	return *pattern == '\0';
+}
+
+static FilterTruth truth(bool value) {
+	return value ? FILTER_TRUE : FILTER_FALSE;
+}
+
+static FilterTruth compare_number(const Test *test, uint32_t value) {
+	switch (test->comparison) {
+		case COMPARE_EQ: return truth(value == test->number);
+		case COMPARE_NE: return truth(value != test->number);
+		case COMPARE_LT: return truth(value < test->number);
+		case COMPARE_LE: return truth(value <= test->number);
+		case COMPARE_GT: return truth(value > test->number);
+		default: return truth(value >= test->number);
+	}
+}
+
+static FilterTruth compare_string(const Test *test, const String *value) {
+	bool matched = value != NULL && match_pattern(test->pattern, value->value, value->length);
+	return truth(matched == (test->comparison == COMPARE_EQ));
+}
+
+/* Compare a member's type, or its method's return type, as Java writes it */
+static FilterTruth compare_type(const Test *test, const Class *class, const Field *member) {
+	const TypeNode *type = constant_member_type(class, member->desc_idx);
+	if (type == NULL) return truth(test->comparison == COMPARE_NE);
+	if (type->sort == SORT_METHOD) type = type->inner;
+	Buffer written;
+	init_buffer(&written, NULL, 64);
+	append_type(&written, type);
+	const String value = {written.length, written.data};
+	FilterTruth result = compare_string(test, &value);
+	free_buffer(&written);
+	return result;
+}
+
+/* Judge test against class as parsed by stage, and member, a Field or a Method, at FILTER_MEMBER */
+static FilterTruth run_test(const Test *test, const Class *class, FilterStage stage, const Field *member, bool method) {
+	if (TEST_STAGES[test->kind] > stage) return FILTER_UNKNOWN;
+	if (test->member_kind >= 0 && test->member_kind != method) return FILTER_FALSE;
+	uint16_t i;
+	switch (test->kind) {
+		case TEST_MAJOR_VERSION:
+			return compare_number(test, class->major_version);
+		case TEST_MINOR_VERSION:
+			return compare_number(test, class->minor_version);
+		case TEST_CLASS_FLAG:
+			return truth(class->flags & test->flag);
+		case TEST_CLASS_NAME:
+			return compare_string(test, get_class_name(class, class->this_class));
+		case TEST_SUPER:
+			return compare_string(test, get_class_name(class, class->super_class));
+		case TEST_IMPLEMENTS:
+			// == holds if any interface matches, != if none does
+			for (i = 0; i < class->interfaces_count; i++) {
+				const String *name = get_class_name(class, class->interfaces[i].class_idx);
+				if (name != NULL && match_pattern(test->pattern, name->value, name->length)) {
+					return truth(test->comparison == COMPARE_EQ);
+				}
+			}
+			return truth(test->comparison == COMPARE_NE);
+		case TEST_KIND:
+			return FILTER_TRUE;
+		case TEST_FLAG:
+			return truth(member->flags & test->flag);
+		case TEST_NAME:
+			return compare_string(test, get_utf8(class, member->name_idx));
+		case TEST_DESCRIPTOR:
+			return compare_string(test, get_utf8(class, member->desc_idx));
+		default:
+			return compare_type(test, class, member);
+	}
+}
+
+/* Run the program in three-valued logic: false < unknown < true, so && takes the lesser and || the greater */
+static FilterTruth run_filter(const Filter *filter, const Class *class, FilterStage stage, const Field *member, bool method) {
+	FilterTruth stack[filter->depth + 1];
+	uint32_t top = 0, i;
+	for (i = 0; i < filter->steps_count; i++) {
+		const Step *step = filter->steps + i;
+		switch (step->kind) {
+			case STEP_TEST:
+				stack[top++] = run_test(filter->tests + step->test, class, stage, member, method);
+				break;
+			case STEP_NOT:
+				stack[top - 1] = FILTER_TRUE - stack[top - 1];
+				break;
+			case STEP_AND:
+				top--;
+				if (stack[top] < stack[top - 1]) stack[top - 1] = stack[top];
+				break;
+			case STEP_OR:
+				top--;
+				if (stack[top] > stack[top - 1]) stack[top - 1] = stack[top];
+				break;
+		}
+	}
+	return stack[0];
+}
+
+FilterTruth filter_class(const Filter *filter, const Class *class, FilterStage stage) {
+	return run_filter(filter, class, stage, NULL, false);
+}
+
+bool filter_members(const Filter *filter, Class *class) {
+	uint16_t i, kept = 0;
+	for (i = 0; i < class->fields_count; i++) {
+		if (run_filter(filter, class, FILTER_MEMBER, class->fields + i, false) == FILTER_TRUE) class->fields[kept++] = class->fields[i];
+	}
+	class->fields_count = kept;
+	kept = 0;
+	for (i = 0; i < class->methods_count; i++) {
+		// Fields and Methods share a layout
+		const Field *method = (const Field *) (class->methods + i);
+		if (run_filter(filter, class, FILTER_MEMBER, method, true) == FILTER_TRUE) class->methods[kept++] = class->methods[i];
+	}
+	class->methods_count = kept;
+	return class->fields_count > 0 || class->methods_count > 0;
+}
+
+bool filter_parsed_class(const Filter *filter, Class *class) {
+	FilterTruth verdict = filter_class(filter, class, FILTER_DECLARATION);
+	return verdict == FILTER_TRUE || (verdict == FILTER_UNKNOWN && !class->skimmed && filter_members(filter, class));
+}
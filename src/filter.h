@@ -0,0 +1,55 @@
+#ifndef FILTER_H
+#define FILTER_H
+#include "class.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A small predicate language for picking classes and members, compiled once and run while classes are parsed. Tests combine
+ * with &&, || and ! and group with parentheses:
+ *
+ *   major_version >= 61                         minor_version, with == != < <= > >=
+ *   class.interface                             class flags: class.public, .final, .abstract, .enum, .annotation, ...
+ *   class.name == com.example.*                 also class.extends and class.implements; * matches anything
+ *   method, field                               what kind of member is tested
+ *   public, static, native, ...                 member flags
+ *   name == get*, descriptor == "()V"           the member's name and descriptor
+ *   returns == java.lang.String                 a method's return type or a field's type, as Java writes it
+ *
+ * Values are bare words or double-quoted strings. A class is kept if the expression holds for it; with member tests, if it holds
+ * for at least one of its fields and methods, and then only those members are kept. Each test is judged as soon as what it
+ * reads has been parsed, in three-valued logic, so a class can be dropped right after its version (parse_header) or its
+ * declaration without the rest being decoded. */
+
+typedef struct Filter Filter;
+
+/* How much of a class has been parsed, and so which tests can be judged */
+typedef enum {
+	FILTER_HEADER,      /* The version */
+	FILTER_DECLARATION, /* Also the constant pool, flags, name, super class and interfaces */
+	FILTER_MEMBER       /* Also the field or method being tested */
+} FilterStage;
+
+typedef enum {
+	FILTER_FALSE,
+	FILTER_UNKNOWN, /* Depends on something not parsed yet */
+	FILTER_TRUE
+} FilterTruth;
+
+/* Compile expression. Returns NULL, after writing why into error, if it doesn't parse. */
+Filter *compile_filter(const char *expression, char *error, size_t error_size);
+void free_filter(Filter *filter);
+
+/* Return true if filter tests fields or methods, which skimmed classes don't have */
+bool filter_uses_members(const Filter *filter);
+
+/* Judge class on what has been parsed of it by stage, FILTER_HEADER or FILTER_DECLARATION */
+FilterTruth filter_class(const Filter *filter, const Class *class, FilterStage stage);
+
+/* Drop class's fields and methods that filter doesn't hold for. Returns false if none are left. */
+bool filter_members(const Filter *filter, Class *class);
+
+/* Judge a class parsed without filter, e.g. loaded from a snapshot, dropping members as filter_members does. Returns whether
+ * to keep it. */
+bool filter_parsed_class(const Filter *filter, Class *class);
+
+#endif //FILTER_H
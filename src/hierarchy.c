@@ -0,0 +1,301 @@
+#include "hierarchy.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* The preorder number of a type not yet reached */
+#define UNNUMBERED UINT32_MAX
+
+/* Point to where length bytes of value were copied at *tail, and step *tail past them */
+static String copy_string(const String *value, char **tail) {
+	String copy = {0, NULL};
+	if (value == NULL) return copy;
+	memcpy(*tail, value->value, value->length);
+	copy.length = value->length;
+	copy.value = *tail;
+	*tail += value->length;
+	return copy;
+}
+
+TypeDecl *describe_type(const Class *class) {
+	const String *name = get_class_name(class, class->this_class);
+	if (name == NULL) return NULL;
+	const String *super = get_class_name(class, class->super_class);
+
+	size_t length = sizeof(TypeDecl) + class->interfaces_count * sizeof(String) + name->length + (super ? super->length : 0);
+	uint16_t i;
+	for (i = 0; i < class->interfaces_count; i++) {
+		const String *interface = get_class_name(class, class->interfaces[i].class_idx);
+		if (interface != NULL) length += interface->length;
+	}
+
+	TypeDecl *decl = malloc(length);
+	char *tail = (char *) (decl->interfaces + class->interfaces_count);
+	decl->flags = class->flags;
+	decl->name = copy_string(name, &tail);
+	decl->super = copy_string(super, &tail);
+	decl->interfaces_count = 0;
+	for (i = 0; i < class->interfaces_count; i++) {
+		const String *interface = get_class_name(class, class->interfaces[i].class_idx);
+		if (interface != NULL) decl->interfaces[decl->interfaces_count++] = copy_string(interface, &tail);
+	}
+	return decl;
+}
+
+void init_hierarchy(Hierarchy *hierarchy) {
+	memset(hierarchy, 0, sizeof(*hierarchy));
+	init_symtab(&hierarchy->names);
+}
+
+/* Drop everything build_hierarchy computed */
+static void free_numbering(Hierarchy *hierarchy) {
+	free(hierarchy->preorder);
+	free(hierarchy->order);
+	free(hierarchy->first_range);
+	free(hierarchy->ranges_count);
+	free(hierarchy->ranges);
+	hierarchy->preorder = hierarchy->order = hierarchy->first_range = hierarchy->ranges_count = NULL;
+	hierarchy->ranges = NULL;
+	hierarchy->ranges_length = 0;
+}
+
+void free_hierarchy(Hierarchy *hierarchy) {
+	free_numbering(hierarchy);
+	free_symtab(&hierarchy->names);
+	free(hierarchy->supers);
+	free(hierarchy->kinds);
+	free(hierarchy->edges);
+}
+
+/* Intern name and make sure the per-type arrays cover its id */
+static TypeId intern_type(Hierarchy *hierarchy, const String name) {
+	TypeId id = intern(&hierarchy->names, name.value, name.length);
+	if (id < hierarchy->types_known) return id;
+
+	if (id >= hierarchy->types_capacity) {
+		hierarchy->types_capacity = hierarchy->types_capacity ? hierarchy->types_capacity * 2 : 256;
+		hierarchy->supers = realloc(hierarchy->supers, hierarchy->types_capacity * sizeof(TypeId));
+		hierarchy->kinds = realloc(hierarchy->kinds, hierarchy->types_capacity);
+	}
+	// Ids are handed out in order, so this is always the next one
+	hierarchy->supers[id] = NO_TYPE;
+	hierarchy->kinds[id] = TYPE_UNDECLARED;
+	hierarchy->types_known = id + 1;
+	return id;
+}
+
+static void add_edge(Hierarchy *hierarchy, TypeId interface, TypeId sub) {
+	if (hierarchy->edges_count == hierarchy->edges_capacity) {
+		hierarchy->edges_capacity = hierarchy->edges_capacity ? hierarchy->edges_capacity * 2 : 256;
+		hierarchy->edges = realloc(hierarchy->edges, hierarchy->edges_capacity * 2 * sizeof(TypeId));
+	}
+	hierarchy->edges[hierarchy->edges_count * 2] = interface;
+	hierarchy->edges[hierarchy->edges_count * 2 + 1] = sub;
+	hierarchy->edges_count++;
+}
+
+void add_type(Hierarchy *hierarchy, const TypeDecl *decl) {
+	TypeId id = intern_type(hierarchy, decl->name);
+	if (hierarchy->kinds[id] != TYPE_UNDECLARED) return;
+
+	hierarchy->kinds[id] = decl->flags & ACC_INTERFACE ? TYPE_INTERFACE : TYPE_CLASS;
+	if (decl->super.length > 0) {
+		TypeId super = intern_type(hierarchy, decl->super);
+		hierarchy->supers[id] = super;
+	}
+	uint16_t i;
+	for (i = 0; i < decl->interfaces_count; i++) {
+		add_edge(hierarchy, intern_type(hierarchy, decl->interfaces[i]), id);
+	}
+}
+
+/* Build a compressed adjacency list: the targets of node n are targets[start[n]] to targets[start[n + 1]] */
+static void build_adjacency(uint32_t nodes, const TypeId *from, const TypeId *to, size_t count, size_t stride,
+		uint32_t **start, TypeId **targets) {
+	*start = calloc(nodes + 1, sizeof(uint32_t));
+	*targets = malloc((count > 0 ? count : 1) * sizeof(TypeId));
+	size_t i;
+	for (i = 0; i < count; i++) {
+		(*start)[from[i * stride] + 1]++;
+	}
+	uint32_t n;
+	for (n = 0; n < nodes; n++) {
+		(*start)[n + 1] += (*start)[n];
+	}
+	uint32_t *next = malloc((nodes > 0 ? nodes : 1) * sizeof(uint32_t));
+	memcpy(next, *start, nodes * sizeof(uint32_t));
+	for (i = 0; i < count; i++) {
+		(*targets)[next[from[i * stride]]++] = to[i * stride];
+	}
+	free(next);
+}
+
+/* State for numbering the types and merging their ranges */
+typedef struct {
+	Hierarchy *hierarchy;
+	uint32_t *end;             // by id: the end of its superclass subtree
+	uint32_t *subtypes_start;  // interfaces to their direct implementors and subinterfaces
+	TypeId *subtypes;
+	uint8_t *state;            // by id: 0 not merged, 1 merging, 2 merged
+	TypeRange *scratch;
+	size_t scratch_capacity;
+	size_t ranges_capacity;
+} Numbering;
+
+/* Number root and its subclasses in preorder without recursing, since superclass chains can be long */
+static void number_subtree(Numbering *numbering, const uint32_t *children_start, const TypeId *children, TypeId root,
+		uint32_t *counter, TypeId *stack, uint32_t *next) {
+	Hierarchy *hierarchy = numbering->hierarchy;
+	size_t depth = 0;
+	hierarchy->preorder[root] = *counter;
+	hierarchy->order[(*counter)++] = root;
+	stack[0] = root;
+	next[0] = children_start[root];
+	depth = 1;
+	while (depth > 0) {
+		TypeId top = stack[depth - 1];
+		if (next[depth - 1] < children_start[top + 1]) {
+			TypeId child = children[next[depth - 1]++];
+			if (hierarchy->preorder[child] != UNNUMBERED) continue;
+			hierarchy->preorder[child] = *counter;
+			hierarchy->order[(*counter)++] = child;
+			stack[depth] = child;
+			next[depth] = children_start[child];
+			depth++;
+		} else {
+			numbering->end[top] = *counter;
+			depth--;
+		}
+	}
+}
+
+static int compare_ranges(const void *a, const void *b) {
+	uint32_t x = ((const TypeRange *) a)->first, y = ((const TypeRange *) b)->first;
+	return x < y ? -1 : x > y;
+}
+
+static void push_scratch(Numbering *numbering, size_t *length, TypeRange range) {
+	if (*length == numbering->scratch_capacity) {
+		numbering->scratch_capacity = numbering->scratch_capacity ? numbering->scratch_capacity * 2 : 64;
+		numbering->scratch = realloc(numbering->scratch, numbering->scratch_capacity * sizeof(TypeRange));
+	}
+	numbering->scratch[(*length)++] = range;
+}
+
+/* Give type its own subtree plus the ranges of everything implementing it, merged. Interface graphs are shallow, so recursing is
+ * fine; a cycle, which only a malformed classpath can contain, is cut where it's found. */
+static void merge_ranges(Numbering *numbering, TypeId type) {
+	Hierarchy *hierarchy = numbering->hierarchy;
+	numbering->state[type] = 1;
+	uint32_t i;
+	for (i = numbering->subtypes_start[type]; i < numbering->subtypes_start[type + 1]; i++) {
+		if (numbering->state[numbering->subtypes[i]] == 0) merge_ranges(numbering, numbering->subtypes[i]);
+	}
+
+	size_t length = 0;
+	TypeRange own = {hierarchy->preorder[type], numbering->end[type]};
+	push_scratch(numbering, &length, own);
+	for (i = numbering->subtypes_start[type]; i < numbering->subtypes_start[type + 1]; i++) {
+		TypeId sub = numbering->subtypes[i];
+		if (numbering->state[sub] != 2) continue;
+		uint32_t r;
+		for (r = 0; r < hierarchy->ranges_count[sub]; r++) {
+			push_scratch(numbering, &length, hierarchy->ranges[hierarchy->first_range[sub] + r]);
+		}
+	}
+	if (length > 1) qsort(numbering->scratch, length, sizeof(TypeRange), compare_ranges);
+
+	// Coalesce overlapping and adjacent ranges onto the end of the shared array
+	if (hierarchy->ranges_length + length > numbering->ranges_capacity) {
+		while (hierarchy->ranges_length + length > numbering->ranges_capacity) numbering->ranges_capacity *= 2;
+		hierarchy->ranges = realloc(hierarchy->ranges, numbering->ranges_capacity * sizeof(TypeRange));
+	}
+	hierarchy->first_range[type] = hierarchy->ranges_length;
+	TypeRange *merged = hierarchy->ranges + hierarchy->ranges_length;
+	uint32_t count = 0;
+	size_t s;
+	for (s = 0; s < length; s++) {
+		if (count > 0 && numbering->scratch[s].first <= merged[count - 1].end) {
+			if (numbering->scratch[s].end > merged[count - 1].end) merged[count - 1].end = numbering->scratch[s].end;
+		} else {
+			merged[count++] = numbering->scratch[s];
+		}
+	}
+	hierarchy->ranges_count[type] = count;
+	hierarchy->ranges_length += count;
+	numbering->state[type] = 2;
+}
+
+void build_hierarchy(Hierarchy *hierarchy) {
+	free_numbering(hierarchy);
+	const uint32_t count = hierarchy->names.count;
+	const size_t slots = count > 0 ? count : 1;
+	hierarchy->preorder = malloc(slots * sizeof(uint32_t));
+	hierarchy->order = malloc(slots * sizeof(TypeId));
+	hierarchy->first_range = malloc(slots * sizeof(uint32_t));
+	hierarchy->ranges_count = malloc(slots * sizeof(uint32_t));
+	memset(hierarchy->preorder, 0xff, slots * sizeof(uint32_t));
+
+	Numbering numbering = {hierarchy, malloc(slots * sizeof(uint32_t)), NULL, NULL, calloc(slots, 1), NULL, 0, slots};
+	hierarchy->ranges = malloc(numbering.ranges_capacity * sizeof(TypeRange));
+
+	// Superclass edges, parent to child, with roots first in id order so the numbering is stable
+	TypeId *parents = malloc(slots * sizeof(TypeId));
+	TypeId *ids = malloc(slots * sizeof(TypeId));
+	uint32_t edges = 0, id;
+	for (id = 0; id < count; id++) {
+		if (hierarchy->supers[id] == NO_TYPE) continue;
+		parents[edges] = hierarchy->supers[id];
+		ids[edges++] = id;
+	}
+	uint32_t *children_start;
+	TypeId *children;
+	build_adjacency(count, parents, ids, edges, 1, &children_start, &children);
+	free(parents);
+	free(ids);
+
+	TypeId *stack = malloc(slots * sizeof(TypeId));
+	uint32_t *next = malloc(slots * sizeof(uint32_t));
+	uint32_t counter = 0;
+	for (id = 0; id < count; id++) {
+		if (hierarchy->supers[id] == NO_TYPE) number_subtree(&numbering, children_start, children, id, &counter, stack, next);
+	}
+	// Anything left is on a superclass cycle
+	for (id = 0; id < count; id++) {
+		if (hierarchy->preorder[id] == UNNUMBERED) number_subtree(&numbering, children_start, children, id, &counter, stack, next);
+	}
+	free(stack);
+	free(next);
+	free(children_start);
+	free(children);
+
+	build_adjacency(count, hierarchy->edges, hierarchy->edges + 1, hierarchy->edges_count, 2, &numbering.subtypes_start,
+			&numbering.subtypes);
+	for (id = 0; id < count; id++) {
+		if (numbering.state[id] == 0) merge_ranges(&numbering, id);
+	}
+
+	free(numbering.end);
+	free(numbering.subtypes_start);
+	free(numbering.subtypes);
+	free(numbering.state);
+	free(numbering.scratch);
+}
+
+bool is_subtype(const Hierarchy *hierarchy, TypeId sub, TypeId super) {
+	const uint32_t position = hierarchy->preorder[sub];
+	uint32_t count;
+	const TypeRange *ranges = subtype_ranges(hierarchy, super, &count);
+	if (count == 1) return position >= ranges[0].first && position < ranges[0].end;
+
+	// Find the last range starting at or before position
+	uint32_t low = 0, high = count;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if (ranges[middle].first <= position) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low > 0 && position < ranges[low - 1].end;
+}
@@ -0,0 +1,98 @@
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+#include "class.h"
+#include "symtab.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The class hierarchy of a set of classes. Type names are interned into dense ids, then build_hierarchy numbers the superclass
+ * forest depth first, so the subclasses of any type are one contiguous preorder range. Interfaces add the ranges of everything
+ * that implements or extends them, merged, so every subtype query is a range lookup: one comparison for a class, a binary
+ * search over a handful of ranges for an interface. */
+
+typedef SymbolId TypeId;
+
+#define NO_TYPE NO_SYMBOL
+
+/* What we know about a type: only its name, if it was merely referred to */
+typedef enum {
+	TYPE_UNDECLARED,
+	TYPE_CLASS,
+	TYPE_INTERFACE
+} TypeKind;
+
+/* A class's place in the hierarchy, copied out of the Class so it outlives it. One malloc'd block; free() it. */
+typedef struct {
+	uint16_t flags;
+	uint16_t interfaces_count;
+	String name;
+	String super;       // length 0 for java/lang/Object
+	String interfaces[];
+} TypeDecl;
+
+/* A run of preorder numbers, end exclusive */
+typedef struct {
+	uint32_t first;
+	uint32_t end;
+} TypeRange;
+
+typedef struct {
+	Symtab names;
+	uint32_t types_known;    // ids below this have their supers and kinds set
+	uint32_t types_capacity;
+	TypeId *supers;       // by id; NO_TYPE for roots
+	uint8_t *kinds;       // by id; a TypeKind
+	TypeId *edges;        // (interface, subtype) pairs from interfaces tables
+	size_t edges_count;
+	size_t edges_capacity;
+
+	// Filled in by build_hierarchy
+	uint32_t *preorder;   // by id
+	TypeId *order;        // by preorder number
+	uint32_t *first_range; // by id, into ranges
+	uint32_t *ranges_count; // by id
+	TypeRange *ranges;
+	size_t ranges_length;
+} Hierarchy;
+
+/* Copy class's name, flags, superclass and interfaces. Returns NULL if class has no resolvable name. */
+TypeDecl *describe_type(const Class *class);
+
+void init_hierarchy(Hierarchy *hierarchy);
+void free_hierarchy(Hierarchy *hierarchy);
+
+/* Declare decl's type and its edges. A type declared twice keeps its first declaration, as the first on a classpath wins. */
+void add_type(Hierarchy *hierarchy, const TypeDecl *decl);
+
+/* Number the types added so far; must be called before querying, and again after adding more */
+void build_hierarchy(Hierarchy *hierarchy);
+
+/* Return the id of the type named by length bytes at name, or NO_TYPE if it was never mentioned */
+static inline TypeId find_type(const Hierarchy *hierarchy, const char *name, size_t length) {
+	return find_symbol(&hierarchy->names, name, length);
+}
+
+static inline String type_name(const Hierarchy *hierarchy, TypeId id) {
+	return symbol_string(&hierarchy->names, id);
+}
+
+static inline uint32_t types_count(const Hierarchy *hierarchy) {
+	return hierarchy->names.count;
+}
+
+/* Return the type with the given preorder number */
+static inline TypeId type_at(const Hierarchy *hierarchy, uint32_t preorder) {
+	return hierarchy->order[preorder];
+}
+
+/* Return the preorder ranges holding type and every type that extends or implements it, directly or not. Sorted and disjoint. */
+static inline const TypeRange *subtype_ranges(const Hierarchy *hierarchy, TypeId type, uint32_t *count) {
+	*count = hierarchy->ranges_count[type];
+	return hierarchy->ranges + hierarchy->first_range[type];
+}
+
+/* Return true if sub is super or extends or implements it, directly or not */
+bool is_subtype(const Hierarchy *hierarchy, TypeId sub, TypeId super);
+
+#endif //HIERARCHY_H
@@ -0,0 +1,173 @@
+#include "intern.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	SHARD_BITS = 6,
+	SHARDS = 1 << SHARD_BITS,
+	INITIAL_SHARD_SLOTS = 256,
+	PAGE_BITS = 12,
+	PAGE_SIZE = 1 << PAGE_BITS,
+	MAX_PAGES = 1 << 16
+};
+
+static const char *WELL_KNOWN_NAMES[WELL_KNOWN_SYMBOLS] = {
+	"Code", "ConstantValue", "Exceptions", "InnerClasses", "Signature", "SourceFile", "<init>", "<clinit>", "java/lang/Object"
+};
+
+/* An open addressing index slot: the string's hash, and its id + 1, or 0 if empty */
+typedef struct {
+	uint32_t hash;
+	uint32_t id;
+} ShardSlot;
+
+/* One lock's worth of the index. A string always hashes to the same shard, so interning it only takes that shard's lock. */
+typedef struct {
+	pthread_mutex_t lock;
+	Arena *arena;   // the interned bytes
+	ShardSlot *slots;
+	uint32_t slots_mask;
+	uint32_t count;
+} Shard;
+
+/* Strings are stored by id in fixed size pages, so a page never moves once published and lookups by id take no lock */
+static struct {
+	pthread_once_t once;
+	Shard shards[SHARDS];
+	String *pages[MAX_PAGES];
+	uint32_t count;
+} interner = {PTHREAD_ONCE_INIT};
+
+static String *string_slot(SymbolId id) {
+	String **page = interner.pages + (id >> PAGE_BITS);
+	String *strings = __atomic_load_n(page, __ATOMIC_ACQUIRE);
+	if (strings == NULL) {
+		String *fresh = calloc(PAGE_SIZE, sizeof(String));
+		if (__atomic_compare_exchange_n(page, &strings, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			strings = fresh;
+		} else {
+			// Another shard published this page first
+			free(fresh);
+		}
+	}
+	return strings + (id & (PAGE_SIZE - 1));
+}
+
+/* Double shard's index, keeping it at most half full. Called with the shard locked. */
+static void grow_shard(Shard *shard) {
+	uint32_t capacity = (shard->slots_mask + 1) * 2;
+	ShardSlot *slots = calloc(capacity, sizeof(ShardSlot));
+	uint32_t i;
+	for (i = 0; i <= shard->slots_mask; i++) {
+		if (shard->slots[i].id == 0) continue;
+		uint32_t j = shard->slots[i].hash & (capacity - 1);
+		while (slots[j].id != 0) j = (j + 1) & (capacity - 1);
+		slots[j] = shard->slots[i];
+	}
+	free(shard->slots);
+	shard->slots = slots;
+	shard->slots_mask = capacity - 1;
+}
+
+/* Return the slot holding the given string, or the empty slot it would go in. Called with the shard locked. */
+static ShardSlot *find_shard_slot(const Shard *shard, const char *value, size_t length, uint32_t hash) {
+	uint32_t i = hash & shard->slots_mask;
+	for (;;) {
+		ShardSlot *slot = shard->slots + i;
+		if (slot->id == 0) return slot;
+		if (slot->hash == hash) {
+			const String *string = interner.pages[(slot->id - 1) >> PAGE_BITS] + ((slot->id - 1) & (PAGE_SIZE - 1));
+			if (string->length == length && memcmp(string->value, value, length) == 0) return slot;
+		}
+		i = (i + 1) & shard->slots_mask;
+	}
+}
+
+static SymbolId intern_hashed(const char *value, uint16_t length, uint32_t hash) {
+	Shard *shard = interner.shards + (hash >> (32 - SHARD_BITS));
+	pthread_mutex_lock(&shard->lock);
+	ShardSlot *slot = find_shard_slot(shard, value, length, hash);
+	if (slot->id == 0) {
+		SymbolId id = __atomic_fetch_add(&interner.count, 1, __ATOMIC_RELAXED);
+		if (id >> PAGE_BITS >= MAX_PAGES) {
+			fprintf(stderr, "Too many interned strings\n");
+			abort();
+		}
+		char *copy = arena_alloc(shard->arena, length > 0 ? length : 1);
+		memcpy(copy, value, length);
+		String *string = string_slot(id);
+		string->length = length;
+		string->value = copy;
+		slot->hash = hash;
+		slot->id = id + 1;
+		if (++shard->count * 2 > shard->slots_mask + 1) grow_shard(shard);
+		pthread_mutex_unlock(&shard->lock);
+		return id;
+	}
+	SymbolId id = slot->id - 1;
+	pthread_mutex_unlock(&shard->lock);
+	return id;
+}
+
+static void init_interner(void) {
+	int i;
+	for (i = 0; i < SHARDS; i++) {
+		Shard *shard = interner.shards + i;
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->arena = create_arena(0);
+		shard->slots = calloc(INITIAL_SHARD_SLOTS, sizeof(ShardSlot));
+		shard->slots_mask = INITIAL_SHARD_SLOTS - 1;
+	}
+	for (i = 0; i < WELL_KNOWN_SYMBOLS; i++) {
+		intern_hashed(WELL_KNOWN_NAMES[i], strlen(WELL_KNOWN_NAMES[i]), hash_symbol(WELL_KNOWN_NAMES[i], strlen(WELL_KNOWN_NAMES[i])));
+	}
+}
+
+SymbolId intern_string(const char *value, uint16_t length) {
+	pthread_once(&interner.once, init_interner);
+	return intern_hashed(value, length, hash_symbol(value, length));
+}
+
+SymbolId find_interned(const char *value, size_t length) {
+	if (length > UINT16_MAX) return NO_SYMBOL;
+	pthread_once(&interner.once, init_interner);
+	uint32_t hash = hash_symbol(value, length);
+	Shard *shard = interner.shards + (hash >> (32 - SHARD_BITS));
+	pthread_mutex_lock(&shard->lock);
+	ShardSlot *slot = find_shard_slot(shard, value, length, hash);
+	SymbolId id = slot->id != 0 ? slot->id - 1 : NO_SYMBOL;
+	pthread_mutex_unlock(&shard->lock);
+	return id;
+}
+
+String interned_string(SymbolId id) {
+	return interner.pages[id >> PAGE_BITS][id & (PAGE_SIZE - 1)];
+}
+
+uint32_t interned_count(void) {
+	pthread_once(&interner.once, init_interner);
+	return __atomic_load_n(&interner.count, __ATOMIC_RELAXED);
+}
+
+void intern_constants(Class *class) {
+	class->symbols = arena_alloc(class->arena, (size_t) class->const_pool_count * sizeof(SymbolId));
+	class->symbols[0] = NO_SYMBOL;
+	uint16_t i;
+	for (i = 1; i < class->const_pool_count; i++) {
+		if (class->tags[i] != STRING_UTF8) {
+			class->symbols[i] = NO_SYMBOL;
+			continue;
+		}
+		String *string = class->strings + class->payloads[i];
+		class->symbols[i] = intern_string(string->value, string->length);
+		*string = interned_string(class->symbols[i]);
+	}
+}
+
+SymbolId constant_symbol(const Class *class, uint16_t cp_idx) {
+	if (class->symbols != NULL) return cp_idx < class->const_pool_count ? class->symbols[cp_idx] : NO_SYMBOL;
+	const String *string = get_utf8(class, cp_idx);
+	return string != NULL ? intern_string(string->value, string->length) : NO_SYMBOL;
+}
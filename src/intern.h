@@ -0,0 +1,46 @@
+#ifndef INTERN_H
+#define INTERN_H
+#include "class.h"
+#include "symtab.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* The process-wide interner. Any thread may intern a modified UTF-8 string and gets back the same id as every other thread
+ * that interns the same bytes, for the life of the process. Ids are dense, so they can index arrays, and the interned bytes
+ * are never freed, so Strings from interned_string stay valid even after the class they came from is gone. */
+
+/* Interned before anything else, so their ids are the same constants in every run */
+typedef enum {
+	SYMBOL_CODE,
+	SYMBOL_CONSTANT_VALUE,
+	SYMBOL_EXCEPTIONS,
+	SYMBOL_INNER_CLASSES,
+	SYMBOL_SIGNATURE,
+	SYMBOL_SOURCE_FILE,
+	SYMBOL_INIT,
+	SYMBOL_CLINIT,
+	SYMBOL_OBJECT,
+	WELL_KNOWN_SYMBOLS
+} WellKnownSymbol;
+
+/* Return the global id of the length bytes at value, interning them if they are new. Thread safe. */
+SymbolId intern_string(const char *value, uint16_t length);
+
+/* Return the global id of the length bytes at value, or NO_SYMBOL if no thread has interned them. Thread safe. */
+SymbolId find_interned(const char *value, size_t length);
+
+/* Return the string with the given id. The id must have come from this thread, or have been handed over with some
+ * synchronisation such as a lock or a thread join, as it always is when it was read from a Class. */
+String interned_string(SymbolId id);
+
+/* Return how many strings have been interned so far */
+uint32_t interned_count(void);
+
+/* Return the global id of the UTF-8 constant at cp_idx, interning it now unless class was read with ParseOptions.intern.
+ * Returns NO_SYMBOL if there is no such constant. */
+SymbolId constant_symbol(const Class *class, uint16_t cp_idx);
+
+/* Intern every UTF-8 constant of class, filling class->symbols and pointing each constant's String at the shared copy */
+void intern_constants(Class *class);
+
+#endif //INTERN_H
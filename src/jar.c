@@ -0,0 +1,277 @@
+#include "jar.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+enum ZIP_RECORDS {
+	LOCAL_HEADER_SIG   = 0x04034b50,
+	CENTRAL_HEADER_SIG = 0x02014b50,
+	EOCD_SIG           = 0x06054b50,
+	EOCD64_LOCATOR_SIG = 0x07064b50,
+	EOCD64_SIG         = 0x06064b50,
+	ZIP64_EXTRA_ID     = 0x0001,
+
+	LOCAL_HEADER_SIZE   = 30,
+	CENTRAL_HEADER_SIZE = 46,
+	EOCD_SIZE           = 22,
+	EOCD64_LOCATOR_SIZE = 20,
+	EOCD64_SIZE         = 56,
+	MAX_COMMENT_SIZE    = 0xffff
+};
+
+enum INFLATE_LIMITS {
+	/* Deflate can't expand input by more than about 1032 to 1, so a larger size in the header is a lie */
+	MAX_DEFLATE_RATIO = 1032,
+
+	/* No plausible class inflates to more than this, whatever its header claims */
+	MAX_INFLATED_SIZE = 256 << 20
+};
+
+/* Zip fields are little endian, unlike everything in a class file */
+static inline uint16_t le16(const uint8_t *p) {
+	return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t *p) {
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline uint64_t le64(const uint8_t *p) {
+	return (uint64_t) le32(p) | (uint64_t) le32(p + 4) << 32;
+}
+
+/* Find the end of central directory record by scanning backwards over any trailing comment */
+static const uint8_t *find_eocd(const uint8_t *image, size_t length) {
+	if (length < EOCD_SIZE) return NULL;
+	size_t lowest = length > EOCD_SIZE + MAX_COMMENT_SIZE ? length - EOCD_SIZE - MAX_COMMENT_SIZE : 0;
+	size_t offset = length - EOCD_SIZE;
+	while (true) {
+		if (le32(image + offset) == EOCD_SIG) return image + offset;
+		if (offset == lowest) return NULL;
+		offset--;
+	}
+}
+
+Jar *open_jar(char *file_name) {
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open '%s': %s\n", file_name, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Skipping '%s': not a regular file\n", file_name);
+		close(fd);
+		return NULL;
+	}
+	const size_t length = st.st_size;
+	uint8_t *image = length > 0 ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "Could not map '%s': %s\n", file_name, length > 0 ? strerror(errno) : "empty file");
+		return NULL;
+	}
+
+	const uint8_t *eocd = find_eocd(image, length);
+	if (eocd == NULL) {
+		fprintf(stderr, "Skipping '%s': not a valid jar/zip file\n", file_name);
+		munmap(image, length);
+		return NULL;
+	}
+	uint64_t entries_count = le16(eocd + 10);
+	uint64_t cd_length = le32(eocd + 12);
+	uint64_t cd_offset = le32(eocd + 16);
+
+	// Archives with more than 65535 entries or over 4GB keep the real values in the zip64 record
+	const size_t eocd_offset = eocd - image;
+	if (eocd_offset >= EOCD64_LOCATOR_SIZE && le32(eocd - EOCD64_LOCATOR_SIZE) == EOCD64_LOCATOR_SIG) {
+		uint64_t eocd64_offset = le64(eocd - EOCD64_LOCATOR_SIZE + 8);
+		if (length >= EOCD64_SIZE && eocd64_offset <= length - EOCD64_SIZE && le32(image + eocd64_offset) == EOCD64_SIG) {
+			const uint8_t *eocd64 = image + eocd64_offset;
+			entries_count = le64(eocd64 + 32);
+			cd_length = le64(eocd64 + 40);
+			cd_offset = le64(eocd64 + 48);
+		}
+	}
+	if (cd_offset > length || cd_length > length - cd_offset) {
+		fprintf(stderr, "Skipping '%s': central directory is out of bounds\n", file_name);
+		munmap(image, length);
+		return NULL;
+	}
+
+	Jar *jar = malloc(sizeof(Jar));
+	jar->file_name = file_name;
+	jar->image = image;
+	jar->image_length = length;
+	jar->central_dir = image + cd_offset;
+	jar->central_dir_length = cd_length;
+	jar->entries_count = entries_count;
+	return jar;
+}
+
+void close_jar(Jar *jar) {
+	if (jar == NULL) return;
+	munmap((void *) jar->image, jar->image_length);
+	free(jar);
+}
+
+bool is_jar_name(const char *file_name) {
+	size_t length = strlen(file_name);
+	return length > 4 && (strcasecmp(file_name + length - 4, ".jar") == 0 || strcasecmp(file_name + length - 4, ".zip") == 0);
+}
+
+JarIterator jar_iterator(const Jar *jar) {
+	JarIterator it = {jar, 0, 0};
+	return it;
+}
+
+/* Apply the zip64 extended information extra field, which only carries the values whose 32-bit slots are saturated */
+static void read_zip64_extra(const uint8_t *extra, uint16_t extra_length, JarEntry *entry) {
+	size_t offset = 0;
+	while (offset + 4 <= extra_length) {
+		uint16_t id = le16(extra + offset);
+		uint16_t size = le16(extra + offset + 2);
+		const uint8_t *data = extra + offset + 4;
+		const uint8_t *data_end = data + (offset + 4 + size <= extra_length ? size : 0);
+		if (id == ZIP64_EXTRA_ID) {
+			if (entry->size == 0xffffffff && data + 8 <= data_end) {
+				entry->size = le64(data);
+				data += 8;
+			}
+			if (entry->compressed_size == 0xffffffff && data + 8 <= data_end) {
+				entry->compressed_size = le64(data);
+				data += 8;
+			}
+			if (entry->local_header_offset == 0xffffffff && data + 8 <= data_end) {
+				entry->local_header_offset = le64(data);
+			}
+			return;
+		}
+		offset += 4 + size;
+	}
+}
+
+bool next_class_entry(JarIterator *it, JarEntry *entry) {
+	const Jar *jar = it->jar;
+	while (it->index < jar->entries_count) {
+		if (jar->central_dir_length - it->offset < CENTRAL_HEADER_SIZE) return false;
+		const uint8_t *header = jar->central_dir + it->offset;
+		if (le32(header) != CENTRAL_HEADER_SIG) return false;
+
+		uint16_t name_length = le16(header + 28);
+		uint16_t extra_length = le16(header + 30);
+		uint16_t comment_length = le16(header + 32);
+		size_t record_length = CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+		if (jar->central_dir_length - it->offset < record_length) return false;
+
+		it->offset += record_length;
+		it->index++;
+
+		const char *name = (const char *) header + CENTRAL_HEADER_SIZE;
+		if (name_length < 6 || memcmp(name + name_length - 6, ".class", 6) != 0) continue;
+
+		entry->name = name;
+		entry->name_length = name_length;
+		entry->method = le16(header + 10);
+		entry->compressed_size = le32(header + 20);
+		entry->size = le32(header + 24);
+		entry->local_header_offset = le32(header + 42);
+		read_zip64_extra(header + CENTRAL_HEADER_SIZE + name_length, extra_length, entry);
+		return true;
+	}
+	return false;
+}
+
+const uint8_t *jar_entry_data(const Jar *jar, const JarEntry *entry) {
+	if (jar->image_length < LOCAL_HEADER_SIZE || entry->local_header_offset > jar->image_length - LOCAL_HEADER_SIZE) return NULL;
+	const uint8_t *header = jar->image + entry->local_header_offset;
+	if (le32(header) != LOCAL_HEADER_SIG) return NULL;
+
+	// The local name and extra field lengths may differ from the central directory's
+	uint64_t data_offset = entry->local_header_offset + LOCAL_HEADER_SIZE + le16(header + 26) + le16(header + 28);
+	if (data_offset > jar->image_length || entry->compressed_size > jar->image_length - data_offset) return NULL;
+	return jar->image + data_offset;
+}
+
+const uint8_t *read_jar_entry(const Jar *jar, const JarEntry *entry, size_t *length, bool *owned) {
+	*owned = false;
+	if (entry->method == ZIP_DEFLATED) {
+		if (entry->size > MAX_INFLATED_SIZE) return NULL;
+		// compressed_size is below MAX_INFLATED_SIZE when this multiplies, so it can't overflow
+		if (entry->size > entry->compressed_size && entry->size > entry->compressed_size * MAX_DEFLATE_RATIO) return NULL;
+	} else if (entry->method != ZIP_STORED) {
+		return NULL;
+	}
+	const uint8_t *data = jar_entry_data(jar, entry);
+	if (data == NULL) return NULL;
+
+	if (entry->method == ZIP_STORED) {
+		*length = entry->compressed_size;
+		return data;
+	} else if (entry->compressed_size > UINT32_MAX) {
+		return NULL;
+	}
+
+	uint8_t *out = malloc(entry->size > 0 ? entry->size : 1);
+	if (out == NULL) {
+		fprintf(stderr, "Out of memory inflating a %llu byte jar entry\n", (unsigned long long) entry->size);
+		abort();
+	}
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) { // raw deflate, no zlib header
+		free(out);
+		return NULL;
+	}
+	stream.next_in = (Bytef *) data;
+	stream.avail_in = entry->compressed_size;
+	stream.next_out = out;
+	stream.avail_out = entry->size;
+	int status = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	if (status != Z_STREAM_END || stream.total_out != entry->size) {
+		free(out);
+		return NULL;
+	}
+	*length = entry->size;
+	*owned = true;
+	return out;
+}
+
+Class *read_class_from_jar_entry(const Jar *jar, const JarEntry *entry, char *file_name, const ParseOptions *options) {
+	size_t length;
+	bool owned;
+	uint64_t started = stats_clock();
+	const uint8_t *image = read_jar_entry(jar, entry, &length, &owned);
+	if (image == NULL) {
+		fprintf(stderr, "Skipping '%s': unsupported or corrupt jar entry\n", file_name);
+		return NULL;
+	}
+	started = record_phase(PHASE_OPEN, started);
+	bool valid = is_class_image(image, length);
+	record_phase(PHASE_IS_CLASS, started);
+	if (!valid) {
+		fprintf(stderr, "Skipping '%s': not a valid class file\n", file_name);
+		if (owned) free((void *) image);
+		return NULL;
+	}
+
+	Class *class = read_class_from_buffer(file_name, image, length, options);
+	if (class == NULL) {
+		fprintf(stderr, "Parsing aborted; invalid class file contents: %s\n", file_name);
+		if (owned) free((void *) image);
+		return NULL;
+	}
+	if (owned) class->image_source = IMAGE_HEAP;
+	return class;
+}
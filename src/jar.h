@@ -0,0 +1,68 @@
+#ifndef JAR_H
+#define JAR_H
+#include "class.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compression methods we can extract; see section 4.4.5 of PKWARE's APPNOTE.TXT */
+typedef enum {
+	ZIP_STORED   = 0,
+	ZIP_DEFLATED = 8
+} ZipMethod;
+
+/* A mapped .jar/.zip file and the location of its central directory */
+typedef struct {
+	char *file_name;
+	const uint8_t *image;
+	size_t image_length;
+	const uint8_t *central_dir;
+	size_t central_dir_length;
+	uint64_t entries_count;
+} Jar;
+
+/* One central directory record. name points into the jar's mapping and is NOT NUL-terminated. */
+typedef struct {
+	const char *name;
+	uint16_t name_length;
+	uint16_t method;
+	uint64_t compressed_size;
+	uint64_t size;
+	uint64_t local_header_offset;
+} JarEntry;
+
+/* Walks the central directory in order without allocating */
+typedef struct {
+	const Jar *jar;
+	uint64_t index;
+	size_t offset;
+} JarIterator;
+
+/* Map file_name and locate its central directory. Returns NULL, after reporting why on stderr, if it isn't a readable zip file. */
+Jar *open_jar(char *file_name);
+
+/* Unmap and free jar. Classes decoded from stored entries point into the mapping, so free them first. */
+void close_jar(Jar *jar);
+
+/* Return true if file_name ends in .jar or .zip */
+bool is_jar_name(const char *file_name);
+
+/* Return an iterator positioned before the first central directory entry of jar */
+JarIterator jar_iterator(const Jar *jar);
+
+/* Advance it to the next entry whose name ends in .class and store it in entry. Returns false when there are no more. */
+bool next_class_entry(JarIterator *it, JarEntry *entry);
+
+/* Return where entry's compressed_size bytes of stored or deflated data start in the mapping, or NULL if they don't fit */
+const uint8_t *jar_entry_data(const Jar *jar, const JarEntry *entry);
+
+/* Return entry's uncompressed bytes and store their count in length, or NULL if the entry is corrupt, uses an unsupported method
+ * or claims a size no deflate stream of its compressed size could reach.
+ * Stored entries point straight into the mapping; deflated entries are inflated into a buffer the caller must free.
+ * owned is set to tell the two apart. */
+const uint8_t *read_jar_entry(const Jar *jar, const JarEntry *entry, size_t *length, bool *owned);
+
+/* Decode entry as a class named file_name, which must outlive the Class. Reports failures on stderr and returns NULL. */
+Class *read_class_from_jar_entry(const Jar *jar, const JarEntry *entry, char *file_name, const ParseOptions *options);
+
+#endif //JAR_H
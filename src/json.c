@@ -0,0 +1,343 @@
+#include "json.h"
+#include <math.h>
+#include "mutf8.h"
+#include <stdio.h>
+
+void init_json_writer(JsonWriter *writer, Buffer *out) {
+	writer->out = out;
+	writer->depth = 0;
+	writer->first[0] = true;
+	writer->after_key = false;
+}
+
+/* Emit the comma that separates this value from the previous one in the same container, if any */
+static inline void begin_value(JsonWriter *writer) {
+	if (writer->after_key) {
+		writer->after_key = false;
+	} else if (!writer->first[writer->depth]) {
+		append_char(writer->out, ',');
+	}
+	writer->first[writer->depth] = false;
+}
+
+static void open_container(JsonWriter *writer, char c) {
+	begin_value(writer);
+	append_char(writer->out, c);
+	if (writer->depth < JSON_MAX_DEPTH - 1) writer->depth++;
+	writer->first[writer->depth] = true;
+}
+
+static void close_container(JsonWriter *writer, char c) {
+	if (writer->depth > 0) writer->depth--;
+	append_char(writer->out, c);
+}
+
+void json_begin_object(JsonWriter *writer) {
+	open_container(writer, '{');
+}
+
+void json_end_object(JsonWriter *writer) {
+	close_container(writer, '}');
+}
+
+void json_begin_array(JsonWriter *writer) {
+	open_container(writer, '[');
+}
+
+void json_end_array(JsonWriter *writer) {
+	close_container(writer, ']');
+}
+
+void json_key(JsonWriter *writer, const char *key) {
+	json_cstring(writer, key);
+	append_char(writer->out, ':');
+	writer->after_key = true;
+}
+
+void json_string(JsonWriter *writer, const char *value, size_t length) {
+	static const char hex[] = "0123456789abcdef";
+	begin_value(writer);
+	Buffer *out = writer->out;
+	append_char(out, '"');
+	size_t start = 0, i;
+	for (i = 0; i < length; i++) {
+		unsigned char c = value[i];
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+		// Copy the clean run, then the escape
+		append_chars(out, value + start, i - start);
+		start = i + 1;
+		switch (c) {
+			case '"': append_chars(out, "\\\"", 2); break;
+			case '\\': append_chars(out, "\\\\", 2); break;
+			case '\n': append_chars(out, "\\n", 2); break;
+			case '\r': append_chars(out, "\\r", 2); break;
+			case '\t': append_chars(out, "\\t", 2); break;
+			default: {
+				char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+				append_chars(out, escape, sizeof(escape));
+			}
+		}
+	}
+	append_chars(out, value + start, length - start);
+	append_char(out, '"');
+}
+
+void json_mutf8(JsonWriter *writer, const char *value, size_t length) {
+	if (count_ascii(value, length) == length) {
+		json_string(writer, value, length);
+		return;
+	}
+	Buffer decoded;
+	init_buffer(&decoded, NULL, length + 16);
+	decode_mutf8(&decoded, value, length);
+	json_string(writer, decoded.data, decoded.length);
+	free_buffer(&decoded);
+}
+
+void json_cstring(JsonWriter *writer, const char *value) {
+	json_string(writer, value, strlen(value));
+}
+
+void json_int(JsonWriter *writer, int64_t value) {
+	begin_value(writer);
+	append_int(writer->out, value);
+}
+
+void json_uint(JsonWriter *writer, uint64_t value) {
+	begin_value(writer);
+	append_uint(writer->out, value);
+}
+
+void json_double(JsonWriter *writer, double value) {
+	if (!isfinite(value)) {
+		json_null(writer);
+		return;
+	}
+	begin_value(writer);
+	char *p = reserve(writer->out, 32);
+	writer->out->length += snprintf(p, 32, "%.17g", value);
+}
+
+void json_bool(JsonWriter *writer, bool value) {
+	begin_value(writer);
+	append_string(writer->out, value ? "true" : "false");
+}
+
+void json_null(JsonWriter *writer) {
+	begin_value(writer);
+	append_chars(writer->out, "null", 4);
+}
+
+/* Write the UTF-8 constant at cp_idx as a string, or null if there isn't one */
+static void json_utf8(JsonWriter *writer, const Class *class, uint16_t cp_idx) {
+	const String *string = get_utf8(class, cp_idx);
+	if (string != NULL) {
+		json_mutf8(writer, string->value, string->length);
+	} else {
+		json_null(writer);
+	}
+}
+
+/* Write the name of the Class constant at cp_idx, or null */
+static void json_class_name(JsonWriter *writer, const Class *class, uint16_t cp_idx) {
+	const String *string = get_class_name(class, cp_idx);
+	if (string != NULL) {
+		json_mutf8(writer, string->value, string->length);
+	} else {
+		json_null(writer);
+	}
+}
+
+/* Write the name and descriptor of the NameAndType constant at cp_idx as two members */
+static void json_name_and_type(JsonWriter *writer, const Class *class, uint16_t cp_idx) {
+	bool valid = get_tag(class, cp_idx) == NAME;
+	const Ref nat = valid ? get_ref(class, cp_idx) : (Ref) {0, 0};
+	json_key(writer, "name");
+	json_utf8(writer, class, nat.class_idx);
+	json_key(writer, "descriptor");
+	json_utf8(writer, class, nat.name_idx);
+}
+
+static void json_constant(JsonWriter *writer, const Class *class, uint16_t cp_idx, const Item *item) {
+	json_begin_object(writer);
+	json_key(writer, "index");
+	json_uint(writer, cp_idx);
+	json_key(writer, "tag");
+	json_cstring(writer, tag2str(item->tag));
+	switch (item->tag) {
+		case STRING_UTF8:
+			json_key(writer, "value");
+			json_mutf8(writer, item->value.string.value, item->value.string.length);
+			break;
+		case INTEGER:
+			json_key(writer, "value");
+			json_int(writer, item->value.integer);
+			break;
+		case FLOAT:
+			json_key(writer, "value");
+			json_double(writer, item->value.flt);
+			break;
+		case LONG:
+			json_key(writer, "value");
+			json_int(writer, to_long(item->value.lng));
+			break;
+		case DOUBLE:
+			json_key(writer, "value");
+			json_double(writer, to_double(item->value.dbl));
+			break;
+		case CLASS:
+			json_key(writer, "name_idx");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "name");
+			json_utf8(writer, class, item->value.ref.class_idx);
+			break;
+		case STRING:
+			json_key(writer, "string_idx");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "value");
+			json_utf8(writer, class, item->value.ref.class_idx);
+			break;
+		case FIELD:
+		case METHOD:
+		case INTERFACE_METHOD:
+			json_key(writer, "class_idx");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "name_and_type_idx");
+			json_uint(writer, item->value.ref.name_idx);
+			json_key(writer, "class");
+			json_class_name(writer, class, item->value.ref.class_idx);
+			json_name_and_type(writer, class, item->value.ref.name_idx);
+			break;
+		case NAME:
+			json_key(writer, "name_idx");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "descriptor_idx");
+			json_uint(writer, item->value.ref.name_idx);
+			json_key(writer, "name");
+			json_utf8(writer, class, item->value.ref.class_idx);
+			json_key(writer, "descriptor");
+			json_utf8(writer, class, item->value.ref.name_idx);
+			break;
+		case METHOD_HANDLE:
+			json_key(writer, "reference_kind");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "reference_idx");
+			json_uint(writer, item->value.ref.name_idx);
+			break;
+		case METHOD_TYPE:
+			json_key(writer, "descriptor_idx");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "descriptor");
+			json_utf8(writer, class, item->value.ref.class_idx);
+			break;
+		case DYNAMIC:
+		case INVOKE_DYNAMIC:
+			json_key(writer, "bootstrap_method_attr_idx");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "name_and_type_idx");
+			json_uint(writer, item->value.ref.name_idx);
+			json_name_and_type(writer, class, item->value.ref.name_idx);
+			break;
+		case MODULE:
+		case PACKAGE:
+			json_key(writer, "name_idx");
+			json_uint(writer, item->value.ref.class_idx);
+			json_key(writer, "name");
+			json_utf8(writer, class, item->value.ref.class_idx);
+			break;
+	}
+	json_end_object(writer);
+}
+
+static void json_attributes(JsonWriter *writer, const Class *class, const Attribute *attrs, uint16_t attrs_count) {
+	json_key(writer, "attributes");
+	json_begin_array(writer);
+	uint16_t idx;
+	for (idx = 0; idx < attrs_count; idx++) {
+		json_begin_object(writer);
+		json_key(writer, "name");
+		json_utf8(writer, class, attrs[idx].name_idx);
+		json_key(writer, "length");
+		json_uint(writer, attrs[idx].length);
+		json_end_object(writer);
+	}
+	json_end_array(writer);
+}
+
+/* Fields and methods share a layout */
+static void json_member(JsonWriter *writer, const Class *class, uint16_t flags, uint16_t name_idx, uint16_t desc_idx,
+		const Attribute *attrs, uint16_t attrs_count) {
+	json_begin_object(writer);
+	json_key(writer, "access_flags");
+	json_uint(writer, flags);
+	json_key(writer, "name");
+	json_utf8(writer, class, name_idx);
+	json_key(writer, "descriptor");
+	json_utf8(writer, class, desc_idx);
+	json_attributes(writer, class, attrs, attrs_count);
+	json_end_object(writer);
+}
+
+void format_class_json(Buffer *out, const Class *class) {
+	JsonWriter writer;
+	JsonWriter *w = &writer;
+	init_json_writer(w, out);
+
+	json_begin_object(w);
+	json_key(w, "file");
+	json_cstring(w, class->file_name);
+	json_key(w, "minor_version");
+	json_uint(w, class->minor_version);
+	json_key(w, "major_version");
+	json_uint(w, class->major_version);
+	json_key(w, "constant_pool_count");
+	json_uint(w, class->const_pool_count);
+
+	json_key(w, "constant_pool");
+	json_begin_array(w);
+	uint16_t i = 1;
+	while (i < class->const_pool_count) {
+		const Item item = get_item(class, i);
+		json_constant(w, class, i, &item);
+		// 8-byte constants take 2 pool entries
+		i += (item.tag == LONG || item.tag == DOUBLE) ? 2 : 1;
+	}
+	json_end_array(w);
+
+	json_key(w, "access_flags");
+	json_uint(w, class->flags);
+	json_key(w, "this_class");
+	json_class_name(w, class, class->this_class);
+	json_key(w, "super_class");
+	json_class_name(w, class, class->super_class);
+
+	json_key(w, "interfaces");
+	json_begin_array(w);
+	uint16_t idx;
+	for (idx = 0; idx < class->interfaces_count; idx++) {
+		json_class_name(w, class, class->interfaces[idx].class_idx);
+	}
+	json_end_array(w);
+
+	if (!class->skimmed) {
+		json_key(w, "fields");
+		json_begin_array(w);
+		for (idx = 0; idx < class->fields_count; idx++) {
+			const Field *f = class->fields + idx;
+			json_member(w, class, f->flags, f->name_idx, f->desc_idx, f->attrs, f->attrs_count);
+		}
+		json_end_array(w);
+
+		json_key(w, "methods");
+		json_begin_array(w);
+		for (idx = 0; idx < class->methods_count; idx++) {
+			const Method *m = class->methods + idx;
+			json_member(w, class, m->flags, m->name_idx, m->desc_idx, m->attrs, m->attrs_count);
+		}
+		json_end_array(w);
+
+		json_attributes(w, class, class->attributes, class->attributes_count);
+	}
+	json_end_object(w);
+}
@@ -0,0 +1,49 @@
+#ifndef JSON_H
+#define JSON_H
+#include "buffer.h"
+#include "class.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+	JSON_MAX_DEPTH = 32
+};
+
+/* A streaming JSON writer. Values go straight into out as they're written; there is no document tree. The writer only tracks
+ * where commas are needed. */
+typedef struct {
+	Buffer *out;
+	int depth;
+	bool first[JSON_MAX_DEPTH]; // whether the container at each depth is still empty
+	bool after_key;
+} JsonWriter;
+
+void init_json_writer(JsonWriter *writer, Buffer *out);
+
+void json_begin_object(JsonWriter *writer);
+void json_end_object(JsonWriter *writer);
+void json_begin_array(JsonWriter *writer);
+void json_end_array(JsonWriter *writer);
+
+/* Write an object member's name; the next value written is its value */
+void json_key(JsonWriter *writer, const char *key);
+
+/* Write length bytes of UTF-8 as an escaped JSON string */
+void json_string(JsonWriter *writer, const char *value, size_t length);
+
+/* Write the length bytes of modified UTF-8 at value, a class file constant, as a string of standard UTF-8 */
+void json_mutf8(JsonWriter *writer, const char *value, size_t length);
+
+void json_cstring(JsonWriter *writer, const char *value);
+void json_int(JsonWriter *writer, int64_t value);
+void json_uint(JsonWriter *writer, uint64_t value);
+/* Non-finite values have no JSON representation and are written as null */
+void json_double(JsonWriter *writer, double value);
+void json_bool(JsonWriter *writer, bool value);
+void json_null(JsonWriter *writer);
+
+/* Write class as a single-line JSON object: header, resolved constant pool, interfaces, fields, methods and attributes */
+void format_class_json(Buffer *out, const Class *class);
+
+#endif //JSON_H
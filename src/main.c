@@ -1,52 +1,781 @@
+#include "cache.h"
+#include "callgraph.h"
 #include "class.h"
+#include "classpath.h"
+#include "diff.h"
 #include <endian.h>
 #include <errno.h>
+#include "filter.h"
+#include <getopt.h>
+#include "hierarchy.h"
+#include "jar.h"
+#include "json.h"
+#include "pool.h"
+#include "prefetch.h"
 #include "print.h"
+#include "snapshot.h"
+#include "stats.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "watch.h"
 
-int main(int argc, char *args[]) {
-	if (argc == 1) {
-		printf("Please pass at least 1 .class file to open");
-		exit(EXIT_FAILURE);
+/* How classes are written to stdout */
+typedef enum {
+	FORMAT_TEXT,   /* print_class's human readable listing */
+	FORMAT_JSON,   /* one JSON array holding an object per class */
+	FORMAT_NDJSON  /* one JSON object per class per line */
+} Format;
+
+/* Options with no short form */
+enum {
+	OPT_SUBTYPES = 256,
+	OPT_IS_SUBTYPE,
+	OPT_CALLGRAPH,
+	OPT_REACHABLE_FROM,
+	OPT_CLASSPATH,
+	OPT_WATCH,
+	OPT_FILTER,
+	OPT_STATS
+};
+
+/* Files read ahead of the workers, beyond one per worker */
+#define PREFETCH_WINDOW 64
+
+/* A question about the class hierarchy or call graph, answered once every class has been read */
+typedef struct {
+	int option;     // one of the OPT_ values above
+	char *argument; // a class name, "sub,super", a method, or NULL
+} Query;
+
+/* One class to decode: a file of its own, an entry of an open jar or a class of an open snapshot */
+typedef struct {
+	char *file_name;
+	Jar *jar;
+	JarEntry entry;
+	Snapshot *snapshot;
+	uint64_t snapshot_index;
+} Job;
+
+/* The keys one job added to a worker's CallSites */
+typedef struct {
+	int worker;
+	size_t first;
+	size_t count;
+} SiteRun;
+
+/* Every class named on the command line, expanded up front so they can be handed out to workers */
+typedef struct {
+	Job *jobs;
+	size_t jobs_count;
+	size_t jobs_capacity;
+	Jar **jars;
+	size_t jars_count;
+	Snapshot **snapshots;
+	size_t snapshots_count;
+	char **paths;     // file names found by walking directories and classpaths
+	size_t paths_count;
+	char **prefetch_paths; // by job, the names of class files for the prefetcher; NULL for jar entries and snapshot classes
+	Prefetcher *prefetcher;
+	SnapshotWriter *fragments; // one per job when saving a snapshot, merged in job order afterwards
+	Cache *cache;
+	TypeDecl **decls; // one per job when answering hierarchy queries instead of printing
+	CallSites *sites; // one per worker when answering call graph queries instead of printing
+	SiteRun *site_runs; // by job, where in sites its methods went
+	Stats *stats;     // with --stats, one per worker and a last one for the main thread
+	int workers;
+	ParseOptions options;
+	Format format;
+} Batch;
+
+static void add_job(Batch *batch, const Job job) {
+	if (batch->jobs_count == batch->jobs_capacity) {
+		batch->jobs_capacity = batch->jobs_capacity ? batch->jobs_capacity * 2 : 64;
+		batch->jobs = realloc(batch->jobs, batch->jobs_capacity * sizeof(Job));
 	}
+	batch->jobs[batch->jobs_count++] = job;
+}
 
-	int i;
-	for (i = 1; i < argc; i++) {
-		char *file_name = args[i];
-		FILE *file = fopen(file_name, "r");
+/* Queue every .class entry of the jar at file_name. The jar stays mapped until free_batch. */
+static void add_jar(Batch *batch, char *file_name) {
+	Jar *jar = open_jar(file_name);
+	if (jar == NULL) return;
+
+	batch->jars = realloc(batch->jars, (batch->jars_count + 1) * sizeof(Jar *));
+	batch->jars[batch->jars_count++] = jar;
+
+	JarIterator it = jar_iterator(jar);
+	Job job = {file_name, jar, {0}, NULL, 0};
+	while (next_class_entry(&it, &job.entry)) {
+		add_job(batch, job);
+	}
+}
+
+/* Queue every class of the snapshot at file_name. The snapshot stays mapped until free_batch. */
+static void add_snapshot(Batch *batch, char *file_name) {
+	Snapshot *snapshot = open_snapshot(file_name);
+	if (snapshot == NULL) return;
+
+	batch->snapshots = realloc(batch->snapshots, (batch->snapshots_count + 1) * sizeof(Snapshot *));
+	batch->snapshots[batch->snapshots_count++] = snapshot;
 
-		if (!file) {
-			printf("Could not open '%s': %s\n", file_name, strerror(errno));
-			continue;
+	Job job = {file_name, NULL, {0}, snapshot, 0};
+	for (job.snapshot_index = 0; job.snapshot_index < snapshot_classes_count(snapshot); job.snapshot_index++) {
+		add_job(batch, job);
+	}
+}
+
+static void add_input(Batch *batch, char *file_name);
+
+/* Keep a path found by walking and queue it; a PathVisitor */
+static void add_found_path(char *path, void *context) {
+	Batch *batch = context;
+	batch->paths = realloc(batch->paths, (batch->paths_count + 1) * sizeof(char *));
+	batch->paths[batch->paths_count++] = path;
+	add_input(batch, path);
+}
+
+/* Queue file_name by kind: a jar's classes, a snapshot's classes, the class files under a directory, or a class file */
+static void add_input(Batch *batch, char *file_name) {
+	if (is_jar_name(file_name)) {
+		add_jar(batch, file_name);
+	} else if (is_snapshot_name(file_name)) {
+		add_snapshot(batch, file_name);
+	} else if (is_directory(file_name)) {
+		walk_directory(file_name, ".class", add_found_path, batch);
+	} else {
+		Job job = {file_name, NULL, {0}, NULL, 0};
+		add_job(batch, job);
+	}
+}
+
+/* Start reading the batch's class files in the background, so parsing needn't wait on each open and read in turn */
+static void start_prefetching(Batch *batch, int threads) {
+	size_t i, files = 0;
+	batch->prefetch_paths = malloc(batch->jobs_count * sizeof(char *));
+	for (i = 0; i < batch->jobs_count; i++) {
+		const Job *job = batch->jobs + i;
+		bool file = job->jar == NULL && job->snapshot == NULL;
+		batch->prefetch_paths[i] = file ? job->file_name : NULL;
+		files += file;
+	}
+	if (files > 0) batch->prefetcher = start_prefetch(batch->prefetch_paths, batch->jobs_count, PREFETCH_WINDOW + threads, PREFETCH_IO_URING);
+}
+
+/* Merge the per-job fragments in job order and write them to file_name */
+static bool save_snapshot(Batch *batch, const char *file_name) {
+	SnapshotWriter writer;
+	init_snapshot_writer(&writer);
+	size_t i;
+	for (i = 0; i < batch->jobs_count; i++) {
+		merge_snapshot(&writer, batch->fragments + i);
+	}
+	bool saved = write_snapshot(&writer, file_name);
+	free_snapshot_writer(&writer);
+	return saved;
+}
+
+static void free_batch(Batch *batch) {
+	size_t i;
+	if (batch->prefetcher != NULL) stop_prefetch(batch->prefetcher);
+	free(batch->prefetch_paths);
+	for (i = 0; i < batch->jars_count; i++) {
+		close_jar(batch->jars[i]);
+	}
+	free(batch->jars);
+	for (i = 0; batch->fragments != NULL && i < batch->jobs_count; i++) {
+		free_snapshot_writer(batch->fragments + i);
+	}
+	free(batch->fragments);
+	for (i = 0; i < batch->snapshots_count; i++) {
+		close_snapshot(batch->snapshots[i]);
+	}
+	free(batch->snapshots);
+	for (i = 0; batch->decls != NULL && i < batch->jobs_count; i++) {
+		free(batch->decls[i]);
+	}
+	free(batch->decls);
+	for (i = 0; batch->sites != NULL && i < (size_t) batch->workers; i++) {
+		free_call_sites(batch->sites + i);
+	}
+	free(batch->sites);
+	free(batch->site_runs);
+	free(batch->stats);
+	free(batch->jobs);
+	for (i = 0; i < batch->paths_count; i++) {
+		free(batch->paths[i]);
+	}
+	free(batch->paths);
+}
+
+/* Write class in the batch's format */
+static void format_job(const Batch *batch, Buffer *out, const Class *class) {
+	uint64_t started = stats_clock();
+	if (batch->format == FORMAT_TEXT) {
+		format_class(out, class);
+	} else {
+		format_class_json(out, class);
+		if (batch->format == FORMAT_NDJSON) append_char(out, '\n');
+	}
+	record_phase(PHASE_PRINT, started);
+}
+
+/* Look job up in the cache, appending its output to out on a hit. Returns whether probe was filled in, hit or miss. */
+static bool probe_job(const Batch *batch, const Job *job, const char *name, CacheProbe *probe, Buffer *out, bool *hit) {
+	*hit = false;
+	// A snapshot being saved needs the parsed class, and snapshot classes are quicker to load than to look up
+	if (batch->cache == NULL || batch->fragments != NULL || batch->decls != NULL || batch->sites != NULL ||
+			job->snapshot != NULL) return false;
+
+	if (job->jar != NULL) {
+		// Hash the entry as stored, so a hit doesn't even inflate it
+		const uint8_t *data = jar_entry_data(job->jar, &job->entry);
+		if (data == NULL) return false;
+		*hit = probe_data(batch->cache, data, job->entry.compressed_size, name, probe, out);
+	} else {
+		*hit = probe_file(batch->cache, job->file_name, name, probe, out);
+	}
+	return true;
+}
+
+/* Decode the class file of job index, read ahead by the prefetcher if there is one */
+static Class *read_file_job(const Batch *batch, size_t index) {
+	const Job *job = batch->jobs + index;
+	size_t length;
+	uint64_t started = stats_clock();
+	uint8_t *image = batch->prefetcher != NULL ? take_file(batch->prefetcher, index, &length) : NULL;
+	if (image != NULL) {
+		// Read ahead, so this is only the wait for it
+		record_phase(PHASE_OPEN, started);
+		return read_class_from_heap(job->file_name, image, length, &batch->options);
+	}
+	// Not prefetched, or unreadable or not a regular file: open it here, which reports why or streams it
+	return read_class_from_file_name(job->file_name, &batch->options);
+}
+
+/* Decode and print job index on worker */
+static void decode_job(const Batch *batch, size_t index, int worker, Buffer *out) {
+	const Job *job = batch->jobs + index;
+	char *entry_name = NULL;
+	char *name = job->file_name;
+	Class *class;
+
+	if (job->jar != NULL) {
+		// Name classes as "app.jar!/com/example/Foo.class"
+		entry_name = malloc(strlen(job->file_name) + 2 + job->entry.name_length + 1);
+		sprintf(entry_name, "%s!/%.*s", job->file_name, job->entry.name_length, job->entry.name);
+		name = entry_name;
+	}
+
+	CacheProbe probe;
+	bool hit;
+	bool probed = probe_job(batch, job, name, &probe, out, &hit);
+	if (hit) {
+		free(entry_name);
+		return;
+	}
+
+	if (job->jar != NULL) {
+		class = read_class_from_jar_entry(job->jar, &job->entry, entry_name, &batch->options);
+	} else if (job->snapshot != NULL) {
+		class = load_snapshot_class(job->snapshot, job->snapshot_index);
+		if (class == NULL) {
+			fprintf(stderr, "Skipping class %lu of '%s': corrupt snapshot record\n", (unsigned long) job->snapshot_index, job->file_name);
+		} else if (batch->options.filter != NULL) {
+			// Loaded whole, so judged whole
+			class->filtered = !filter_parsed_class(batch->options.filter, class);
 		}
+	} else {
+		class = read_file_job(batch, index);
+	}
 
-		// Check the file header for .class nature
-		if (!is_class(file)) {
-			printf("Skipping '%s': not a valid class file\n", file_name);
-			continue;
+	if (class != NULL && class->filtered) {
+		// Rejected by --filter: nothing to print, which is worth caching too
+		if (probed) store_probe(batch->cache, &probe, "", 0);
+		free_class(class);
+	} else if (class != NULL) {
+		// yay, valid!
+		if (batch->decls != NULL || batch->sites != NULL) {
+			if (batch->decls != NULL) batch->decls[index] = describe_type(class);
+			if (batch->sites != NULL) {
+				SiteRun *run = batch->site_runs + index;
+				run->worker = worker;
+				run->first = batch->sites[worker].keys_count;
+				add_call_sites(batch->sites + worker, class);
+				run->count = batch->sites[worker].keys_count - run->first;
+			}
+			free_class(class);
+			free(entry_name);
+			return;
+		}
+		if (batch->fragments != NULL) add_to_snapshot(batch->fragments + index, class);
+		if (probed) {
+			// Render on the side so the output can be cached as well as emitted
+			Buffer rendered;
+			init_buffer(&rendered, NULL, 8192);
+			format_job(batch, &rendered, class);
+			store_probe(batch->cache, &probe, rendered.data, rendered.length);
+			append_chars(out, rendered.data, rendered.length);
+			free_buffer(&rendered);
+		} else {
+			format_job(batch, out, class);
 		}
+		free_class(class);
+	}
+	free(entry_name);
+}
+
+/* Decode and print one job, counting the arena chunks it mallocs with --stats; a Task for run_tasks */
+static void run_job(size_t index, int worker, Buffer *out, void *context) {
+	const Batch *batch = context;
+	if (batch->stats == NULL) {
+		decode_job(batch, index, worker, out);
+		return;
+	}
+	thread_stats = batch->stats + worker;
+	const uint64_t chunks = arena_chunks_allocated();
+	decode_job(batch, index, worker, out);
+	thread_stats->allocations += arena_chunks_allocated() - chunks;
+}
 
-		const ClassFile class_file = {
-			file_name,
-			file
-		};
+/* Intern name, given in internal (java/lang/Object) or source (java.lang.Object) form, and look it up */
+static TypeId lookup_type(const Hierarchy *hierarchy, const char *name, size_t length) {
+	char internal[length + 1];
+	size_t i;
+	for (i = 0; i < length; i++) {
+		internal[i] = name[i] == '.' ? '/' : name[i];
+	}
+	return find_type(hierarchy, internal, length);
+}
 
-		Class *class = read_class(class_file);
-		if (class == NULL) {
-			fprintf(stderr, "Parsing aborted; invalid class file contents: %s\n", class_file.file_name);
+/* Answer a hierarchy query on out */
+static void answer_type_query(const Hierarchy *hierarchy, const Query *query, Buffer *out) {
+	if (query->option == OPT_SUBTYPES) {
+		TypeId type = lookup_type(hierarchy, query->argument, strlen(query->argument));
+		append_string(out, query->argument);
+		if (type == NO_TYPE) {
+			append_string(out, ": unknown type\n");
+			return;
+		}
+		uint32_t count, r, total = 0;
+		const TypeRange *ranges = subtype_ranges(hierarchy, type, &count);
+		for (r = 0; r < count; r++) {
+			total += ranges[r].end - ranges[r].first;
+		}
+		append_string(out, ": ");
+		append_uint(out, total - 1);
+		append_string(out, " subtypes\n");
+		for (r = 0; r < count; r++) {
+			uint32_t i;
+			for (i = ranges[r].first; i < ranges[r].end; i++) {
+				if (type_at(hierarchy, i) == type) continue;
+				String name = type_name(hierarchy, type_at(hierarchy, i));
+				append_char(out, '\t');
+				append_chars(out, name.value, name.length);
+				append_char(out, '\n');
+			}
+		}
+	} else {
+		const char *comma = strchr(query->argument, ',');
+		TypeId sub = lookup_type(hierarchy, query->argument, comma - query->argument);
+		TypeId super = lookup_type(hierarchy, comma + 1, strlen(comma + 1));
+		append_chars(out, query->argument, comma - query->argument);
+		if (sub == NO_TYPE || super == NO_TYPE) {
+			append_string(out, sub == NO_TYPE ? ": unknown type\n" : " is not a subtype of ");
 		} else {
-			// yay, valid!
-			print_class(stdout, class);
+			append_string(out, is_subtype(hierarchy, sub, super) ? " is a subtype of " : " is not a subtype of ");
 		}
+		if (sub != NO_TYPE) {
+			append_string(out, comma + 1);
+			append_char(out, '\n');
+		}
+	}
+}
 
-		free(class);
-		fclose(file);
+/* Answer a call graph query on out */
+static void answer_call_query(const CallGraph *graph, const Query *query, Buffer *out) {
+	uint32_t n, i, count;
+	if (query->option == OPT_CALLGRAPH) {
+		append_string(out, "Call graph: ");
+		append_uint(out, methods_count(graph));
+		append_string(out, " methods, ");
+		append_uint(out, graph->edges_count);
+		append_string(out, " calls\n");
+		for (n = 0; n < methods_count(graph); n++) {
+			const MethodId *callees = get_callees(graph, n, &count);
+			if (count == 0) continue;
+			append_method(out, graph, n);
+			append_char(out, '\n');
+			for (i = 0; i < count; i++) {
+				append_string(out, "\t-> ");
+				append_method(out, graph, callees[i]);
+				append_char(out, '\n');
+			}
+		}
+	} else {
+		append_string(out, query->argument);
+		MethodId start = find_method(graph, query->argument, strlen(query->argument));
+		if (start == NO_METHOD) {
+			append_string(out, ": unknown method\n");
+			return;
+		}
+		MethodId *reached = malloc(methods_count(graph) * sizeof(MethodId));
+		count = find_reachable(graph, start, reached);
+		append_string(out, ": ");
+		append_uint(out, count - 1);
+		append_string(out, " reachable methods\n");
+		for (i = 1; i < count; i++) {
+			append_char(out, '\t');
+			append_method(out, graph, reached[i]);
+			append_char(out, '\n');
+		}
+		free(reached);
+	}
+}
+
+/* Index every class read and answer queries in order */
+static void answer_queries(const Batch *batch, const Query *queries, size_t queries_count) {
+	Hierarchy hierarchy;
+	CallGraph graph;
+	size_t i;
+	if (batch->decls != NULL) {
+		init_hierarchy(&hierarchy);
+		for (i = 0; i < batch->jobs_count; i++) {
+			if (batch->decls[i] != NULL) add_type(&hierarchy, batch->decls[i]);
+		}
+		build_hierarchy(&hierarchy);
+	}
+	if (batch->sites != NULL) {
+		// Merging in job order numbers methods the same way whatever the thread count
+		init_call_graph(&graph);
+		for (i = 0; i < batch->jobs_count; i++) {
+			const SiteRun *run = batch->site_runs + i;
+			merge_call_sites(&graph, batch->sites + run->worker, run->first, run->count);
+		}
+		build_call_graph(&graph);
 	}
 
-	exit(EXIT_SUCCESS);
+	Buffer out;
+	init_buffer(&out, stdout, 1 << 16);
+	for (i = 0; i < queries_count; i++) {
+		if (queries[i].option == OPT_CALLGRAPH || queries[i].option == OPT_REACHABLE_FROM) {
+			answer_call_query(&graph, queries + i, &out);
+		} else {
+			answer_type_query(&hierarchy, queries + i, &out);
+		}
+	}
+	free_buffer(&out);
+	if (batch->decls != NULL) free_hierarchy(&hierarchy);
+	if (batch->sites != NULL) free_call_graph(&graph);
+}
+
+/* Keep directory's classes parsed and print how they change until killed */
+static void watch_classes(const char *directory, const ParseOptions *options, Format format) {
+	Watch *watch = open_watch(directory, options);
+	if (watch == NULL) exit(EXIT_FAILURE);
+	fprintf(stderr, "Watching %s: %zu classes\n", directory, watched_count(watch));
+	Buffer out;
+	init_buffer(&out, stdout, 1 << 16);
+	// Each change is written out as soon as it is found, so json means one object per line here too
+	while (poll_watch(watch, -1, &out, format != FORMAT_TEXT) >= 0) {
+		flush_buffer(&out);
+		fflush(stdout);
+	}
+	free_buffer(&out);
+	close_watch(watch);
+	exit(EXIT_FAILURE);
+}
+
+/* Where the changes found by cfr diff go */
+typedef struct {
+	Buffer out;
+	Format format;
+	size_t written;
+} DiffOutput;
+
+/* Write one changed class in the chosen format; a ChangeVisitor */
+static void write_change(ChangeKind event, const char *name, const ClassPrint *print, const ClassDelta *delta, void *context) {
+	DiffOutput *output = context;
+	if (output->format == FORMAT_JSON && output->written > 0) append_string(&output->out, ",\n");
+	format_class_delta(&output->out, output->format != FORMAT_TEXT, event, name, print, delta);
+	if (output->format != FORMAT_JSON) append_char(&output->out, '\n');
+	output->written++;
+}
+
+/* Compare two class files or jars and exit like diff(1): 0 if they match, 1 if they differ and 2 on trouble */
+static void diff_classes_in(char *before, char *after, const ParseOptions *options, Format format) {
+	DiffOutput output = {{0}, format, 0};
+	init_buffer(&output.out, stdout, 1 << 16);
+	if (format == FORMAT_JSON) append_string(&output.out, "[\n");
+	DiffCounts counts;
+	bool read = diff_files(before, after, options, write_change, &output, &counts);
+	if (format == FORMAT_JSON) append_string(&output.out, "\n]\n");
+	free_buffer(&output.out);
+	fprintf(stderr, "Diff: %zu classes compared, %zu identical, %zu differ\n", counts.compared, counts.identical, counts.changed);
+	exit(!read ? 2 : counts.changed > 0 ? 1 : 0);
+}
+
+static void usage(void) {
+	printf("Usage: cfr [-j N] [-s] [-f FORMAT] [-c DIR] [-o FILE] [--classpath PATH] .class|.jar|.cfrs|DIR [.class|.jar|.cfrs|DIR ..]\n");
+	printf("       cfr [-s] [-f FORMAT] --watch DIR\n");
+	printf("       cfr diff [-s] [-f FORMAT] A.class B.class | A.jar B.jar\n");
+	printf("  -j, --jobs N              parse with N threads (0 = one per CPU); output order is unchanged\n");
+	printf("  -s, --skim                only read the header: version, flags, this/super class and interfaces\n");
+	printf("  -f, --format              text (default), json (one array) or ndjson (one object per line)\n");
+	printf("  --filter EXPR             only print the classes and members EXPR holds for, e.g. 'major_version >= 61 && public'\n");
+	printf("  --stats[=json]            print where the time went, per phase, and what was read to stderr, as a table or JSON\n");
+	printf("  -c, --cache DIR           reuse output cached in DIR for inputs seen before; prints hit/miss counts at exit\n");
+	printf("  --subtypes CLASS          instead of printing, list every class extending or implementing CLASS\n");
+	printf("  --is-subtype SUB,SUPER    instead of printing, say whether SUB extends or implements SUPER\n");
+	printf("  --callgraph               instead of printing, list the methods each method invokes\n");
+	printf("  --reachable-from METHOD   instead of printing, list every method reachable from METHOD, e.g. Foo.run()V\n");
+	printf("  -o, --save-snapshot FILE  also write every class read to FILE, a snapshot that loads without decoding class files\n");
+	printf("  --classpath, --cp PATH    also read every class on PATH: directories, jars and DIR/* separated by ':'\n");
+	printf("  --watch DIR               keep DIR's classes parsed and print the members added, removed or changed as files change\n");
+	printf("  diff A B                  print the classes and members added, removed or changed from A to B; exits 1 if any\n");
 }
 
+int main(int argc, char *args[]) {
+	static const struct option options[] = {
+		{"jobs", required_argument, NULL, 'j'},
+		{"skim", no_argument, NULL, 's'},
+		{"format", required_argument, NULL, 'f'},
+		{"cache", required_argument, NULL, 'c'},
+		{"save-snapshot", required_argument, NULL, 'o'},
+		{"subtypes", required_argument, NULL, OPT_SUBTYPES},
+		{"is-subtype", required_argument, NULL, OPT_IS_SUBTYPE},
+		{"callgraph", no_argument, NULL, OPT_CALLGRAPH},
+		{"reachable-from", required_argument, NULL, OPT_REACHABLE_FROM},
+		{"classpath", required_argument, NULL, OPT_CLASSPATH},
+		{"cp", required_argument, NULL, OPT_CLASSPATH},
+		{"watch", required_argument, NULL, OPT_WATCH},
+		{"filter", required_argument, NULL, OPT_FILTER},
+		{"stats", optional_argument, NULL, OPT_STATS},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	Batch batch = {0};
+	const char *snapshot_name = NULL;
+	char *cache_directory = NULL;
+	const char *watch_directory = NULL;
+	const char *filter_expression = NULL;
+	Filter *filter = NULL;
+	char filter_error[128];
+	bool stats = false, stats_json = false;
+	Query *queries = NULL;
+	size_t queries_count = 0;
+	char **classpaths = NULL;
+	size_t classpaths_count = 0;
+	bool type_queries = false, call_queries = false;
+	int threads = 1;
+	int opt;
+	char *end;
+	// "cfr diff ..." takes the usual options after the command word, which getopt then treats as the program name
+	bool diff = argc > 1 && strcmp(args[1], "diff") == 0;
+	if (diff) {
+		argc--;
+		args++;
+	}
+	while ((opt = getopt_long(argc, args, "j:sf:c:o:h", options, NULL)) != -1) {
+		switch (opt) {
+			case 'j':
+				threads = strtol(optarg, &end, 10);
+				if (*end != '\0' || threads < 0) {
+					fprintf(stderr, "Invalid thread count '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				if (threads == 0) threads = available_cpus();
+				break;
+			case 's':
+				batch.options.skim = true;
+				break;
+			case 'f':
+				if (strcmp(optarg, "text") == 0) {
+					batch.format = FORMAT_TEXT;
+				} else if (strcmp(optarg, "json") == 0) {
+					batch.format = FORMAT_JSON;
+				} else if (strcmp(optarg, "ndjson") == 0) {
+					batch.format = FORMAT_NDJSON;
+				} else {
+					fprintf(stderr, "Unknown format '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'c':
+				cache_directory = optarg;
+				break;
+			case 'o':
+				snapshot_name = optarg;
+				break;
+			case OPT_IS_SUBTYPE:
+				if (strchr(optarg, ',') == NULL) {
+					fprintf(stderr, "Expected SUB,SUPER but got '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				// fall through
+			case OPT_SUBTYPES:
+			case OPT_CALLGRAPH:
+			case OPT_REACHABLE_FROM:
+				if (opt == OPT_CALLGRAPH || opt == OPT_REACHABLE_FROM) {
+					call_queries = true;
+				} else {
+					type_queries = true;
+				}
+				queries = realloc(queries, (queries_count + 1) * sizeof(Query));
+				queries[queries_count].option = opt;
+				queries[queries_count++].argument = optarg;
+				break;
+			case OPT_CLASSPATH:
+				classpaths = realloc(classpaths, (classpaths_count + 1) * sizeof(char *));
+				classpaths[classpaths_count++] = optarg;
+				break;
+			case OPT_WATCH:
+				watch_directory = optarg;
+				break;
+			case OPT_FILTER:
+				if (filter != NULL) free_filter(filter);
+				filter = compile_filter(optarg, filter_error, sizeof(filter_error));
+				if (filter == NULL) {
+					fprintf(stderr, "Invalid filter '%s': %s\n", optarg, filter_error);
+					exit(EXIT_FAILURE);
+				}
+				filter_expression = optarg;
+				break;
+			case OPT_STATS:
+				if (optarg != NULL && strcmp(optarg, "json") != 0 && strcmp(optarg, "text") != 0) {
+					fprintf(stderr, "Unknown stats format '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				stats = true;
+				stats_json = optarg != NULL && strcmp(optarg, "json") == 0;
+				break;
+			case 'h':
+				usage();
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (diff) {
+		if (argc - optind != 2 || watch_directory != NULL || classpaths_count > 0 || queries_count > 0 || snapshot_name != NULL
+				|| cache_directory != NULL || filter != NULL || stats) {
+			fprintf(stderr, "diff compares exactly two class files or jars and takes only -s and -f\n");
+			exit(2);
+		}
+		diff_classes_in(args[optind], args[optind + 1], &batch.options, batch.format);
+	}
+
+	if (watch_directory != NULL) {
+		if (optind < argc || classpaths_count > 0 || queries_count > 0 || snapshot_name != NULL || cache_directory != NULL
+				|| filter != NULL || stats) {
+			fprintf(stderr, "--watch reads only its directory and can't be combined with other inputs, queries, -o, -c, --filter or --stats\n");
+			exit(EXIT_FAILURE);
+		}
+		watch_classes(watch_directory, &batch.options, batch.format);
+	}
+
+	if (optind == argc && classpaths_count == 0) {
+		printf("Please pass at least 1 .class or .jar file to open\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (filter != NULL) {
+		// Type queries skim too, see below
+		if (filter_uses_members(filter) && (batch.options.skim || (type_queries && !call_queries))) {
+			fprintf(stderr, "--filter '%s' tests members, which skimming doesn't read\n", filter_expression);
+			exit(EXIT_FAILURE);
+		}
+		if (snapshot_name != NULL) {
+			fprintf(stderr, "A snapshot holds whole classes, so -o can't be combined with --filter\n");
+			exit(EXIT_FAILURE);
+		}
+		batch.options.filter = filter;
+	}
+
+	uint64_t started = 0;
+	int workers = threads > 1 ? threads : 1;
+	batch.workers = workers;
+	if (stats) {
+		batch.stats = calloc(workers + 1, sizeof(Stats));
+		thread_stats = batch.stats + workers;
+		started = stats_clock();
+	}
+
+	size_t c;
+	for (c = 0; c < classpaths_count; c++) {
+		walk_classpath(classpaths[c], add_found_path, &batch);
+	}
+	free(classpaths);
+	int i;
+	for (i = optind; i < argc; i++) {
+		add_input(&batch, args[i]);
+	}
+
+	Cache cache;
+	if (cache_directory != NULL) {
+		// Anything that changes the output must change the keys
+		uint64_t flavour = (uint64_t) batch.format | (uint64_t) batch.options.skim << 8;
+		if (filter != NULL) {
+			const CacheKey seed = {0, 0};
+			flavour ^= hash_bytes(filter_expression, strlen(filter_expression), seed).low << 16;
+		}
+		if (!open_cache(&cache, cache_directory, flavour)) exit(EXIT_FAILURE);
+		batch.cache = &cache;
+	}
+
+	// A cache hit on a file needs only its stat, so reading ahead would be wasted
+	if (batch.cache == NULL) start_prefetching(&batch, threads);
+
+	if (snapshot_name != NULL) {
+		// Zeroed writers allocate nothing until their job yields a class
+		batch.fragments = calloc(batch.jobs_count, sizeof(SnapshotWriter));
+	}
+
+	if (queries_count > 0) {
+		if (type_queries) batch.decls = calloc(batch.jobs_count, sizeof(TypeDecl *));
+		if (call_queries) {
+			// Zeroed CallSites allocate nothing until a worker scans its first class
+			batch.sites = calloc(workers, sizeof(CallSites));
+			batch.site_runs = calloc(batch.jobs_count, sizeof(SiteRun));
+			// The graph keys methods by global ids, so have them ready in Class.symbols as each pool is read
+			batch.options.intern = true;
+		} else {
+			// The header has everything the hierarchy needs
+			batch.options.skim = true;
+		}
+		run_tasks(batch.jobs_count, threads, run_job, &batch, stdout, NULL);
+		answer_queries(&batch, queries, queries_count);
+	} else if (batch.format == FORMAT_JSON) {
+		fputs("[\n", stdout);
+		run_tasks(batch.jobs_count, threads, run_job, &batch, stdout, ",\n");
+		fputs("\n]\n", stdout);
+	} else {
+		run_tasks(batch.jobs_count, threads, run_job, &batch, stdout, NULL);
+	}
+	bool saved = snapshot_name == NULL || save_snapshot(&batch, snapshot_name);
+	if (batch.stats != NULL) {
+		const uint64_t elapsed = stats_clock() - started;
+		Stats *total = calloc(1, sizeof(Stats));
+		int w;
+		for (w = 0; w <= workers; w++) {
+			merge_stats(total, batch.stats + w);
+		}
+		Buffer report;
+		init_buffer(&report, stderr, 4096);
+		append_stats(&report, total, elapsed, stats_json);
+		free_buffer(&report);
+		free(total);
+	}
+	free_batch(&batch);
+	free(queries);
+	if (filter != NULL) free_filter(filter);
+	if (batch.cache != NULL) {
+		fprintf(stderr, "Cache: %zu hits, %zu misses\n", cache.hits, cache.misses);
+	}
+
+	exit(saved ? EXIT_SUCCESS : EXIT_FAILURE);
+}
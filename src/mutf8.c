@@ -0,0 +1,128 @@
+#include "mutf8.h"
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char REPLACEMENT[] = "\xef\xbf\xbd";
+
+size_t count_ascii(const char *value, size_t length) {
+	const uint8_t *p = (const uint8_t *) value;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 32 <= length; i += 32) {
+		__m128i low = _mm_loadu_si128((const __m128i *) (p + i));
+		__m128i high = _mm_loadu_si128((const __m128i *) (p + i + 16));
+		// The top bit marks a multibyte sequence; a zero byte is never legal
+		__m128i bad = _mm_or_si128(_mm_or_si128(low, _mm_cmpeq_epi8(low, zero)), _mm_or_si128(high, _mm_cmpeq_epi8(high, zero)));
+		if (_mm_movemask_epi8(bad) != 0) break;
+	}
+	for (; i + 16 <= length; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *) (p + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, zero)));
+		if (mask != 0) return i + __builtin_ctz(mask);
+	}
+#else
+	for (; i + 8 <= length; i += 8) {
+		uint64_t word;
+		memcpy(&word, p + i, sizeof(word));
+		uint64_t zeros = (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+		if (((word & 0x8080808080808080ULL) | zeros) != 0) break;
+	}
+#endif
+	while (i < length && (uint8_t) (p[i] - 1) < 0x7f) i++;
+	return i;
+}
+
+static inline bool is_continuation(uint8_t c) {
+	return (c & 0xc0) == 0x80;
+}
+
+/* Append code point c to out as standard UTF-8 */
+static void append_code_point(Buffer *out, uint32_t c) {
+	char bytes[4];
+	size_t length;
+	if (c < 0x80) {
+		bytes[0] = c;
+		length = 1;
+	} else if (c < 0x800) {
+		bytes[0] = 0xc0 | c >> 6;
+		bytes[1] = 0x80 | (c & 0x3f);
+		length = 2;
+	} else if (c < 0x10000) {
+		bytes[0] = 0xe0 | c >> 12;
+		bytes[1] = 0x80 | (c >> 6 & 0x3f);
+		bytes[2] = 0x80 | (c & 0x3f);
+		length = 3;
+	} else {
+		bytes[0] = 0xf0 | c >> 18;
+		bytes[1] = 0x80 | (c >> 12 & 0x3f);
+		bytes[2] = 0x80 | (c >> 6 & 0x3f);
+		bytes[3] = 0x80 | (c & 0x3f);
+		length = 4;
+	}
+	append_chars(out, bytes, length);
+}
+
+/* Decode the three byte sequence at p, which has at least three bytes, or return UINT32_MAX if it is malformed */
+static inline uint32_t read_three(const uint8_t *p) {
+	if ((p[0] & 0xf0) != 0xe0 || !is_continuation(p[1]) || !is_continuation(p[2])) return UINT32_MAX;
+	uint32_t c = (p[0] & 0x0f) << 12 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+	return c >= 0x800 ? c : UINT32_MAX;
+}
+
+/* Walk the modified UTF-8 at value, appending it to out as standard UTF-8 unless out is NULL */
+static bool walk_mutf8(Buffer *out, const char *value, size_t length) {
+	const uint8_t *p = (const uint8_t *) value, *end = p + length;
+	bool valid = true;
+	while (p < end) {
+		size_t ascii = count_ascii((const char *) p, end - p);
+		if (out != NULL) append_chars(out, (const char *) p, ascii);
+		p += ascii;
+		if (p == end) break;
+
+		uint32_t c = UINT32_MAX;
+		size_t width = 1;
+		if ((p[0] & 0xe0) == 0xc0 && end - p >= 2 && is_continuation(p[1])) {
+			c = (p[0] & 0x1f) << 6 | (p[1] & 0x3f);
+			// Only NUL may be spelled with two bytes when one would do
+			if (c < 0x80 && c != 0) c = UINT32_MAX;
+			width = 2;
+		} else if (end - p >= 3) {
+			c = read_three(p);
+			width = 3;
+			if (c >= 0xd800 && c <= 0xdbff && end - p >= 6) {
+				uint32_t low = read_three(p + 3);
+				if (low >= 0xdc00 && low <= 0xdfff) {
+					c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+					width = 6;
+				}
+			}
+		}
+		if (c == UINT32_MAX) {
+			valid = false;
+			width = 1;
+			if (out == NULL) return false;
+			append_chars(out, REPLACEMENT, 3);
+		} else if (out != NULL) {
+			if (c >= 0xd800 && c <= 0xdfff) {
+				// A lone surrogate is fine in a Java string but has no standard UTF-8 form
+				append_chars(out, REPLACEMENT, 3);
+			} else {
+				append_code_point(out, c);
+			}
+		}
+		p += width;
+	}
+	return valid;
+}
+
+bool validate_mutf8(const char *value, size_t length) {
+	return walk_mutf8(NULL, value, length);
+}
+
+bool decode_mutf8(Buffer *out, const char *value, size_t length) {
+	return walk_mutf8(out, value, length);
+}
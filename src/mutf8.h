@@ -0,0 +1,22 @@
+#ifndef MUTF8_H
+#define MUTF8_H
+#include "buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The JVM's modified UTF-8 (section 4.4.7 of the JVM spec) differs from the standard kind in two ways: NUL is the two bytes
+ * C0 80, never a zero byte, and characters beyond the BMP are a surrogate pair of three byte sequences rather than one four
+ * byte sequence. Nearly every constant is plain ASCII, so both functions check whole blocks for that first and only decode
+ * byte by byte around the rest. */
+
+/* Return how many of the length bytes at value, from the start, are ASCII other than NUL */
+size_t count_ascii(const char *value, size_t length);
+
+/* Return true if the length bytes at value are well-formed modified UTF-8 */
+bool validate_mutf8(const char *value, size_t length);
+
+/* Append the length bytes of modified UTF-8 at value to out as standard UTF-8. Malformed bytes and lone surrogates, which
+ * standard UTF-8 can't hold, become U+FFFD. Returns false if anything was malformed. */
+bool decode_mutf8(Buffer *out, const char *value, size_t length);
+
+#endif //MUTF8_H
@@ -0,0 +1,244 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+enum POOL_SIZES {
+	/* Tasks per block; blocks are the unit of dealing and stealing */
+	BLOCK_SIZE = 8,
+
+	/* How far, per worker, tasks may run ahead of the oldest unwritten result. Bounds the reorder buffer. */
+	WINDOW_PER_WORKER = 256,
+
+	/* Starting size of each task's private buffer */
+	TASK_BUFFER_SIZE = 8192,
+
+	/* Size of the buffer in front of out; output is written in chunks this big */
+	OUTPUT_BUFFER_SIZE = 1 << 20
+};
+
+/* A worker's queue of blocks: block ids start + k * stride for k in [head, tail). The owner takes from the head, so it works
+ * through the input in order; thieves take from the tail, the work furthest from being written out. */
+typedef struct {
+	pthread_mutex_t lock;
+	size_t start;
+	size_t stride;
+	size_t head;
+	size_t tail;
+} Deque;
+
+/* A finished task's output waiting in the reorder buffer */
+typedef struct {
+	char *data;
+	size_t length;
+	bool ready;
+} Slot;
+
+typedef struct {
+	size_t count;
+	size_t blocks_count;
+	int threads;
+	Task task;
+	void *context;
+	Deque *deques;
+
+	Slot *slots;
+	size_t window;
+	size_t emitted; // tasks written to out so far; read without the lock by workers checking the window
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t drained;
+} Pool;
+
+typedef struct {
+	Pool *pool;
+	int worker;
+} Worker;
+
+static bool pop_block(Deque *deque, size_t *block) {
+	bool found = false;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->head < deque->tail) {
+		*block = deque->start + deque->head * deque->stride;
+		deque->head++;
+		found = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+/* Move the back half of some other worker's blocks into self's (empty) deque. Returns false once every deque is empty. */
+static bool steal_blocks(Pool *pool, int self) {
+	int i;
+	for (i = 1; i < pool->threads; i++) {
+		Deque *victim = pool->deques + (self + i) % pool->threads;
+		pthread_mutex_lock(&victim->lock);
+		size_t remaining = victim->tail - victim->head;
+		if (remaining == 0) {
+			pthread_mutex_unlock(&victim->lock);
+			continue;
+		}
+		size_t taken = (remaining + 1) / 2;
+		size_t start = victim->start, stride = victim->stride, tail = victim->tail;
+		victim->tail -= taken;
+		pthread_mutex_unlock(&victim->lock);
+
+		Deque *deque = pool->deques + self;
+		pthread_mutex_lock(&deque->lock);
+		deque->start = start;
+		deque->stride = stride;
+		deque->head = tail - taken;
+		deque->tail = tail;
+		pthread_mutex_unlock(&deque->lock);
+		return true;
+	}
+	return false;
+}
+
+static void run_one(Pool *pool, size_t index, int worker) {
+	// Don't run so far ahead that the result would overwrite a slot that hasn't been written out yet
+	if (index >= __atomic_load_n(&pool->emitted, __ATOMIC_ACQUIRE) + pool->window) {
+		pthread_mutex_lock(&pool->lock);
+		while (index >= pool->emitted + pool->window) {
+			pthread_cond_wait(&pool->drained, &pool->lock);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	Buffer out;
+	init_buffer(&out, NULL, TASK_BUFFER_SIZE);
+	pool->task(index, worker, &out, pool->context);
+
+	// The slot takes ownership of the buffer's memory
+	pthread_mutex_lock(&pool->lock);
+	Slot *slot = pool->slots + index % pool->window;
+	slot->data = out.data;
+	slot->length = out.length;
+	slot->ready = true;
+	pthread_cond_signal(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void *work(void *arg) {
+	Worker *self = arg;
+	Pool *pool = self->pool;
+	Deque *deque = pool->deques + self->worker;
+	size_t block;
+
+	while (pop_block(deque, &block) || (steal_blocks(pool, self->worker) && pop_block(deque, &block))) {
+		size_t index = block * BLOCK_SIZE;
+		size_t end = index + BLOCK_SIZE < pool->count ? index + BLOCK_SIZE : pool->count;
+		for (; index < end; index++) {
+			run_one(pool, index, self->worker);
+		}
+	}
+	return NULL;
+}
+
+/* Copy one task's output to out, after a separator if it isn't the first */
+static void emit(Buffer *out, const char *data, size_t length, const char *separator, bool *emitted_any) {
+	if (length == 0) return;
+	if (*emitted_any && separator != NULL) append_string(out, separator);
+	append_chars(out, data, length);
+	*emitted_any = true;
+}
+
+void run_tasks(size_t count, int threads, Task task, void *context, FILE *out, const char *separator) {
+	size_t index;
+	bool emitted_any = false;
+	Buffer buffer;
+	init_buffer(&buffer, out, OUTPUT_BUFFER_SIZE);
+	if (threads <= 1 || count <= 1) {
+		if (separator == NULL) {
+			// Nothing to interleave, so tasks can write straight into the output buffer
+			for (index = 0; index < count; index++) {
+				task(index, 0, &buffer, context);
+			}
+		} else {
+			Buffer task_out;
+			init_buffer(&task_out, NULL, TASK_BUFFER_SIZE);
+			for (index = 0; index < count; index++) {
+				task_out.length = 0;
+				task(index, 0, &task_out, context);
+				emit(&buffer, task_out.data, task_out.length, separator, &emitted_any);
+			}
+			free_buffer(&task_out);
+		}
+		free_buffer(&buffer);
+		return;
+	}
+
+	Pool pool;
+	pool.count = count;
+	pool.blocks_count = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	pool.threads = threads;
+	pool.task = task;
+	pool.context = context;
+	pool.window = (size_t) WINDOW_PER_WORKER * threads;
+	pool.slots = calloc(pool.window, sizeof(Slot));
+	pool.emitted = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.ready, NULL);
+	pthread_cond_init(&pool.drained, NULL);
+
+	// Deal blocks round-robin so that every worker starts near the front of the input
+	pool.deques = calloc(threads, sizeof(Deque));
+	int w;
+	for (w = 0; w < threads; w++) {
+		Deque *deque = pool.deques + w;
+		pthread_mutex_init(&deque->lock, NULL);
+		deque->start = w;
+		deque->stride = threads;
+		deque->head = 0;
+		deque->tail = pool.blocks_count > (size_t) w ? (pool.blocks_count - w + threads - 1) / threads : 0;
+	}
+
+	pthread_t *ids = calloc(threads, sizeof(pthread_t));
+	Worker *workers = calloc(threads, sizeof(Worker));
+	for (w = 0; w < threads; w++) {
+		workers[w].pool = &pool;
+		workers[w].worker = w;
+		pthread_create(ids + w, NULL, work, workers + w);
+	}
+
+	// The calling thread is the reorder buffer's only consumer
+	for (index = 0; index < count; index++) {
+		pthread_mutex_lock(&pool.lock);
+		Slot *slot = pool.slots + index % pool.window;
+		while (!slot->ready) {
+			pthread_cond_wait(&pool.ready, &pool.lock);
+		}
+		char *data = slot->data;
+		size_t length = slot->length;
+		slot->ready = false;
+		__atomic_store_n(&pool.emitted, index + 1, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&pool.drained);
+		pthread_mutex_unlock(&pool.lock);
+
+		emit(&buffer, data, length, separator, &emitted_any);
+		free(data);
+	}
+	free_buffer(&buffer);
+
+	for (w = 0; w < threads; w++) {
+		pthread_join(ids[w], NULL);
+	}
+	for (w = 0; w < threads; w++) {
+		pthread_mutex_destroy(&pool.deques[w].lock);
+	}
+	free(ids);
+	free(workers);
+	free(pool.deques);
+	free(pool.slots);
+	pthread_cond_destroy(&pool.drained);
+	pthread_cond_destroy(&pool.ready);
+	pthread_mutex_destroy(&pool.lock);
+}
+
+int available_cpus(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int) cpus : 1;
+}
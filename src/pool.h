@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+#include "buffer.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/* One unit of work. worker identifies the calling thread (0 to threads - 1) so tasks can keep per-worker state.
+ * Everything the task wants emitted must be appended to out. */
+typedef void (*Task)(size_t index, int worker, Buffer *out, void *context);
+
+/* Run task for every index in [0, count) across threads workers. Work is dealt out in small blocks; a worker that runs dry steals
+ * half of another's remaining blocks. Each task appends to a private in-memory Buffer and a reorder buffer copies those to out
+ * strictly in index order, so the output is byte-for-byte what a single-threaded run produces.
+ * With threads <= 1 the tasks run in order on the calling thread instead.
+ * separator, unless NULL, is written between consecutive non-empty outputs, e.g. the commas of a JSON array. */
+void run_tasks(size_t count, int threads, Task task, void *context, FILE *out, const char *separator);
+
+/* Return the number of online processors, for -j 0 */
+int available_cpus(void);
+
+#endif //POOL_H
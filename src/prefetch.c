@@ -0,0 +1,429 @@
+#include "prefetch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+enum PREFETCH_SIZES {
+	/* Files opened and read per io_uring submission; also the ring's size */
+	BATCH_SIZE = 32,
+
+	/* Threads reading when io_uring isn't available */
+	PREAD_THREADS = 4,
+
+	/* How long to back off when the kernel is short of resources or reads are still landing, and how many times before the
+	 * ring is given up on */
+	RING_RETRY_NS = 100000,
+	RING_RETRIES = 1000
+};
+
+/* Only regular files are opened: opening a FIFO would steal its writer from the caller. Non-blocking is belt and braces. */
+#define PREFETCH_OPEN_FLAGS (O_RDONLY | O_CLOEXEC | O_NONBLOCK)
+
+typedef struct {
+	uint8_t *data;
+	size_t length;
+	bool ready;
+} PrefetchSlot;
+
+/* The shared and submission/completion rings, mapped from the kernel */
+typedef struct {
+	int fd;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_tail;
+	unsigned sq_queued_tail; // entries up to here are filled in, and published to the kernel by submit_and_wait
+	unsigned sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+} Ring;
+
+struct Prefetcher {
+	char *const *paths;
+	size_t count;
+	size_t window;
+	PrefetchSlot *slots;
+	size_t next;        // the next index to read
+	size_t outstanding; // read or being read, and not yet taken
+	bool stopping;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t taken;
+	PrefetchBackend backend;
+	Ring ring;
+	pthread_t threads[PREAD_THREADS];
+	int threads_count;
+};
+
+/* Wait for room in the window, then claim up to max of the next files to read. Returns how many, or 0 once there are none left. */
+static size_t claim_files(Prefetcher *prefetcher, size_t max, size_t *indexes) {
+	size_t claimed = 0;
+	pthread_mutex_lock(&prefetcher->lock);
+	while (prefetcher->outstanding >= prefetcher->window && !prefetcher->stopping) {
+		pthread_cond_wait(&prefetcher->taken, &prefetcher->lock);
+	}
+	while (!prefetcher->stopping && claimed < max && prefetcher->outstanding < prefetcher->window
+			&& prefetcher->next < prefetcher->count) {
+		size_t index = prefetcher->next++;
+		if (prefetcher->paths[index] == NULL) continue;
+		indexes[claimed++] = index;
+		prefetcher->outstanding++;
+	}
+	pthread_mutex_unlock(&prefetcher->lock);
+	return claimed;
+}
+
+static void fill_slot(Prefetcher *prefetcher, size_t index, uint8_t *data, size_t length) {
+	pthread_mutex_lock(&prefetcher->lock);
+	PrefetchSlot *slot = prefetcher->slots + index;
+	slot->data = data;
+	slot->length = length;
+	slot->ready = true;
+	pthread_cond_broadcast(&prefetcher->filled);
+	pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/* Return the size of the regular file open as fd, or 0 if it isn't one or is empty */
+static size_t regular_file_size(int fd) {
+	struct stat st;
+	return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? (size_t) st.st_size : 0;
+}
+
+/* Read the whole of path with pread, or return NULL */
+static uint8_t *pread_file(const char *path, size_t *length) {
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+	int fd = open(path, PREFETCH_OPEN_FLAGS);
+	if (fd < 0) return NULL;
+	size_t size = regular_file_size(fd);
+	uint8_t *data = size > 0 ? malloc(size) : NULL;
+	size_t done = 0;
+	while (data != NULL && done < size) {
+		ssize_t n = pread(fd, data + done, size - done, done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		done += n;
+	}
+	close(fd);
+	if (data != NULL && done == 0) {
+		free(data);
+		data = NULL;
+	}
+	*length = done; // short if the file shrank
+	return data;
+}
+
+static void *pread_files(void *context) {
+	Prefetcher *prefetcher = context;
+	size_t index;
+	while (claim_files(prefetcher, 1, &index) > 0) {
+		size_t length = 0;
+		uint8_t *data = pread_file(prefetcher->paths[index], &length);
+		fill_slot(prefetcher, index, data, length);
+	}
+	return NULL;
+}
+
+static bool setup_ring(Ring *ring, unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) return false;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+			IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		close(ring->fd);
+		return false;
+	}
+	ring->cq_ring = single_mmap ? ring->sq_ring : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		if (ring->cq_ring != MAP_FAILED && !single_mmap) munmap(ring->cq_ring, ring->cq_ring_size);
+		if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		close(ring->fd);
+		return false;
+	}
+	if (single_mmap) ring->cq_ring_size = 0;
+
+	uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+	ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	ring->sq_queued_tail = *ring->sq_tail;
+	ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+	ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+	return true;
+}
+
+static void free_ring(Ring *ring) {
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring_size > 0) munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+/* Return a cleared submission queue entry for op, tagged with user_data. It is queued by the next submit_and_wait. */
+static struct io_uring_sqe *queue_sqe(Ring *ring, uint8_t op, uint64_t user_data) {
+	unsigned slot = ring->sq_queued_tail++ & ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + slot;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->user_data = user_data;
+	ring->sq_array[slot] = slot;
+	return sqe;
+}
+
+/* Pass every completion waiting in the ring to complete. Returns how many there were. */
+static unsigned reap_completions(Ring *ring, void (*complete)(void *context, uint64_t user_data, int32_t result), void *context) {
+	unsigned head = *ring->cq_head, reaped = 0;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++, reaped++) {
+		const struct io_uring_cqe *cqe = ring->cqes + (head & ring->cq_mask);
+		complete(context, cqe->user_data, cqe->res);
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return reaped;
+}
+
+/* Submit the queued entries, wait for that many completions and pass each to complete. Returns false if the kernel refused,
+ * but only once every entry it did accept has completed, so the caller can free the buffers they read into. */
+static bool submit_and_wait(Ring *ring, unsigned count, void (*complete)(void *context, uint64_t user_data, int32_t result),
+		void *context) {
+	unsigned submitted = 0, completed = 0, retries = 0;
+	bool refused = false;
+	__atomic_store_n(ring->sq_tail, ring->sq_queued_tail, __ATOMIC_RELEASE);
+	while (completed < (refused ? submitted : count)) {
+		bool wait = refused;
+		if (!refused) {
+			int entered = syscall(__NR_io_uring_enter, ring->fd, count - submitted, count - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (entered >= 0) {
+				submitted += entered;
+			} else if (errno == EAGAIN || errno == EBUSY) {
+				// Out of resources, or the completion queue is full: reap what's there and try again
+				wait = ++retries <= RING_RETRIES;
+				refused = !wait;
+			} else if (errno != EINTR) {
+				refused = true;
+				wait = true;
+			}
+		}
+		unsigned reaped = reap_completions(ring, complete, context);
+		completed += reaped;
+		if (wait && reaped == 0) {
+			const struct timespec pause = {0, RING_RETRY_NS};
+			nanosleep(&pause, NULL);
+		}
+	}
+	return !refused;
+}
+
+/* One batch of files on their way through the ring */
+typedef struct {
+	size_t count;
+	size_t indexes[BATCH_SIZE];
+	struct statx stats[BATCH_SIZE];
+	int fds[BATCH_SIZE];
+	uint8_t *data[BATCH_SIZE];
+	size_t sizes[BATCH_SIZE];
+	size_t done[BATCH_SIZE];
+	bool reading[BATCH_SIZE];
+} RingBatch;
+
+static void statted(void *context, uint64_t user_data, int32_t result) {
+	RingBatch *batch = context;
+	const struct statx *stx = batch->stats + user_data;
+	batch->sizes[user_data] = result == 0 && S_ISREG(stx->stx_mode) ? stx->stx_size : 0;
+}
+
+static void opened(void *context, uint64_t user_data, int32_t result) {
+	RingBatch *batch = context;
+	batch->fds[user_data] = result;
+}
+
+static void read_some(void *context, uint64_t user_data, int32_t result) {
+	RingBatch *batch = context;
+	if (result < 0) {
+		batch->done[user_data] = 0; // don't hand over half a file
+	} else if (result > 0) {
+		batch->done[user_data] += result;
+		if (batch->done[user_data] < batch->sizes[user_data]) return; // short read; go round again
+	}
+	batch->reading[user_data] = false;
+}
+
+/* Stat a batch of files with one submission, open the regular ones with another, then read them all with as few more as short
+ * reads allow */
+static bool read_ring_batch(Prefetcher *prefetcher, RingBatch *batch) {
+	Ring *ring = &prefetcher->ring;
+	size_t k;
+	for (k = 0; k < batch->count; k++) {
+		batch->fds[k] = -1;
+		batch->data[k] = NULL;
+		struct io_uring_sqe *sqe = queue_sqe(ring, IORING_OP_STATX, k);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t) (uintptr_t) prefetcher->paths[batch->indexes[k]];
+		sqe->len = STATX_TYPE | STATX_SIZE;
+		sqe->off = (uint64_t) (uintptr_t) (batch->stats + k);
+	}
+	if (!submit_and_wait(ring, batch->count, statted, batch)) return false;
+
+	unsigned queued = 0;
+	for (k = 0; k < batch->count; k++) {
+		if (batch->sizes[k] == 0) continue;
+		struct io_uring_sqe *sqe = queue_sqe(ring, IORING_OP_OPENAT, k);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t) (uintptr_t) prefetcher->paths[batch->indexes[k]];
+		sqe->open_flags = PREFETCH_OPEN_FLAGS;
+		queued++;
+	}
+	if (queued > 0 && !submit_and_wait(ring, queued, opened, batch)) return false;
+
+	for (k = 0; k < batch->count; k++) {
+		// The file may have changed since it was statted
+		batch->sizes[k] = batch->fds[k] >= 0 ? regular_file_size(batch->fds[k]) : 0;
+		batch->done[k] = 0;
+		if (batch->sizes[k] > 0) batch->data[k] = malloc(batch->sizes[k]);
+		batch->reading[k] = batch->data[k] != NULL;
+	}
+	do {
+		queued = 0;
+		for (k = 0; k < batch->count; k++) {
+			if (!batch->reading[k]) continue;
+			size_t remaining = batch->sizes[k] - batch->done[k];
+			struct io_uring_sqe *sqe = queue_sqe(ring, IORING_OP_READ, k);
+			sqe->fd = batch->fds[k];
+			sqe->addr = (uint64_t) (uintptr_t) (batch->data[k] + batch->done[k]);
+			sqe->len = remaining < 1u << 30 ? remaining : 1u << 30;
+			sqe->off = batch->done[k];
+			queued++;
+		}
+		if (queued > 0 && !submit_and_wait(ring, queued, read_some, batch)) return false;
+	} while (queued > 0);
+
+	for (k = 0; k < batch->count; k++) {
+		if (batch->fds[k] >= 0) close(batch->fds[k]);
+		if (batch->data[k] != NULL && batch->done[k] == 0) {
+			free(batch->data[k]);
+			batch->data[k] = NULL;
+		}
+		fill_slot(prefetcher, batch->indexes[k], batch->data[k], batch->done[k]);
+	}
+	return true;
+}
+
+static void *ring_files(void *context) {
+	Prefetcher *prefetcher = context;
+	RingBatch batch;
+	bool ring_works = true;
+	while ((batch.count = claim_files(prefetcher, BATCH_SIZE, batch.indexes)) > 0) {
+		if (ring_works && read_ring_batch(prefetcher, &batch)) continue;
+		if (ring_works) {
+			// The kernel set the ring up but won't run it, e.g. under a seccomp filter; read the rest the slow way. Whatever it
+			// accepted has completed, so nothing is still reading into the buffers.
+			ring_works = false;
+			size_t k;
+			for (k = 0; k < batch.count; k++) {
+				if (batch.fds[k] >= 0) close(batch.fds[k]);
+				free(batch.data[k]);
+			}
+		}
+		size_t k;
+		for (k = 0; k < batch.count; k++) {
+			size_t length = 0;
+			uint8_t *data = pread_file(prefetcher->paths[batch.indexes[k]], &length);
+			fill_slot(prefetcher, batch.indexes[k], data, length);
+		}
+	}
+	return NULL;
+}
+
+Prefetcher *start_prefetch(char *const *paths, size_t count, size_t window, PrefetchBackend backend) {
+	Prefetcher *prefetcher = calloc(1, sizeof(Prefetcher));
+	prefetcher->paths = paths;
+	prefetcher->count = count;
+	prefetcher->window = window > 0 ? window : 1;
+	prefetcher->slots = calloc(count, sizeof(PrefetchSlot));
+	pthread_mutex_init(&prefetcher->lock, NULL);
+	pthread_cond_init(&prefetcher->filled, NULL);
+	pthread_cond_init(&prefetcher->taken, NULL);
+
+	if (backend == PREFETCH_IO_URING && setup_ring(&prefetcher->ring, BATCH_SIZE)) {
+		prefetcher->backend = PREFETCH_IO_URING;
+		if (pthread_create(prefetcher->threads, NULL, ring_files, prefetcher) == 0) prefetcher->threads_count = 1;
+	} else {
+		prefetcher->backend = PREFETCH_PREAD;
+		int i;
+		for (i = 0; i < PREAD_THREADS; i++) {
+			if (pthread_create(prefetcher->threads + i, NULL, pread_files, prefetcher) != 0) break;
+		}
+		prefetcher->threads_count = i;
+	}
+	return prefetcher;
+}
+
+uint8_t *take_file(Prefetcher *prefetcher, size_t index, size_t *length) {
+	if (index >= prefetcher->count || prefetcher->paths[index] == NULL || prefetcher->threads_count == 0) return NULL;
+	pthread_mutex_lock(&prefetcher->lock);
+	PrefetchSlot *slot = prefetcher->slots + index;
+	while (!slot->ready) {
+		pthread_cond_wait(&prefetcher->filled, &prefetcher->lock);
+	}
+	uint8_t *data = slot->data;
+	*length = slot->length;
+	slot->data = NULL;
+	prefetcher->outstanding--;
+	pthread_cond_broadcast(&prefetcher->taken);
+	pthread_mutex_unlock(&prefetcher->lock);
+	return data;
+}
+
+PrefetchBackend prefetch_backend(const Prefetcher *prefetcher) {
+	return prefetcher->backend;
+}
+
+void stop_prefetch(Prefetcher *prefetcher) {
+	pthread_mutex_lock(&prefetcher->lock);
+	prefetcher->stopping = true;
+	pthread_cond_broadcast(&prefetcher->taken);
+	pthread_mutex_unlock(&prefetcher->lock);
+	int i;
+	for (i = 0; i < prefetcher->threads_count; i++) {
+		pthread_join(prefetcher->threads[i], NULL);
+	}
+	if (prefetcher->backend == PREFETCH_IO_URING) free_ring(&prefetcher->ring);
+
+	size_t k;
+	for (k = 0; k < prefetcher->count; k++) {
+		free(prefetcher->slots[k].data);
+	}
+	free(prefetcher->slots);
+	pthread_cond_destroy(&prefetcher->taken);
+	pthread_cond_destroy(&prefetcher->filled);
+	pthread_mutex_destroy(&prefetcher->lock);
+	free(prefetcher);
+}
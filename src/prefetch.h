@@ -0,0 +1,35 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Reads whole files ahead of the threads that parse them, so waiting on the disk overlaps with parsing instead of coming before
+ * it. Files are read in index order, a bounded number ahead of the oldest one not yet taken. Where the kernel allows it, opens
+ * and reads are submitted in batches through io_uring from one background thread; otherwise a few threads each open, pread and
+ * close one file at a time. */
+
+typedef enum {
+	PREFETCH_IO_URING,
+	PREFETCH_PREAD
+} PrefetchBackend;
+
+typedef struct Prefetcher Prefetcher;
+
+/* Start reading the count files at paths, skipping NULL entries, keeping at most window of them read but not yet taken. window
+ * must be larger than the number of threads calling take_file. backend is the one to try first: io_uring falls back to pread if
+ * the kernel refuses it. paths must outlive the prefetcher. */
+Prefetcher *start_prefetch(char *const *paths, size_t count, size_t window, PrefetchBackend backend);
+
+/* Wait for the file at index and hand over its contents, which the caller must free, storing their size in length. Returns NULL
+ * if the file couldn't be read or isn't a regular file; the caller should then open it itself, which reports why. Each non-NULL
+ * path must be taken once, by index, and in index order by any one thread. */
+uint8_t *take_file(Prefetcher *prefetcher, size_t index, size_t *length);
+
+/* Return the backend actually in use */
+PrefetchBackend prefetch_backend(const Prefetcher *prefetcher);
+
+/* Stop reading, wait for the background threads and free every file not taken */
+void stop_prefetch(Prefetcher *prefetcher);
+
+#endif //PREFETCH_H
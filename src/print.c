@@ -1,125 +1,336 @@
+#include "buffer.h"
 #include "class.h"
+#include "code.h"
+#include "descriptor.h"
+#include "mutf8.h"
+#include "print.h"
 
-void print_class(FILE *stream, const Class *class) {
-	fprintf(stream, "File: %s\n", class->file_name);
-	fprintf(stream, "Minor number: %u \n", class->minor_version);
-	fprintf(stream, "Major number: %u \n", class->major_version);
-	fprintf(stream, "Constant pool size: %u \n", class->const_pool_count);
-	fprintf(stream, "Constant table size: %ub \n", class->pool_size_bytes);
-	fprintf(stream, "Printing constant pool of %d items...\n", class->const_pool_count-1);
-
-	Item *s;
-	uint16_t i = 1; // constant pool indexes start at 1, get_item converts to pointer index
+enum {
+	/* print_class's buffer; output is written to the stream in chunks this big */
+	PRINT_BUFFER_SIZE = 1 << 16
+};
+
+static inline void append_utf8(Buffer *out, const String string) {
+	decode_mutf8(out, string.value, string.length);
+}
+
+/* Attribute bodies are binary; like %.*s, stop at the first NUL */
+static void append_attribute_info(Buffer *out, const Class *class, const Attribute *at) {
+	const char *info = (const char *) get_attribute_info(class, at);
+	const char *nul = memchr(info, '\0', at->length);
+	append_chars(out, info, nul != NULL ? (size_t) (nul - info) : at->length);
+}
+
+/* newarray's operand, indexed by the type codes of table 6.5.newarray-A of the JVM spec */
+static const char *ARRAY_TYPES[] = {"?", "?", "?", "?", "boolean", "char", "float", "double", "byte", "short", "int", "long"};
+
+static void append_instruction(Buffer *out, const Instruction *ins) {
+	append_string(out, "\t\t");
+	append_uint(out, ins->pc);
+	append_string(out, ": ");
+	if (ins->wide) append_string(out, "wide ");
+	append_string(out, opcode_name(ins->opcode));
+	switch (OPCODES[ins->opcode].operands) {
+		case OPERAND_BYTE:
+		case OPERAND_SHORT:
+			append_char(out, ' ');
+			append_int(out, instruction_value(ins));
+			break;
+		case OPERAND_CONSTANT:
+			append_string(out, " #");
+			append_uint(out, instruction_index(ins));
+			break;
+		case OPERAND_LOCAL:
+			append_char(out, ' ');
+			append_uint(out, instruction_index(ins));
+			break;
+		case OPERAND_IINC:
+			append_char(out, ' ');
+			append_uint(out, instruction_index(ins));
+			append_string(out, ", ");
+			append_int(out, instruction_value(ins));
+			break;
+		case OPERAND_BRANCH:
+		case OPERAND_BRANCH_WIDE:
+			append_char(out, ' ');
+			append_uint(out, instruction_target(ins));
+			break;
+		case OPERAND_INVOKEINTERFACE:
+		case OPERAND_MULTIANEWARRAY:
+			append_string(out, " #");
+			append_uint(out, instruction_index(ins));
+			append_string(out, ", ");
+			append_int(out, instruction_value(ins));
+			break;
+		case OPERAND_NEWARRAY: {
+			int32_t type = instruction_value(ins);
+			append_char(out, ' ');
+			append_string(out, type < (int32_t) (sizeof(ARRAY_TYPES) / sizeof(ARRAY_TYPES[0])) ? ARRAY_TYPES[type] : "?");
+			break;
+		}
+		case OPERAND_TABLESWITCH:
+		case OPERAND_LOOKUPSWITCH: {
+			Switch table = instruction_switch(ins);
+			append_string(out, " {");
+			uint32_t i;
+			for (i = 0; i < table.count; i++) {
+				int32_t match;
+				uint32_t target;
+				switch_case(&table, i, &match, &target);
+				append_char(out, ' ');
+				append_int(out, match);
+				append_string(out, ": ");
+				append_uint(out, target);
+				append_char(out, ',');
+			}
+			append_string(out, " default: ");
+			append_uint(out, ins->pc + table.default_offset);
+			append_string(out, " }");
+			break;
+		}
+	}
+	append_char(out, '\n');
+}
+
+/* Write a Code attribute as its limits, a listing of its instructions, its exception handlers and its nested attributes'
+ * names. Returns false, having written nothing, if the attribute is too short to hold what it claims to. */
+static bool append_code(Buffer *out, const Class *class, const Attribute *at) {
+	Code code;
+	if (!read_code(class, at, &code)) return false;
+
+	append_string(out, "max stack ");
+	append_uint(out, code.max_stack);
+	append_string(out, ", max locals ");
+	append_uint(out, code.max_locals);
+	append_string(out, ", ");
+	append_uint(out, code.code_length);
+	append_string(out, " bytes of code\n");
+
+	InstructionIterator it = instruction_iterator(&code);
+	Instruction ins;
+	while (next_instruction(&it, &ins)) {
+		append_instruction(out, &ins);
+	}
+	if (it.malformed) {
+		append_string(out, "\t\tMalformed instruction at ");
+		append_uint(out, it.pc);
+		append_char(out, '\n');
+	}
+
+	uint16_t i;
+	for (i = 0; i < code.exception_table_length; i++) {
+		ExceptionHandler handler = get_exception_handler(&code, i);
+		append_string(out, "\t\tException handler: ");
+		append_uint(out, handler.start_pc);
+		append_string(out, " to ");
+		append_uint(out, handler.end_pc);
+		append_string(out, " jumps to ");
+		append_uint(out, handler.handler_pc);
+		append_string(out, ", catching #");
+		append_uint(out, handler.catch_type);
+		append_char(out, '\n');
+	}
+
+	Cursor attributes = code.attributes;
+	for (i = 0; i < code.attributes_count; i++) {
+		Attribute nested;
+		parse_attribute(&attributes, &nested);
+		if (attributes.overflow) break;
+		const String *name = get_utf8(class, nested.name_idx);
+		append_string(out, "\t\tNested attribute: ");
+		if (name != NULL) append_utf8(out, *name);
+		append_string(out, ", length ");
+		append_uint(out, nested.length);
+		append_char(out, '\n');
+	}
+	return true;
+}
+
+/* Write a Signature attribute's signature as Java source would, using signature_type to parse it. Returns false, having
+ * written nothing, if it is malformed. */
+static bool append_signature(Buffer *out, const Class *class, const Attribute *at,
+		const TypeNode *(*signature_type)(const Class *, uint16_t)) {
+	if (at->length != 2) return false;
+	const uint8_t *info = get_attribute_info(class, at);
+	const TypeNode *type = signature_type(class, info[0] << 8 | info[1]);
+	if (type == NULL) return false;
+	append_type(out, type);
+	append_char(out, '\n');
+	return true;
+}
+
+/* Method and class attributes have no newline after the name; field attributes do. signature_type parses their Signature
+ * attributes: constant_member_type for fields and methods, constant_class_signature for classes. */
+static void append_attributes(Buffer *out, const Class *class, const Attribute *attrs, uint16_t attrs_count, bool name_newline,
+		const TypeNode *(*signature_type)(const Class *, uint16_t)) {
+	int aidx = 0;
+	while (aidx < attrs_count) {
+		const Attribute *at = attrs + aidx;
+		Item name = get_item(class, at->name_idx);
+		append_string(out, "\tAttribute name: ");
+		append_utf8(out, name.value.string);
+		if (name_newline) append_char(out, '\n');
+		append_string(out, "\tAttribute length ");
+		append_int(out, (int32_t) at->length);
+		append_string(out, "\n\tAttribute: ");
+		bool written = false;
+		if (at->kind == ATTR_CODE) {
+			written = append_code(out, class, at);
+		} else if (at->kind == ATTR_SIGNATURE) {
+			written = append_signature(out, class, at, signature_type);
+		}
+		if (!written) {
+			append_attribute_info(out, class, at);
+			append_char(out, '\n');
+		}
+		aidx++;
+	}
+}
+
+void format_class(Buffer *out, const Class *class) {
+	append_string(out, "File: ");
+	append_string(out, class->file_name);
+	append_string(out, "\nMinor number: ");
+	append_uint(out, class->minor_version);
+	append_string(out, " \nMajor number: ");
+	append_uint(out, class->major_version);
+	append_string(out, " \nConstant pool size: ");
+	append_uint(out, class->const_pool_count);
+	append_string(out, " \nConstant table size: ");
+	append_uint(out, class->pool_size_bytes);
+	append_string(out, "b \nPrinting constant pool of ");
+	append_int(out, class->const_pool_count - 1);
+	append_string(out, " items...\n");
+
+	Item s;
+	uint16_t i = 1; // constant pool indexes start at 1, get_item decodes each
 	while (i < class->const_pool_count) {
 		s = get_item(class, i);
-		fprintf(stream, "Item #%u %s: ", i, tag2str(s->tag));
-		if (s->tag == STRING_UTF8) {
-			fprintf(stream, "%s\n", s->value.string.value);
-		} else if (s->tag == INTEGER) {
-			fprintf(stream, "%d\n", s->value.integer);
-		} else if (s->tag == FLOAT) {
-			fprintf(stream, "%f\n", s->value.flt);
-		} else if (s->tag == LONG) {
-			fprintf(stream, "%ld\n", to_long(s->value.lng));
-		} else if (s->tag == DOUBLE) {
-			fprintf(stream, "%lf\n", to_double(s->value.dbl));
-		} else if (s->tag == CLASS || s->tag == STRING) {
-			fprintf(stream, "%u\n", s->value.ref.class_idx);
-		} else if(s->tag == FIELD || s->tag == METHOD || s->tag == INTERFACE_METHOD || s->tag == NAME) {
-			fprintf(stream, "%u.%u\n", s->value.ref.class_idx, s->value.ref.name_idx);
+		append_string(out, "Item #");
+		append_uint(out, i);
+		append_char(out, ' ');
+		append_string(out, tag2str(s.tag));
+		append_string(out, ": ");
+		if (s.tag == STRING_UTF8) {
+			append_utf8(out, s.value.string);
+			append_char(out, '\n');
+		} else if (s.tag == INTEGER) {
+			append_int(out, s.value.integer);
+			append_char(out, '\n');
+		} else if (s.tag == FLOAT) {
+			append_double(out, s.value.flt);
+			append_char(out, '\n');
+		} else if (s.tag == LONG) {
+			append_int(out, to_long(s.value.lng));
+			append_char(out, '\n');
+		} else if (s.tag == DOUBLE) {
+			append_double(out, to_double(s.value.dbl));
+			append_char(out, '\n');
+		} else if (s.tag == CLASS || s.tag == STRING || s.tag == METHOD_TYPE || s.tag == MODULE || s.tag == PACKAGE) {
+			append_uint(out, s.value.ref.class_idx);
+			append_char(out, '\n');
+		} else if(s.tag == FIELD || s.tag == METHOD || s.tag == INTERFACE_METHOD || s.tag == NAME || s.tag == METHOD_HANDLE
+				|| s.tag == DYNAMIC || s.tag == INVOKE_DYNAMIC) {
+			append_uint(out, s.value.ref.class_idx);
+			append_char(out, '.');
+			append_uint(out, s.value.ref.name_idx);
+			append_char(out, '\n');
 		} 
 		i++;
 	}
 
-	fprintf(stream, "Access flags: %x\n", class->flags);
+	append_string(out, "Access flags: ");
+	append_hex(out, class->flags);
 
-	Item *cl_str = get_class_string(class, class->this_class);
-	fprintf(stream, "This class: %s\n", cl_str->value.string.value);
+	Item cl_str = get_class_string(class, class->this_class);
+	append_string(out, "\nThis class: ");
+	append_utf8(out, cl_str.value.string);
 
 	cl_str = get_class_string(class, class->super_class);
-	fprintf(stream, "Super class: %s\n", cl_str->value.string.value);
-
-	fprintf(stream, "Interfaces count: %u\n", class->interfaces_count);
+	append_string(out, "\nSuper class: ");
+	append_utf8(out, cl_str.value.string);
 
-	fprintf(stream, "Printing %u interfaces...\n", class->interfaces_count);
+	append_string(out, "\nInterfaces count: ");
+	append_uint(out, class->interfaces_count);
+	append_string(out, "\nPrinting ");
+	append_uint(out, class->interfaces_count);
+	append_string(out, " interfaces...\n");
 	if (class->interfaces_count > 0) {
 		Ref *iface = class->interfaces;
-		Item *the_class;
 		uint16_t idx = 0;
 		while (idx < class->interfaces_count) {
-			the_class = get_item(class, iface->class_idx); // the interface class reference
-			Item *item = get_item(class, the_class->value.ref.class_idx);
-			String string = item->value.string;
-			fprintf(stream, "Interface: %s\n", string.value);
+			Item item = get_class_string(class, iface->class_idx); // the interface class reference's name
+			append_string(out, "Interface: ");
+			append_utf8(out, item.value.string);
+			append_char(out, '\n');
 			idx++;
 			iface = class->interfaces + idx; // next Ref
 		}
 	}
 
-	fprintf(stream, "Printing %d fields...\n", class->fields_count);
+	if (class->skimmed) {
+		return;
+	}
+
+	append_string(out, "Printing ");
+	append_uint(out, class->fields_count);
+	append_string(out, " fields...\n");
 
 	if (class->fields_count > 0) {
 		Field *field = class->fields;
 		uint16_t idx = 0;
 		while (idx < class->fields_count) {
-			Item *name = get_item(class, field->name_idx);
-			Item *desc = get_item(class, field->desc_idx);
-			printf("%s %s\n", field2str(desc->value.string.value[0]), name->value.string.value);
-			Attribute at;
-			if (field->attrs_count > 0) {
-				int aidx = 0;
-				while (aidx < field->attrs_count) {
-					at = field->attrs[aidx];
-					Item *name = get_item(class, at.name_idx);
-					fprintf(stream, "\tAttribute name: %s\n", name->value.string.value);
-					fprintf(stream, "\tAttribute length %d\n", at.length);
-					fprintf(stream, "\tAttribute: %s\n", at.info);
-					aidx++;
-				}
+			Item name = get_item(class, field->name_idx);
+			const String *desc = get_utf8(class, field->desc_idx);
+			const TypeNode *type = constant_member_type(class, field->desc_idx);
+			if (type != NULL) {
+				append_declaration(out, type, name.value.string);
+			} else {
+				// Malformed, or not a UTF-8 constant at all
+				append_string(out, desc != NULL && desc->length > 0 ? field2str(desc->value[0]) : "Undefined");
+				append_char(out, ' ');
+				append_utf8(out, name.value.string);
 			}
+			append_char(out, '\n');
+			append_attributes(out, class, field->attrs, field->attrs_count, true, constant_member_type);
 			idx++;
 			field = class->fields + idx;
 		}
 	}
 
-	fprintf(stream, "Printing %u methods...\n", class->methods_count);
-	i = 0;
+	append_string(out, "Printing ");
+	append_uint(out, class->methods_count);
+	append_string(out, " methods...\n");
 	if (class->methods_count > 0) {
 		Method *method = class->methods;
 		uint16_t idx = 0;
 		while (idx < class->methods_count) {
-			Item *name = get_item(class, method->name_idx);
-			Item *desc = get_item(class, method->desc_idx);
-			printf("%s %s\n", name->value.string.value, desc->value.string.value);
-			Attribute at;
-			if (method->attrs_count > 0) {
-				int aidx = 0;
-				while (aidx < method->attrs_count) {
-					at = method->attrs[aidx];
-					Item *name = get_item(class, at.name_idx);
-					fprintf(stream, "\tAttribute name: %s", name->value.string.value);
-					fprintf(stream, "\tAttribute length %d\n", at.length);
-					fprintf(stream, "\tAttribute: %s\n", at.info);
-					aidx++;
-				}
+			Item name = get_item(class, method->name_idx);
+			const String *desc = get_utf8(class, method->desc_idx);
+			const TypeNode *type = constant_member_type(class, method->desc_idx);
+			if (type != NULL) {
+				append_declaration(out, type, name.value.string);
+			} else {
+				append_utf8(out, name.value.string);
+				append_char(out, ' ');
+				if (desc != NULL) append_utf8(out, *desc);
 			}
+			append_char(out, '\n');
+			append_attributes(out, class, method->attrs, method->attrs_count, false, constant_member_type);
 			idx++;
 			method = class->methods + idx;
 		}
 	}
 
-	fprintf(stream, "Printing %u attributes...\n", class->attributes_count);
-	if (class->attributes_count > 0) {
-		Attribute at;
-		int aidx = 0;
-		while (aidx < class->attributes_count) {
-			at = class->attributes[aidx];
-			Item *name = get_item(class, at.name_idx);
-			fprintf(stream, "\tAttribute name: %s", name->value.string.value);
-			fprintf(stream, "\tAttribute length %d\n", at.length);
-			fprintf(stream, "\tAttribute: %s\n", at.info);
-			aidx++;
-		}
-	}
+	append_string(out, "Printing ");
+	append_uint(out, class->attributes_count);
+	append_string(out, " attributes...\n");
+	append_attributes(out, class, class->attributes, class->attributes_count, false, constant_class_signature);
 }
 
+void print_class(FILE *stream, const Class *class) {
+	Buffer out;
+	init_buffer(&out, stream, PRINT_BUFFER_SIZE);
+	format_class(&out, class);
+	free_buffer(&out);
+}
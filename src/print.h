@@ -1,11 +1,21 @@
 #ifndef PRINT_H
 #define PRINT_H
+#include "buffer.h"
 #include "class.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+enum {
+	/* Bump whenever a class prints differently, as text here or as JSON in json.c, so cached output isn't reused */
+	OUTPUT_VERSION = 1
+};
+
+/* Append the name and class stats/contents to out. All formatting is done by hand into out; nothing is allocated per line. */
+void format_class(Buffer *out, const Class *class);
+
+/* Write the name and class stats/contents to stream through a private buffer, in a few large writes. */
 void print_class(FILE *stream, const Class *class);
 
 #endif //PRINT_H
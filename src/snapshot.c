@@ -0,0 +1,405 @@
+#include "snapshot.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char SNAPSHOT_MAGIC[8] = "CFRSNAP";
+
+/* Where snapshots ask to be mapped: clear of the program, its heap, the libraries and the stacks, and of a sanitizer's shadow */
+#define SNAPSHOT_BASE (sizeof(void *) == 8 ? UINT64_C(0x600000000000) : UINT64_C(0x40000000))
+
+/* Without it the base address is only a hint, and missing it costs a relocation like any other clash */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+enum {
+	BYTE_ORDER_MARK = 0x01020304,
+
+	/* Sections start on this boundary so their records can be read in place */
+	SECTION_ALIGNMENT = 8,
+
+	/* Initial size of each of a writer's buffers; most writers only ever hold one class */
+	WRITER_BUFFER_SIZE = 256
+};
+
+/* The size of one record of each section */
+static const size_t RECORD_SIZES[SNAPSHOT_SECTIONS] = {
+	sizeof(Class), sizeof(uint8_t), sizeof(uint32_t), sizeof(String), sizeof(Ref), sizeof(Field), sizeof(Method),
+	sizeof(Attribute), 1
+};
+
+/* Snapshots are only read by hosts that agree on where the pointers sit in a record */
+static uint32_t record_layout(void) {
+	return (uint32_t) (sizeof(Class) << 16 | sizeof(String) << 8 | sizeof(Field));
+}
+
+/* Return p moved by shift bytes. Records hold plain offsets in their pointers until they are written, so this is arithmetic
+ * on numbers rather than on pointers into one object. */
+static inline void *shift_pointer(const void *p, uintptr_t shift) {
+	return (void *) ((uintptr_t) p + shift);
+}
+
+/* Shift the pointers of every record from first[s] to lengths[s] bytes into each section s, by shift[t] for those pointing
+ * into section t */
+static void relocate(uint8_t *const *sections, const uint64_t *first, const uint64_t *lengths, const uintptr_t *shift) {
+	uint64_t at;
+	for (at = first[SECTION_CLASSES]; at < lengths[SECTION_CLASSES]; at += sizeof(Class)) {
+		Class *class = (Class *) (sections[SECTION_CLASSES] + at);
+		class->file_name = shift_pointer(class->file_name, shift[SECTION_BLOB]);
+		class->image = shift_pointer(class->image, shift[SECTION_BLOB]);
+		class->tags = shift_pointer(class->tags, shift[SECTION_TAGS]);
+		class->payloads = shift_pointer(class->payloads, shift[SECTION_PAYLOADS]);
+		class->strings = shift_pointer(class->strings, shift[SECTION_STRINGS]);
+		class->interfaces = shift_pointer(class->interfaces, shift[SECTION_INTERFACES]);
+		class->fields = shift_pointer(class->fields, shift[SECTION_FIELDS]);
+		class->methods = shift_pointer(class->methods, shift[SECTION_METHODS]);
+		class->attributes = shift_pointer(class->attributes, shift[SECTION_ATTRIBUTES]);
+	}
+	for (at = first[SECTION_STRINGS]; at < lengths[SECTION_STRINGS]; at += sizeof(String)) {
+		String *string = (String *) (sections[SECTION_STRINGS] + at);
+		string->value = shift_pointer(string->value, shift[SECTION_BLOB]);
+	}
+	for (at = first[SECTION_FIELDS]; at < lengths[SECTION_FIELDS]; at += sizeof(Field)) {
+		Field *field = (Field *) (sections[SECTION_FIELDS] + at);
+		field->attrs = shift_pointer(field->attrs, shift[SECTION_ATTRIBUTES]);
+	}
+	for (at = first[SECTION_METHODS]; at < lengths[SECTION_METHODS]; at += sizeof(Method)) {
+		Method *method = (Method *) (sections[SECTION_METHODS] + at);
+		method->attrs = shift_pointer(method->attrs, shift[SECTION_ATTRIBUTES]);
+	}
+}
+
+void init_snapshot_writer(SnapshotWriter *writer) {
+	memset(writer, 0, sizeof(*writer));
+}
+
+void free_snapshot_writer(SnapshotWriter *writer) {
+	int s;
+	for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+		free_buffer(writer->sections + s);
+	}
+}
+
+/* Allocate writer's buffers, the first time it is given a class */
+static void start_writer(SnapshotWriter *writer) {
+	if (writer->sections[SECTION_CLASSES].data != NULL) return;
+	int s;
+	for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+		init_buffer(writer->sections + s, NULL, s == SECTION_CLASSES ? sizeof(Class) : WRITER_BUFFER_SIZE);
+	}
+}
+
+/* Append count records to section and return a pointer holding the offset of the first */
+static void *add_records(SnapshotWriter *writer, SnapshotSection section, const void *records, size_t count) {
+	Buffer *buffer = writer->sections + section;
+	const uintptr_t offset = buffer->length;
+	if (count > 0) append_chars(buffer, records, count * RECORD_SIZES[section]);
+	return (void *) offset;
+}
+
+void add_to_snapshot(SnapshotWriter *writer, const Class *class) {
+	start_writer(writer);
+	Class record;
+	memcpy(&record, class, sizeof(record));
+	record.image = add_records(writer, SECTION_BLOB, class->image, class->image_length);
+	record.file_name = add_records(writer, SECTION_BLOB, class->file_name, strlen(class->file_name) + 1);
+	record.tags = add_records(writer, SECTION_TAGS, class->tags, class->const_pool_count);
+	record.payloads = add_records(writer, SECTION_PAYLOADS, class->payloads, class->const_pool_count);
+
+	// Strings in the image keep their place in its copy; interned ones are copied after it
+	record.strings = add_records(writer, SECTION_STRINGS, NULL, 0);
+	uint16_t i;
+	for (i = 0; i < class->strings_count; i++) {
+		// Field by field, so the padding written is zeroes rather than whatever the parser's String had
+		String string;
+		memset(&string, 0, sizeof(string));
+		string.length = class->strings[i].length;
+		string.value = class->strings[i].value;
+		const uintptr_t at = (uintptr_t) string.value - (uintptr_t) class->image;
+		if ((uintptr_t) string.value >= (uintptr_t) class->image && at <= class->image_length
+				&& string.length <= class->image_length - at) {
+			string.value = shift_pointer(record.image, at);
+		} else {
+			string.value = add_records(writer, SECTION_BLOB, string.value, string.length);
+		}
+		add_records(writer, SECTION_STRINGS, &string, 1);
+	}
+
+	record.interfaces = add_records(writer, SECTION_INTERFACES, class->interfaces, class->interfaces_count);
+	// Attribute offsets are relative to the image, which is copied whole, and their kinds are kept
+	record.attributes = add_records(writer, SECTION_ATTRIBUTES, class->attributes, class->attributes_count);
+	record.fields = add_records(writer, SECTION_FIELDS, NULL, 0);
+	for (i = 0; i < class->fields_count; i++) {
+		Field field = class->fields[i];
+		field.attrs = add_records(writer, SECTION_ATTRIBUTES, field.attrs, field.attrs_count);
+		add_records(writer, SECTION_FIELDS, &field, 1);
+	}
+	record.methods = add_records(writer, SECTION_METHODS, NULL, 0);
+	for (i = 0; i < class->methods_count; i++) {
+		Method method = class->methods[i];
+		method.attrs = add_records(writer, SECTION_ATTRIBUTES, method.attrs, method.attrs_count);
+		add_records(writer, SECTION_METHODS, &method, 1);
+	}
+
+	// What belongs to the loading process rather than the class
+	record.image_source = IMAGE_BORROWED;
+	record.filtered = false;
+	record.symbols = NULL;
+	record.types = NULL;
+	record.arena = NULL;
+	add_records(writer, SECTION_CLASSES, &record, 1);
+}
+
+void merge_snapshot(SnapshotWriter *writer, const SnapshotWriter *from) {
+	if (from->sections[SECTION_CLASSES].length == 0) return;
+	start_writer(writer);
+	// from's records point at offsets into its own sections, which now start where writer's ended
+	uint8_t *sections[SNAPSHOT_SECTIONS];
+	uint64_t first[SNAPSHOT_SECTIONS], lengths[SNAPSHOT_SECTIONS];
+	uintptr_t shift[SNAPSHOT_SECTIONS];
+	int s;
+	for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+		first[s] = shift[s] = writer->sections[s].length;
+		append_chars(writer->sections + s, from->sections[s].data, from->sections[s].length);
+		sections[s] = (uint8_t *) writer->sections[s].data;
+		lengths[s] = writer->sections[s].length;
+	}
+	relocate(sections, first, lengths, shift);
+}
+
+static uint64_t align_section(uint64_t offset) {
+	return (offset + SECTION_ALIGNMENT - 1) & ~(uint64_t) (SECTION_ALIGNMENT - 1);
+}
+
+/* Write a section at its aligned offset, padding from the current position */
+static bool write_section(FILE *file, uint64_t *position, uint64_t offset, const uint8_t *data, uint64_t length) {
+	static const char zeroes[SECTION_ALIGNMENT] = {0};
+	if (fwrite(zeroes, 1, offset - *position, file) != offset - *position) return false;
+	if (fwrite(data, 1, length, file) != length) return false;
+	*position = offset + length;
+	return true;
+}
+
+bool write_snapshot(const SnapshotWriter *writer, const char *file_name) {
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.layout = record_layout();
+	header.base = SNAPSHOT_BASE;
+
+	// Point copies of the records that hold pointers at where their sections will be mapped
+	uint8_t *sections[SNAPSHOT_SECTIONS];
+	uint64_t first[SNAPSHOT_SECTIONS];
+	uintptr_t shift[SNAPSHOT_SECTIONS];
+	uint64_t offset = sizeof(header);
+	int s;
+	for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+		offset = align_section(offset);
+		header.offsets[s] = offset;
+		header.lengths[s] = writer->sections[s].length;
+		offset += header.lengths[s];
+		first[s] = 0;
+		shift[s] = (uintptr_t) (header.base + header.offsets[s]);
+		sections[s] = (uint8_t *) writer->sections[s].data;
+		if (header.lengths[s] > 0 && (s == SECTION_CLASSES || s == SECTION_STRINGS || s == SECTION_FIELDS || s == SECTION_METHODS)) {
+			sections[s] = malloc(header.lengths[s]);
+			memcpy(sections[s], writer->sections[s].data, header.lengths[s]);
+		}
+	}
+	relocate(sections, first, header.lengths, shift);
+
+	FILE *file = fopen(file_name, "wb");
+	bool written = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1;
+	uint64_t position = sizeof(header);
+	for (s = 0; s < SNAPSHOT_SECTIONS && written; s++) {
+		written = write_section(file, &position, header.offsets[s], sections[s], header.lengths[s]);
+	}
+	if (file != NULL && fclose(file) != 0) written = false;
+	if (!written) {
+		fprintf(stderr, "Could not write snapshot '%s': %s\n", file_name, strerror(errno));
+	}
+	for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+		if (sections[s] != (uint8_t *) writer->sections[s].data) free(sections[s]);
+	}
+	return written;
+}
+
+bool is_snapshot_name(const char *file_name) {
+	size_t length = strlen(file_name);
+	return length > 5 && strcasecmp(file_name + length - 5, ".cfrs") == 0;
+}
+
+/* Return true if length bytes at offset lie within a file of file_length bytes and start suitably aligned */
+static bool section_fits(uint64_t offset, uint64_t length, size_t record_size, size_t file_length) {
+	return offset % SECTION_ALIGNMENT == 0 && offset <= file_length && length <= file_length - offset && length % record_size == 0;
+}
+
+Snapshot *open_snapshot(char *file_name) {
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open '%s': %s\n", file_name, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	SnapshotHeader header;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t) st.st_size < sizeof(header)
+			|| pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+		fprintf(stderr, "Skipping '%s': not a valid snapshot\n", file_name);
+		close(fd);
+		return NULL;
+	}
+	const size_t length = st.st_size;
+	bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == SNAPSHOT_VERSION
+		&& header.byte_order == BYTE_ORDER_MARK
+		&& header.layout == record_layout()
+		&& header.base == (uintptr_t) header.base;
+	int s;
+	for (s = 0; s < SNAPSHOT_SECTIONS && valid; s++) {
+		valid = section_fits(header.offsets[s], header.lengths[s], RECORD_SIZES[s], length);
+	}
+	if (!valid) {
+		fprintf(stderr, "Skipping '%s': not a valid snapshot for this host\n", file_name);
+		close(fd);
+		return NULL;
+	}
+
+	// Private and writable: relocating, or filtering a loaded class's members, copies the pages touched and leaves the file be
+	uint8_t *image = mmap((void *) (uintptr_t) header.base, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED_NOREPLACE,
+			fd, 0);
+	if (image == MAP_FAILED) image = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "Could not map '%s': %s\n", file_name, strerror(errno));
+		return NULL;
+	}
+
+	Snapshot *snapshot = malloc(sizeof(Snapshot));
+	snapshot->image = image;
+	snapshot->image_length = length;
+	snapshot->header = (const SnapshotHeader *) image;
+	for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+		snapshot->sections[s] = image + header.offsets[s];
+	}
+	snapshot->relocated = (uintptr_t) image != header.base;
+	if (snapshot->relocated) {
+		// Somebody else has the base address: move every pointer by how far off we landed
+		uint64_t first[SNAPSHOT_SECTIONS];
+		uintptr_t shift[SNAPSHOT_SECTIONS];
+		for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+			first[s] = 0;
+			shift[s] = (uintptr_t) image - (uintptr_t) header.base;
+		}
+		relocate(snapshot->sections, first, header.lengths, shift);
+	}
+	return snapshot;
+}
+
+void close_snapshot(Snapshot *snapshot) {
+	if (snapshot == NULL) return;
+	munmap(snapshot->image, snapshot->image_length);
+	free(snapshot);
+}
+
+/* Return true if count records from p lie within section of snapshot, starting on a record boundary */
+static bool in_section(const Snapshot *snapshot, SnapshotSection section, const void *p, uint64_t count) {
+	const uintptr_t start = (uintptr_t) snapshot->sections[section];
+	const uint64_t length = snapshot->header->lengths[section];
+	const size_t size = RECORD_SIZES[section];
+	const uintptr_t at = (uintptr_t) p - start;
+	return (uintptr_t) p >= start && at <= length && at % size == 0 && count <= (length - at) / size;
+}
+
+/* Return true if record's pool arrays and strings array lie within their sections, so its constants can be looked up */
+static bool pool_fits(const Snapshot *snapshot, const Class *record) {
+	return record->const_pool_count > 0
+		&& in_section(snapshot, SECTION_TAGS, record->tags, record->const_pool_count)
+		&& in_section(snapshot, SECTION_PAYLOADS, record->payloads, record->const_pool_count)
+		&& in_section(snapshot, SECTION_STRINGS, record->strings, record->strings_count);
+}
+
+const char *snapshot_class_name(const Snapshot *snapshot, uint64_t index, uint16_t *length) {
+	if (index >= snapshot_classes_count(snapshot)) return NULL;
+	const Class *record = (const Class *) snapshot->sections[SECTION_CLASSES] + index;
+	if (!pool_fits(snapshot, record) || get_tag(record, record->this_class) != CLASS) return NULL;
+
+	const uint16_t name_idx = get_ref(record, record->this_class).class_idx;
+	if (get_tag(record, name_idx) != STRING_UTF8 || record->payloads[name_idx] >= record->strings_count) return NULL;
+	const String *name = record->strings + record->payloads[name_idx];
+	if (!in_section(snapshot, SECTION_BLOB, name->value, name->length)) return NULL;
+	*length = name->length;
+	return name->value;
+}
+
+/* Return true if count attributes from attrs lie within the attributes section, with known kinds and bodies inside record's
+ * image */
+static bool attributes_fit(const Snapshot *snapshot, const Class *record, const Attribute *attrs, uint16_t count) {
+	if (!in_section(snapshot, SECTION_ATTRIBUTES, attrs, count)) return false;
+	uint16_t i;
+	for (i = 0; i < count; i++) {
+		if (attrs[i].kind >= ATTRIBUTE_KINDS || attrs[i].offset > record->image_length
+				|| attrs[i].length > record->image_length - attrs[i].offset) return false;
+	}
+	return true;
+}
+
+/* Return true if everything record points to lies within the snapshot, so the printers can follow it as they would a parsed
+ * class. Only reads. */
+static bool class_fits(const Snapshot *snapshot, const Class *record) {
+	if (!pool_fits(snapshot, record)
+			|| !in_section(snapshot, SECTION_BLOB, record->image, record->image_length)
+			|| !in_section(snapshot, SECTION_BLOB, record->file_name, 1)
+			|| !in_section(snapshot, SECTION_INTERFACES, record->interfaces, record->interfaces_count)
+			|| !in_section(snapshot, SECTION_FIELDS, record->fields, record->fields_count)
+			|| !in_section(snapshot, SECTION_METHODS, record->methods, record->methods_count)
+			|| !attributes_fit(snapshot, record, record->attributes, record->attributes_count)) {
+		return false;
+	}
+	const uint8_t *blob_end = snapshot->sections[SECTION_BLOB] + snapshot->header->lengths[SECTION_BLOB];
+	if (memchr(record->file_name, '\0', blob_end - (const uint8_t *) record->file_name) == NULL) return false;
+
+	uint16_t i;
+	for (i = 0; i < record->const_pool_count; i++) {
+		const uint8_t tag = record->tags[i];
+		if (tag > MAX_CPOOL_TAG || (i == 0 && tag != 0)) return false;
+		if (tag == STRING_UTF8 && record->payloads[i] >= record->strings_count) return false;
+		// The low word of a Long or Double is read from the next slot
+		if ((tag == LONG || tag == DOUBLE) && i + 1 >= record->const_pool_count) return false;
+	}
+	for (i = 0; i < record->strings_count; i++) {
+		if (!in_section(snapshot, SECTION_BLOB, record->strings[i].value, record->strings[i].length)) return false;
+	}
+	for (i = 0; i < record->fields_count; i++) {
+		if (!attributes_fit(snapshot, record, record->fields[i].attrs, record->fields[i].attrs_count)) return false;
+	}
+	for (i = 0; i < record->methods_count; i++) {
+		if (!attributes_fit(snapshot, record, record->methods[i].attrs, record->methods[i].attrs_count)) return false;
+	}
+	return true;
+}
+
+Class *load_snapshot_class(const Snapshot *snapshot, uint64_t index) {
+	if (index >= snapshot_classes_count(snapshot)) return NULL;
+	const Class *record = (const Class *) snapshot->sections[SECTION_CLASSES] + index;
+	if (!class_fits(snapshot, record)) return NULL;
+
+	// The record is shared by every load, so the class gets a copy of its own to hang an arena and type trees off
+	Arena *arena = create_arena(sizeof(Class));
+	Class *class = arena_alloc(arena, sizeof(Class));
+	memcpy(class, record, sizeof(Class));
+	class->arena = arena;
+	class->image_source = IMAGE_BORROWED;
+	class->filtered = false;
+	class->symbols = NULL;
+	class->types = NULL;
+	return class;
+}
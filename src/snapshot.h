@@ -0,0 +1,93 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include "buffer.h"
+#include "class.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A snapshot is an image of parsed classes laid out exactly as they sit in memory: Class records, then the pool arrays,
+ * Strings, interfaces, fields, methods and attributes they point to, then one blob holding every class image. The pointers
+ * inside are written for the file being mapped at its header's base address, so when the mapping lands there a loaded class is
+ * a view into it, attribute kinds and all, with only its Class record copied and nothing fixed up. If the address is taken, e.g. by a second
+ * snapshot, open_snapshot shifts every pointer once instead. Records are only good for a host with the same byte order and
+ * record sizes as the one that wrote them. */
+
+enum {
+	SNAPSHOT_VERSION = 2
+};
+
+/* The sections of a snapshot, in file order */
+typedef enum {
+	SECTION_CLASSES,    // Class
+	SECTION_TAGS,       // uint8_t, const_pool_count per class
+	SECTION_PAYLOADS,   // uint32_t, const_pool_count per class
+	SECTION_STRINGS,    // String
+	SECTION_INTERFACES, // Ref
+	SECTION_FIELDS,     // Field
+	SECTION_METHODS,    // Method
+	SECTION_ATTRIBUTES, // Attribute, class attributes and then each member's
+	SECTION_BLOB,       // each class's image, then its file name and any strings from outside the image
+	SNAPSHOT_SECTIONS
+} SnapshotSection;
+
+typedef struct {
+	char magic[8];        // "CFRSNAP\0"
+	uint32_t version;
+	uint32_t byte_order;  // 0x01020304 as written by the host that made the snapshot
+	uint32_t layout;      // the sizes of Class, String and Field on that host
+	uint32_t padding;
+	uint64_t base;        // the address every pointer in the records assumes the file is mapped at
+	uint64_t offsets[SNAPSHOT_SECTIONS]; // from the start of the file
+	uint64_t lengths[SNAPSHOT_SECTIONS]; // in bytes
+} SnapshotHeader;
+
+/* Accumulates classes in memory until write_snapshot. Pointers in its records hold offsets into its own sections. Zeroed, a
+ * writer is empty and allocates nothing until the first add_to_snapshot. */
+typedef struct {
+	Buffer sections[SNAPSHOT_SECTIONS];
+} SnapshotWriter;
+
+/* A mapped snapshot. Opening one validates the header and section bounds, and relocates it if need be, and nothing else. */
+typedef struct {
+	uint8_t *image;
+	size_t image_length;
+	const SnapshotHeader *header;
+	uint8_t *sections[SNAPSHOT_SECTIONS];
+	bool relocated; // mapped somewhere other than the header's base, so every pointer was shifted on opening
+} Snapshot;
+
+void init_snapshot_writer(SnapshotWriter *writer);
+void free_snapshot_writer(SnapshotWriter *writer);
+
+/* Append class to writer. Its image and strings are copied, so class may be freed straight after. */
+void add_to_snapshot(SnapshotWriter *writer, const Class *class);
+
+/* Append every class in from to writer, in order */
+void merge_snapshot(SnapshotWriter *writer, const SnapshotWriter *from);
+
+/* Write writer's classes to file_name. Returns false, after reporting why on stderr, on failure. */
+bool write_snapshot(const SnapshotWriter *writer, const char *file_name);
+
+/* Return true if file_name ends in .cfrs, the snapshot extension */
+bool is_snapshot_name(const char *file_name);
+
+/* Map file_name and check it's a snapshot this host can read. Returns NULL, after reporting why on stderr, if not. */
+Snapshot *open_snapshot(char *file_name);
+
+/* Unmap snapshot. Classes loaded from it point into the mapping, so free them first. */
+void close_snapshot(Snapshot *snapshot);
+
+static inline uint64_t snapshot_classes_count(const Snapshot *snapshot) {
+	return snapshot->header->lengths[SECTION_CLASSES] / sizeof(Class);
+}
+
+/* Return the name of class index's this_class straight from the mapping, without loading it; NULL if it has none */
+const char *snapshot_class_name(const Snapshot *snapshot, uint64_t index, uint16_t *length);
+
+/* Return snapshot class index for the printers. Only the Class record is copied, into an arena the class can build type trees
+ * in; its pool, strings, members and attributes are the snapshot's own, bounds-checked in place. The mapping is private, so
+ * filtering members in place doesn't touch the file. Returns NULL if the record is out of bounds. */
+Class *load_snapshot_class(const Snapshot *snapshot, uint64_t index);
+
+#endif //SNAPSHOT_H
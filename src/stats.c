@@ -0,0 +1,153 @@
+#include "json.h"
+#include "stats.h"
+#include <stdio.h>
+
+__thread Stats *thread_stats = NULL;
+
+static const char *PHASE_NAMES[PHASES] = {"open", "is_class", "const_pool", "members", "print"};
+
+/* Bucket nanoseconds falls in: exact below 8, then 8 buckets per power of two */
+static uint32_t bucket_of(uint64_t nanoseconds) {
+	if (nanoseconds < HISTOGRAM_SUB_BUCKETS) return nanoseconds;
+	const int top = 63 - __builtin_clzll(nanoseconds);
+	return (top - 2) * HISTOGRAM_SUB_BUCKETS + ((nanoseconds >> (top - 3)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* The largest value that lands in bucket */
+static uint64_t bucket_limit(uint32_t bucket) {
+	if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+	const int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	const uint64_t low = (uint64_t) (HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+	return low + ((uint64_t) 1 << shift) - 1;
+}
+
+void add_sample(Histogram *histogram, uint64_t nanoseconds) {
+	histogram->count++;
+	histogram->total += nanoseconds;
+	if (nanoseconds > histogram->max) histogram->max = nanoseconds;
+	histogram->buckets[bucket_of(nanoseconds)]++;
+}
+
+void count_class(const Class *class) {
+	Stats *stats = thread_stats;
+	if (stats == NULL) return;
+	stats->classes++;
+	stats->bytes_read += class->image_length;
+	uint16_t i;
+	for (i = 1; i < class->const_pool_count; i++) {
+		stats->constants[class->tags[i]]++;
+	}
+	stats->allocated_bytes += class->arena->allocated;
+}
+
+void merge_stats(Stats *into, const Stats *from) {
+	into->classes += from->classes;
+	into->bytes_read += from->bytes_read;
+	into->allocations += from->allocations;
+	into->allocated_bytes += from->allocated_bytes;
+	int i, b;
+	for (i = 0; i <= MAX_CPOOL_TAG; i++) {
+		into->constants[i] += from->constants[i];
+	}
+	for (i = 0; i < PHASES; i++) {
+		Histogram *histogram = into->phases + i;
+		const Histogram *other = from->phases + i;
+		histogram->count += other->count;
+		histogram->total += other->total;
+		if (other->max > histogram->max) histogram->max = other->max;
+		for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+			histogram->buckets[b] += other->buckets[b];
+		}
+	}
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, double fraction) {
+	if (histogram->count == 0) return 0;
+	uint64_t rank = (uint64_t) (fraction * histogram->count + 0.999999), seen = 0;
+	if (rank == 0) rank = 1;
+	uint32_t b;
+	for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+		seen += histogram->buckets[b];
+		if (seen >= rank) break;
+	}
+	const uint64_t limit = bucket_limit(b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS - 1);
+	return limit < histogram->max ? limit : histogram->max;
+}
+
+static void json_stats(Buffer *out, const Stats *stats, uint64_t elapsed) {
+	JsonWriter writer;
+	init_json_writer(&writer, out);
+	json_begin_object(&writer);
+	json_key(&writer, "classes");
+	json_uint(&writer, stats->classes);
+	json_key(&writer, "bytes_read");
+	json_uint(&writer, stats->bytes_read);
+	json_key(&writer, "elapsed_ns");
+	json_uint(&writer, elapsed);
+	json_key(&writer, "allocations");
+	json_uint(&writer, stats->allocations);
+	json_key(&writer, "allocated_bytes");
+	json_uint(&writer, stats->allocated_bytes);
+	json_key(&writer, "constants");
+	json_begin_object(&writer);
+	int i;
+	for (i = MIN_CPOOL_TAG; i <= MAX_CPOOL_TAG; i++) {
+		if (stats->constants[i] == 0) continue;
+		json_key(&writer, tag2str(i));
+		json_uint(&writer, stats->constants[i]);
+	}
+	json_end_object(&writer);
+	json_key(&writer, "phases");
+	json_begin_object(&writer);
+	for (i = 0; i < PHASES; i++) {
+		const Histogram *histogram = stats->phases + i;
+		json_key(&writer, PHASE_NAMES[i]);
+		json_begin_object(&writer);
+		json_key(&writer, "count");
+		json_uint(&writer, histogram->count);
+		json_key(&writer, "total_ns");
+		json_uint(&writer, histogram->total);
+		json_key(&writer, "p50_ns");
+		json_uint(&writer, histogram_percentile(histogram, 0.5));
+		json_key(&writer, "p99_ns");
+		json_uint(&writer, histogram_percentile(histogram, 0.99));
+		json_key(&writer, "max_ns");
+		json_uint(&writer, histogram->max);
+		json_end_object(&writer);
+	}
+	json_end_object(&writer);
+	json_end_object(&writer);
+	append_char(out, '\n');
+}
+
+void append_stats(Buffer *out, const Stats *stats, uint64_t elapsed, bool json) {
+	if (json) {
+		json_stats(out, stats, elapsed);
+		return;
+	}
+	char line[160];
+	snprintf(line, sizeof(line), "Stats: %llu classes, %llu bytes read in %.3f ms\n", (unsigned long long) stats->classes,
+			(unsigned long long) stats->bytes_read, elapsed / 1e6);
+	append_string(out, line);
+	snprintf(line, sizeof(line), "%-12s %10s %12s %10s %10s %10s\n", "phase", "count", "total ms", "p50 us", "p99 us", "max us");
+	append_string(out, line);
+	int i;
+	for (i = 0; i < PHASES; i++) {
+		const Histogram *histogram = stats->phases + i;
+		snprintf(line, sizeof(line), "%-12s %10llu %12.3f %10.3f %10.3f %10.3f\n", PHASE_NAMES[i], (unsigned long long) histogram->count,
+				histogram->total / 1e6, histogram_percentile(histogram, 0.5) / 1e3, histogram_percentile(histogram, 0.99) / 1e3,
+				histogram->max / 1e3);
+		append_string(out, line);
+	}
+	append_string(out, "Constants:");
+	bool first = true;
+	for (i = MIN_CPOOL_TAG; i <= MAX_CPOOL_TAG; i++) {
+		if (stats->constants[i] == 0) continue;
+		snprintf(line, sizeof(line), "%s %llu %s", first ? "" : ",", (unsigned long long) stats->constants[i], tag2str(i));
+		append_string(out, line);
+		first = false;
+	}
+	snprintf(line, sizeof(line), "\nAllocations: %llu arena chunks malloc'd, %llu bytes used by classes\n",
+			(unsigned long long) stats->allocations, (unsigned long long) stats->allocated_bytes);
+	append_string(out, line);
+}
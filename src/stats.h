@@ -0,0 +1,82 @@
+#ifndef STATS_H
+#define STATS_H
+#include "buffer.h"
+#include "class.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Where the time goes and how much was read, for --stats. Each thread counts into its own Stats, found through thread_stats,
+ * so nothing is shared or locked while classes are parsed; the caller merges them at the end. While thread_stats is NULL every
+ * hook below is a single untaken branch. */
+
+/* The phases a class goes through, timed separately */
+typedef enum {
+	PHASE_OPEN,       /* Opening and mapping a file, waiting for the prefetcher or inflating a jar entry */
+	PHASE_IS_CLASS,   /* Checking the magic number */
+	PHASE_CONST_POOL, /* parse_header and parse_const_pool */
+	PHASE_MEMBERS,    /* The declaration, fields, methods and attributes */
+	PHASE_PRINT,      /* Formatting the class as text or JSON */
+	PHASES
+} Phase;
+
+enum HISTOGRAM_LAYOUT {
+	/* Each power of two is split into this many buckets, so a percentile is off by at most an eighth */
+	HISTOGRAM_SUB_BUCKETS = 8,
+
+	/* Enough buckets for any 64-bit number of nanoseconds */
+	HISTOGRAM_BUCKETS = 62 * HISTOGRAM_SUB_BUCKETS
+};
+
+/* Latencies of one phase in nanoseconds, in log-linear buckets */
+typedef struct {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+typedef struct {
+	uint64_t classes;
+	uint64_t bytes_read;               /* Size of the class images decoded */
+	uint64_t constants[MAX_CPOOL_TAG + 1]; /* By tag */
+	uint64_t allocations;              /* Arena chunks that came from malloc rather than a thread's spare chunks */
+	uint64_t allocated_bytes;          /* Handed out by the classes' arenas */
+	Histogram phases[PHASES];
+} Stats;
+
+/* Where the calling thread's counts go; NULL, the default, turns counting off */
+extern __thread Stats *thread_stats;
+
+/* Return the monotonic clock in nanoseconds if this thread is counting, otherwise 0 without reading it */
+static inline uint64_t stats_clock(void) {
+	if (thread_stats == NULL) return 0;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Add one sample of nanoseconds to histogram */
+void add_sample(Histogram *histogram, uint64_t nanoseconds);
+
+/* Charge the time since started, a stats_clock reading, to phase. Returns the clock now, to start the next phase from. */
+static inline uint64_t record_phase(Phase phase, uint64_t started) {
+	if (thread_stats == NULL) return 0;
+	uint64_t now = stats_clock();
+	add_sample(thread_stats->phases + phase, now - started);
+	return now;
+}
+
+/* Count class, once it has been decoded as far as it will be: its bytes, its constants by tag and its arena's size */
+void count_class(const Class *class);
+
+/* Add the counts in from to into */
+void merge_stats(Stats *into, const Stats *from);
+
+/* Return the latency below which fraction of histogram's samples fall, to within a bucket, and never above the maximum */
+uint64_t histogram_percentile(const Histogram *histogram, double fraction);
+
+/* Append stats, gathered over elapsed nanoseconds of wall time, as a table or a JSON object, either ending in a newline */
+void append_stats(Buffer *out, const Stats *stats, uint64_t elapsed, bool json);
+
+#endif //STATS_H
@@ -0,0 +1,80 @@
+#include "symtab.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	INITIAL_SLOTS = 1024
+};
+
+void init_symtab(Symtab *symtab) {
+	symtab->arena = create_arena(0);
+	symtab->count = 0;
+	symtab->strings_capacity = INITIAL_SLOTS / 2;
+	symtab->strings = malloc(symtab->strings_capacity * sizeof(String));
+	symtab->hashes = malloc(symtab->strings_capacity * sizeof(uint32_t));
+	symtab->slots = calloc(INITIAL_SLOTS, sizeof(uint32_t));
+	symtab->slots_mask = INITIAL_SLOTS - 1;
+}
+
+void free_symtab(Symtab *symtab) {
+	free_arena(symtab->arena);
+	free(symtab->strings);
+	free(symtab->hashes);
+	free(symtab->slots);
+}
+
+/* Return the slot holding the given string, or the empty slot it would go in */
+static uint32_t *find_slot(const Symtab *symtab, const char *value, size_t length, uint32_t hash) {
+	uint32_t i = hash & symtab->slots_mask;
+	for (;;) {
+		uint32_t *slot = symtab->slots + i;
+		if (*slot == 0) return slot;
+		const String *string = symtab->strings + *slot - 1;
+		if (symtab->hashes[*slot - 1] == hash && string->length == length && memcmp(string->value, value, length) == 0) {
+			return slot;
+		}
+		i = (i + 1) & symtab->slots_mask;
+	}
+}
+
+/* Double the index, keeping it at most half full */
+static void grow_slots(Symtab *symtab) {
+	uint32_t capacity = (symtab->slots_mask + 1) * 2;
+	free(symtab->slots);
+	symtab->slots = calloc(capacity, sizeof(uint32_t));
+	symtab->slots_mask = capacity - 1;
+	uint32_t id;
+	for (id = 0; id < symtab->count; id++) {
+		uint32_t i = symtab->hashes[id] & symtab->slots_mask;
+		while (symtab->slots[i] != 0) i = (i + 1) & symtab->slots_mask;
+		symtab->slots[i] = id + 1;
+	}
+}
+
+SymbolId intern(Symtab *symtab, const char *value, uint16_t length) {
+	uint32_t hash = hash_symbol(value, length);
+	uint32_t *slot = find_slot(symtab, value, length, hash);
+	if (*slot != 0) return *slot - 1;
+
+	if (symtab->count == symtab->strings_capacity) {
+		symtab->strings_capacity *= 2;
+		symtab->strings = realloc(symtab->strings, symtab->strings_capacity * sizeof(String));
+		symtab->hashes = realloc(symtab->hashes, symtab->strings_capacity * sizeof(uint32_t));
+	}
+	SymbolId id = symtab->count++;
+	char *copy = arena_alloc(symtab->arena, length > 0 ? length : 1);
+	memcpy(copy, value, length);
+	symtab->strings[id].length = length;
+	symtab->strings[id].value = copy;
+	symtab->hashes[id] = hash;
+	*slot = id + 1;
+
+	if (symtab->count * 2 > symtab->slots_mask + 1) grow_slots(symtab);
+	return id;
+}
+
+SymbolId find_symbol(const Symtab *symtab, const char *value, size_t length) {
+	if (length > UINT16_MAX) return NO_SYMBOL;
+	uint32_t *slot = find_slot(symtab, value, length, hash_symbol(value, length));
+	return *slot != 0 ? *slot - 1 : NO_SYMBOL;
+}
@@ -0,0 +1,49 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+#include "arena.h"
+#include "class.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t SymbolId;
+
+/* Never handed out as a SymbolId */
+#define NO_SYMBOL UINT32_MAX
+
+/* FNV-1a; symbols are short */
+static inline uint32_t hash_symbol(const char *value, size_t length) {
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t) value[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/* Interns strings into dense ids 0, 1, 2, ... in first-seen order. Each string's bytes are copied once into the table's arena,
+ * so the Strings it hands back stay valid until free_symtab, whatever happens to the classes they came from. */
+typedef struct {
+	Arena *arena;
+	String *strings;   // by id
+	uint32_t *hashes;  // by id, so growing the index doesn't rehash the bytes
+	uint32_t count;
+	uint32_t strings_capacity;
+	uint32_t *slots;   // open addressing index: id + 1, or 0 if empty
+	uint32_t slots_mask;
+} Symtab;
+
+void init_symtab(Symtab *symtab);
+void free_symtab(Symtab *symtab);
+
+/* Return the id of the length bytes at value, interning them if they are new */
+SymbolId intern(Symtab *symtab, const char *value, uint16_t length);
+
+/* Return the id of the length bytes at value, or NO_SYMBOL if they have never been interned */
+SymbolId find_symbol(const Symtab *symtab, const char *value, size_t length);
+
+static inline String symbol_string(const Symtab *symtab, SymbolId id) {
+	return symtab->strings[id];
+}
+
+#endif //SYMTAB_H
@@ -0,0 +1,356 @@
+#include "classpath.h"
+#include "delta.h"
+#include "prefetch.h"
+#include "symtab.h"
+#include "watch.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+enum {
+	/* How long events must stop arriving before the files they named are read, so a compiler writing many classes costs one pass */
+	SETTLE_MS = 50,
+
+	/* Give up waiting for quiet after this many settle periods and read what has changed so far */
+	MAX_SETTLE_ROUNDS = 20,
+
+	/* Class files read ahead of parsing during a pass */
+	READ_WINDOW = 64
+};
+
+/* Everything that can add, replace or remove a class file or a directory of them */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_ONLYDIR)
+
+/* A class file seen at some point, and the version of it last read */
+typedef struct {
+	char *path;
+	Class *class; // NULL once the file is gone, or if it has never held a valid class
+	ClassPrint print;
+} WatchedFile;
+
+struct Watch {
+	int fd;
+	char *directory;
+	ParseOptions options;
+	char **directories; // by watch descriptor, NULL where there is none
+	size_t directories_count;
+	Symtab paths;       // path to index in files
+	WatchedFile *files; // by path id
+	size_t files_capacity;
+	size_t live;        // files with a class
+	char **pending;     // paths of class files to re-read, in no particular order and possibly repeated
+	size_t pending_count;
+	size_t pending_capacity;
+	bool rescan;        // events were lost, so every file must be re-read
+};
+
+static bool has_class_suffix(const char *name) {
+	size_t length = strlen(name);
+	return length > 6 && strcmp(name + length - 6, ".class") == 0;
+}
+
+/* Queue path to be re-read; a PathVisitor */
+static void add_pending(char *path, void *context) {
+	Watch *watch = context;
+	if (watch->pending_count == watch->pending_capacity) {
+		watch->pending_capacity = watch->pending_capacity ? watch->pending_capacity * 2 : 64;
+		watch->pending = realloc(watch->pending, watch->pending_capacity * sizeof(char *));
+	}
+	watch->pending[watch->pending_count++] = path;
+}
+
+/* Queue every known class file under directory, whose watch is about to go or has gone with it */
+static void add_pending_under(Watch *watch, const char *directory) {
+	size_t length = strlen(directory);
+	uint32_t i;
+	for (i = 0; i < watch->paths.count; i++) {
+		const char *path = watch->files[i].path;
+		if (watch->files[i].class != NULL && strncmp(path, directory, length) == 0 && path[length] == '/') {
+			add_pending(strdup(path), watch);
+		}
+	}
+}
+
+/* Subscribe to directory, keeping it as the descriptor's path. Returns false, after reporting why, if it can't be watched. */
+static bool watch_directory(Watch *watch, char *directory) {
+	int wd = inotify_add_watch(watch->fd, directory, WATCH_EVENTS);
+	if (wd < 0) {
+		fprintf(stderr, "Could not watch '%s': %s\n", directory, strerror(errno));
+		free(directory);
+		return false;
+	}
+	if ((size_t) wd >= watch->directories_count) {
+		size_t count = (size_t) wd * 2 + 1;
+		watch->directories = realloc(watch->directories, count * sizeof(char *));
+		memset(watch->directories + watch->directories_count, 0, (count - watch->directories_count) * sizeof(char *));
+		watch->directories_count = count;
+	}
+	// Watching a directory again, e.g. after it moved, hands back the same descriptor
+	free(watch->directories[wd]);
+	watch->directories[wd] = directory;
+	return true;
+}
+
+/* A PathVisitor for watch_directory */
+static void add_directory(char *directory, void *context) {
+	watch_directory(context, directory);
+}
+
+/* Watch directory and everything under it, and queue the class files already there. Returns false if directory itself can't be
+ * watched. */
+static bool add_tree(Watch *watch, const char *directory) {
+	// Subscribe first, so a file written meanwhile is either in the listing or in an event
+	if (!watch_directory(watch, strdup(directory))) return false;
+	walk_subdirectories(directory, add_directory, watch);
+	walk_directory(directory, ".class", add_pending, watch);
+	return true;
+}
+
+/* Stop watching directory and everything under it, e.g. because it moved somewhere its paths no longer describe */
+static void remove_tree(Watch *watch, const char *directory) {
+	size_t length = strlen(directory);
+	size_t wd;
+	for (wd = 0; wd < watch->directories_count; wd++) {
+		const char *path = watch->directories[wd];
+		if (path != NULL && strncmp(path, directory, length) == 0 && (path[length] == '\0' || path[length] == '/')) {
+			inotify_rm_watch(watch->fd, (int) wd);
+			free(watch->directories[wd]);
+			watch->directories[wd] = NULL;
+		}
+	}
+}
+
+static void handle_event(Watch *watch, const struct inotify_event *event) {
+	if (event->mask & IN_Q_OVERFLOW) {
+		watch->rescan = true;
+		return;
+	}
+	if (event->wd < 0 || (size_t) event->wd >= watch->directories_count || watch->directories[event->wd] == NULL) return;
+	if (event->mask & IN_IGNORED) {
+		free(watch->directories[event->wd]);
+		watch->directories[event->wd] = NULL;
+		return;
+	}
+	if (event->len == 0) return;
+
+	// Joined the way the directory walk joins them, so both name a file the same way
+	const char *directory = watch->directories[event->wd];
+	size_t length = strlen(directory);
+	bool slash = directory[length - 1] != '/';
+	char *path = malloc(length + slash + strlen(event->name) + 1);
+	sprintf(path, slash ? "%s/%s" : "%s%s", directory, event->name);
+	if (event->mask & IN_ISDIR) {
+		if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+			add_pending_under(watch, path);
+			remove_tree(watch, path);
+		}
+		if (event->mask & (IN_CREATE | IN_MOVED_TO)) add_tree(watch, path);
+		free(path);
+	} else if (has_class_suffix(event->name) && !(event->mask & IN_CREATE)) {
+		// A created file is reported again once it has been written and closed
+		add_pending(path, watch);
+	} else {
+		free(path);
+	}
+}
+
+/* Drain the events waiting on the descriptor. Returns false if reading them failed. */
+static bool read_events(Watch *watch) {
+	// Events are aligned like the int they start with
+	uint32_t events[4096 / sizeof(uint32_t)];
+	for (;;) {
+		ssize_t length = read(watch->fd, events, sizeof(events));
+		if (length < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) return true;
+			fprintf(stderr, "Could not read file events: %s\n", strerror(errno));
+			return false;
+		}
+		const char *p = (const char *) events;
+		while (p < (const char *) events + length) {
+			const struct inotify_event *event = (const struct inotify_event *) p;
+			handle_event(watch, event);
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+static int compare_paths(const void *a, const void *b) {
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Re-read the pending files, replacing the classes held for them, and report those that changed if report is set. Returns how
+ * many were reported. */
+static int read_pending(Watch *watch, Buffer *out, bool json, bool report_changes) {
+	// Each file is read once per pass however many events named it
+	qsort(watch->pending, watch->pending_count, sizeof(char *), compare_paths);
+	size_t i, count = 0;
+	for (i = 0; i < watch->pending_count; i++) {
+		if (count > 0 && strcmp(watch->pending[count - 1], watch->pending[i]) == 0) {
+			free(watch->pending[i]);
+		} else {
+			watch->pending[count++] = watch->pending[i];
+		}
+	}
+	watch->pending_count = 0;
+
+	int reported = 0;
+	Prefetcher *prefetcher = count > 0 ? start_prefetch(watch->pending, count, READ_WINDOW, PREFETCH_IO_URING) : NULL;
+	for (i = 0; i < count; i++) {
+		char *path = watch->pending[i];
+		uint32_t known = watch->paths.count;
+		SymbolId id = intern(&watch->paths, path, (uint16_t) strlen(path));
+		if (id == known) {
+			if (watch->paths.count > watch->files_capacity) {
+				watch->files_capacity = watch->files_capacity ? watch->files_capacity * 2 : 64;
+				watch->files = realloc(watch->files, watch->files_capacity * sizeof(WatchedFile));
+			}
+			watch->files[id].path = strdup(path);
+			watch->files[id].class = NULL;
+		}
+		WatchedFile *file = watch->files + id;
+
+		size_t length;
+		uint8_t *image = take_file(prefetcher, i, &length);
+		Class *class;
+		if (image != NULL) {
+			const Class *old = file->class;
+			if (old != NULL && old->image_length == length && memcmp(old->image, image, length) == 0) {
+				free(image);
+				continue;
+			}
+			class = read_class_from_heap(file->path, image, length, &watch->options);
+		} else if (access(path, F_OK) != 0) {
+			if (file->class != NULL) {
+				ClassDelta delta;
+				diff_classes(&delta, &file->print, NULL);
+				if (report_changes) {
+					format_class_delta(out, json, MEMBER_REMOVED, file->path, &file->print, &delta);
+					append_char(out, '\n');
+					reported++;
+				}
+				free_class_delta(&delta);
+				free_class_print(&file->print);
+				free_class(file->class);
+				file->class = NULL;
+				watch->live--;
+			}
+			continue;
+		} else {
+			// Unreadable or not a regular file: opening it here says why
+			class = read_class_from_file_name(file->path, &watch->options);
+		}
+		// A file that no longer parses keeps its last good version, as it may just be half written
+		if (class == NULL) continue;
+
+		ClassPrint print;
+		fingerprint_class(&print, class);
+		ClassDelta delta;
+		diff_classes(&delta, file->class != NULL ? &file->print : NULL, &print);
+		if (report_changes && (file->class == NULL || delta_changed(&delta))) {
+			format_class_delta(out, json, file->class == NULL ? MEMBER_ADDED : MEMBER_CHANGED, file->path, &print, &delta);
+			append_char(out, '\n');
+			reported++;
+		}
+		free_class_delta(&delta);
+		if (file->class != NULL) {
+			free_class_print(&file->print);
+			free_class(file->class);
+		} else {
+			watch->live++;
+		}
+		file->class = class;
+		file->print = print;
+	}
+	if (prefetcher != NULL) stop_prefetch(prefetcher);
+	for (i = 0; i < count; i++) {
+		free(watch->pending[i]);
+	}
+	return reported;
+}
+
+Watch *open_watch(const char *directory, const ParseOptions *options) {
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Could not watch '%s': %s\n", directory, strerror(errno));
+		return NULL;
+	}
+	Watch *watch = calloc(1, sizeof(Watch));
+	watch->fd = fd;
+	watch->directory = strdup(directory);
+	// Without trailing slashes, so the directory's own events and the walk of it agree on paths
+	size_t length = strlen(watch->directory);
+	while (length > 1 && watch->directory[length - 1] == '/') {
+		watch->directory[--length] = '\0';
+	}
+	if (options != NULL) watch->options = *options;
+	init_symtab(&watch->paths);
+
+	if (!add_tree(watch, watch->directory)) {
+		close_watch(watch);
+		return NULL;
+	}
+	read_pending(watch, NULL, false, false);
+	return watch;
+}
+
+size_t watched_count(const Watch *watch) {
+	return watch->live;
+}
+
+int poll_watch(Watch *watch, int timeout_ms, Buffer *out, bool json) {
+	struct pollfd descriptor = {watch->fd, POLLIN, 0};
+	int ready = poll(&descriptor, 1, timeout_ms);
+	int rounds = 0;
+	while (ready != 0) {
+		if (ready < 0) {
+			if (errno == EINTR) return 0;
+			fprintf(stderr, "Could not wait for file events: %s\n", strerror(errno));
+			return -1;
+		}
+		if (!read_events(watch)) return -1;
+		if (++rounds == MAX_SETTLE_ROUNDS) break;
+		ready = poll(&descriptor, 1, SETTLE_MS);
+	}
+
+	if (watch->rescan) {
+		// Events were dropped, so trust nothing: re-read every file held and every file there now
+		watch->rescan = false;
+		uint32_t i;
+		for (i = 0; i < watch->paths.count; i++) {
+			if (watch->files[i].class != NULL) add_pending(strdup(watch->files[i].path), watch);
+		}
+		add_tree(watch, watch->directory);
+	}
+	return read_pending(watch, out, json, true);
+}
+
+void close_watch(Watch *watch) {
+	size_t i;
+	for (i = 0; i < watch->paths.count; i++) {
+		WatchedFile *file = watch->files + i;
+		if (file->class != NULL) {
+			free_class_print(&file->print);
+			free_class(file->class);
+		}
+		free(file->path);
+	}
+	free(watch->files);
+	free_symtab(&watch->paths);
+	for (i = 0; i < watch->directories_count; i++) {
+		free(watch->directories[i]);
+	}
+	free(watch->directories);
+	for (i = 0; i < watch->pending_count; i++) {
+		free(watch->pending[i]);
+	}
+	free(watch->pending);
+	free(watch->directory);
+	close(watch->fd);
+	free(watch);
+}
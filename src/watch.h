@@ -0,0 +1,30 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include "buffer.h"
+#include "class.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Keeps every class file under a directory parsed and, told by inotify which files were written, moved or deleted, re-reads only
+ * those and reports how each of their classes changed, member by member. A rebuild costs in proportion to what it touched rather
+ * than to the size of the tree. */
+
+typedef struct Watch Watch;
+
+/* Subscribe to changes under directory, including subdirectories made later, then read every class file already there. Returns
+ * NULL, after reporting why on stderr, if directory can't be watched. */
+Watch *open_watch(const char *directory, const ParseOptions *options);
+
+/* Return the number of valid class files currently held */
+size_t watched_count(const Watch *watch);
+
+/* Wait up to timeout_ms (-1 for ever) for changes, let a burst of them settle, then re-read the class files it touched and append
+ * each class that changed to out. As text that is "Added: ", "Removed: " or "Changed: " and the path, then append_delta's lines;
+ * with json, one object per line holding "event", "file", "class" and json_delta's members. Files rewritten with the same bytes,
+ * or recompiled without a change that matters, are not reported. Returns the number of classes reported, or -1 if the watch
+ * itself failed. */
+int poll_watch(Watch *watch, int timeout_ms, Buffer *out, bool json);
+
+void close_watch(Watch *watch);
+
+#endif //WATCH_H
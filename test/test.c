@@ -1,6 +1,28 @@
 #include "../src/class.h"
+#include "../src/arena.c"
+#include "../src/buffer.c"
+#include "../src/cache.c"
+#include "../src/callgraph.c"
 #include "../src/class.c"
+#include "../src/classpath.c"
+#include "../src/code.c"
+#include "../src/delta.c"
+#include "../src/descriptor.c"
+#include "../src/diff.c"
+#include "../src/filter.c"
+#include "../src/jar.c"
+#include "../src/hierarchy.c"
+#include "../src/intern.c"
+#include "../src/json.c"
+#include "../src/mutf8.c"
+#include "../src/prefetch.c"
+#include "../src/print.c"
+#include "../src/snapshot.c"
+#include "../src/stats.c"
+#include "../src/symtab.c"
+#include "../src/watch.c"
 #include <math.h>
+#include <pthread.h>
 #include "tap.h"
 #include <stdio.h>
 #include <string.h>
@@ -11,6 +33,31 @@ int main(void) {
 	fields();
 	empty();
 	test_field2str();
+	jar();
+	arena();
+	skim();
+	buffer();
+	json();
+	snapshot();
+	cache();
+	code();
+	hierarchy();
+	callgraph();
+	interning();
+	attribute_kinds();
+	constant_tags();
+	mutf8();
+	descriptors();
+	classpath();
+	prefetch();
+	delta();
+	watch();
+	diff();
+	filter();
+	stats();
+	class_types();
+	malformed_members();
+	jar_limits();
 	return exit_status();
 }	
 
@@ -29,6 +76,15 @@ void lok(long i, long j, char *msg) {
 	ok(i == j, cmp_msg);
 }
 
+/* Write a comparison string into msg and call ok(string_equals(string, str), msg); */
+void utf8ok(char *str, const String string, char *msg) {
+	char *fmt_str = "%s - Comparison: '%s' == '%.*s'";
+	int str_len = strlen(msg) + strlen(fmt_str) + strlen(str) + string.length + 1;
+	char *cmp_msg = malloc(sizeof(char) * str_len);
+	snprintf(cmp_msg, str_len, fmt_str, msg, str, string.length, string.value);
+	ok(string_equals(string, str), cmp_msg);
+}
+
 /* Write a comparison string into msg and call ok(0 == strcmp(str1, str2), msg); */
 void strok(char *str1, char *str2, char *msg) {
 	char *fmt_str = "%s - Comparison: '%s' == '%s'";
@@ -41,7 +97,7 @@ void strok(char *str1, char *str2, char *msg) {
 void dbl() {
 	printh("Double");
 	char *double_file = "./files/DoubleTest.class";
-	Class *c = read_class_from_file_name(double_file);
+	Class *c = read_class_from_file_name(double_file, NULL);
 
 	ok(c != NULL, "C is not NULL");
 	ok((strcmp(c->file_name, double_file) == 0), "File name matches");
@@ -51,128 +107,128 @@ void dbl() {
 	ok(31 == c->const_pool_count, "Constant pool count is 31"); // two for double type, plus # of items is 1 less than this member's value
 	ok(0 == c->attributes_count, "Attributes count = 0");
 
-	const Item *desc = get_item(c, c->fields[0].desc_idx);
-	ok(desc != NULL, "Field descriptor Item is in the constant pool");
-	ok('D' == desc->value.string.value[0], "Field type tag is D");
+	const Item desc = get_item(c, c->fields[0].desc_idx);
+	ok(desc.tag != 0, "Field descriptor Item is in the constant pool");
+	ok('D' == desc.value.string.value[0], "Field type tag is D");
 
 	ok(1 == c->fields[0].attrs_count, "Attribute count for field 0 is 1");
 
-	const Item *attr_name = get_item(c, c->fields[0].attrs[0].name_idx);
-	ok(strcmp("ConstantValue", attr_name->value.string.value) == 0, "First attribute in first field has name ConstantValue");
+	const Item attr_name = get_item(c, c->fields[0].attrs[0].name_idx);
+	ok(string_equals(attr_name.value.string, "ConstantValue"), "First attribute in first field has name ConstantValue");
 
 	// Constant pool content tests; could probably make a recursive function but this way is explicit & simpler
-	Item *i = get_item(c, 1);
-	ok(17 == i->value.ref.name_idx, " 1 = Methodref			   6");
-	ok(6 == i->value.ref.class_idx, " 1 = Methodref          17         //  java/lang/Object.\"<init>\":()V");
+	Item i = get_item(c, 1);
+	ok(17 == i.value.ref.name_idx, " 1 = Methodref			   6");
+	ok(6 == i.value.ref.class_idx, " 1 = Methodref          17         //  java/lang/Object.\"<init>\":()V");
 
 	i = get_item(c, 2);
-	ok(18 == i->value.ref.class_idx, " 2 = Fieldref           18        //  java/lang/System.out:Ljava/io/PrintStream;");
-	ok(19 == i->value.ref.name_idx, " 2 = Fieldref           19        //  java/lang/System.out:Ljava/io/PrintStream;");
+	ok(18 == i.value.ref.class_idx, " 2 = Fieldref           18        //  java/lang/System.out:Ljava/io/PrintStream;");
+	ok(19 == i.value.ref.name_idx, " 2 = Fieldref           19        //  java/lang/System.out:Ljava/io/PrintStream;");
 
 	i = get_item(c, 3);
-	ok(20 == i->value.ref.class_idx, " 3 = String             20            //  Hello world1.0");
+	ok(20 == i.value.ref.class_idx, " 3 = String             20            //  Hello world1.0");
 
 	i = get_item(c, 4);
-	ok(21 == i->value.ref.class_idx, " 4 = Methodref         21        //  java/io/PrintStream.println:(Ljava/lang/String;)V");
-	ok(22 == i->value.ref.name_idx, " 4 = Methodref          22        //  java/io/PrintStream.println:(Ljava/lang/String;)V");
+	ok(21 == i.value.ref.class_idx, " 4 = Methodref         21        //  java/io/PrintStream.println:(Ljava/lang/String;)V");
+	ok(22 == i.value.ref.name_idx, " 4 = Methodref          22        //  java/io/PrintStream.println:(Ljava/lang/String;)V");
 
 	i = get_item(c, 5);
-	iok(23, i->value.ref.class_idx, " 5 = Class              23            //  DoubleTest");
+	iok(23, i.value.ref.class_idx, " 5 = Class              23            //  DoubleTest");
 
 	i = get_item(c, 6);
-	iok(24, i->value.ref.class_idx, " 6 = Class              24            //  java/lang/Object");
+	iok(24, i.value.ref.class_idx, " 6 = Class              24            //  java/lang/Object");
 
 	i = get_item(c, 7);
-	ok(0 == strcmp("d", i->value.string.value), " 7 = Utf8               d");
+	ok(string_equals(i.value.string, "d"), " 7 = Utf8               d");
 
 	i = get_item(c, 8);
-	ok(0 == strcmp("D", i->value.string.value), " 8 = Utf8               D");
+	ok(string_equals(i.value.string, "D"), " 8 = Utf8               D");
 
 	i = get_item(c, 9);
-	ok(0 == strcmp("ConstantValue", i->value.string.value), " 9 = Utf8               ConstantValue");
+	ok(string_equals(i.value.string, "ConstantValue"), " 9 = Utf8               ConstantValue");
 
 	i = get_item(c, 10);
-	ok(1.0 == to_double(i->value.dbl), " 10 = Double             1.0d");
+	ok(1.0 == to_double(i.value.dbl), " 10 = Double             1.0d");
 
 	i = get_item(c, 12);
-	strok("<init>", i->value.string.value, " 12 = Utf8               <init>");
+	utf8ok("<init>", i.value.string, " 12 = Utf8               <init>");
 
 	i = get_item(c, 13);
-	strok("()V", i->value.string.value, " 13 = Utf8               ()V");
+	utf8ok("()V", i.value.string, " 13 = Utf8               ()V");
 
 	i = get_item(c, 14);
-	strok("Code", i->value.string.value, " 14 = Utf8               Code");
+	utf8ok("Code", i.value.string, " 14 = Utf8               Code");
 
 	i = get_item(c, 15);
-	strok("main", i->value.string.value, " 15 = Utf8               main");
+	utf8ok("main", i.value.string, " 15 = Utf8               main");
 
 	i = get_item(c, 16);
-	strok("([Ljava/lang/String;)V", i->value.string.value, " 16 = Utf8               ([Ljava/lang/String;)V");
+	utf8ok("([Ljava/lang/String;)V", i.value.string, " 16 = Utf8               ([Ljava/lang/String;)V");
 
 	i = get_item(c, 17);
-	ok(12 == i->value.ref.class_idx, " 17 = NameAndType        12          \"<init>\":()V");
-	ok(13 == i->value.ref.name_idx, " 17 = NameAndType        13          \"<init>\":()V");
+	ok(12 == i.value.ref.class_idx, " 17 = NameAndType        12          \"<init>\":()V");
+	ok(13 == i.value.ref.name_idx, " 17 = NameAndType        13          \"<init>\":()V");
 
 	i = get_item(c, 18);
-	ok(25 == i->value.ref.class_idx, " 18 = Class              25              java/lang/System");
+	ok(25 == i.value.ref.class_idx, " 18 = Class              25              java/lang/System");
 
 	i = get_item(c, 19);
-	ok(26 == i->value.ref.class_idx, " 19 = NameAndType        26          out:Ljava/io/PrintStream;");
-	ok(27 == i->value.ref.name_idx, " 19 = NameAndType        27          out:Ljava/io/PrintStream;");
+	ok(26 == i.value.ref.class_idx, " 19 = NameAndType        26          out:Ljava/io/PrintStream;");
+	ok(27 == i.value.ref.name_idx, " 19 = NameAndType        27          out:Ljava/io/PrintStream;");
 
 	i = get_item(c, 20);
-	strok("Hello world1.0", i->value.string.value, " 20 = Utf8               Hello world1.0");
+	utf8ok("Hello world1.0", i.value.string, " 20 = Utf8               Hello world1.0");
 
 	i = get_item(c, 21);
-	ok(28 == i->value.ref.class_idx, " 21 = Class              28              java/io/PrintStream");
+	ok(28 == i.value.ref.class_idx, " 21 = Class              28              java/io/PrintStream");
 
 	i = get_item(c, 22);
-	ok(29 == i->value.ref.class_idx, " 22 = NameAndType        29          println:(Ljava/lang/String;)V");
-	ok(30 == i->value.ref.name_idx, " 22 = NameAndType        30          println:(Ljava/lang/String;)V");
+	ok(29 == i.value.ref.class_idx, " 22 = NameAndType        29          println:(Ljava/lang/String;)V");
+	ok(30 == i.value.ref.name_idx, " 22 = NameAndType        30          println:(Ljava/lang/String;)V");
 
 	i = get_item(c, 23);
-	strok("DoubleTest", i->value.string.value, " 23 = Utf8               DoubleTest");
+	utf8ok("DoubleTest", i.value.string, " 23 = Utf8               DoubleTest");
 
 	i = get_item(c, 24);
-	strok("java/lang/Object", i->value.string.value, " 24 = Utf8               java/lang/Object");
+	utf8ok("java/lang/Object", i.value.string, " 24 = Utf8               java/lang/Object");
 
 	i = get_item(c, 25);
-	strok("java/lang/System", i->value.string.value, " 25 = Utf8               java/lang/System");
+	utf8ok("java/lang/System", i.value.string, " 25 = Utf8               java/lang/System");
 
 	i = get_item(c, 26);
-	strok("out", i->value.string.value, " 26 = Utf8               out");
+	utf8ok("out", i.value.string, " 26 = Utf8               out");
 
 	i = get_item(c, 27);
-	strok("Ljava/io/PrintStream;", i->value.string.value, " 27 = Utf8               Ljava/io/PrintStream;");
+	utf8ok("Ljava/io/PrintStream;", i.value.string, " 27 = Utf8               Ljava/io/PrintStream;");
 
 	i = get_item(c, 28);
-	strok("java/io/PrintStream", i->value.string.value, " 28 = Utf8               java/io/PrintStream");
+	utf8ok("java/io/PrintStream", i.value.string, " 28 = Utf8               java/io/PrintStream");
 
 	i = get_item(c, 29);
-	strok("println", i->value.string.value, " 29 = Utf8               println");
+	utf8ok("println", i.value.string, " 29 = Utf8               println");
 
 	i = get_item(c, 30);
-	strok("(Ljava/lang/String;)V", i->value.string.value, " 30 = Utf8               (Ljava/lang/String;)V");
+	utf8ok("(Ljava/lang/String;)V", i.value.string, " 30 = Utf8               (Ljava/lang/String;)V");
 
 	const Method *method = c->methods;
-	const Item *m1name = get_item(c, c->methods[0].name_idx);
-	const Item *m2name = get_item(c, c->methods[1].name_idx);
+	const Item m1name = get_item(c, c->methods[0].name_idx);
+	const Item m2name = get_item(c, c->methods[1].name_idx);
 	ok(c->methods_count == 2, "Methods count == 2, main() and constructor");
-	ok(0 == strcmp("<init>", m1name->value.string.value), "First method's name is <init>");
-	ok(0 == strcmp("main", m2name->value.string.value), "Second method's name is main");
+	ok(string_equals(m1name.value.string, "<init>"), "First method's name is <init>");
+	ok(string_equals(m2name.value.string, "main"), "Second method's name is main");
 	ok(1 == method->attrs_count, "init method attribute count is 1");
 
 	// Test that attribute 1 (index 0) has the name "Code"
-	const Item *m1attr1 = get_item(c, method->attrs[0].name_idx);
-	ok(0 == strcmp("Code", m1attr1->value.string.value), "Attribute #1 of method #1 has name Code");
+	const Item m1attr1 = get_item(c, method->attrs[0].name_idx);
+	ok(string_equals(m1attr1.value.string, "Code"), "Attribute #1 of method #1 has name Code");
 	ok(1 == c->methods[1].attrs_count, "main method attribute count is 1");
-	free(c);
+	free_class(c);
 }
 
 void empty() {
 	printh("Empty");
 	char *empty = "./files/Empty.class";
-	Class *c = read_class_from_file_name(empty);
+	Class *c = read_class_from_file_name(empty, NULL);
 
 	ok(c != NULL, "C is not NULL");
 	ok(0 == (strcmp(c->file_name, empty)), "File name matches");
@@ -182,13 +238,13 @@ void empty() {
 	ok(10 == c->const_pool_count, "Constant pool count is 10");
 	ok(0 == c->attributes_count, "Attributes count = 0");
 
-	free(c);
+	free_class(c);
 }
 
 void test_long() {
 	printh("Long");
 	char *fname = "files/Fields.class";
-	Class *c = read_class_from_file_name(fname);
+	Class *c = read_class_from_file_name(fname, NULL);
 	ok(NULL != c, "C is not NULL");
 	ok(0 == (strcmp(c->file_name, fname)), "File name matches");
 	ok(0 == c->minor_version, "Major version is 0 (1.7.0_10)");
@@ -197,22 +253,545 @@ void test_long() {
 	iok(15, c->const_pool_count, "Constant pool count is 15");
 	iok(0, c->attributes_count, "Attributes count = 0");
 	
-	iok(10, c->items[1].tag, "Item #1 tag byte is 10");
-	strok(1, c->items[7].tag, "Item #7's tag byte is 1");
-	strok("ConstantValue", c->items[7].value.string.value, "Item #7 is 'ConstantValue' UTF8");
-	lok(1.0, to_long(c->items[8].value.lng), "Long constant pool item value is 1.0");
-	strok("<init>", c->items[10].value.string.value, "Item #10 is '<init>' UTF8");
-	free(c);
+	iok(10, get_item(c, 2).tag, "Item #1 tag byte is 10");
+	strok(1, get_item(c, 8).tag, "Item #7's tag byte is 1");
+	utf8ok("ConstantValue", get_item(c, 8).value.string, "Item #7 is 'ConstantValue' UTF8");
+	lok(1.0, to_long(get_item(c, 9).value.lng), "Long constant pool item value is 1.0");
+	utf8ok("<init>", get_item(c, 11).value.string, "Item #10 is '<init>' UTF8");
+	free_class(c);
 }
 
 void fields() {
 	printh("Fields");
-	Class *c = read_class_from_file_name("files/Fields.class");
+	Class *c = read_class_from_file_name("files/Fields.class", NULL);
 	ok(c != NULL, "C is not NULL");
 	ok(c->fields_count == 7, "Fields count == 7");
 	ok(c->methods_count == 2, "Methods count == 2, main() and constructor");
 }
 
+void jar() {
+	printh("Jar");
+	Jar *jar = open_jar("files/Test.jar");
+	ok(jar != NULL, "Jar is not NULL");
+	ok(is_jar_name("files/Test.jar"), "Test.jar has a jar name");
+	ok(!is_jar_name("files/Empty.class"), "Empty.class doesn't have a jar name");
+
+	JarIterator it = jar_iterator(jar);
+	JarEntry entry;
+	int entries = 0, parsed = 0;
+	bool found_empty = false;
+	while (next_class_entry(&it, &entry)) {
+		Class *c = read_class_from_jar_entry(jar, &entry, "entry", NULL);
+		if (c != NULL) parsed++;
+		if (c != NULL && entry.name_length == 11 && memcmp("Empty.class", entry.name, 11) == 0) {
+			found_empty = true;
+			iok(10, c->const_pool_count, "Empty.class from the jar has a constant pool count of 10");
+		}
+		free_class(c);
+		entries++;
+	}
+	iok(7, entries, "Jar has 7 .class entries");
+	iok(entries, parsed, "Every .class entry parses");
+	ok(found_empty, "Jar contains Empty.class");
+	close_jar(jar);
+}
+
+void skim() {
+	printh("Skim");
+	ParseOptions options = {.skim = true};
+	Class *c = read_class_from_file_name("files/Interfaces.class", &options);
+	ok(c != NULL, "C is not NULL");
+	ok(c->skimmed, "Class is marked as skimmed");
+	iok(2, c->interfaces_count, "Interfaces count = 2");
+	utf8ok("Interfaces", get_class_string(c, c->this_class).value.string, "This class is Interfaces");
+	utf8ok("java/lang/Object", get_class_string(c, c->super_class).value.string, "Super class is java/lang/Object");
+	utf8ok("java/io/Serializable", get_class_string(c, c->interfaces[0].class_idx).value.string, "First interface is Serializable");
+	iok(0, c->methods_count, "Methods aren't read");
+	free_class(c);
+}
+
+void buffer() {
+	printh("Buffer");
+	Buffer out;
+	init_buffer(&out, NULL, 4);
+	append_uint(&out, 0);
+	append_char(&out, ' ');
+	append_int(&out, -2147483648LL);
+	append_char(&out, ' ');
+	append_uint(&out, 18446744073709551615ULL);
+	append_char(&out, ' ');
+	append_hex(&out, 0x4021);
+	append_char(&out, ' ');
+	append_double(&out, 1.5);
+	append_char(&out, '\0');
+	strok("0 -2147483648 18446744073709551615 4021 1.500000", out.data, "Unbound buffer grows to hold everything");
+	free_buffer(&out);
+
+	FILE *tmp = tmpfile();
+	init_buffer(&out, tmp, 8);
+	append_string(&out, "0123456789");
+	append_string(&out, "abc");
+	free_buffer(&out);
+	char written[16] = {0};
+	rewind(tmp);
+	fread(written, 1, sizeof(written) - 1, tmp);
+	strok("0123456789abc", written, "Bound buffer flushes everything to its stream");
+	fclose(tmp);
+}
+
+void json() {
+	printh("JSON");
+	Buffer out;
+	init_buffer(&out, NULL, 64);
+	JsonWriter writer;
+	init_json_writer(&writer, &out);
+	json_begin_object(&writer);
+	json_key(&writer, "name");
+	json_cstring(&writer, "a \"quoted\"\\path\n\x01");
+	json_key(&writer, "list");
+	json_begin_array(&writer);
+	json_int(&writer, -1);
+	json_uint(&writer, 2);
+	json_double(&writer, 0.5);
+	json_double(&writer, NAN);
+	json_begin_object(&writer);
+	json_end_object(&writer);
+	json_end_array(&writer);
+	json_key(&writer, "ok");
+	json_bool(&writer, true);
+	json_end_object(&writer);
+	append_char(&out, '\0');
+	strok("{\"name\":\"a \\\"quoted\\\"\\\\path\\n\\u0001\",\"list\":[-1,2,0.5,null,{}],\"ok\":true}", out.data,
+			"Writer places commas and escapes strings");
+	free_buffer(&out);
+}
+
+void snapshot() {
+	printh("Snapshot");
+	Class *c = read_class_from_file_name("files/Interfaces.class", NULL);
+	SnapshotWriter writer;
+	init_snapshot_writer(&writer);
+	add_to_snapshot(&writer, c);
+	add_to_snapshot(&writer, c);
+	ok(write_snapshot(&writer, "Interfaces.cfrs"), "Snapshot is written");
+	free_snapshot_writer(&writer);
+
+	Snapshot *snapshot = open_snapshot("Interfaces.cfrs");
+	ok(snapshot != NULL, "Snapshot opens");
+	iok(2, snapshot_classes_count(snapshot), "Snapshot holds 2 classes");
+	uint16_t length = 0;
+	const char *name = snapshot_class_name(snapshot, 1, &length);
+	ok(name != NULL && length == 10 && memcmp(name, "Interfaces", 10) == 0, "Class name is read without loading");
+
+	Class *loaded = load_snapshot_class(snapshot, 1);
+	ok(loaded != NULL, "Loaded class is not NULL");
+	strok(c->file_name, loaded->file_name, "File name survives");
+	iok(c->const_pool_count, loaded->const_pool_count, "Constant pool count survives");
+	iok(c->methods_count, loaded->methods_count, "Methods count survives");
+	utf8ok("java/io/Serializable", get_class_string(loaded, loaded->interfaces[0].class_idx).value.string, "First interface survives");
+	ok(loaded->attributes_count == c->attributes_count && loaded->attributes[0].length == c->attributes[0].length
+			&& memcmp(get_attribute_info(loaded, loaded->attributes), get_attribute_info(c, c->attributes), c->attributes[0].length) == 0,
+			"Attribute bodies survive");
+	ok((const uint8_t *) loaded->tags >= snapshot->image && (const uint8_t *) loaded->tags < snapshot->image + snapshot->image_length,
+			"Constant pool is read in place");
+	const Attribute *code = find_attribute(loaded->methods[0].attrs, loaded->methods[0].attrs_count, ATTR_CODE);
+	ok(code != NULL && code->length == find_attribute(c->methods[0].attrs, c->methods[0].attrs_count, ATTR_CODE)->length,
+			"Attribute kinds are stored");
+	ok(load_snapshot_class(snapshot, 2) == NULL, "Out of range class is NULL");
+
+	// The first mapping holds the base address, so this one lands elsewhere and has to be relocated
+	Snapshot *moved = open_snapshot("Interfaces.cfrs");
+	ok(moved != NULL && moved->relocated, "Second mapping is relocated");
+	name = snapshot_class_name(moved, 0, &length);
+	ok(name != NULL && length == 10 && memcmp(name, "Interfaces", 10) == 0, "Relocated class name is read");
+	Class *relocated = load_snapshot_class(moved, 0);
+	ok(relocated != NULL && relocated->attributes_count == c->attributes_count
+			&& memcmp(get_attribute_info(relocated, relocated->attributes), get_attribute_info(c, c->attributes), c->attributes[0].length) == 0,
+			"Relocated attribute bodies survive");
+	free_class(relocated);
+	close_snapshot(moved);
+	free_class(loaded);
+	close_snapshot(snapshot);
+	remove("Interfaces.cfrs");
+	free_class(c);
+}
+
+void cache() {
+	printh("Cache");
+	const char *fox = "The quick brown fox jumps over the lazy dog";
+	CacheKey zero = {0, 0};
+	CacheKey key = hash_bytes(fox, strlen(fox), zero);
+	ok(key.high == 0xe34bbc7bbc071b6cULL && key.low == 0x7a433ca9c49a9347ULL, "Hash matches MurmurHash3 x64 128");
+
+	char directory[] = "/tmp/cfr-cacheXXXXXX";
+	ok(mkdtemp(directory) != NULL, "Cache directory is created");
+	Cache cache;
+	ok(open_cache(&cache, directory, 0), "Cache opens");
+	Buffer out;
+	init_buffer(&out, NULL, 16);
+	CacheProbe probe;
+	ok(!probe_data(&cache, fox, strlen(fox), "fox", &probe, &out), "First probe misses");
+	store_probe(&cache, &probe, "rendered", 8);
+	ok(probe_data(&cache, fox, strlen(fox), "fox", &probe, &out) && out.length == 8 && memcmp(out.data, "rendered", 8) == 0,
+			"Second probe hits with the stored output");
+	ok(!probe_data(&cache, fox, strlen(fox), "dog", &probe, &out), "Another name misses");
+	iok(1, cache.hits, "1 hit counted");
+	iok(2, cache.misses, "2 misses counted");
+	free_buffer(&out);
+}
+
+/* An InstructionVisitor that counts */
+bool count_instruction(const Instruction *instruction, void *context) {
+	(void) instruction;
+	(*(int *) context)++;
+	return true;
+}
+
+void code() {
+	printh("Code");
+	const uint8_t body[] = {
+		0, 2, 0, 3, 0, 0, 0, 49,
+		0x1b,                                                     // 0: iload_1
+		0xaa, 0, 0, 0, 0, 0, 30, 0, 0, 0, 1, 0, 0, 0, 2,          // 1: tableswitch, 2 bytes of padding
+		0, 0, 0, 20, 0, 0, 0, 25,
+		0xc4, 0x84, 0x01, 0x2c, 0xff, 0xfe,                       // 24: wide iinc 300, -2
+		0xab, 0, 0, 0, 0, 18, 0, 0, 0, 1, 0, 0, 0, 7, 0, 0, 0, 5, // 30: lookupswitch, 1 byte of padding
+		0xb1,                                                     // 48: return
+		0, 1, 0, 0, 0, 24, 0, 30, 0, 0,
+		0, 0
+	};
+	Code code;
+	ok(decode_code(body, 0, sizeof(body), &code), "Code decodes");
+	iok(2, code.max_stack, "Max stack = 2");
+	iok(3, code.max_locals, "Max locals = 3");
+	iok(49, code.code_length, "Code length = 49");
+	iok(30, get_exception_handler(&code, 0).handler_pc, "Handler is at 30");
+
+	InstructionIterator it = instruction_iterator(&code);
+	Instruction ins;
+	next_instruction(&it, &ins);
+	next_instruction(&it, &ins);
+	Switch table = instruction_switch(&ins);
+	int32_t match;
+	uint32_t target;
+	switch_case(&table, 1, &match, &target);
+	ok(ins.opcode == OP_TABLESWITCH && ins.length == 23 && table.count == 2 && match == 2 && target == 26,
+			"Tableswitch skips its padding");
+	next_instruction(&it, &ins);
+	ok(ins.wide && ins.opcode == OP_IINC && instruction_index(&ins) == 300 && instruction_value(&ins) == -2,
+			"Wide iinc has 16-bit operands");
+	next_instruction(&it, &ins);
+	table = instruction_switch(&ins);
+	switch_case(&table, 0, &match, &target);
+	ok(ins.pc == 30 && table.lookup && match == 7 && target == 35 && ins.pc + table.default_offset == 48, "Lookupswitch decodes");
+
+	int count = 0;
+	ok(visit_instructions(&code, count_instruction, &count), "Every instruction is well formed");
+	iok(5, count, "5 instructions are visited");
+
+	const uint8_t truncated[] = {0, 1, 0, 0, 0, 0, 0, 2, 0x11, 0, 0, 0, 0, 0};
+	ok(decode_code(truncated, 0, sizeof(truncated), &code) && !visit_instructions(&code, count_instruction, &count),
+			"Truncated sipush is malformed");
+}
+
+/* Declare name with super and up to one interface */
+void declare(Hierarchy *h, char *name, char *super, char *interface, bool is_interface) {
+	TypeDecl *decl = malloc(sizeof(TypeDecl) + sizeof(String));
+	decl->flags = is_interface ? ACC_INTERFACE : 0;
+	decl->name.value = name;
+	decl->name.length = strlen(name);
+	decl->super.value = super;
+	decl->super.length = strlen(super);
+	decl->interfaces_count = interface != NULL;
+	if (interface != NULL) {
+		decl->interfaces[0].value = interface;
+		decl->interfaces[0].length = strlen(interface);
+	}
+	add_type(h, decl);
+	free(decl);
+}
+
+void hierarchy() {
+	printh("Hierarchy");
+	Hierarchy h;
+	init_hierarchy(&h);
+	declare(&h, "A", "java/lang/Object", NULL, false);
+	declare(&h, "B", "A", "I", false);
+	declare(&h, "C", "B", NULL, false);
+	declare(&h, "D", "java/lang/Object", "J", false);
+	declare(&h, "J", "java/lang/Object", "I", true);
+	declare(&h, "I", "java/lang/Object", NULL, true);
+	build_hierarchy(&h);
+
+	TypeId a = find_type(&h, "A", 1), c = find_type(&h, "C", 1), d = find_type(&h, "D", 1), i = find_type(&h, "I", 1);
+	ok(find_type(&h, "E", 1) == NO_TYPE, "Unknown types aren't found");
+	ok(is_subtype(&h, c, a), "C extends A through B");
+	ok(is_subtype(&h, c, i), "C implements I through B");
+	ok(is_subtype(&h, d, i), "D implements I through J");
+	ok(!is_subtype(&h, a, i), "A doesn't implement I");
+	ok(!is_subtype(&h, d, a), "D doesn't extend A");
+	ok(is_subtype(&h, a, find_type(&h, "java/lang/Object", 16)), "Undeclared java/lang/Object is a root");
+
+	uint32_t count, r, total = 0;
+	const TypeRange *ranges = subtype_ranges(&h, i, &count);
+	for (r = 0; r < count; r++) total += ranges[r].end - ranges[r].first;
+	iok(5, total, "I, J, B, C and D are subtypes of I");
+	free_hierarchy(&h);
+}
+
+/* Append method, named as owner, name and descriptor run together, to sites as add_call_sites would */
+size_t push_method(CallSites *sites, const char *method) {
+	const char *dot = strchr(method, '.'), *paren = strchr(method, '(');
+	return push_key(sites, intern_string(method, dot - method), intern_string(dot + 1, paren - dot - 1),
+			intern_string(paren, strlen(paren)));
+}
+
+/* Record a call from caller to callee in sites */
+void call(CallSites *sites, char *caller, char *callee) {
+	size_t key = push_method(sites, caller);
+	push_method(sites, callee);
+	sites->keys[key].callees = 1;
+}
+
+void callgraph() {
+	printh("Call graph");
+	CallSites a = {0}, b = {0};
+	call(&a, "A.main()V", "B.run()V");
+	call(&a, "A.main()V", "B.run()V");
+	call(&a, "A.main()V", "A.log()V");
+	call(&b, "B.run()V", "C.step()V");
+	call(&b, "C.step()V", "B.run()V");
+	push_method(&b, "D.unused()V");
+
+	CallGraph graph;
+	init_call_graph(&graph);
+	merge_call_sites(&graph, &a, 0, a.keys_count);
+	merge_call_sites(&graph, &b, 0, b.keys_count);
+	build_call_graph(&graph);
+	iok(5, methods_count(&graph), "Methods from both classes are merged");
+	iok(4, graph.edges_count, "Repeated calls are one edge");
+
+	uint32_t count;
+	MethodId main = find_method(&graph, "A.main()V", 9);
+	iok(0, main, "Methods are numbered in order of first appearance");
+	const MethodId *callees = get_callees(&graph, main, &count);
+	ok(count == 2 && callees[0] < callees[1], "A.main()V calls two methods, sorted");
+	ok(find_method(&graph, "A.main()I", 9) == NO_METHOD && find_method(&graph, "A.main", 6) == NO_METHOD,
+			"Unknown and malformed methods aren't found");
+
+	Buffer out;
+	init_buffer(&out, NULL, 64);
+	append_method(&out, &graph, callees[1]);
+	append_char(&out, '\0');
+	strok("A.log()V", out.data, "Methods are named from their interned parts");
+	free_buffer(&out);
+
+	MethodId reached[5];
+	iok(4, find_reachable(&graph, main, reached), "Everything but D.unused()V is reachable from A.main()V");
+	iok(2, find_reachable(&graph, find_method(&graph, "C.step()V", 9), reached), "Cycles are followed once");
+	free_call_graph(&graph);
+	free_call_sites(&a);
+	free_call_sites(&b);
+}
+
+/* Intern the same names from several threads; a pthread start routine */
+void *intern_names(void *ids) {
+	char name[16];
+	int i;
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "name%d", i);
+		((SymbolId *) ids)[i] = intern_string(name, strlen(name));
+	}
+	return NULL;
+}
+
+void interning() {
+	printh("Interner");
+	ok(intern_string("Code", 4) == SYMBOL_CODE, "Well known names have fixed ids");
+	ok(find_interned("never interned", 14) == NO_SYMBOL, "Unknown strings aren't found");
+
+	static SymbolId ids[4][1000];
+	pthread_t threads[4];
+	int t;
+	for (t = 0; t < 4; t++) pthread_create(threads + t, NULL, intern_names, ids[t]);
+	for (t = 0; t < 4; t++) pthread_join(threads[t], NULL);
+	ok(memcmp(ids[0], ids[1], sizeof(ids[0])) == 0 && memcmp(ids[0], ids[3], sizeof(ids[0])) == 0,
+			"Every thread gets the same ids");
+	utf8ok("name999", interned_string(ids[2][999]), "Ids map back to their strings");
+
+	ParseOptions options = {.intern = true};
+	Class *a = read_class_from_file_name("files/Interfaces.class", &options);
+	Class *b = read_class_from_file_name("files/Interfaces.class", &options);
+	ok(a->symbols != NULL, "Interned classes have symbols");
+	uint16_t name_idx = get_item(a, a->this_class).value.ref.class_idx;
+	ok(a->symbols[name_idx] == b->symbols[name_idx], "The same name in two classes has one id");
+	ok(get_utf8(a, name_idx)->value == get_utf8(b, name_idx)->value, "The same name in two classes shares its bytes");
+	ok(a->symbols[get_item(a, a->super_class).value.ref.class_idx] == SYMBOL_OBJECT, "java/lang/Object is well known");
+	ok(find_attribute(a->methods[0].attrs, a->methods[0].attrs_count, ATTR_CODE) != NULL
+			&& find_attribute(a->attributes, a->attributes_count, ATTR_SOURCE_FILE) != NULL,
+			"Interned classes classify attributes by id");
+	free_class(a);
+	free_class(b);
+}
+
+void attribute_kinds() {
+	printh("Attribute kinds");
+	int kind;
+	bool all = true;
+	for (kind = ATTR_UNKNOWN + 1; kind < ATTRIBUTE_KINDS; kind++) {
+		const char *name = attribute_kind_name(kind);
+		String string = {strlen(name), name};
+		all = all && attribute_kind(&string) == (AttributeKind) kind;
+	}
+	ok(all, "Every spec name maps back to its kind");
+	String custom = {14, "ScalaSignature"}, near = {4, "Cods"}, tiny = {1, "C"};
+	ok(attribute_kind(&custom) == ATTR_UNKNOWN, "Names outside the spec are unknown");
+	ok(attribute_kind(&near) == ATTR_UNKNOWN, "Near misses are unknown");
+	ok(attribute_kind(&tiny) == ATTR_UNKNOWN, "Short names are unknown");
+
+	Class *c = read_class_from_file_name("files/Interfaces.class", NULL);
+	const Attribute *source = find_attribute(c->attributes, c->attributes_count, ATTR_SOURCE_FILE);
+	ok(source != NULL && string_equals(*get_utf8(c, source->name_idx), "SourceFile"), "Class attributes are classified");
+	ok(find_attribute(c->methods[0].attrs, c->methods[0].attrs_count, ATTR_CODE) != NULL, "Method attributes are classified");
+	free_class(c);
+}
+
+void constant_tags() {
+	printh("Constant tags");
+	static const uint8_t image[] = {
+		0xca, 0xfe, 0xba, 0xbe, 0x00, 0x00, 0x00, 0x37, 0x00, 0x0f,
+		0x01, 0x00, 0x01, 'A',                          // #1 Utf8 A
+		0x07, 0x00, 0x01,                               // #2 Class A
+		0x01, 0x00, 0x03, '(', ')', 'V',                // #3 Utf8 ()V
+		0x10, 0x00, 0x03,                               // #4 MethodType ()V
+		0x0f, 0x06, 0x00, 0x09,                         // #5 MethodHandle invokestatic #9
+		0x0c, 0x00, 0x01, 0x00, 0x03,                   // #6 NameAndType A ()V
+		0x11, 0x00, 0x00, 0x00, 0x06,                   // #7 Dynamic 0, #6
+		0x12, 0x00, 0x01, 0x00, 0x06,                   // #8 InvokeDynamic 1, #6
+		0x0a, 0x00, 0x02, 0x00, 0x06,                   // #9 Methodref A.A()V
+		0x13, 0x00, 0x01,                               // #10 Module A
+		0x14, 0x00, 0x01,                               // #11 Package A
+		0x05, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, // #12 and #13 Long
+		0x03, 0xff, 0xff, 0xff, 0xfe,                   // #14 Integer -2
+		0x00, 0x21, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+	Class *c = read_class_from_buffer("A.class", image, sizeof(image), NULL);
+	ok(c != NULL, "Every tag up to Package parses");
+	iok(3 + 2 + 5 + 2 + 3 + 4 + 4 + 4 + 4 + 2 + 2 + 8 + 4, c->pool_size_bytes, "Pool size counts each entry's width");
+	ok(get_item(c, 5).tag == METHOD_HANDLE && get_item(c, 5).value.ref.class_idx == 6 && get_item(c, 5).value.ref.name_idx == 9,
+			"MethodHandle has its kind and reference");
+	ok(get_item(c, 8).tag == INVOKE_DYNAMIC && get_item(c, 8).value.ref.class_idx == 1 && get_item(c, 8).value.ref.name_idx == 6,
+			"InvokeDynamic has its bootstrap method and NameAndType");
+	ok(get_item(c, 7).tag == DYNAMIC && get_item(c, 10).tag == MODULE && get_item(c, 11).tag == PACKAGE, "Dynamic, Module and Package");
+	ok(to_long(get_item(c, 12).value.lng) == 0x100000002L, "Long is read whole");
+	iok(-2, get_item(c, 14).value.integer, "The Integer after the Long's second slot");
+	iok(0, get_item(c, 13).tag, "The Long's second slot has no constant");
+	iok(0, get_item(c, 15).tag, "Indexes past the pool have no constant");
+	iok(2, c->strings_count, "UTF-8 constants are stored densely");
+	strok("Package", tag2str(PACKAGE), "Tags up to Package have names");
+	free_class(c);
+}
+
+/* Decode length bytes of value and compare the result with the expected_length bytes of expected */
+void decodeok(const char *value, size_t length, const char *expected, size_t expected_length, bool valid, char *msg) {
+	Buffer out;
+	init_buffer(&out, NULL, 16);
+	bool decoded = decode_mutf8(&out, value, length);
+	ok(decoded == valid && out.length == expected_length && memcmp(out.data, expected, out.length) == 0, msg);
+	free_buffer(&out);
+}
+
+void mutf8() {
+	printh("Modified UTF-8");
+	char long_name[64];
+	memset(long_name, 'a', sizeof(long_name));
+	long_name[40] = '\xc3';
+	long_name[41] = '\xa9';
+	iok(40, count_ascii(long_name, sizeof(long_name)), "The ASCII run stops at the first multibyte sequence");
+	iok(3, count_ascii("abc\0def", 7), "The ASCII run stops at a zero byte");
+	ok(validate_mutf8(long_name, sizeof(long_name)), "Two byte sequences are valid");
+	ok(validate_mutf8("\xc0\x80", 2), "C0 80 is NUL");
+	ok(!validate_mutf8("a\0b", 3), "A zero byte is invalid");
+	ok(!validate_mutf8("\xf0\x9f\x98\x80", 4), "Four byte sequences are invalid");
+	ok(!validate_mutf8("\xc1\x81", 2), "Overlong sequences other than NUL are invalid");
+	ok(!validate_mutf8("\xe2\x82", 2), "Truncated sequences are invalid");
+
+	decodeok("\xc0\x80", 2, "\0", 1, true, "NUL decodes to a zero byte");
+	decodeok("\xed\xa0\xbd\xed\xb8\x80", 6, "\xf0\x9f\x98\x80", 4, true, "Surrogate pairs decode to four bytes");
+	decodeok("x\xed\xa0\xbdy", 5, "x\xef\xbf\xbdy", 5, true, "Lone surrogates decode to U+FFFD");
+	decodeok("x\xffy", 3, "x\xef\xbf\xbdy", 5, false, "Malformed bytes decode to U+FFFD");
+
+	Buffer out;
+	init_buffer(&out, NULL, 16);
+	JsonWriter writer;
+	init_json_writer(&writer, &out);
+	json_mutf8(&writer, "\xc0\x80\xed\xa0\xbd\xed\xb8\x80", 8);
+	append_char(&out, '\0');
+	strok("\"\\u0000\xf0\x9f\x98\x80\"", out.data, "JSON gets standard UTF-8");
+	free_buffer(&out);
+}
+
+/* Parse value with parse, render it and compare with expected */
+void typeok(const TypeNode *(*parse)(Arena *, const char *, size_t), char *value, char *expected, char *msg) {
+	Arena *arena = create_arena(0);
+	const TypeNode *type = parse(arena, value, strlen(value));
+	Buffer out;
+	init_buffer(&out, NULL, 64);
+	if (type != NULL) append_type(&out, type);
+	append_char(&out, '\0');
+	strok(expected, out.data, msg);
+	free_buffer(&out);
+	free_arena(arena);
+}
+
+void descriptors() {
+	printh("Descriptors");
+	typeok(parse_member_type, "[[J", "long[][]", "Arrays of primitives");
+	typeok(parse_member_type, "([Ljava/lang/String;I)V", "void(java.lang.String[], int)", "Method descriptors");
+	typeok(parse_member_type, "<T:Ljava/lang/Object;>(Ljava/util/List<+TT;>;)TT;^Ljava/io/IOException;",
+			"<T extends java.lang.Object> T(java.util.List<? extends T>) throws java.io.IOException", "Method signatures");
+	typeok(parse_member_type, "Lpkg/Outer<TT;>.Inner<*>;", "pkg.Outer<T>.Inner<?>", "Nested generic classes");
+	typeok(parse_class_signature, "<K::Ljava/lang/Comparable<TK;>;>Ljava/util/AbstractMap<TK;-TK;>;Ljava/io/Serializable;",
+			"<K extends java.lang.Comparable<K>> extends java.util.AbstractMap<K, ? super K> implements java.io.Serializable",
+			"Class signatures");
+
+	Arena *arena = create_arena(0);
+	ok(parse_member_type(arena, "V", 1) == NULL, "void isn't a field type");
+	ok(parse_member_type(arena, "(I", 2) == NULL, "Unclosed parameters are malformed");
+	ok(parse_member_type(arena, "Ljava/lang/String", 17) == NULL, "Unterminated classes are malformed");
+	ok(parse_member_type(arena, "II", 2) == NULL, "Trailing bytes are malformed");
+	free_arena(arena);
+
+	SymbolId id = intern_string("(JJ)Z", 5);
+	const TypeNode *type = member_type(id);
+	ok(type != NULL && type->sort == SORT_METHOD && type->types_count == 2, "Interned descriptors are parsed");
+	ok(member_type(id) == type, "and parsed only once");
+	ok(member_type(intern_string("(", 1)) == NULL, "Malformed descriptors stay malformed");
+}
+
+void arena() {
+	printh("Arena");
+	Arena *arena = create_arena(0);
+	ok(arena != NULL, "Arena is not NULL");
+
+	char *small = arena_alloc(arena, 3);
+	long *aligned = arena_alloc(arena, sizeof(long));
+	ok(((uintptr_t) aligned % 16) == 0, "Allocations are aligned");
+	ok((char *) aligned > small, "Allocations don't overlap");
+
+	int *zeroed = arena_calloc(arena, 1024, sizeof(int));
+	ok(zeroed[0] == 0 && zeroed[1023] == 0, "arena_calloc zeroes memory");
+
+	char *big = arena_alloc(arena, 1 << 20);
+	big[(1 << 20) - 1] = 'x';
+	ok(arena->head->next != NULL, "A large allocation adds a chunk");
+
+	reset_arena(arena);
+	ok(arena->head->next == NULL, "reset_arena keeps only the first chunk");
+	iok(0, arena->allocated, "reset_arena drops every allocation");
+	free_arena(arena);
+}
+
 void test_field2str() {
 	printh("field2str");
 	ok("byte" == field2str('B'), "B == byte");
@@ -227,9 +806,613 @@ void test_field2str() {
 	ok("array" == field2str('['), "[ == array");
 }
 
+/* Write length bytes of data to directory/name */
+void write_test_file(const char *directory, const char *name, const char *data, size_t length) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	FILE *file = fopen(path, "w");
+	fwrite(data, 1, length, file);
+	fclose(file);
+}
+
+/* Collect walked paths, relative to the walked directory, into a newline separated Buffer; a PathVisitor */
+void collect_path(char *path, void *context) {
+	Buffer *found = context;
+	append_string(found, strchr(path + strlen("/tmp/"), '/') + 1);
+	append_char(found, '\n');
+	free(path);
+}
+
+void classpath() {
+	printh("Classpath");
+	char directory[] = "/tmp/cfr-walkXXXXXX";
+	ok(mkdtemp(directory) != NULL, "Walk directory is created");
+	char path[256];
+	snprintf(path, sizeof(path), "%s/b", directory);
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/b/c", directory);
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/lib", directory);
+	mkdir(path, 0700);
+	write_test_file(directory, "Z.class", "", 0);
+	write_test_file(directory, "a.class", "", 0);
+	write_test_file(directory, "b/c/C.class", "", 0);
+	write_test_file(directory, "b/B.class", "", 0);
+	write_test_file(directory, "b/notes.txt", "", 0);
+	write_test_file(directory, "lib/x.jar", "", 0);
+	write_test_file(directory, "lib/y.class", "", 0);
+	snprintf(path, sizeof(path), "%s/b/loop", directory);
+	ok(symlink(directory, path) == 0, "A link back to the top is made");
+
+	Buffer found;
+	init_buffer(&found, NULL, 256);
+	ok(walk_directory(directory, ".class", collect_path, &found), "The directory is walked");
+	append_char(&found, '\0');
+	strok("Z.class\na.class\nb/B.class\nb/c/C.class\nlib/y.class\n", found.data, "Class files come depth first in name order, not through links");
+
+	found.length = 0;
+	char classpath[512];
+	snprintf(classpath, sizeof(classpath), "%s/b::%s/lib/*:%s/a.class", directory, directory, directory);
+	ok(walk_classpath(classpath, collect_path, &found), "The classpath is walked");
+	append_char(&found, '\0');
+	strok("b/B.class\nb/c/C.class\nlib/x.jar\na.class\n", found.data, "Directories, wildcards and files are expanded in order");
+	free_buffer(&found);
+
+	ok(is_directory(directory) && !is_directory("/tmp/cfr-walk-missing"), "is_directory tells directories apart");
+}
+
+/* Prefetch every file named in paths with backend and check that each comes back with its expected contents, or NULL */
+void prefetchok(char **paths, const char **expected, size_t count, PrefetchBackend backend, char *msg) {
+	Prefetcher *prefetcher = start_prefetch(paths, count, 2, backend);
+	bool matched = true;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		size_t length = 0;
+		uint8_t *data = take_file(prefetcher, i, &length);
+		if (expected[i] == NULL) {
+			matched &= data == NULL;
+		} else {
+			matched &= data != NULL && length == strlen(expected[i]) && memcmp(data, expected[i], length) == 0;
+		}
+		free(data);
+	}
+	stop_prefetch(prefetcher);
+	ok(matched, msg);
+}
+
+void prefetch() {
+	printh("Prefetch");
+	char directory[] = "/tmp/cfr-prefetchXXXXXX";
+	ok(mkdtemp(directory) != NULL, "Prefetch directory is created");
+	enum { FILES = 40 };
+	char *paths[FILES];
+	const char *expected[FILES];
+	char names[FILES][16];
+	size_t i;
+	for (i = 0; i < FILES; i++) {
+		snprintf(names[i], sizeof(names[i]), "%zu.class", i);
+		paths[i] = malloc(strlen(directory) + 1 + strlen(names[i]) + 1);
+		sprintf(paths[i], "%s/%s", directory, names[i]);
+		expected[i] = names[i];
+		write_test_file(directory, names[i], names[i], strlen(names[i]));
+	}
+	// Skipped, missing, empty and not a regular file
+	free(paths[3]);
+	paths[3] = NULL;
+	expected[3] = NULL;
+	unlink(paths[5]);
+	expected[5] = NULL;
+	write_test_file(directory, names[7], "", 0);
+	expected[7] = NULL;
+	strcpy(paths[9] + strlen(directory), "");
+	expected[9] = NULL;
+
+	prefetchok(paths, expected, FILES, PREFETCH_IO_URING, "Files read through io_uring, or its fallback, match");
+	prefetchok(paths, expected, FILES, PREFETCH_PREAD, "Files read with pread match");
+
+	Prefetcher *prefetcher = start_prefetch(paths, FILES, 4, PREFETCH_PREAD);
+	ok(prefetch_backend(prefetcher) == PREFETCH_PREAD, "pread can be asked for");
+	size_t length;
+	uint8_t *data = take_file(prefetcher, 0, &length);
+	ok(data != NULL, "The first file is taken");
+	free(data);
+	stop_prefetch(prefetcher);
+	ok(true, "Stopping with files still to take doesn't hang or leak");
+
+	for (i = 0; i < FILES; i++) {
+		if (paths[i] != NULL) unlink(paths[i]);
+		free(paths[i]);
+	}
+	rmdir(directory);
+}
+
+void put_u2(Buffer *out, uint16_t value) {
+	append_char(out, value >> 8);
+	append_char(out, value & 0xff);
+}
+
+void put_utf8(Buffer *out, const char *value) {
+	append_char(out, STRING_UTF8);
+	put_u2(out, strlen(value));
+	append_string(out, value);
+}
+
+/* Append a public ()V method called the constant at name whose Code is body */
+void put_method(Buffer *out, uint16_t name, uint16_t base, const char *body, uint32_t length) {
+	put_u2(out, ACC_PUBLIC);
+	put_u2(out, name);
+	put_u2(out, base + 6);
+	put_u2(out, 1);
+	put_u2(out, base + 7);
+	put_u2(out, 0);
+	put_u2(out, 12 + length);
+	put_u2(out, 1);
+	put_u2(out, 1);
+	put_u2(out, 0);
+	put_u2(out, length);
+	append_chars(out, body, length);
+	put_u2(out, 0);
+	put_u2(out, 0);
+}
+
+/* Build class A into out, with pad unused constants first so every index moves, then int count if field, then
+ * void run() { ldc constant; pop; return } and, if stop, an empty void stop() */
+void build_class(Buffer *out, uint16_t pad, bool field, int32_t constant, bool stop) {
+	out->length = 0;
+	append_chars(out, "\xca\xfe\xba\xbe\0\0\0\x37", 8);
+	const uint16_t base = pad;
+	put_u2(out, pad + 12);
+	uint16_t i;
+	for (i = 0; i < pad; i++) {
+		put_utf8(out, "pad");
+	}
+	put_utf8(out, "A");
+	append_char(out, CLASS);
+	put_u2(out, base + 1);
+	put_utf8(out, "java/lang/Object");
+	append_char(out, CLASS);
+	put_u2(out, base + 3);
+	put_utf8(out, "run");
+	put_utf8(out, "()V");
+	put_utf8(out, "Code");
+	put_utf8(out, "count");
+	put_utf8(out, "I");
+	put_utf8(out, "stop");
+	append_char(out, INTEGER);
+	put_u2(out, (uint32_t) constant >> 16);
+	put_u2(out, constant & 0xffff);
+
+	put_u2(out, ACC_PUBLIC | ACC_SUPER);
+	put_u2(out, base + 2);
+	put_u2(out, base + 4);
+	put_u2(out, 0);
+	put_u2(out, field);
+	if (field) {
+		put_u2(out, ACC_FINAL);
+		put_u2(out, base + 8);
+		put_u2(out, base + 9);
+		put_u2(out, 0);
+	}
+	put_u2(out, 1 + stop);
+	const char run[] = {OP_LDC, base + 11, 0x57, OP_RETURN};
+	put_method(out, base + 5, base, run, sizeof(run));
+	const char empty[] = {OP_RETURN};
+	if (stop) put_method(out, base + 10, base, empty, sizeof(empty));
+	put_u2(out, 0);
+}
+
+/* Fingerprint a class built by build_class into print, returning the class it points into */
+Class *print_built(Buffer *image, ClassPrint *print, uint16_t pad, bool field, int32_t constant, bool stop) {
+	build_class(image, pad, field, constant, stop);
+	Class *c = read_class_from_buffer("A.class", (uint8_t *) image->data, image->length, NULL);
+	fingerprint_class(print, c);
+	return c;
+}
+
+void delta() {
+	printh("Delta");
+	Buffer images[3], out;
+	ClassPrint prints[3];
+	Class *classes[3];
+	ClassDelta delta;
+	int i;
+	for (i = 0; i < 3; i++) {
+		init_buffer(images + i, NULL, 256);
+	}
+	uint32_t interned = interned_count();
+	classes[0] = print_built(images, prints, 0, true, 7, false);
+	classes[1] = print_built(images + 1, prints + 1, 3, true, 7, false);
+	classes[2] = print_built(images + 2, prints + 2, 0, false, 8, true);
+	ok(classes[0] != NULL && classes[1] != NULL && classes[2] != NULL, "Built classes parse");
+	iok(2, prints[0].members_count, "A field and a method are fingerprinted");
+	ok(prints[0].members[0].kind != prints[0].members[1].kind, "The field and the method are told apart");
+
+	diff_classes(&delta, prints, prints + 1);
+	ok(!delta_changed(&delta), "Moving every constant pool index is no change");
+	free_class_delta(&delta);
+
+	diff_classes(&delta, prints, prints + 2);
+	init_buffer(&out, NULL, 256);
+	append_delta(&out, &delta, prints + 2);
+	append_char(&out, '\0');
+	strok("\t- int count\n\t~ void run()\n\t+ void stop()\n", out.data, "Removed, changed and added members are listed in order");
+	iok(interned, interned_count(), "Fingerprinting and printing a delta interns nothing");
+	out.length = 0;
+	JsonWriter writer;
+	init_json_writer(&writer, &out);
+	json_begin_object(&writer);
+	json_delta(&writer, &delta);
+	json_end_object(&writer);
+	append_char(&out, '\0');
+	strok("{\"header_changed\":false,\"added\":[\"void stop()\"],\"removed\":[\"int count\"],\"changed\":[\"void run()\"]}", out.data,
+			"The delta is written as JSON");
+	free_class_delta(&delta);
+
+	diff_classes(&delta, NULL, prints);
+	ok(delta.changes_count == 2 && delta.changes[0].kind == MEMBER_ADDED && !delta.header_changed, "Every member of a new class is added");
+	free_class_delta(&delta);
+	diff_classes(&delta, prints, NULL);
+	ok(delta.changes_count == 2 && delta.changes[1].kind == MEMBER_REMOVED, "Every member of a deleted class is removed");
+	free_class_delta(&delta);
+
+	free_buffer(&out);
+	for (i = 0; i < 3; i++) {
+		free_class_print(prints + i);
+		free_class(classes[i]);
+		free_buffer(images + i);
+	}
+}
+
+/* Write image to path, replacing it the way a compiler would */
+void write_image(const char *directory, const char *name, const Buffer *image) {
+	write_test_file(directory, name, image->data, image->length);
+}
+
+/* Poll watch once and check how many classes it reports and what it writes */
+void pollok(Watch *watch, bool json, int expected_count, const char *expected, char *msg) {
+	Buffer out;
+	init_buffer(&out, NULL, 256);
+	int count = poll_watch(watch, 1000, &out, json);
+	append_char(&out, '\0');
+	ok(count == expected_count && strcmp(out.data, expected) == 0, msg);
+	if (count != expected_count || strcmp(out.data, expected) != 0) printf("# Got %d: %s", count, out.data);
+	free_buffer(&out);
+}
+
+void watch() {
+	printh("Watch");
+	char directory[] = "/tmp/cfr-watchXXXXXX";
+	ok(mkdtemp(directory) != NULL, "Watch directory is created");
+	Buffer image;
+	init_buffer(&image, NULL, 256);
+	build_class(&image, 0, true, 7, false);
+	write_image(directory, "A.class", &image);
+	write_test_file(directory, "Broken.class", "\xca\xfe", 2);
+
+	Watch *watch = open_watch(directory, NULL);
+	ok(watch != NULL, "The directory is watched");
+	iok(1, watched_count(watch), "The valid class already there is read");
+
+	write_image(directory, "A.class", &image);
+	pollok(watch, false, 0, "", "Rewriting the same bytes is no change");
+	build_class(&image, 3, true, 7, false);
+	write_image(directory, "A.class", &image);
+	pollok(watch, false, 0, "", "Recompiling without a change is no change");
+
+	char expected[512];
+	build_class(&image, 0, false, 8, true);
+	write_image(directory, "A.class", &image);
+	snprintf(expected, sizeof(expected), "Changed: %s/A.class\n\t- int count\n\t~ void run()\n\t+ void stop()\n\n", directory);
+	pollok(watch, false, 1, expected, "A changed class lists its members' changes");
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/sub", directory);
+	mkdir(path, 0700);
+	write_image(path, "B.class", &image);
+	snprintf(expected, sizeof(expected), "Added: %s/sub/B.class\n\t+ void run()\n\t+ void stop()\n\n", directory);
+	pollok(watch, false, 1, expected, "Classes in a new directory are added");
+	iok(2, watched_count(watch), "Both classes are held");
+
+	snprintf(path, sizeof(path), "%s/A.class", directory);
+	unlink(path);
+	snprintf(expected, sizeof(expected), "{\"event\":\"removed\",\"file\":\"%s/A.class\",\"class\":\"A\",\"header_changed\":false,"
+			"\"added\":[],\"removed\":[\"void run()\",\"void stop()\"],\"changed\":[]}\n", directory);
+	pollok(watch, true, 1, expected, "A deleted class is reported as JSON");
+	iok(1, watched_count(watch), "The deleted class is let go");
+
+	snprintf(path, sizeof(path), "%s/sub/B.class", directory);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/sub", directory);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/Broken.class", directory);
+	unlink(path);
+	snprintf(expected, sizeof(expected), "Removed: %s/sub/B.class\n\t- void run()\n\t- void stop()\n\n", directory);
+	pollok(watch, false, 1, expected, "Removing a directory removes its classes");
+	close_watch(watch);
+	free_buffer(&image);
+	rmdir(directory);
+}
+
+void put_le2(Buffer *out, uint16_t value) {
+	append_char(out, value & 0xff);
+	append_char(out, value >> 8);
+}
+
+void put_le4(Buffer *out, uint32_t value) {
+	put_le2(out, value & 0xffff);
+	put_le2(out, value >> 16);
+}
+
+/* Write a jar at path holding count stored entries, names[i] with the bytes of images[i] */
+void write_stored_jar(const char *path, const char **names, Buffer **images, int count) {
+	Buffer jar, central;
+	init_buffer(&jar, NULL, 1024);
+	init_buffer(&central, NULL, 256);
+	int i;
+	for (i = 0; i < count; i++) {
+		const uint32_t offset = jar.length, length = images[i]->length;
+		const uint16_t name_length = strlen(names[i]);
+		put_le4(&jar, 0x04034b50);
+		put_le2(&jar, 20);
+		put_le2(&jar, 0);
+		put_le2(&jar, ZIP_STORED);
+		put_le4(&jar, 0);
+		put_le4(&jar, 0);
+		put_le4(&jar, length);
+		put_le4(&jar, length);
+		put_le2(&jar, name_length);
+		put_le2(&jar, 0);
+		append_string(&jar, names[i]);
+		append_chars(&jar, images[i]->data, length);
+
+		put_le4(&central, 0x02014b50);
+		put_le2(&central, 20);
+		put_le2(&central, 20);
+		put_le2(&central, 0);
+		put_le2(&central, ZIP_STORED);
+		put_le4(&central, 0);
+		put_le4(&central, 0);
+		put_le4(&central, length);
+		put_le4(&central, length);
+		put_le2(&central, name_length);
+		put_le4(&central, 0);
+		put_le4(&central, 0);
+		put_le4(&central, 0);
+		put_le4(&central, offset);
+		append_string(&central, names[i]);
+	}
+	const uint32_t central_offset = jar.length;
+	append_chars(&jar, central.data, central.length);
+	put_le4(&jar, 0x06054b50);
+	put_le4(&jar, 0);
+	put_le2(&jar, count);
+	put_le2(&jar, count);
+	put_le4(&jar, central.length);
+	put_le4(&jar, central_offset);
+	put_le2(&jar, 0);
+	FILE *file = fopen(path, "w");
+	fwrite(jar.data, 1, jar.length, file);
+	fclose(file);
+	free_buffer(&jar);
+	free_buffer(&central);
+}
+
+/* Append each change as text; a ChangeVisitor */
+void collect_change(ChangeKind event, const char *name, const ClassPrint *print, const ClassDelta *delta, void *context) {
+	format_class_delta(context, false, event, name, print, delta);
+}
+
+void diff() {
+	printh("Diff");
+	char directory[] = "/tmp/cfr-diffXXXXXX";
+	ok(mkdtemp(directory) != NULL, "Diff directory is created");
+	Buffer v1, v2, v3;
+	init_buffer(&v1, NULL, 256);
+	init_buffer(&v2, NULL, 256);
+	init_buffer(&v3, NULL, 256);
+	build_class(&v1, 0, true, 7, false);
+	build_class(&v2, 3, true, 7, false);
+	build_class(&v3, 0, false, 8, true);
+
+	char before[256], after[256];
+	snprintf(before, sizeof(before), "%s/before.jar", directory);
+	snprintf(after, sizeof(after), "%s/after.jar", directory);
+	const char *before_names[] = {"p/Changed.class", "p/Gone.class", "p/Recompiled.class", "p/Same.class"};
+	Buffer *before_images[] = {&v1, &v1, &v1, &v1};
+	write_stored_jar(before, before_names, before_images, 4);
+	const char *after_names[] = {"p/Same.class", "p/Recompiled.class", "p/New.class", "p/Changed.class"};
+	Buffer *after_images[] = {&v1, &v2, &v1, &v3};
+	write_stored_jar(after, after_names, after_images, 4);
+
+	Buffer out;
+	init_buffer(&out, NULL, 256);
+	DiffCounts counts;
+	ok(diff_files(before, after, NULL, collect_change, &out, &counts), "The jars are compared");
+	append_char(&out, '\0');
+	strok("Changed: p/Changed.class\n\t- int count\n\t~ void run()\n\t+ void stop()\n"
+			"Removed: p/Gone.class\n\t- int count\n\t- void run()\n"
+			"Added: p/New.class\n\t+ int count\n\t+ void run()\n", out.data, "Classes are paired by entry name and reported in name order");
+	ok(counts.identical == 1 && counts.compared == 2 && counts.changed == 3, "The identical entry is skipped unparsed");
+
+	char first[256], second[256];
+	snprintf(first, sizeof(first), "%s/A.class", directory);
+	snprintf(second, sizeof(second), "%s/B.class", directory);
+	write_image(directory, "A.class", &v1);
+	write_image(directory, "B.class", &v2);
+	out.length = 0;
+	ok(diff_files(first, second, NULL, collect_change, &out, &counts) && out.length == 0 && counts.compared == 1,
+			"A class recompiled with its pool reordered matches");
+	ok(!diff_files(first, after, NULL, collect_change, &out, &counts), "A class file isn't compared with a jar");
+
+	unlink(before);
+	unlink(after);
+	unlink(first);
+	unlink(second);
+	rmdir(directory);
+	free_buffer(&out);
+	free_buffer(&v1);
+	free_buffer(&v2);
+	free_buffer(&v3);
+}
+
+/* Parse image with a filter compiled from expression */
+Class *read_filtered(const Buffer *image, const char *expression) {
+	char error[128];
+	ParseOptions options = {0};
+	options.filter = compile_filter(expression, error, sizeof(error));
+	Class *c = read_class_from_buffer("A.class", (uint8_t *) image->data, image->length, &options);
+	free_filter((Filter *) options.filter);
+	return c;
+}
+
+void filter() {
+	printh("Filter");
+	char error[128];
+	ok(compile_filter("public &&", error, sizeof(error)) == NULL, "A dangling && is rejected");
+	strok("Expected a test at column 10", error, "The error says where");
+	ok(compile_filter("major_version >= java", error, sizeof(error)) == NULL, "Versions are numbers");
+	ok(compile_filter("name < run", error, sizeof(error)) == NULL, "Names are only compared for equality");
+	Filter *f = compile_filter("!(major_version < 52) && class.public", error, sizeof(error));
+	ok(f != NULL && !filter_uses_members(f), "Class tests don't need members");
+	free_filter(f);
+	f = compile_filter("class.interface || static", error, sizeof(error));
+	ok(f != NULL && filter_uses_members(f), "Member tests need members");
+	free_filter(f);
+
+	Buffer image;
+	init_buffer(&image, NULL, 256);
+	build_class(&image, 0, true, 7, true);
+	Class *c = read_filtered(&image, "major_version > 55 && name == run");
+	ok(c->filtered && c->const_pool_count == 0, "A class is rejected on its version before the pool is read");
+	free_class(c);
+	c = read_filtered(&image, "class.name == A && class.extends == java.lang.*");
+	ok(!c->filtered && c->fields_count == 1 && c->methods_count == 2, "A class accepted on its declaration keeps every member");
+	free_class(c);
+	c = read_filtered(&image, "method && name == st*");
+	ok(!c->filtered && c->fields_count == 0 && c->methods_count == 1 && string_equals(*get_utf8(c, c->methods[0].name_idx), "stop"),
+			"Only the members matched are kept");
+	free_class(c);
+	c = read_filtered(&image, "returns == int || final");
+	ok(!c->filtered && c->fields_count == 1 && c->methods_count == 0, "Fields are matched on their type");
+	free_class(c);
+	c = read_filtered(&image, "class.interface || synchronized");
+	ok(c->filtered, "A class with no matching member is rejected");
+	free_class(c);
+
+	c = read_class_from_buffer("A.class", (uint8_t *) image.data, image.length, NULL);
+	f = compile_filter("descriptor == \"()V\" && !public", error, sizeof(error));
+	ok(!filter_parsed_class(f, c), "An already parsed class is judged whole");
+	free_filter(f);
+	free_class(c);
+	free_buffer(&image);
+}
+
+void stats() {
+	printh("Stats");
+	Stats *counted = calloc(2, sizeof(Stats));
+	Histogram *histogram = counted->phases + PHASE_PRINT;
+	uint64_t i;
+	for (i = 1; i <= 100; i++) {
+		add_sample(histogram, i * 1000);
+	}
+	ok(histogram->count == 100 && histogram->max == 100000, "Samples are counted");
+	uint64_t p50 = histogram_percentile(histogram, 0.5);
+	ok(p50 >= 50000 && p50 < 50000 + 50000 / 8, "p50 is within a bucket");
+	iok(100000, histogram_percentile(histogram, 1), "The top percentile is the maximum");
+
+	Buffer image;
+	init_buffer(&image, NULL, 256);
+	build_class(&image, 2, true, 7, false);
+	thread_stats = counted + 1;
+	Class *c = read_class_from_buffer("A.class", (uint8_t *) image.data, image.length, NULL);
+	thread_stats = NULL;
+	ok(counted[1].classes == 1 && counted[1].bytes_read == image.length, "A parsed class and its bytes are counted");
+	ok(counted[1].constants[STRING_UTF8] == 10 && counted[1].constants[CLASS] == 2 && counted[1].constants[INTEGER] == 1,
+			"Constants are counted by tag");
+	ok(counted[1].phases[PHASE_CONST_POOL].count == 1 && counted[1].phases[PHASE_MEMBERS].count == 1, "Parsing phases are timed");
+	merge_stats(counted, counted + 1);
+	ok(counted->classes == 1 && histogram->count == 100 && counted->phases[PHASE_MEMBERS].count == 1, "Threads' stats merge");
+	free_class(c);
+	free_buffer(&image);
+	free(counted);
+}
+
+void class_types() {
+	printh("Class types");
+	Buffer image;
+	init_buffer(&image, NULL, 256);
+	build_class(&image, 0, true, 7, false);
+	Class *c = read_class_from_buffer("A.class", (uint8_t *) image.data, image.length, NULL);
+	uint32_t interned = interned_count();
+	const TypeNode *type = constant_member_type(c, c->methods[0].desc_idx);
+	ok(type != NULL && type->sort == SORT_METHOD && constant_member_type(c, c->methods[0].desc_idx) == type,
+			"A class's descriptors are parsed once");
+	ok(constant_member_type(c, 2) == NULL && interned_count() == interned, "and into the class, not the interner");
+	free_class(c);
+	free_buffer(&image);
+}
+
+void malformed_members() {
+	printh("Malformed members");
+	Buffer image, out;
+	init_buffer(&image, NULL, 256);
+	init_buffer(&out, NULL, 1024);
+	build_class(&image, 0, true, 7, false);
+	Class *c = read_class_from_buffer("A.class", (uint8_t *) image.data, image.length, NULL);
+	// As a corrupt snapshot record could have it: descriptors naming a Class constant
+	c->fields[0].desc_idx = 2;
+	c->methods[0].desc_idx = 2;
+	format_class(&out, c);
+	append_char(&out, '\0');
+	ok(strstr(out.data, "Undefined count\n") != NULL && strstr(out.data, "run \n") != NULL,
+			"Members whose descriptor isn't UTF-8 are printed without one");
+	free_class(c);
+
+	build_class(&image, 1, true, 7, false);
+	image.data[14] = '\xff'; // the first constant, "pad", becomes "p\xffd"
+	c = read_class_from_buffer("A.class", (uint8_t *) image.data, image.length, NULL);
+	ok(c != NULL, "A class with malformed modified UTF-8 still parses");
+	out.length = 0;
+	if (c != NULL) format_class(&out, c);
+	append_char(&out, '\0');
+	ok(strstr(out.data, "p\xef\xbf\xbd" "d") != NULL, "Its malformed bytes are printed as U+FFFD");
+	free_class(c);
+	free_buffer(&out);
+	free_buffer(&image);
+}
+
 /* Print a pretty test header so we can distinguish results */
 void printh(const char *test_name) {
 	printf("#####################\n");
 	printf("Test: %s\n", test_name);
 	printf("#####################\n");
 }
+
+void jar_limits() {
+	printh("Jar limits");
+	uint8_t image[LOCAL_HEADER_SIZE + 256] = {0x50, 0x4b, 0x03, 0x04};
+	uint8_t zeros[4096] = {0};
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	stream.next_in = zeros;
+	stream.avail_in = sizeof(zeros);
+	stream.next_out = image + LOCAL_HEADER_SIZE;
+	stream.avail_out = sizeof(image) - LOCAL_HEADER_SIZE;
+	deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+
+	Jar jar = {.image = image, .image_length = LOCAL_HEADER_SIZE + stream.total_out};
+	JarEntry entry = {.method = ZIP_DEFLATED, .compressed_size = stream.total_out, .size = sizeof(zeros)};
+	size_t length = 0;
+	bool owned;
+	const uint8_t *data = read_jar_entry(&jar, &entry, &length, &owned);
+	ok(data != NULL && owned && length == sizeof(zeros), "A deflated entry inflates to its stated size");
+	if (owned) free((void *) data);
+
+	entry.size = entry.compressed_size * MAX_DEFLATE_RATIO + 1;
+	ok(read_jar_entry(&jar, &entry, &length, &owned) == NULL, "An entry claiming more than deflate can produce is refused unread");
+	entry.compressed_size = MAX_INFLATED_SIZE;
+	entry.size = (uint64_t) MAX_INFLATED_SIZE + 1;
+	ok(read_jar_entry(&jar, &entry, &length, &owned) == NULL, "An entry larger than any plausible class is refused");
+}